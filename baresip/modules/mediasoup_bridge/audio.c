@@ -9,6 +9,8 @@
 #include "mediasoup_bridge.h"
 
 
+static const int16_t silence[MS_FRAME_SAMPC_MAX];
+
 static struct ausrc *mediasoup_ausrc;
 static struct auplay *mediasoup_auplay;
 static mtx_t *device_mutex;
@@ -59,6 +61,16 @@ static void record_error_locked(struct ms_context *ctx, const char *reason,
 }
 
 
+static void count_tx_error_locked(struct ms_context *ctx, const char *reason,
+				  int err)
+{
+	ms_seq_write_begin(&ctx->tx_stats.lock);
+	++ctx->tx_stats.v.errors;
+	ms_seq_write_end(&ctx->tx_stats.lock);
+	record_error_locked(ctx, reason, err);
+}
+
+
 static int send_rtp_locked(struct ms_context *ctx, const uint8_t *payload,
 			   size_t payload_len)
 {
@@ -83,64 +95,235 @@ static int send_rtp_locked(struct ms_context *ctx, const uint8_t *payload,
 	if (err)
 		return err;
 
-	++ctx->tx_packets;
-	ctx->tx_bytes += ctx->tx_mbuf->end;
-	ctx->tx_timestamp += MS_FRAME_SAMP_PER_CH;
+	ms_seq_write_begin(&ctx->tx_stats.lock);
+	++ctx->tx_stats.v.packets;
+	ctx->tx_stats.v.bytes += ctx->tx_mbuf->end;
+	ms_seq_write_end(&ctx->tx_stats.lock);
+	ctx->tx_timestamp += ctx->frame_samp_per_ch;
 	return 0;
 }
 
 
-static void tx_mix_handler(const int16_t *sampv, size_t sampc, void *arg)
+/*
+ * Encode and send one frame of the context's ptime.  Clocked by the TX
+ * mixer sink, or by the single caller's capture read while the context is
+ * bypassed.
+ */
+static void tx_encode_frame(struct ms_context *ctx, const int16_t *sampv,
+			    size_t sampc)
 {
-	struct ms_context *ctx = arg;
-	int16_t silence[MS_FRAME_SAMPC] = {0};
 	uint8_t packet[MS_OPUS_MAX_PACKET];
 	const int16_t *input = sampv;
+	struct ms_level level;
+	uint64_t now_us;
+	uint64_t encode_us;
 	int encoded;
 	int err;
 
-	if (!ctx || !sampv || sampc != MS_FRAME_SAMPC)
+	if (!ctx || !sampv)
 		return;
 
+	ms_level_measure(&level, sampv, sampc);
+	now_us = tmr_jiffies_usec();
+
 	mtx_lock(ctx->mutex);
-	if (ctx->closing) {
+	/* A retired mixer may still deliver one frame of the old ptime. */
+	if (ctx->closing || sampc != ctx->frame_sampc) {
 		mtx_unlock(ctx->mutex);
 		return;
 	}
 
-	ctx->tx_level_dbfs = ms_level_dbfs(sampv, sampc);
-	ctx->tx_last_frame_ms = tmr_jiffies();
+	/* Handovers (bypass switch, ptime change) reset the clock. */
+	ms_clock_tick(&ctx->clockv[MS_CLOCK_TX], ctx->ptime, now_us);
 
-	if (!ctx->tx_ready || !ctx->tx_rtp) {
+	ms_seq_write_begin(&ctx->tx_stats.lock);
+	ms_level_window_add(&ctx->tx_stats.v.level,
+			    &ctx->tx_stats.level_restart, &level);
+	ctx->tx_stats.v.last_frame_ms = tmr_jiffies();
+	ms_seq_write_end(&ctx->tx_stats.lock);
+
+	if (ctx->tx_muted)
+		input = silence;
+
+	if (ctx->trunk) {
+		ms_trunk_send(ctx, input, ctx->frame_samp_per_ch);
 		mtx_unlock(ctx->mutex);
 		return;
 	}
 
-	if (ctx->tx_muted)
-		input = silence;
+	if (!ctx->tx_ready || !ctx->tx_rtp) {
+		mtx_unlock(ctx->mutex);
+		return;
+	}
 
-	encoded = opus_encode(ctx->encoder, input, MS_FRAME_SAMP_PER_CH,
+	encode_us = tmr_jiffies_usec();
+	encoded = opus_encode(ctx->encoder, input,
+			      (int)ctx->frame_samp_per_ch,
 			      packet, sizeof(packet));
 	if (encoded < 0) {
-		++ctx->tx_errors;
-		record_error_locked(ctx, "opus-encode-failed", EPROTO);
+		count_tx_error_locked(ctx, "opus-encode-failed", EPROTO);
 		mtx_unlock(ctx->mutex);
 		return;
 	}
 
+	if (ctx->loopback)
+		ms_loopback_tx(ctx->loopback, input, sampc, ctx->tx_timestamp);
+
 	err = send_rtp_locked(ctx, packet, (size_t)encoded);
 	if (err) {
-		++ctx->tx_errors;
-		record_error_locked(ctx, "rtp-send-failed", err);
+		count_tx_error_locked(ctx, "rtp-send-failed", err);
+		mtx_unlock(ctx->mutex);
+		return;
 	}
+
+	encode_us = tmr_jiffies_usec() - encode_us;
+	ms_seq_write_begin(&ctx->tx_stats.lock);
+	++ctx->tx_stats.v.encodes;
+	ctx->tx_stats.v.encode_us_sum += encode_us;
+	if (encode_us > ctx->tx_stats.v.encode_us_max)
+		ctx->tx_stats.v.encode_us_max = (uint32_t)encode_us;
+	ms_seq_write_end(&ctx->tx_stats.lock);
 	mtx_unlock(ctx->mutex);
 }
 
 
+static void tx_mix_handler(const int16_t *sampv, size_t sampc, void *arg)
+{
+	ms_sched_thread_enter();
+	tx_encode_frame(arg, sampv, sampc);
+}
+
+
+static int mixers_alloc(struct aumix **tx_mixp, struct aumix **rx_mixp,
+			struct aumix_source **tx_sinkp, struct ms_context *ctx,
+			uint32_t ptime)
+{
+	struct aumix *tx_mix = NULL;
+	struct aumix *rx_mix = NULL;
+	struct aumix_source *tx_sink = NULL;
+	int err;
+
+	err = aumix_alloc(&tx_mix, MS_SRATE, MS_CHANNELS, ptime);
+	if (err)
+		goto out;
+
+	err = aumix_alloc(&rx_mix, MS_SRATE, MS_CHANNELS, ptime);
+	if (err)
+		goto out;
+
+	/*
+	 * aumix callbacks are mix-minus-self. A silent sink therefore receives
+	 * the complete sum of every local caller and clocks the Opus sender.
+	 */
+	err = aumix_source_alloc(&tx_sink, tx_mix, tx_mix_handler, ctx);
+	if (err)
+		goto out;
+
+	aumix_source_enable(tx_sink, true);
+
+	*tx_mixp = tx_mix;
+	*rx_mixp = rx_mix;
+	*tx_sinkp = tx_sink;
+	return 0;
+
+out:
+	mem_deref(tx_sink);
+	mem_deref(rx_mix);
+	mem_deref(tx_mix);
+	return err;
+}
+
+
+/* Whether something holds a source on the mixers; with ctx->mutex held */
+static bool context_mixers_busy_locked(const struct ms_context *ctx)
+{
+	struct le *le;
+
+	if (ctx->callers.head || ctx->trunk)
+		return true;
+
+	for (le = ctx->sources.head; le; le = le->next) {
+		const struct ms_source *src = le->data;
+
+		if (src->mix_source)
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Replace both mixers with ones clocked at a new ptime.  Only done while no
+ * caller is attached, no RX source is active and no trunk is joined, so
+ * nothing else holds a source on the old mixers.  Called with
+ * ctx->pairing_mutex held (device halves attach under it) from the main
+ * thread (which activates sources).
+ */
+static int context_set_ptime(struct ms_context *ctx, uint32_t ptime)
+{
+	struct aumix *tx_mix = NULL;
+	struct aumix *rx_mix = NULL;
+	struct aumix_source *tx_sink = NULL;
+	struct aumix *old_tx_mix = NULL;
+	struct aumix *old_rx_mix = NULL;
+	struct aumix_source *old_tx_sink = NULL;
+	bool busy;
+	int err;
+
+	mtx_lock(ctx->mutex);
+	busy = context_mixers_busy_locked(ctx);
+	mtx_unlock(ctx->mutex);
+
+	if (busy)
+		return EBUSY;
+
+	err = mixers_alloc(&tx_mix, &rx_mix, &tx_sink, ctx, ptime);
+	if (err)
+		return err;
+
+	mtx_lock(ctx->mutex);
+	if (ctx->closing) {
+		mtx_unlock(ctx->mutex);
+		err = ESHUTDOWN;
+		goto out;
+	}
+
+	ctx->ptime = ptime;
+	ctx->frame_samp_per_ch = MS_SRATE * ptime / 1000;
+	ctx->frame_sampc = ctx->frame_samp_per_ch * MS_CHANNELS;
+	old_tx_mix = ctx->tx_mix;
+	old_rx_mix = ctx->rx_mix;
+	old_tx_sink = ctx->tx_sink;
+	ctx->tx_mix = tx_mix;
+	tx_mix = NULL;
+	ctx->rx_mix = rx_mix;
+	rx_mix = NULL;
+	ctx->tx_sink = tx_sink;
+	tx_sink = NULL;
+	ms_clock_reset(&ctx->clockv[MS_CLOCK_TX]);
+	ms_clock_reset(&ctx->clockv[MS_CLOCK_RX]);
+	mtx_unlock(ctx->mutex);
+
+out:
+	/* Stop the retired sinks before their mixer threads are joined. */
+	if (old_tx_sink)
+		aumix_source_enable(old_tx_sink, false);
+	if (tx_sink)
+		aumix_source_enable(tx_sink, false);
+	mem_deref(old_tx_sink);
+	mem_deref(old_rx_mix);
+	mem_deref(old_tx_mix);
+	mem_deref(tx_sink);
+	mem_deref(rx_mix);
+	mem_deref(tx_mix);
+	return err;
+}
+
+
 int ms_context_audio_alloc(struct ms_context *ctx)
 {
 	int opus_err;
-	int err;
 
 	if (!ctx)
 		return EINVAL;
@@ -164,29 +347,12 @@ int ms_context_audio_alloc(struct ms_context *ctx)
 		return EPROTO;
 	}
 
-	err = aumix_alloc(&ctx->tx_mix, MS_SRATE, MS_CHANNELS, MS_PTIME);
-	if (err)
-		return err;
-
-	err = aumix_alloc(&ctx->rx_mix, MS_SRATE, MS_CHANNELS, MS_PTIME);
-	if (err)
-		return err;
-
 	ctx->tx_mbuf = mbuf_alloc(RTP_HEADER_SIZE + MS_OPUS_MAX_PACKET);
 	if (!ctx->tx_mbuf)
 		return ENOMEM;
 
-	/*
-	 * aumix callbacks are mix-minus-self. A silent sink therefore receives
-	 * the complete sum of every local caller and clocks the Opus sender.
-	 */
-	err = aumix_source_alloc(&ctx->tx_sink, ctx->tx_mix,
-				 tx_mix_handler, ctx);
-	if (err)
-		return err;
-
-	aumix_source_enable(ctx->tx_sink, true);
-	return 0;
+	return mixers_alloc(&ctx->tx_mix, &ctx->rx_mix, &ctx->tx_sink, ctx,
+			    ctx->ptime);
 }
 
 
@@ -207,81 +373,128 @@ void ms_context_audio_close(struct ms_context *ctx)
 }
 
 
-int ms_context_configure(struct ms_context *ctx, bool mix_local_callers,
-			 int bitrate_bps, bool *changed)
+/*
+ * Apply a context configuration whole or not at all.  Every field is
+ * validated, and everything that can fail (a refused ptime change, the
+ * caller array, the encoder bitrate) runs before any of it is applied.
+ * The ptime change rebuilds the mixers last and puts the bitrate back if
+ * it fails; the remaining fields cannot fail.
+ */
+int ms_context_configure(struct ms_context *ctx,
+			 const struct ms_ctx_config *cfg, bool *changed)
 {
 	struct ms_caller **callerv = NULL;
 	struct le *le;
 	size_t caller_count = 0;
-	size_t caller_index = 0;
 	size_t i;
-	bool config_changed;
+	bool mix_local_callers;
+	bool ptime_changed;
+	int bitrate_bps;
+	int old_bitrate_bps;
 	int opus_err;
+	int err = 0;
 
-	if (!ctx || bitrate_bps < MS_BITRATE_MIN ||
-	    bitrate_bps > MS_BITRATE_MAX)
+	if (!ctx || !cfg || cfg->bitrate_bps < MS_BITRATE_MIN ||
+	    cfg->bitrate_bps > MS_BITRATE_MAX ||
+	    (cfg->ptime && !ms_valid_ptime(cfg->ptime)) ||
+	    cfg->telemetry_ms < MS_TELEMETRY_MIN_MS ||
+	    cfg->telemetry_ms > MS_TELEMETRY_MAX_MS ||
+	    !(cfg->hysteresis_db >= 0.0) ||
+	    cfg->hysteresis_db > MS_HYSTERESIS_MAX_DB)
 		return EINVAL;
 
+	mix_local_callers = cfg->mix_local_callers;
+	bitrate_bps = cfg->bitrate_bps;
+
+	/* Held throughout, so no device half attaches after the check */
+	mtx_lock(ctx->pairing_mutex);
 	mtx_lock(ctx->mutex);
 	if (ctx->closing) {
-		mtx_unlock(ctx->mutex);
-		return ESHUTDOWN;
+		err = ESHUTDOWN;
+		goto unlock;
 	}
 
-	config_changed = ctx->mix_local_callers != mix_local_callers ||
-			 ctx->bitrate_bps != bitrate_bps;
-	if (!config_changed) {
+	ptime_changed = cfg->ptime && ctx->ptime != cfg->ptime;
+	if (!ptime_changed &&
+	    ctx->mix_local_callers == mix_local_callers &&
+	    ctx->bitrate_bps == bitrate_bps &&
+	    ctx->telemetry_ms == cfg->telemetry_ms &&
+	    ctx->hysteresis_db == cfg->hysteresis_db) {
 		if (changed)
 			*changed = false;
-		mtx_unlock(ctx->mutex);
-		return 0;
+		goto unlock;
 	}
 
-	if (ctx->mix_local_callers != mix_local_callers) {
-		caller_count = list_count(&ctx->callers);
-		if (caller_count) {
-			callerv = mem_zalloc(caller_count * sizeof(*callerv),
-					     NULL);
-			if (!callerv) {
-				mtx_unlock(ctx->mutex);
-				return ENOMEM;
-			}
-
-			for (le = ctx->callers.head; le; le = le->next)
-				callerv[caller_index++] = mem_ref(le->data);
+	if (ptime_changed && context_mixers_busy_locked(ctx)) {
+		err = EBUSY;
+		goto unlock;
+	}
+
+	if (ctx->mix_local_callers != mix_local_callers &&
+	    ctx->callers.head) {
+		callerv = mem_zalloc(list_count(&ctx->callers) *
+				     sizeof(*callerv), NULL);
+		if (!callerv) {
+			err = ENOMEM;
+			goto unlock;
 		}
+
+		for (le = ctx->callers.head; le; le = le->next)
+			callerv[caller_count++] = mem_ref(le->data);
 	}
 
+	old_bitrate_bps = ctx->bitrate_bps;
 	if (ctx->bitrate_bps != bitrate_bps) {
 		opus_err = opus_encoder_ctl(
 			ctx->encoder, OPUS_SET_BITRATE(bitrate_bps));
 		if (opus_err != OPUS_OK) {
 			record_error_locked(ctx, "opus-bitrate-failed", EPROTO);
-			mtx_unlock(ctx->mutex);
-			for (i = 0; i < caller_index; ++i)
-				mem_deref(callerv[i]);
-			mem_deref(callerv);
-			return EPROTO;
+			err = EPROTO;
+			goto unlock;
 		}
 		ctx->bitrate_bps = bitrate_bps;
 	}
+	mtx_unlock(ctx->mutex);
+
+	if (ptime_changed)
+		err = context_set_ptime(ctx, cfg->ptime);
 
-	if (ctx->mix_local_callers != mix_local_callers) {
-		ctx->mix_local_callers = mix_local_callers;
+	mtx_lock(ctx->mutex);
+	if (err) {
+		/* A bitrate the encoder took before cannot be refused. */
+		if (ctx->bitrate_bps != old_bitrate_bps) {
+			(void)opus_encoder_ctl(
+				ctx->encoder,
+				OPUS_SET_BITRATE(old_bitrate_bps));
+			ctx->bitrate_bps = old_bitrate_bps;
+		}
+		goto unlock;
 	}
 
+	ctx->mix_local_callers = mix_local_callers;
+
+	/* Read by the telemetry tick on this (main) thread. */
+	ctx->telemetry_ms = cfg->telemetry_ms;
+	ctx->hysteresis_db = cfg->hysteresis_db;
+
 	if (changed)
 		*changed = true;
+
+unlock:
 	mtx_unlock(ctx->mutex);
+	mtx_unlock(ctx->pairing_mutex);
 
-	for (i = 0; i < caller_index; ++i) {
-		mtx_lock(callerv[i]->mutex);
-		callerv[i]->mix_local_callers = mix_local_callers;
-		mtx_unlock(callerv[i]->mutex);
+	for (i = 0; i < caller_count; ++i) {
+		if (!err) {
+			mtx_lock(callerv[i]->mutex);
+			callerv[i]->mix_local_callers = mix_local_callers;
+			mtx_unlock(callerv[i]->mutex);
+		}
 		mem_deref(callerv[i]);
 	}
 	mem_deref(callerv);
-	return 0;
+
+	return err;
 }
 
 
@@ -401,6 +614,31 @@ int ms_tx_configure(struct ms_context *ctx, const struct sa *remote,
 }
 
 
+/**
+ * Stop sending and release the TX socket, as before the first
+ * ms_tx_configure()
+ *
+ * @param ctx Context
+ */
+void ms_tx_unconfigure(struct ms_context *ctx)
+{
+	struct rtp_sock *retired;
+
+	if (!ctx)
+		return;
+
+	mtx_lock(ctx->mutex);
+	retired = ctx->tx_rtp;
+	ctx->tx_rtp = NULL;
+	ctx->tx_local_port = 0;
+	ctx->tx_ready = false;
+	++ctx->tx_socket_generation;
+	mtx_unlock(ctx->mutex);
+
+	mem_deref(retired);
+}
+
+
 int ms_tx_set_mute(struct ms_context *ctx, bool mute, bool *changed)
 {
 	if (!ctx)
@@ -420,6 +658,26 @@ int ms_tx_set_mute(struct ms_context *ctx, bool mute, bool *changed)
 }
 
 
+static void caller_link_locked(struct ms_context *ctx,
+			       struct ms_caller *caller)
+{
+	list_append(&ctx->callers, &caller->le, caller);
+	atomic_store(&ctx->caller_count, list_count(&ctx->callers));
+}
+
+
+static void caller_unlink_locked(struct ms_context *ctx,
+				 struct ms_caller *caller)
+{
+	list_unlink(&caller->le);
+	atomic_store(&ctx->caller_count, list_count(&ctx->callers));
+
+	/* No caller callbacks left to observe the RX mixer by. */
+	if (!ctx->callers.head)
+		ms_clock_reset(&ctx->clockv[MS_CLOCK_RX]);
+}
+
+
 static bool supported_format(int fmt)
 {
 	return fmt == AUFMT_S16LE || fmt == AUFMT_FLOAT ||
@@ -467,22 +725,65 @@ static void caller_destructor(void *arg)
 }
 
 
-static void local_output_handler(const int16_t *sampv, size_t sampc, void *arg)
+/*
+ * Hand one 48 kHz stereo frame to the caller's capture side.
+ *
+ * A direct frame is only taken while the RX bypass is armed and when it
+ * has the mixer's frame size; anything else (another sender ptime, an odd
+ * PLC frame) ends direct mode and is refused, so the source puts it into
+ * the RX mixer instead.  While direct, every mixer frame is dropped: the
+ * decode timer and the mixer thread are not phase-locked, so a mixer frame
+ * can fall between two direct ones and would play its bypassed silence
+ * between real audio.  Only after MS_RX_DIRECT_PTIMES packet times without
+ * a direct frame does direct mode end and the mixer supply the call with
+ * silence through jitter-buffer gaps and DTX.
+ */
+static bool caller_deliver(struct ms_caller *caller, const int16_t *sampv,
+			   size_t sampc, bool direct)
 {
-	struct ms_caller *caller = arg;
 	struct ausrc_st *st;
 	struct auframe af;
+	uint64_t now;
 	size_t outc;
 	int err = 0;
 
-	if (!caller || !sampv || sampc != MS_FRAME_SAMPC)
-		return;
+	if (!caller || !sampv)
+		return false;
+
+	now = tmr_jiffies_usec();
 
 	mtx_lock(caller->mutex);
 	st = caller->src;
 	if (caller->stopped || !st) {
 		mtx_unlock(caller->mutex);
-		return;
+		return false;
+	}
+
+	if (direct) {
+		if (!caller->rx_bypass ||
+		    sampc != caller->ctx->frame_sampc) {
+			caller->rx_direct = false;
+			mtx_unlock(caller->mutex);
+			return false;
+		}
+
+		caller->rx_direct = true;
+		caller->rx_direct_us = now;
+	}
+	else if (sampc != caller->ctx->frame_sampc) {
+		mtx_unlock(caller->mutex);
+		return false;
+	}
+	else if (caller->rx_direct) {
+		const uint64_t timeout_us = (uint64_t)MS_RX_DIRECT_PTIMES *
+					    caller->ctx->ptime * 1000;
+
+		if (now - caller->rx_direct_us < timeout_us) {
+			mtx_unlock(caller->mutex);
+			return false;
+		}
+
+		caller->rx_direct = false;
 	}
 
 	outc = st->s16_capacity;
@@ -512,6 +813,14 @@ static void local_output_handler(const int16_t *sampv, size_t sampc, void *arg)
 		st->rh(&af, st->arg);
 
 	mtx_unlock(caller->mutex);
+	return true;
+}
+
+
+static void local_output_handler(const int16_t *sampv, size_t sampc, void *arg)
+{
+	ms_sched_thread_enter();
+	(void)caller_deliver(arg, sampv, sampc, false);
 }
 
 
@@ -524,9 +833,15 @@ static void local_read_handler(struct auframe *af, void *arg)
 	bool mix_local_callers;
 	int err = 0;
 
-	if (!caller || !af || af->sampc != MS_FRAME_SAMPC)
+	ms_sched_thread_enter();
+
+	if (!caller || !af || af->sampc != caller->ctx->frame_sampc)
 		return;
 
+	/* Once per RX mixer cycle; the other callers' calls are skipped. */
+	ms_clock_tick(&caller->ctx->clockv[MS_CLOCK_RX], caller->ctx->ptime,
+		      tmr_jiffies_usec());
+
 	memset(af->sampv, 0, af->sampc * sizeof(int16_t));
 
 	mtx_lock(caller->mutex);
@@ -553,7 +868,7 @@ static void local_read_handler(struct auframe *af, void *arg)
 		if (st->prm.srate == MS_SRATE &&
 		    st->prm.ch == MS_CHANNELS) {
 			memcpy(af->sampv, st->s16,
-			       MS_FRAME_SAMPC * sizeof(int16_t));
+			       af->sampc * sizeof(int16_t));
 		}
 		else {
 			outc = af->sampc;
@@ -571,9 +886,13 @@ static void local_read_handler(struct auframe *af, void *arg)
 	/*
 	 * The RX mixer's local source is also copied into the TX mixer. This
 	 * yields one aggregate producer while RX aumix supplies party-line
-	 * mix-minus-self to each co-located caller.
+	 * mix-minus-self to each co-located caller.  A lone caller is the
+	 * aggregate, so it feeds the encoder directly (lock order: caller,
+	 * then context).
 	 */
-	if (caller->tx_mix_source)
+	if (caller->tx_direct && !caller->stopped)
+		tx_encode_frame(caller->ctx, af->sampv, af->sampc);
+	else if (caller->tx_mix_source)
 		(void)aumix_source_put(caller->tx_mix_source,
 				       af->sampv, af->sampc);
 
@@ -594,6 +913,7 @@ static int caller_alloc(struct ms_caller **callerp, struct ms_context *ctx,
 	if (!caller)
 		return ENOMEM;
 
+	caller->ctx = ctx;
 	str_ncpy(caller->key, ctx->key, sizeof(caller->key));
 	str_ncpy(caller->call_token, call_token, sizeof(caller->call_token));
 	caller->mix_local_callers = mix_local_callers;
@@ -624,6 +944,156 @@ out:
 }
 
 
+static void caller_tx_mixer_enable(struct ms_caller *caller, bool enable)
+{
+	struct aumix_source *tx_source = NULL;
+
+	mtx_lock(caller->mutex);
+	if (!caller->stopped)
+		tx_source = mem_ref(caller->tx_mix_source);
+	mtx_unlock(caller->mutex);
+
+	if (tx_source)
+		aumix_source_enable(tx_source, enable);
+	mem_deref(tx_source);
+}
+
+
+/*
+ * Select between the mixer path and the direct single-caller path.
+ *
+ * With exactly one local caller the TX mixer is idle: the caller's capture
+ * frames are encoded directly and the mixer sink is disabled.  If that
+ * context also has exactly one active RX source and no trunk stream,
+ * decoded frames of the mixer's frame size skip the RX mixer and go
+ * straight to the caller.  A second caller or source restores the mixers.
+ * Called with ctx->pairing_mutex held after every caller or source
+ * membership change; aumix sources are toggled without holding ctx or
+ * caller locks because mixer callbacks take both.
+ */
+static void bypass_update_paired(struct ms_context *ctx)
+{
+	struct ms_caller *old_caller;
+	struct ms_caller *new_caller = NULL;
+	struct ms_source *source = NULL;
+	struct le *le;
+	size_t active = 0;
+	bool restore;
+
+	mtx_lock(ctx->mutex);
+	if (!ctx->closing && list_count(&ctx->callers) == 1)
+		new_caller = ctx->callers.head->data;
+
+	for (le = ctx->sources.head; le; le = le->next) {
+		struct ms_source *src = le->data;
+
+		if (src->active && src->mix_source) {
+			source = src;
+			++active;
+		}
+	}
+	if (ctx->trunk)
+		++active;
+	if (!new_caller || active != 1)
+		source = NULL;
+
+	old_caller = ctx->bypass_caller;
+	restore = old_caller && old_caller != new_caller &&
+		  old_caller->le.list == &ctx->callers;
+	ctx->bypass_caller = new_caller;
+	ctx->bypass_source = source;
+	if (old_caller != new_caller) {
+		/* TX moves between the mixer sink and the caller's clock. */
+		ms_clock_reset(&ctx->clockv[MS_CLOCK_TX]);
+		mem_ref(old_caller);
+	}
+	else {
+		old_caller = NULL;
+	}
+	mem_ref(new_caller);
+	mtx_unlock(ctx->mutex);
+
+	/* Leaving: put the previous caller back on the TX mixer first. */
+	if (old_caller) {
+		mtx_lock(old_caller->mutex);
+		old_caller->tx_direct = false;
+		old_caller->rx_bypass = false;
+		old_caller->rx_direct = false;
+		mtx_unlock(old_caller->mutex);
+
+		if (restore)
+			caller_tx_mixer_enable(old_caller, true);
+	}
+
+	if (!new_caller) {
+		if (ctx->tx_sink)
+			aumix_source_enable(ctx->tx_sink, true);
+		mem_deref(old_caller);
+		return;
+	}
+
+	if (ctx->tx_sink)
+		aumix_source_enable(ctx->tx_sink, false);
+	caller_tx_mixer_enable(new_caller, false);
+
+	/* Direct RX starts with the first frame of the right size. */
+	mtx_lock(new_caller->mutex);
+	new_caller->tx_direct = !new_caller->stopped;
+	new_caller->rx_bypass = !new_caller->stopped && source != NULL;
+	new_caller->rx_direct = false;
+	new_caller->rx_direct_us = 0;
+	mtx_unlock(new_caller->mutex);
+
+	mem_deref(old_caller);
+	mem_deref(new_caller);
+}
+
+
+void ms_context_bypass_update(struct ms_context *ctx)
+{
+	if (!ctx || !ctx->pairing_mutex)
+		return;
+
+	mtx_lock(ctx->pairing_mutex);
+	bypass_update_paired(ctx);
+	mtx_unlock(ctx->pairing_mutex);
+}
+
+
+/**
+ * Deliver a decoded RX frame straight to the context's only caller
+ *
+ * @param src    Source the frame was decoded from
+ * @param sampv  48 kHz stereo samples
+ * @param sampc  Number of samples
+ *
+ * @return true if delivered, false if the frame must go to the RX mixer
+ */
+bool ms_context_rx_direct(struct ms_source *src, const int16_t *sampv,
+			  size_t sampc)
+{
+	struct ms_context *ctx;
+	struct ms_caller *caller = NULL;
+	bool delivered;
+
+	if (!src || !src->ctx)
+		return false;
+
+	ctx = src->ctx;
+	mtx_lock(ctx->mutex);
+	if (ctx->bypass_source == src)
+		caller = mem_ref(ctx->bypass_caller);
+	mtx_unlock(ctx->mutex);
+
+	if (!caller)
+		return false;
+
+	delivered = caller_deliver(caller, sampv, sampc, true);
+	mem_deref(caller);
+	return delivered;
+}
+
+
 static struct ms_caller *caller_find_id_locked(struct ms_context *ctx,
 					       const char *call_token)
 {
@@ -641,7 +1111,7 @@ static struct ms_caller *caller_find_id_locked(struct ms_context *ctx,
 
 
 static int caller_attach(struct ms_context *ctx, bool source, void *state,
-			 const char *call_token,
+			 uint32_t ptime, const char *call_token,
 			 struct ms_caller **callerp)
 {
 	struct ms_caller *caller = NULL;
@@ -657,6 +1127,12 @@ static int caller_attach(struct ms_context *ctx, bool source, void *state,
 		err = ESHUTDOWN;
 		goto out;
 	}
+	/* The device half was sized before a concurrent ptime change. */
+	if (ctx->ptime != ptime) {
+		mtx_unlock(ctx->mutex);
+		err = EBUSY;
+		goto out;
+	}
 	mix_local_callers = ctx->mix_local_callers;
 	caller = caller_find_id_locked(ctx, call_token);
 	if (caller)
@@ -680,7 +1156,7 @@ static int caller_attach(struct ms_context *ctx, bool source, void *state,
 			err = ESHUTDOWN;
 			goto out;
 		}
-		list_append(&ctx->callers, &caller->le, caller);
+		caller_link_locked(ctx, caller);
 		mtx_unlock(ctx->mutex);
 	}
 
@@ -707,11 +1183,13 @@ out:
 		mtx_lock(ctx->mutex);
 		linked = caller->le.list == &ctx->callers;
 		if (linked)
-			list_unlink(&caller->le);
+			caller_unlink_locked(ctx, caller);
 		mtx_unlock(ctx->mutex);
 		if (linked)
 			caller_stop(caller);
 	}
+	if (new_caller)
+		bypass_update_paired(ctx);
 	if (caller && (!new_caller || err))
 		mem_deref(caller);
 	mtx_unlock(ctx->pairing_mutex);
@@ -719,6 +1197,69 @@ out:
 }
 
 
+/**
+ * Estimate the memory held by a context, its sources and its callers
+ *
+ * Counts structures, codec state and frame buffers.  aumix and jitter
+ * buffer internals are not visible from here and are left out.
+ *
+ * @param ctx  Bridge context
+ * @param fp   Returned footprint
+ */
+void ms_context_footprint(struct ms_context *ctx, struct ms_footprint *fp)
+{
+	struct ms_caller **callerv = NULL;
+	size_t caller_count;
+	size_t caller_index = 0;
+	struct le *le;
+	size_t i;
+
+	if (!ctx || !fp)
+		return;
+
+	memset(fp, 0, sizeof(*fp));
+
+	mtx_lock(ctx->mutex);
+	fp->context_bytes = sizeof(*ctx) +
+			    (ctx->tx_mbuf ? ctx->tx_mbuf->size : 0);
+	if (ctx->encoder)
+		fp->context_bytes += (size_t)opus_encoder_get_size(MS_CHANNELS);
+
+	for (le = ctx->sources.head; le; le = le->next)
+		fp->source_bytes += ms_source_footprint(le->data);
+
+	caller_count = list_count(&ctx->callers);
+	if (caller_count)
+		callerv = mem_zalloc(caller_count * sizeof(*callerv), NULL);
+	if (callerv) {
+		for (le = ctx->callers.head; le; le = le->next)
+			callerv[caller_index++] = mem_ref(le->data);
+	}
+	mtx_unlock(ctx->mutex);
+
+	/* Device halves are guarded by the caller lock, taken first. */
+	for (i = 0; i < caller_index; ++i) {
+		struct ms_caller *caller = callerv[i];
+
+		mtx_lock(caller->mutex);
+		fp->caller_bytes += sizeof(*caller);
+		if (caller->src) {
+			fp->caller_bytes += sizeof(*caller->src) +
+					    ms_slab_size(caller->src->s16) +
+					    ms_slab_size(caller->src->native);
+		}
+		if (caller->play) {
+			fp->caller_bytes += sizeof(*caller->play) +
+					    ms_slab_size(caller->play->s16) +
+					    ms_slab_size(caller->play->native);
+		}
+		mtx_unlock(caller->mutex);
+		mem_deref(caller);
+	}
+	mem_deref(callerv);
+}
+
+
 void ms_context_detach_callers(struct ms_context *ctx)
 {
 	if (!ctx || !ctx->mutex || !ctx->pairing_mutex)
@@ -735,9 +1276,11 @@ void ms_context_detach_callers(struct ms_context *ctx)
 		}
 
 		caller = ctx->callers.head->data;
-		list_unlink(&caller->le);
+		caller_unlink_locked(ctx, caller);
 		mtx_unlock(ctx->mutex);
 
+		bypass_update_paired(ctx);
+
 		mtx_lock(caller->mutex);
 		caller->attached = false;
 		mtx_unlock(caller->mutex);
@@ -776,7 +1319,7 @@ static void caller_detach_state(struct ms_caller *caller, bool source,
 	if (ctx && empty) {
 		mtx_lock(ctx->mutex);
 		if (caller->le.list == &ctx->callers) {
-			list_unlink(&caller->le);
+			caller_unlink_locked(ctx, caller);
 			removed = true;
 		}
 		mtx_unlock(ctx->mutex);
@@ -785,6 +1328,7 @@ static void caller_detach_state(struct ms_caller *caller, bool source,
 			mtx_lock(caller->mutex);
 			caller->attached = false;
 			mtx_unlock(caller->mutex);
+			bypass_update_paired(ctx);
 		}
 	}
 
@@ -809,8 +1353,10 @@ static void ausrc_destructor(void *arg)
 		st->caller = mem_deref(caller);
 	}
 
-	st->s16 = mem_deref(st->s16);
-	st->native = mem_deref(st->native);
+	ms_slab_free(st->s16);
+	ms_slab_free(st->native);
+	st->s16 = NULL;
+	st->native = NULL;
 	if (st->tracked) {
 		st->tracked = false;
 		device_track(false);
@@ -828,8 +1374,10 @@ static void auplay_destructor(void *arg)
 		st->caller = mem_deref(caller);
 	}
 
-	st->s16 = mem_deref(st->s16);
-	st->native = mem_deref(st->native);
+	ms_slab_free(st->s16);
+	ms_slab_free(st->native);
+	st->s16 = NULL;
+	st->native = NULL;
 	if (st->tracked) {
 		st->tracked = false;
 		device_track(false);
@@ -850,6 +1398,18 @@ static int setup_resampler(struct auresamp *resamp, uint32_t input_rate,
 }
 
 
+static uint32_t context_ptime(struct ms_context *ctx)
+{
+	uint32_t ptime;
+
+	mtx_lock(ctx->mutex);
+	ptime = ctx->ptime;
+	mtx_unlock(ctx->mutex);
+
+	return ptime;
+}
+
+
 static bool valid_call_token(const char *token)
 {
 	size_t i;
@@ -912,6 +1472,7 @@ static int mediasoup_src_alloc(struct ausrc_st **stp,
 	char call_token[MS_CALL_TOKEN_SIZE];
 	char key[MS_KEY_SIZE];
 	size_t native_size;
+	uint32_t ptime;
 	int err;
 	(void)ausrc;
 
@@ -929,18 +1490,26 @@ static int mediasoup_src_alloc(struct ausrc_st **stp,
 	if (!st)
 		return ENOMEM;
 
+	err = ms_context_get_or_create(&ctx, key, NULL);
+	if (err)
+		goto out;
+
+	/* Device frames follow the context's mixer ptime. */
+	ptime = context_ptime(ctx);
 	st->prm = *prm;
-	st->prm.ptime = MS_PTIME;
+	st->prm.ptime = ptime;
 	st->rh = rh;
 	st->errh = errh;
 	st->arg = arg;
-	st->sampc = au_calc_nsamp(prm->srate, prm->ch, MS_PTIME);
-	st->s16_capacity = MAX(st->sampc, (size_t)MS_FRAME_SAMPC);
+	st->sampc = au_calc_nsamp(prm->srate, prm->ch, ptime);
+	st->s16_capacity = MAX(st->sampc,
+			       (size_t)au_calc_nsamp(MS_SRATE, MS_CHANNELS,
+						     ptime));
 	native_size = st->sampc *
 		      aufmt_sample_size((enum aufmt)prm->fmt);
 
-	st->s16 = mem_zalloc(st->s16_capacity * sizeof(*st->s16), NULL);
-	st->native = mem_zalloc(native_size, NULL);
+	st->s16 = ms_slab_alloc(st->s16_capacity * sizeof(*st->s16));
+	st->native = ms_slab_alloc(native_size);
 	if (!st->s16 || !st->native) {
 		err = ENOMEM;
 		goto out;
@@ -951,11 +1520,7 @@ static int mediasoup_src_alloc(struct ausrc_st **stp,
 	if (err)
 		goto out;
 
-	err = ms_context_get_or_create(&ctx, key, NULL);
-	if (err)
-		goto out;
-
-	err = caller_attach(ctx, true, st, call_token, &st->caller);
+	err = caller_attach(ctx, true, st, ptime, call_token, &st->caller);
 	if (err)
 		goto out;
 
@@ -981,6 +1546,7 @@ static int mediasoup_play_alloc(struct auplay_st **stp,
 	char call_token[MS_CALL_TOKEN_SIZE];
 	char key[MS_KEY_SIZE];
 	size_t native_size;
+	uint32_t ptime;
 	int err;
 	(void)auplay;
 
@@ -998,17 +1564,23 @@ static int mediasoup_play_alloc(struct auplay_st **stp,
 	if (!st)
 		return ENOMEM;
 
+	err = ms_context_get_or_create(&ctx, key, NULL);
+	if (err)
+		goto out;
+
+	/* Device frames follow the context's mixer ptime. */
+	ptime = context_ptime(ctx);
 	st->prm = *prm;
-	st->prm.ptime = MS_PTIME;
+	st->prm.ptime = ptime;
 	st->wh = wh;
 	st->arg = arg;
-	st->sampc = au_calc_nsamp(prm->srate, prm->ch, MS_PTIME);
+	st->sampc = au_calc_nsamp(prm->srate, prm->ch, ptime);
 	st->s16_capacity = st->sampc;
 	native_size = st->sampc *
 		      aufmt_sample_size((enum aufmt)prm->fmt);
 
-	st->s16 = mem_zalloc(st->s16_capacity * sizeof(*st->s16), NULL);
-	st->native = mem_zalloc(native_size, NULL);
+	st->s16 = ms_slab_alloc(st->s16_capacity * sizeof(*st->s16));
+	st->native = ms_slab_alloc(native_size);
 	if (!st->s16 || !st->native) {
 		err = ENOMEM;
 		goto out;
@@ -1019,11 +1591,7 @@ static int mediasoup_play_alloc(struct auplay_st **stp,
 	if (err)
 		goto out;
 
-	err = ms_context_get_or_create(&ctx, key, NULL);
-	if (err)
-		goto out;
-
-	err = caller_attach(ctx, false, st, call_token, &st->caller);
+	err = caller_attach(ctx, false, st, ptime, call_token, &st->caller);
 	if (err)
 		goto out;
 
@@ -0,0 +1,748 @@
+/**
+ * @file bridge_bench.c mediasoup_bridge load generator
+ *
+ * Runs the module inside a bare libre/libbaresip process, without a UA or
+ * SIP stack.  Contexts are opened and wired through the module's own
+ * ctrl_tcp commands.  Each gets M synthetic Opus producers sending over
+ * loopback UDP, a TX sink on loopback, and U synthetic SIP callers on the
+ * virtual ausrc/auplay pair.  After a warm-up, process CPU, packet rates,
+ * encode and decode cost, TX clock lateness and jitter-buffer counters are
+ * measured over the run and printed as one JSON line on stdout, so two
+ * builds can be compared with diff or jq.  Producer send cost is timed and
+ * reported apart from the bridge's CPU share.  Maxima include the warm-up.
+ *
+ *   mediasoup_bridge_load_bench [-c contexts] [-p producers] [-u callers]
+ *                               [-t ptime] [-w warmup s] [-d duration s]
+ *                               [-P first RTP port]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "mediasoup_bridge.h"
+
+
+enum {
+	BENCH_PT         = 111,
+	BENCH_BITRATE    = 64000,
+	BENCH_LOOP       = 50,
+	BENCH_TONE_HZ    = 440,
+	BENCH_AMPLITUDE  = 8000,
+	BENCH_CMD_SIZE   = 256,
+	BENCH_PORT_FIRST = 40000,
+};
+
+
+struct producer {
+	struct udp_sock *us;
+	struct sa dst;
+	struct mbuf *mb;
+	uint32_t ssrc;
+	uint16_t seq;
+	uint32_t ts;
+	unsigned next;
+};
+
+
+struct caller {
+	struct auplay_st *play;
+	struct ausrc_st *rec;
+};
+
+
+struct snapshot {
+	uint64_t wall_us;
+	uint64_t cpu_us;
+	uint64_t gen_us;
+	uint64_t sink_packets;
+	uint64_t caller_frames_in;
+	uint64_t caller_frames_out;
+
+	uint64_t rx_packets;
+	uint64_t rx_lost;
+	uint64_t plc_frames;
+	uint64_t decode_errors;
+	uint64_t decodes;
+	uint64_t decode_us_sum;
+	uint32_t decode_us_max;
+
+	uint64_t tx_packets;
+	uint64_t tx_errors;
+	uint64_t encodes;
+	uint64_t encode_us_sum;
+	uint32_t encode_us_max;
+	uint64_t ticks;
+	uint64_t late_ticks;
+	uint64_t late_us_sum;
+	uint32_t late_us_max;
+
+	uint64_t jb_late;
+	uint64_t jb_lost;
+	uint64_t jb_overflow;
+	uint64_t jb_underflow;
+	uint64_t jb_flush;
+	uint64_t jb_delay_ms_sum;
+	uint64_t jb_sources;
+};
+
+
+static struct {
+	unsigned contexts;
+	unsigned producers;
+	unsigned callers;
+	uint32_t ptime;
+	uint32_t warmup_s;
+	uint32_t duration_s;
+	uint16_t port_first;
+
+	uint8_t packetv[BENCH_LOOP][MS_OPUS_MAX_PACKET];
+	size_t packet_lenv[BENCH_LOOP];
+	int16_t *tone;
+	size_t tone_sampc;
+
+	struct producer *producerv;
+	size_t producerc;
+	struct caller *callerv;
+	size_t callerc;
+	struct udp_sock *sink;
+	struct tmr send_tmr;
+	struct tmr phase_tmr;
+	uint64_t start_ms;
+	uint64_t sends;
+	uint64_t gen_us;
+	uint64_t sink_packets;
+	atomic_uint_fast64_t caller_frames_in;
+	atomic_uint_fast64_t caller_frames_out;
+	struct snapshot begin;
+	struct snapshot end;
+} bench;
+
+
+/* Linked in from module.c; the symbol name follows the STATIC build flag. */
+extern const struct mod_export DECL_EXPORTS(mediasoup_bridge);
+
+
+static int mbuf_print_handler(const char *p, size_t size, void *arg)
+{
+	return mbuf_write_mem(arg, (const uint8_t *)p, size);
+}
+
+
+/* Run one module command and return its JSON answer in mb. */
+static int bench_command(struct mbuf *mb, const char *fmt, ...)
+{
+	struct re_printf pf = {mbuf_print_handler, mb};
+	char cmd[BENCH_CMD_SIZE];
+	va_list ap;
+	int n;
+	int err;
+
+	va_start(ap, fmt);
+	n = re_vsnprintf(cmd, sizeof(cmd), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return EOVERFLOW;
+
+	mbuf_reset(mb);
+	err = cmd_process_long(baresip_commands(), cmd, (size_t)n, &pf,
+			       NULL);
+	(void)mbuf_write_u8(mb, 0);
+	if (!err && strstr((const char *)mb->buf, "\"error\""))
+		err = EPROTO;
+	if (err)
+		fprintf(stderr, "bridge_bench: '%s' failed: %s\n", cmd,
+			mb->buf ? (const char *)mb->buf : "");
+
+	return err;
+}
+
+
+static int json_u32(const struct mbuf *mb, const char *name, uint32_t *v)
+{
+	char pattern[64];
+	const char *p;
+
+	(void)re_snprintf(pattern, sizeof(pattern), "\"%s\":", name);
+	p = strstr((const char *)mb->buf, pattern);
+	if (!p)
+		return ENOENT;
+
+	*v = (uint32_t)strtoul(p + str_len(pattern), NULL, 10);
+	return 0;
+}
+
+
+/* One second of a tone, encoded once and replayed by every producer. */
+static int packets_encode(void)
+{
+	const size_t frames = MS_SRATE * bench.ptime / 1000;
+	int16_t *pcm;
+	OpusEncoder *enc;
+	unsigned i;
+	size_t j;
+	int opus_err;
+	int err = 0;
+
+	pcm = mem_zalloc(frames * MS_CHANNELS * sizeof(*pcm), NULL);
+	enc = opus_encoder_create(MS_SRATE, MS_CHANNELS,
+				  OPUS_APPLICATION_VOIP, &opus_err);
+	if (!pcm || !enc) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	(void)opus_encoder_ctl(enc, OPUS_SET_BITRATE(BENCH_BITRATE));
+
+	for (i = 0; i < BENCH_LOOP; ++i) {
+		int len;
+
+		for (j = 0; j < frames; ++j) {
+			const double t = (double)(i * frames + j) / MS_SRATE;
+			const int16_t v = (int16_t)(BENCH_AMPLITUDE *
+				sin(2.0 * M_PI * BENCH_TONE_HZ * t));
+
+			pcm[j * MS_CHANNELS] = v;
+			pcm[j * MS_CHANNELS + 1] = v;
+		}
+
+		len = opus_encode(enc, pcm, (int)frames, bench.packetv[i],
+				  MS_OPUS_MAX_PACKET);
+		if (len < 0) {
+			err = EPROTO;
+			goto out;
+		}
+		bench.packet_lenv[i] = (size_t)len;
+	}
+
+	/* Callers play the last frame of the tone on every tick. */
+	bench.tone = pcm;
+	bench.tone_sampc = frames * MS_CHANNELS;
+	pcm = NULL;
+
+out:
+	if (enc)
+		opus_encoder_destroy(enc);
+	mem_deref(pcm);
+	return err;
+}
+
+
+static void producer_send(struct producer *p)
+{
+	const unsigned i = p->next;
+	struct rtp_header hdr = {
+		.ver  = RTP_VERSION,
+		.pt   = BENCH_PT,
+		.seq  = p->seq++,
+		.ts   = p->ts,
+		.ssrc = p->ssrc,
+	};
+
+	p->ts += MS_SRATE * bench.ptime / 1000;
+	p->next = (i + 1) % BENCH_LOOP;
+
+	mbuf_reset(p->mb);
+	if (rtp_hdr_encode(p->mb, &hdr) ||
+	    mbuf_write_mem(p->mb, bench.packetv[i], bench.packet_lenv[i]))
+		return;
+
+	p->mb->pos = 0;
+	(void)udp_send(p->us, &p->dst, p->mb);
+}
+
+
+static void send_handler(void *arg)
+{
+	const uint64_t start = tmr_jiffies_usec();
+	uint64_t due;
+	uint64_t now;
+	size_t i;
+	(void)arg;
+
+	for (i = 0; i < bench.producerc; ++i)
+		producer_send(&bench.producerv[i]);
+
+	bench.gen_us += tmr_jiffies_usec() - start;
+	++bench.sends;
+
+	/* Anchored to the start so timer slack does not accumulate. */
+	due = bench.start_ms + bench.sends * bench.ptime;
+	now = tmr_jiffies();
+	tmr_start(&bench.send_tmr, due > now ? due - now : 0, send_handler,
+		  NULL);
+}
+
+
+static void sink_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+
+	++bench.sink_packets;
+}
+
+
+static void caller_write_handler(struct auframe *af, void *arg)
+{
+	(void)arg;
+
+	if (af->sampc == bench.tone_sampc)
+		memcpy(af->sampv, bench.tone, af->sampc * sizeof(int16_t));
+	atomic_fetch_add(&bench.caller_frames_in, 1);
+}
+
+
+static void caller_read_handler(struct auframe *af, void *arg)
+{
+	(void)af;
+	(void)arg;
+
+	atomic_fetch_add(&bench.caller_frames_out, 1);
+}
+
+
+static uint64_t cpu_usec(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+	       (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+
+static void snapshot_source(struct snapshot *s, const struct ms_source *src)
+{
+	struct jbuf_stat jstat;
+	struct ms_rx_stats rx;
+
+	ms_rx_stats_read(&src->rx_stats, &rx);
+	s->rx_packets += rx.packets;
+	s->rx_lost += rx.lost;
+	s->plc_frames += rx.plc_frames;
+	s->decode_errors += rx.decode_errors;
+	s->decodes += rx.decodes;
+	s->decode_us_sum += rx.decode_us_sum;
+	s->decode_us_max = MAX(s->decode_us_max, rx.decode_us_max);
+
+	memset(&jstat, 0, sizeof(jstat));
+	if (!src->jbuf || jbuf_stats(src->jbuf, &jstat))
+		return;
+
+	s->jb_late += jstat.c_late;
+	s->jb_lost += jstat.c_lost;
+	s->jb_overflow += jstat.c_overflow;
+	s->jb_underflow += jstat.c_underflow;
+	s->jb_flush += jstat.c_flush;
+	s->jb_delay_ms_sum += jstat.c_delay;
+	++s->jb_sources;
+}
+
+
+/* Source lists change on this (main) thread only. */
+static void snapshot_take(struct snapshot *s)
+{
+	struct le *le;
+
+	memset(s, 0, sizeof(*s));
+	s->wall_us = tmr_jiffies_usec();
+	s->cpu_us = cpu_usec();
+	s->gen_us = bench.gen_us;
+	s->sink_packets = bench.sink_packets;
+	s->caller_frames_in = atomic_load(&bench.caller_frames_in);
+	s->caller_frames_out = atomic_load(&bench.caller_frames_out);
+
+	mtx_lock(ms_contexts_mutex);
+	for (le = ms_contexts.head; le; le = le->next) {
+		const struct ms_context *ctx = le->data;
+		struct ms_clock_stats clock;
+		struct ms_tx_stats tx;
+		struct le *sle;
+
+		ms_tx_stats_read(&ctx->tx_stats, &tx);
+		ms_clock_stats_read(&ctx->clockv[MS_CLOCK_TX].stats, &clock);
+		s->tx_packets += tx.packets;
+		s->tx_errors += tx.errors;
+		s->encodes += tx.encodes;
+		s->encode_us_sum += tx.encode_us_sum;
+		s->encode_us_max = MAX(s->encode_us_max, tx.encode_us_max);
+		s->ticks += clock.ticks;
+		s->late_ticks += clock.late_ticks;
+		s->late_us_sum += clock.late_us_sum;
+		s->late_us_max = MAX(s->late_us_max, clock.late_us_max);
+
+		for (sle = ctx->sources.head; sle; sle = sle->next)
+			snapshot_source(s, sle->data);
+	}
+	mtx_unlock(ms_contexts_mutex);
+}
+
+
+static void phase_end(void *arg)
+{
+	(void)arg;
+
+	snapshot_take(&bench.end);
+	re_cancel();
+}
+
+
+static void phase_begin(void *arg)
+{
+	(void)arg;
+
+	snapshot_take(&bench.begin);
+	tmr_start(&bench.phase_tmr, bench.duration_s * 1000, phase_end,
+		  NULL);
+}
+
+
+static int context_setup(struct mbuf *mb, unsigned c, uint16_t sink_port)
+{
+	struct sa local;
+	uint32_t port;
+	unsigned i;
+	int err;
+
+	err  = bench_command(mb, "ms_ctx_open bench%u", c);
+	err |= bench_command(mb, "ms_ctx_config bench%u party-line %u "
+			     "ptime=%u", c, BENCH_BITRATE, bench.ptime);
+	err |= bench_command(mb, "ms_bridge_tx bench%u 127.0.0.1 %u %u %u",
+			     c, sink_port, BENCH_PT, rand_u32() | 1);
+	if (err)
+		return err;
+
+	for (i = 0; i < bench.producers; ++i) {
+		struct producer *p = &bench.producerv[bench.producerc];
+
+		err = bench_command(mb, "ms_src_reserve bench%u p%u", c, i);
+		if (!err)
+			err = json_u32(mb, "localRecvPort", &port);
+		if (err)
+			return err;
+
+		(void)sa_set_str(&local, "127.0.0.1", 0);
+		err = udp_listen(&p->us, &local, NULL, NULL);
+		if (!err)
+			err = udp_local_get(p->us, &local);
+		if (err)
+			return err;
+
+		p->mb = mbuf_alloc(RTP_HEADER_SIZE + MS_OPUS_MAX_PACKET);
+		if (!p->mb)
+			return ENOMEM;
+
+		(void)sa_set_str(&p->dst, "127.0.0.1", (uint16_t)port);
+		p->ssrc = rand_u32() | 1;
+		p->seq = rand_u16();
+		p->ts = rand_u32();
+		p->next = bench.producerc % BENCH_LOOP;
+		++bench.producerc;
+
+		err = bench_command(mb, "ms_bridge_addsrc bench%u p%u "
+				    "127.0.0.1 %u %u %u", c, i,
+				    sa_port(&local), BENCH_PT, p->ssrc);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < bench.callers; ++i) {
+		struct caller *cl = &bench.callerv[bench.callerc++];
+		struct auplay_prm play_prm = {
+			.srate = MS_SRATE, .ch = MS_CHANNELS,
+			.ptime = bench.ptime, .fmt = AUFMT_S16LE,
+		};
+		struct ausrc_prm src_prm = {
+			.srate = MS_SRATE, .ch = MS_CHANNELS,
+			.ptime = bench.ptime, .fmt = AUFMT_S16LE,
+		};
+		char device[MS_KEY_SIZE + MS_CALL_TOKEN_SIZE + 1];
+
+		(void)re_snprintf(device, sizeof(device),
+				  "bench%u|%016llx%016llx%016llx%016llx", c,
+				  (unsigned long long)rand_u64(),
+				  (unsigned long long)rand_u64(),
+				  (unsigned long long)rand_u64(),
+				  (unsigned long long)rand_u64());
+
+		err = auplay_alloc(&cl->play, baresip_auplayl(), "mediasoup",
+				   &play_prm, device, caller_write_handler,
+				   NULL);
+		if (err)
+			return err;
+
+		err = ausrc_alloc(&cl->rec, baresip_ausrcl(), "mediasoup",
+				  &src_prm, device, caller_read_handler, NULL,
+				  NULL);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+static double per_second(uint64_t count, uint64_t wall_us)
+{
+	return wall_us ? (double)count * 1e6 / (double)wall_us : 0.0;
+}
+
+
+static uint64_t average(uint64_t sum, uint64_t count)
+{
+	return count ? sum / count : 0;
+}
+
+
+static void report(void)
+{
+	const struct snapshot *a = &bench.begin;
+	const struct snapshot *b = &bench.end;
+	const uint64_t wall = b->wall_us - a->wall_us;
+	const uint64_t gen = b->gen_us - a->gen_us;
+	const uint64_t cpu = b->cpu_us - a->cpu_us;
+	const uint64_t bridge = cpu > gen ? cpu - gen : 0;
+	const unsigned streams = bench.contexts * (bench.producers + 1);
+	const double cpu_pct = wall ? 100.0 * (double)bridge / (double)wall
+				    : 0.0;
+
+	printf("{\"bench\":\"mediasoup_bridge\",\"contexts\":%u,"
+	       "\"producersPerContext\":%u,\"callersPerContext\":%u,"
+	       "\"ptimeMs\":%u,\"seconds\":%.3f,\"streams\":%u,"
+	       "\"cpuPercent\":%.2f,\"cpuPercentPerStream\":%.4f,"
+	       "\"generatorCpuPercent\":%.2f,",
+	       bench.contexts, bench.producers, bench.callers, bench.ptime,
+	       (double)wall / 1e6, streams, cpu_pct,
+	       streams ? cpu_pct / streams : 0.0,
+	       wall ? 100.0 * (double)gen / (double)wall : 0.0);
+
+	printf("\"rx\":{\"packetsPerSecond\":%.1f,\"lost\":%llu,"
+	       "\"plcFrames\":%llu,\"decodeErrors\":%llu,"
+	       "\"decodeAvgUs\":%llu,\"decodeMaxUs\":%u},",
+	       per_second(b->rx_packets - a->rx_packets, wall),
+	       (unsigned long long)(b->rx_lost - a->rx_lost),
+	       (unsigned long long)(b->plc_frames - a->plc_frames),
+	       (unsigned long long)(b->decode_errors - a->decode_errors),
+	       (unsigned long long)average(b->decode_us_sum - a->decode_us_sum,
+					   b->decodes - a->decodes),
+	       b->decode_us_max);
+
+	printf("\"tx\":{\"packetsPerSecond\":%.1f,"
+	       "\"sinkPacketsPerSecond\":%.1f,\"errors\":%llu,"
+	       "\"encodeAvgUs\":%llu,\"encodeMaxUs\":%u,"
+	       "\"lateTicks\":%llu,\"avgLateUs\":%llu,\"maxLateUs\":%u},",
+	       per_second(b->tx_packets - a->tx_packets, wall),
+	       per_second(b->sink_packets - a->sink_packets, wall),
+	       (unsigned long long)(b->tx_errors - a->tx_errors),
+	       (unsigned long long)average(b->encode_us_sum - a->encode_us_sum,
+					   b->encodes - a->encodes),
+	       b->encode_us_max,
+	       (unsigned long long)(b->late_ticks - a->late_ticks),
+	       (unsigned long long)average(b->late_us_sum - a->late_us_sum,
+					   b->ticks - a->ticks),
+	       b->late_us_max);
+
+	printf("\"jbuf\":{\"late\":%llu,\"lost\":%llu,\"overflow\":%llu,"
+	       "\"underflow\":%llu,\"flush\":%llu,\"avgDelayMs\":%llu},",
+	       (unsigned long long)(b->jb_late - a->jb_late),
+	       (unsigned long long)(b->jb_lost - a->jb_lost),
+	       (unsigned long long)(b->jb_overflow - a->jb_overflow),
+	       (unsigned long long)(b->jb_underflow - a->jb_underflow),
+	       (unsigned long long)(b->jb_flush - a->jb_flush),
+	       (unsigned long long)average(b->jb_delay_ms_sum,
+					   b->jb_sources));
+
+	printf("\"callers\":{\"framesInPerSecond\":%.1f,"
+	       "\"framesOutPerSecond\":%.1f}}\n",
+	       per_second(b->caller_frames_in - a->caller_frames_in, wall),
+	       per_second(b->caller_frames_out - a->caller_frames_out,
+			  wall));
+}
+
+
+static void bench_teardown(void)
+{
+	size_t i;
+
+	tmr_cancel(&bench.send_tmr);
+	tmr_cancel(&bench.phase_tmr);
+
+	for (i = 0; i < bench.callerc; ++i) {
+		bench.callerv[i].rec = mem_deref(bench.callerv[i].rec);
+		bench.callerv[i].play = mem_deref(bench.callerv[i].play);
+	}
+
+	for (i = 0; i < bench.producerc; ++i) {
+		bench.producerv[i].us = mem_deref(bench.producerv[i].us);
+		bench.producerv[i].mb = mem_deref(bench.producerv[i].mb);
+	}
+
+	bench.sink = mem_deref(bench.sink);
+	bench.callerv = mem_deref(bench.callerv);
+	bench.producerv = mem_deref(bench.producerv);
+	bench.tone = mem_deref(bench.tone);
+}
+
+
+static int bench_run(void)
+{
+	struct mbuf *mb = NULL;
+	struct sa local;
+	unsigned c;
+	int err;
+
+	err = packets_encode();
+	if (err)
+		return err;
+
+	bench.producerv = mem_zalloc((size_t)bench.contexts * bench.producers *
+				     sizeof(*bench.producerv), NULL);
+	bench.callerv = mem_zalloc((size_t)bench.contexts * bench.callers *
+				   sizeof(*bench.callerv), NULL);
+	mb = mbuf_alloc(1024);
+	if ((bench.producers && !bench.producerv) ||
+	    (bench.callers && !bench.callerv) || !mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	(void)sa_set_str(&local, "127.0.0.1", 0);
+	err = udp_listen(&bench.sink, &local, sink_recv, NULL);
+	if (!err)
+		err = udp_local_get(bench.sink, &local);
+	if (err)
+		goto out;
+
+	for (c = 0; c < bench.contexts; ++c) {
+		err = context_setup(mb, c, sa_port(&local));
+		if (err)
+			goto out;
+	}
+
+	bench.start_ms = tmr_jiffies();
+	tmr_start(&bench.send_tmr, 0, send_handler, NULL);
+	tmr_start(&bench.phase_tmr, bench.warmup_s * 1000, phase_begin,
+		  NULL);
+
+	err = re_main(NULL);
+	if (!err)
+		report();
+
+out:
+	bench_teardown();
+	mem_deref(mb);
+	return err;
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mediasoup_bridge_load_bench [-c contexts] "
+		"[-p producers] [-u callers]\n"
+		"         [-t ptime] [-w warmup s] [-d duration s] "
+		"[-P first RTP port]\n");
+}
+
+
+static int parse_args(int argc, char *argv[])
+{
+	int opt;
+
+	bench.contexts = 10;
+	bench.producers = 3;
+	bench.callers = 1;
+	bench.ptime = MS_PTIME_DEFAULT;
+	bench.warmup_s = 2;
+	bench.duration_s = 10;
+	bench.port_first = BENCH_PORT_FIRST;
+
+	while ((opt = getopt(argc, argv, "c:p:u:t:w:d:P:h")) != -1) {
+		const unsigned long v = strtoul(optarg ? optarg : "0",
+						NULL, 10);
+
+		switch (opt) {
+
+		case 'c': bench.contexts = (unsigned)v;   break;
+		case 'p': bench.producers = (unsigned)v;  break;
+		case 'u': bench.callers = (unsigned)v;    break;
+		case 't': bench.ptime = (uint32_t)v;      break;
+		case 'w': bench.warmup_s = (uint32_t)v;   break;
+		case 'd': bench.duration_s = (uint32_t)v; break;
+		case 'P': bench.port_first = (uint16_t)v; break;
+		default:
+			return EINVAL;
+		}
+	}
+
+	if (!bench.contexts || !bench.duration_s ||
+	    !ms_valid_ptime(bench.ptime) || bench.port_first < 1024 ||
+	    bench.port_first + 2ul * bench.contexts * bench.producers + 2 >
+	    65535)
+		return EINVAL;
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	char conf[256];
+	int n;
+	int err;
+
+	err = parse_args(argc, argv);
+	if (err) {
+		usage();
+		return 2;
+	}
+
+	n = re_snprintf(conf, sizeof(conf),
+			"mediasoup_bridge_rtp_ports\t%u-%lu\n"
+			"mediasoup_bridge_bind_addr\t127.0.0.1\n",
+			bench.port_first,
+			bench.port_first +
+			2ul * bench.contexts * bench.producers + 1);
+	if (n < 0)
+		return 1;
+
+	err = libre_init();
+	if (err)
+		return 1;
+
+	(void)fd_setsize(-1);
+
+	err = conf_configure_buf((const uint8_t *)conf, (size_t)n);
+	if (!err)
+		err = baresip_init(conf_config());
+	if (err) {
+		fprintf(stderr, "bridge_bench: baresip init: %s\n",
+			strerror(err));
+		goto out;
+	}
+
+	err = DECL_EXPORTS(mediasoup_bridge).init();
+	if (err) {
+		fprintf(stderr, "bridge_bench: module init: %s\n",
+			strerror(err));
+		goto out;
+	}
+
+	err = bench_run();
+	if (err)
+		fprintf(stderr, "bridge_bench: %s\n", strerror(err));
+
+	(void)DECL_EXPORTS(mediasoup_bridge).close();
+
+out:
+	baresip_close();
+	libre_close();
+	return err ? 1 : 0;
+}
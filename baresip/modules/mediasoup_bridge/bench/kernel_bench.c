@@ -0,0 +1,456 @@
+/**
+ * @file kernel_bench.c Audio kernel microbenchmarks
+ *
+ * Times the per-frame audio kernels of mediasoup_bridge and vumeter_stereo
+ * in isolation, on 20 ms frames at 8, 16 and 48 kHz, mono and stereo:
+ *
+ *  - ms_level:    ms_level_measure() plus ms_level_dbfs()
+ *  - vu_level:    vu_measure_s16() plus two vu_calc_dbfs()
+ *  - deliver_*:   the caller capture path of local_output_handler(), from
+ *                 the 48 kHz stereo mix to the device rate, channels and
+ *                 format (s16, float, s24_3le)
+ *  - read_*:      the caller playback path of local_read_handler(), from
+ *                 the device format back to 48 kHz stereo
+ *  - aumix_put:   aumix_source_put() of one frame
+ *  - aumix_mix:   mixer-thread CPU per mixing cycle with BENCH_MIX_SOURCES
+ *                 sources, which refill themselves from their frame handler
+ *
+ * One result line per kernel and configuration, in ns per frame.  The
+ * mixer runs on its own clock, so aumix_mix takes -d ms per configuration.
+ *
+ *   mediasoup_bridge_kernel_bench [-d mix duration ms]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <re.h>
+#include <rem.h>
+
+#include "level.h"
+#include "vu_level.h"
+
+
+enum {
+	BENCH_PTIME       = 20,
+	BENCH_SRATE       = 48000,
+	BENCH_CH          = 2,
+	BENCH_MAX_SAMPC   = BENCH_SRATE * BENCH_PTIME / 1000 * BENCH_CH,
+	BENCH_FRAMES      = 16,
+	BENCH_ITER        = 20000,
+	BENCH_PUT_BURST   = 4,
+	BENCH_MIX_SOURCES = 4,
+	BENCH_MIX_MS      = 1000,
+};
+
+
+struct config {
+	uint32_t srate;
+	uint8_t ch;
+	size_t sampc;
+};
+
+
+struct mix_probe {
+	struct aumix_source *src;
+	const int16_t *frame;
+	size_t sampc;
+	bool counter;
+};
+
+
+static const uint32_t sratev[] = {8000, 16000, 48000};
+static const uint8_t chv[] = {1, 2};
+
+static const struct {
+	const char *name;
+	enum aufmt fmt;
+} formatv[] = {
+	{"s16",     AUFMT_S16LE},
+	{"float",   AUFMT_FLOAT},
+	{"s24_3le", AUFMT_S24_3LE},
+};
+
+static int16_t framev[BENCH_FRAMES][BENCH_MAX_SAMPC];
+static int16_t s16[BENCH_MAX_SAMPC];
+static int16_t out[BENCH_MAX_SAMPC];
+static uint8_t native[BENCH_MAX_SAMPC * 4];
+static volatile double sink;
+
+static uint32_t mix_ms = BENCH_MIX_MS;
+
+/* Written by the mixer thread only, read after it has stopped. */
+static struct {
+	uint64_t cycles;
+	uint64_t cpu_first;
+	uint64_t cpu_last;
+} mix;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/* Speech-like level spread: random samples from 0 to -47 dB gain. */
+static void fill_frames(void)
+{
+	uint32_t seed = 0x1234567u;
+	size_t f;
+	size_t i;
+
+	for (f = 0; f < BENCH_FRAMES; ++f) {
+		const double gain = pow(10.0, -(double)(f * 3) / 20.0);
+
+		for (i = 0; i < BENCH_MAX_SAMPC; ++i) {
+			seed = seed * 1664525u + 1013904223u;
+			framev[f][i] = (int16_t)((double)(int16_t)(seed >> 16) *
+						 gain);
+		}
+	}
+}
+
+
+static void result(const char *kernel, const struct config *cfg,
+		   uint64_t ns, uint64_t frames)
+{
+	printf("kernel_bench kernel=%s srate=%u ch=%u sampc=%zu "
+	       "ns_per_frame=%.1f\n", kernel, cfg->srate, cfg->ch, cfg->sampc,
+	       frames ? (double)ns / (double)frames : 0.0);
+}
+
+
+static void bench_ms_level(const struct config *cfg)
+{
+	struct ms_level lvl;
+	uint64_t t0;
+	size_t n;
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_ITER; ++n) {
+		ms_level_measure(&lvl, framev[n % BENCH_FRAMES], cfg->sampc);
+		sink = ms_level_dbfs(&lvl);
+	}
+
+	result("ms_level", cfg, now_ns() - t0, BENCH_ITER);
+}
+
+
+static void bench_vu_level(const struct config *cfg)
+{
+	struct vu_sums sums;
+	uint64_t t0;
+	size_t n;
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_ITER; ++n) {
+		memset(&sums, 0, sizeof(sums));
+		vu_measure_s16(&sums, framev[n % BENCH_FRAMES], cfg->sampc,
+			       cfg->ch);
+		sink = vu_calc_dbfs(sums.sum_l, sums.samples) +
+		       vu_calc_dbfs(sums.sum_r, sums.samples);
+	}
+
+	result("vu_level", cfg, now_ns() - t0, BENCH_ITER);
+}
+
+
+/* As caller_deliver(): 48 kHz stereo mix to the capture device. */
+static int bench_deliver(const struct config *cfg, size_t f)
+{
+	const size_t mix_sampc = BENCH_MAX_SAMPC;
+	const bool passthrough = cfg->srate == BENCH_SRATE &&
+				 cfg->ch == BENCH_CH;
+	struct auresamp resamp;
+	char kernel[32];
+	uint64_t t0;
+	size_t outc;
+	size_t n;
+	int err;
+
+	auresamp_init(&resamp);
+	err = auresamp_setup(&resamp, BENCH_SRATE, BENCH_CH, cfg->srate,
+			     cfg->ch);
+	if (err)
+		return err;
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_ITER; ++n) {
+		const int16_t *mixed = framev[n % BENCH_FRAMES];
+
+		outc = BENCH_MAX_SAMPC;
+		if (passthrough) {
+			memcpy(s16, mixed, mix_sampc * sizeof(*s16));
+			outc = mix_sampc;
+		}
+		else {
+			err = auresamp(&resamp, s16, &outc, mixed, mix_sampc);
+		}
+		if (err || outc != cfg->sampc)
+			return err ? err : EPROTO;
+
+		if (formatv[f].fmt == AUFMT_S16LE)
+			memcpy(native, s16, outc * sizeof(*s16));
+		else
+			auconv_from_s16(formatv[f].fmt, native, s16, outc);
+	}
+
+	(void)re_snprintf(kernel, sizeof(kernel), "deliver_%s",
+			  formatv[f].name);
+	result(kernel, cfg, now_ns() - t0, BENCH_ITER);
+
+	return 0;
+}
+
+
+/* As local_read_handler(): playback device frame to 48 kHz stereo. */
+static int bench_read(const struct config *cfg, size_t f)
+{
+	const bool passthrough = cfg->srate == BENCH_SRATE &&
+				 cfg->ch == BENCH_CH;
+	struct auresamp resamp;
+	char kernel[32];
+	uint64_t t0;
+	size_t outc;
+	size_t n;
+	int err;
+
+	auresamp_init(&resamp);
+	err = auresamp_setup(&resamp, cfg->srate, cfg->ch, BENCH_SRATE,
+			     BENCH_CH);
+	if (err)
+		return err;
+
+	/* Device-native input, converted once outside the timed loop. */
+	auconv_from_s16(formatv[f].fmt, native, framev[1], cfg->sampc);
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_ITER; ++n) {
+
+		if (formatv[f].fmt == AUFMT_S16LE)
+			memcpy(s16, native, cfg->sampc * sizeof(*s16));
+		else
+			auconv_to_s16(s16, formatv[f].fmt, native,
+				      cfg->sampc);
+
+		if (passthrough) {
+			memcpy(out, s16, cfg->sampc * sizeof(*out));
+		}
+		else {
+			outc = BENCH_MAX_SAMPC;
+			err = auresamp(&resamp, out, &outc, s16, cfg->sampc);
+			if (err || outc != BENCH_MAX_SAMPC)
+				return err ? err : EPROTO;
+		}
+	}
+
+	(void)re_snprintf(kernel, sizeof(kernel), "read_%s",
+			  formatv[f].name);
+	result(kernel, cfg, now_ns() - t0, BENCH_ITER);
+
+	return 0;
+}
+
+
+static int bench_aumix_put(const struct config *cfg)
+{
+	struct aumix *mixer = NULL;
+	struct aumix_source *src = NULL;
+	uint64_t ns = 0;
+	size_t n;
+	int err;
+
+	err = aumix_alloc(&mixer, cfg->srate, cfg->ch, BENCH_PTIME);
+	if (!err)
+		err = aumix_source_alloc(&src, mixer, NULL, NULL);
+	if (err)
+		goto out;
+
+	/* Not enabled: no mixer thread.  Drained between bursts so the
+	 * buffer never overruns, as with a running mixer. */
+	for (n = 0; n < BENCH_ITER; n += BENCH_PUT_BURST) {
+		const uint64_t t0 = now_ns();
+		size_t i;
+
+		for (i = 0; i < BENCH_PUT_BURST; ++i)
+			(void)aumix_source_put(src,
+					       framev[(n + i) % BENCH_FRAMES],
+					       cfg->sampc);
+
+		ns += now_ns() - t0;
+		aumix_source_flush(src);
+	}
+
+	result("aumix_put", cfg, ns, BENCH_ITER);
+
+out:
+	mem_deref(src);
+	mem_deref(mixer);
+	return err;
+}
+
+
+static void mix_frame_handler(const int16_t *sampv, size_t sampc, void *arg)
+{
+	struct mix_probe *probe = arg;
+	(void)sampv;
+	(void)sampc;
+
+	if (probe->counter) {
+		const uint64_t cpu = thread_cpu_ns();
+
+		if (!mix.cycles++)
+			mix.cpu_first = cpu;
+		mix.cpu_last = cpu;
+	}
+
+	(void)aumix_source_put(probe->src, probe->frame, probe->sampc);
+}
+
+
+static int bench_aumix_mix(const struct config *cfg)
+{
+	struct mix_probe probev[BENCH_MIX_SOURCES];
+	struct aumix *mixer = NULL;
+	size_t i;
+	int err;
+
+	memset(probev, 0, sizeof(probev));
+	memset(&mix, 0, sizeof(mix));
+
+	err = aumix_alloc(&mixer, cfg->srate, cfg->ch, BENCH_PTIME);
+	if (err)
+		return err;
+
+	for (i = 0; i < BENCH_MIX_SOURCES; ++i) {
+		struct mix_probe *probe = &probev[i];
+
+		probe->frame = framev[i % BENCH_FRAMES];
+		probe->sampc = cfg->sampc;
+		probe->counter = i == 0;
+
+		err = aumix_source_alloc(&probe->src, mixer,
+					 mix_frame_handler, probe);
+		if (err)
+			goto out;
+
+		(void)aumix_source_put(probe->src, probe->frame,
+				       probe->sampc);
+	}
+
+	for (i = 0; i < BENCH_MIX_SOURCES; ++i)
+		aumix_source_enable(probev[i].src, true);
+
+	sys_msleep(mix_ms);
+
+	/* The last source disabled stops the mixer thread. */
+	for (i = 0; i < BENCH_MIX_SOURCES; ++i)
+		aumix_source_enable(probev[i].src, false);
+
+	/* Each cycle is timed from the previous one's probe. */
+	result("aumix_mix", cfg, mix.cpu_last - mix.cpu_first,
+	       mix.cycles > 1 ? mix.cycles - 1 : 0);
+
+out:
+	for (i = 0; i < BENCH_MIX_SOURCES; ++i)
+		mem_deref(probev[i].src);
+	mem_deref(mixer);
+	return err;
+}
+
+
+static int run(const struct config *cfg)
+{
+	size_t f;
+	int err;
+
+	bench_ms_level(cfg);
+	bench_vu_level(cfg);
+
+	for (f = 0; f < RE_ARRAY_SIZE(formatv); ++f) {
+		err = bench_deliver(cfg, f);
+		if (!err)
+			err = bench_read(cfg, f);
+		if (err)
+			return err;
+	}
+
+	err = bench_aumix_put(cfg);
+	if (!err)
+		err = bench_aumix_mix(cfg);
+
+	return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t r;
+	size_t c;
+	int opt;
+	int err;
+
+	while ((opt = getopt(argc, argv, "d:h")) != -1) {
+		switch (opt) {
+
+		case 'd':
+			mix_ms = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+
+		default:
+			fprintf(stderr, "usage: mediasoup_bridge_kernel_bench "
+				"[-d mix duration ms]\n");
+			return 2;
+		}
+	}
+
+	err = libre_init();
+	if (err)
+		return 1;
+
+	ms_level_init();
+	vu_level_init();
+	fill_frames();
+
+	printf("kernel_bench level_kernel=%s vu_kernel=%s ptime=%u iter=%u\n",
+	       ms_level_kernel(), vu_level_kernel(), BENCH_PTIME, BENCH_ITER);
+
+	for (r = 0; r < RE_ARRAY_SIZE(sratev); ++r) {
+		for (c = 0; c < RE_ARRAY_SIZE(chv); ++c) {
+			const struct config cfg = {
+				.srate = sratev[r],
+				.ch    = chv[c],
+				.sampc = (size_t)sratev[r] * BENCH_PTIME /
+					 1000 * chv[c],
+			};
+
+			err = run(&cfg);
+			if (err) {
+				fprintf(stderr, "kernel_bench: srate=%u ch=%u: "
+					"%s\n", cfg.srate, cfg.ch,
+					strerror(err));
+				goto out;
+			}
+		}
+	}
+
+out:
+	libre_close();
+	return err ? 1 : 0;
+}
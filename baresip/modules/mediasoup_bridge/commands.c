@@ -10,8 +10,10 @@
 
 
 enum {
-	MS_MAX_ARGS = 6,
+	MS_MAX_ARGS = 10,
 	MS_PARAM_SIZE = 1024,
+	MS_APPLY_SIZE = 4096,
+	MS_APPLY_MAX_OPS = 16,
 };
 
 struct command_params {
@@ -70,6 +72,56 @@ static int parse_u32(const char *value, uint32_t *number)
 }
 
 
+static int parse_u64(const char *value, uint64_t *number)
+{
+	unsigned long long parsed;
+	char *end;
+
+	if (!str_isset(value) || !number)
+		return EINVAL;
+
+	errno = 0;
+	parsed = strtoull(value, &end, 10);
+	if (errno || *end)
+		return EINVAL;
+
+	*number = (uint64_t)parsed;
+	return 0;
+}
+
+
+static int parse_double(const char *value, double *number)
+{
+	double parsed;
+	char *end;
+
+	if (!str_isset(value) || !number)
+		return EINVAL;
+
+	errno = 0;
+	parsed = strtod(value, &end);
+	if (errno || *end || parsed != parsed)
+		return EINVAL;
+
+	*number = parsed;
+	return 0;
+}
+
+
+/*
+ * Match a "name=value" option argument; returns the value or NULL.
+ */
+static const char *option_value(const char *arg, const char *name)
+{
+	const size_t len = str_len(name);
+
+	if (strncmp(arg, name, len) || arg[len] != '=')
+		return NULL;
+
+	return arg + len + 1;
+}
+
+
 static int parse_remote(struct sa *remote, const char *ip, const char *port)
 {
 	uint32_t value;
@@ -155,51 +207,154 @@ static int cmd_ctx_close(struct re_printf *pf, void *arg)
 }
 
 
+/*
+ * Parse "party-line|isolated <bitrate> [options]" into a full
+ * configuration.  Returns NULL or the error reason.
+ */
+static const char *parse_ctx_config(struct ms_ctx_config *cfg,
+				    char *const *argv, size_t argc)
+{
+	uint32_t bitrate = 0;
+	const char *value;
+	size_t i;
+	int err;
+
+	if (argc < 2 || argc > 5)
+		return "invalid-parameters";
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->telemetry_ms = MS_TELEMETRY_MS;
+	cfg->hysteresis_db = MS_HYSTERESIS_DEFAULT_DB;
+
+	if (!str_cmp(argv[0], "party-line"))
+		cfg->mix_local_callers = true;
+	else if (!str_cmp(argv[0], "isolated"))
+		cfg->mix_local_callers = false;
+	else
+		return "invalid-mix-mode";
+
+	err = parse_u32(argv[1], &bitrate);
+	if (err || bitrate < MS_BITRATE_MIN || bitrate > MS_BITRATE_MAX)
+		return "invalid-bitrate";
+	cfg->bitrate_bps = (int)bitrate;
+
+	for (i = 2; i < argc; ++i) {
+		if ((value = option_value(argv[i], "ptime"))) {
+			err = parse_u32(value, &cfg->ptime);
+			if (err || !ms_valid_ptime(cfg->ptime))
+				return "invalid-ptime";
+		}
+		else if ((value = option_value(argv[i], "interval"))) {
+			err = parse_u32(value, &cfg->telemetry_ms);
+			if (err || cfg->telemetry_ms < MS_TELEMETRY_MIN_MS ||
+			    cfg->telemetry_ms > MS_TELEMETRY_MAX_MS)
+				return "invalid-interval";
+		}
+		else if ((value = option_value(argv[i], "hysteresis"))) {
+			err = parse_double(value, &cfg->hysteresis_db);
+			if (err || cfg->hysteresis_db < 0.0 ||
+			    cfg->hysteresis_db > MS_HYSTERESIS_MAX_DB)
+				return "invalid-hysteresis";
+		}
+		else {
+			return "invalid-parameters";
+		}
+	}
+
+	return NULL;
+}
+
+
+/* <remoteIp> <remotePort> <pt> <ssrc>, with a non-zero SSRC */
+static int parse_tx_endpoint(struct sa *remote, uint8_t *pt, uint32_t *ssrc,
+			     char *const *argv)
+{
+	uint32_t port = 0;
+	uint32_t value = 0;
+	int err;
+
+	err  = parse_u32(argv[1], &port);
+	err |= parse_u32(argv[2], &value);
+	err |= parse_u32(argv[3], ssrc);
+	if (err || !port || port > UINT16_MAX || value > 127 || !*ssrc ||
+	    parse_remote(remote, argv[0], argv[1]))
+		return EINVAL;
+
+	*pt = (uint8_t)value;
+	return 0;
+}
+
+
+/* <remoteIp> <remotePort> <pt> [ssrc], 0 or no SSRC latches the first */
+static int parse_rx_endpoint(struct sa *remote, uint8_t *pt, uint32_t *ssrc,
+			     char *const *argv, size_t argc)
+{
+	uint32_t value = 0;
+	int err;
+
+	if (argc != 3 && argc != 4)
+		return EINVAL;
+
+	*ssrc = 0;
+	err  = parse_remote(remote, argv[0], argv[1]);
+	err |= parse_u32(argv[2], &value);
+	if (argc == 4)
+		err |= parse_u32(argv[3], ssrc);
+	if (err || value > 127)
+		return EINVAL;
+
+	*pt = (uint8_t)value;
+	return 0;
+}
+
+
+/*
+ * ms_ctx_config <key> party-line|isolated <bitrate>
+ *               [ptime=<ms>] [interval=<ms>] [hysteresis=<dB>]
+ *
+ * The command is declarative: omitted options return to their defaults,
+ * except ptime, which stays as it is.  Resetting it would rebuild the
+ * mixers and fail while callers are attached.
+ */
 static int cmd_ctx_config(struct re_printf *pf, void *arg)
 {
 	struct command_params params;
 	struct ms_context *ctx = NULL;
-	uint32_t bitrate = 0;
-	bool mix_local_callers;
+	struct ms_ctx_config cfg;
+	const char *reason;
 	bool changed;
 	int err;
 
-	err = parse_params(&params, arg, 3, 3);
+	err = parse_params(&params, arg, 3, 6);
 	if (err)
 		return command_error(pf, "", "invalid-parameters", err);
 
-	if (!str_cmp(params.argv[1], "party-line"))
-		mix_local_callers = true;
-	else if (!str_cmp(params.argv[1], "isolated"))
-		mix_local_callers = false;
-	else
-		return command_error(pf, params.argv[0],
-				     "invalid-mix-mode", EINVAL);
-
-	err = parse_u32(params.argv[2], &bitrate);
-	if (err || bitrate < MS_BITRATE_MIN || bitrate > MS_BITRATE_MAX)
-		return command_error(pf, params.argv[0],
-				     "invalid-bitrate", EINVAL);
+	reason = parse_ctx_config(&cfg, &params.argv[1], params.argc - 1);
+	if (reason)
+		return command_error(pf, params.argv[0], reason, EINVAL);
 
 	err = command_context(&ctx, pf, params.argv[0]);
 	if (err)
 		return err;
 
-	err = ms_context_configure(ctx, mix_local_callers, (int)bitrate,
-				   &changed);
+	err = ms_context_configure(ctx, &cfg, &changed);
 	if (err) {
 		mem_deref(ctx);
 		return command_error(pf, params.argv[0],
+				     err == EBUSY ? "ptime-change-busy" :
 				     "context-configure-failed", err);
 	}
 
 	err = re_hprintf(
 		pf,
 		"{\"key\":\"%s\",\"mixMode\":\"%s\","
-		"\"mixLocalCallers\":%s,\"bitrateBps\":%u,"
+		"\"mixLocalCallers\":%s,\"bitrateBps\":%d,\"ptimeMs\":%u,"
+		"\"telemetryIntervalMs\":%u,\"levelHysteresisDb\":%.1f,"
 		"\"changed\":%s}",
-		ctx->key, mix_local_callers ? "party-line" : "isolated",
-		mix_local_callers ? "true" : "false", bitrate,
+		ctx->key, cfg.mix_local_callers ? "party-line" : "isolated",
+		cfg.mix_local_callers ? "true" : "false", cfg.bitrate_bps,
+		ctx->ptime,
+		cfg.telemetry_ms, cfg.hysteresis_db,
 		changed ? "true" : "false");
 	mem_deref(ctx);
 	return err;
@@ -211,8 +366,7 @@ static int cmd_bridge_tx(struct re_printf *pf, void *arg)
 	struct command_params params;
 	struct ms_context *ctx = NULL;
 	struct sa remote;
-	uint32_t port = 0;
-	uint32_t pt = 0;
+	uint8_t pt = 0;
 	uint32_t ssrc = 0;
 	bool changed;
 	int err;
@@ -221,11 +375,7 @@ static int cmd_bridge_tx(struct re_printf *pf, void *arg)
 	if (err)
 		return command_error(pf, "", "invalid-parameters", err);
 
-	err  = parse_u32(params.argv[2], &port);
-	err |= parse_u32(params.argv[3], &pt);
-	err |= parse_u32(params.argv[4], &ssrc);
-	if (err || !port || port > UINT16_MAX || pt > 127 || !ssrc ||
-	    parse_remote(&remote, params.argv[1], params.argv[2]))
+	if (parse_tx_endpoint(&remote, &pt, &ssrc, &params.argv[1]))
 		return command_error(pf, params.argv[0],
 				     "invalid-tx-endpoint", EINVAL);
 
@@ -233,7 +383,7 @@ static int cmd_bridge_tx(struct re_printf *pf, void *arg)
 	if (err)
 		return err;
 
-	err = ms_tx_configure(ctx, &remote, (uint8_t)pt, ssrc, &changed);
+	err = ms_tx_configure(ctx, &remote, pt, ssrc, &changed);
 	if (err) {
 		mem_deref(ctx);
 		return command_error(pf, params.argv[0],
@@ -331,7 +481,7 @@ static int cmd_bridge_addsrc(struct re_printf *pf, void *arg)
 	struct ms_context *ctx = NULL;
 	struct ms_source *src;
 	struct sa remote;
-	uint32_t pt = 0;
+	uint8_t pt = 0;
 	uint32_t ssrc = 0;
 	bool changed;
 	int err;
@@ -340,11 +490,8 @@ static int cmd_bridge_addsrc(struct re_printf *pf, void *arg)
 	if (err)
 		return command_error(pf, "", "invalid-parameters", err);
 
-	err = parse_remote(&remote, params.argv[2], params.argv[3]);
-	err |= parse_u32(params.argv[4], &pt);
-	if (params.argc == 6)
-		err |= parse_u32(params.argv[5], &ssrc);
-	if (err || pt > 127)
+	if (parse_rx_endpoint(&remote, &pt, &ssrc, &params.argv[2],
+			      params.argc - 2))
 		return command_error(pf, params.argv[0],
 				     "invalid-rx-endpoint", EINVAL);
 
@@ -363,7 +510,7 @@ static int cmd_bridge_addsrc(struct re_printf *pf, void *arg)
 				     "source-not-reserved", ENOENT);
 	}
 
-	err = ms_source_activate(src, &remote, (uint8_t)pt, ssrc, &changed);
+	err = ms_source_activate(src, &remote, pt, ssrc, &changed);
 	if (err) {
 		mem_deref(src);
 		mem_deref(ctx);
@@ -417,12 +564,417 @@ static int cmd_bridge_delsrc(struct re_printf *pf, void *arg)
 }
 
 
+enum apply_kind {
+	APPLY_CONFIG,
+	APPLY_TX,
+	APPLY_MUTE,
+	APPLY_SRC,
+};
+
+struct apply_op {
+	enum apply_kind kind;
+	struct ms_ctx_config cfg;
+	const char *producer_id;
+	struct sa remote;
+	uint8_t pt;
+	uint32_t ssrc;
+	bool activate;
+	bool mute;
+
+	/* Result, and what a rollback restores */
+	struct ms_source *src;
+	bool applied;
+	bool created;
+	bool had_prev;
+	struct ms_ctx_config prev_cfg;
+	struct sa prev_remote;
+	uint8_t prev_pt;
+	uint32_t prev_ssrc;
+	bool prev_mute;
+};
+
+struct apply_batch {
+	char storage[MS_APPLY_SIZE];
+	const char *key;
+	struct apply_op opv[MS_APPLY_MAX_OPS];
+	size_t opc;
+};
+
+
+static void apply_batch_destructor(void *arg)
+{
+	struct apply_batch *batch = arg;
+	size_t i;
+
+	for (i = 0; i < batch->opc; ++i)
+		mem_deref(batch->opv[i].src);
+}
+
+
+/*
+ * A malformed batch is only answered to the caller.  It never reached a
+ * context, so it does not raise MS_CTX_ERROR.
+ */
+static int apply_reject(struct re_printf *pf, const char *key,
+			const char *reason, int err, int op)
+{
+	(void)re_hprintf(pf,
+			 "{\"error\":\"%s\",\"key\":\"%s\",\"errno\":%d,"
+			 "\"op\":%d,\"rolledBack\":true}",
+			 reason, key ? key : "", err, op);
+	return err;
+}
+
+
+static int apply_error(struct re_printf *pf, const char *key,
+		       const char *reason, int err, int op, bool rolled_back)
+{
+	(void)re_hprintf(pf,
+			 "{\"error\":\"%s\",\"key\":\"%s\",\"errno\":%d,"
+			 "\"op\":%d,\"rolledBack\":%s}",
+			 reason, key ? key : "", err, op,
+			 rolled_back ? "true" : "false");
+	ms_emit_error(key, reason, err);
+	return err;
+}
+
+
+/*
+ * Split "<key> <op>[;<op>...]" and validate every operation, so that a
+ * malformed batch is rejected before anything is applied.
+ */
+static const char *apply_parse(struct apply_batch *batch, const char *prm,
+			       int *failed_op)
+{
+	const char *ws = " \t\r\n";
+	char *seg_save = NULL;
+	char *seg;
+	char *p;
+
+	if (str_len(prm) >= sizeof(batch->storage))
+		return "invalid-parameters";
+
+	str_ncpy(batch->storage, prm, sizeof(batch->storage));
+	p = batch->storage + strspn(batch->storage, ws);
+	batch->key = p;
+	p += strcspn(p, ws);
+	if (*p)
+		*p++ = '\0';
+
+	if (!ms_valid_identifier(batch->key, MS_KEY_SIZE))
+		return "invalid-key";
+
+	for (seg = strtok_r(p, ";", &seg_save); seg;
+	     seg = strtok_r(NULL, ";", &seg_save)) {
+		struct apply_op *op;
+		char *argv[MS_MAX_ARGS];
+		char *tok_save = NULL;
+		char *tok;
+		size_t argc = 0;
+
+		for (tok = strtok_r(seg, ws, &tok_save); tok;
+		     tok = strtok_r(NULL, ws, &tok_save)) {
+			if (argc >= MS_MAX_ARGS)
+				return "invalid-parameters";
+			argv[argc++] = tok;
+		}
+
+		/* Tolerate empty segments such as a trailing ';' */
+		if (!argc)
+			continue;
+
+		*failed_op = (int)batch->opc;
+		if (batch->opc >= MS_APPLY_MAX_OPS)
+			return "too-many-operations";
+
+		op = &batch->opv[batch->opc];
+		if (!str_cmp(argv[0], "config")) {
+			const char *reason;
+
+			op->kind = APPLY_CONFIG;
+			reason = parse_ctx_config(&op->cfg, &argv[1],
+						  argc - 1);
+			if (reason)
+				return reason;
+		}
+		else if (!str_cmp(argv[0], "tx")) {
+			op->kind = APPLY_TX;
+			if (argc != 5 || parse_tx_endpoint(&op->remote, &op->pt,
+							   &op->ssrc, &argv[1]))
+				return "invalid-tx-endpoint";
+		}
+		else if (!str_cmp(argv[0], "mute")) {
+			op->kind = APPLY_MUTE;
+			if (argc != 2 || (str_cmp(argv[1], "on") &&
+					  str_cmp(argv[1], "off")))
+				return "invalid-mute-value";
+			op->mute = !str_cmp(argv[1], "on");
+		}
+		else if (!str_cmp(argv[0], "src")) {
+			op->kind = APPLY_SRC;
+			if (argc < 2 ||
+			    !ms_valid_identifier(argv[1], MS_PRODUCER_SIZE))
+				return "invalid-producer-id";
+
+			op->producer_id = argv[1];
+			op->activate = argc > 2;
+			if (op->activate &&
+			    parse_rx_endpoint(&op->remote, &op->pt, &op->ssrc,
+					      &argv[2], argc - 2))
+				return "invalid-rx-endpoint";
+		}
+		else {
+			return "invalid-operation";
+		}
+
+		++batch->opc;
+	}
+
+	*failed_op = -1;
+	return batch->opc ? NULL : "invalid-parameters";
+}
+
+
+static const char *apply_op(struct ms_context *ctx, struct apply_op *op,
+			    bool *changed, int *err)
+{
+	bool op_changed = false;
+
+	switch (op->kind) {
+
+	case APPLY_CONFIG:
+		/* Configuration is only written on this thread. */
+		op->prev_cfg.mix_local_callers = ctx->mix_local_callers;
+		op->prev_cfg.bitrate_bps = ctx->bitrate_bps;
+		op->prev_cfg.ptime = ctx->ptime;
+		op->prev_cfg.telemetry_ms = ctx->telemetry_ms;
+		op->prev_cfg.hysteresis_db = ctx->hysteresis_db;
+
+		*err = ms_context_configure(ctx, &op->cfg, &op_changed);
+		if (*err)
+			return *err == EBUSY ? "ptime-change-busy" :
+				"context-configure-failed";
+		break;
+
+	case APPLY_TX:
+		op->had_prev = ctx->tx_ready;
+		op->prev_remote = ctx->tx_remote;
+		op->prev_pt = ctx->tx_pt;
+		op->prev_ssrc = ctx->tx_ssrc;
+
+		*err = ms_tx_configure(ctx, &op->remote, op->pt, op->ssrc,
+				       &op_changed);
+		if (*err)
+			return "tx-configure-failed";
+		break;
+
+	case APPLY_MUTE:
+		op->prev_mute = ctx->tx_muted;
+
+		*err = ms_tx_set_mute(ctx, op->mute, &op_changed);
+		if (*err)
+			return "tx-mute-failed";
+		break;
+
+	case APPLY_SRC:
+		*err = ms_source_reserve(ctx, op->producer_id, &op->src,
+					 &op->created);
+		if (*err)
+			return *err == ENOSPC ? "port-range-exhausted" :
+				"source-reserve-failed";
+
+		op_changed = op->created;
+		if (!op->activate)
+			break;
+
+		mtx_lock(ctx->mutex);
+		op->had_prev = op->src->active;
+		op->prev_remote = op->src->remote;
+		op->prev_pt = op->src->pt;
+		op->prev_ssrc = op->src->expected_ssrc;
+		mtx_unlock(ctx->mutex);
+
+		*err = ms_source_activate(op->src, &op->remote, op->pt,
+					  op->ssrc, &op_changed);
+		if (*err)
+			return "source-activate-failed";
+		op_changed |= op->created;
+		break;
+	}
+
+	op->applied = true;
+	*changed |= op_changed;
+	return NULL;
+}
+
+
+/*
+ * Undo operations 0..last in reverse order.  A context opened by the
+ * batch is simply closed again, TX configured for the first time is
+ * unconfigured and a reserved source that the batch activated goes back
+ * to reserved.  Returns false if some state could not be restored.
+ */
+static bool apply_rollback(struct ms_context *ctx, struct apply_batch *batch,
+			   size_t last, bool ctx_created)
+{
+	bool complete = true;
+	size_t i;
+
+	if (ctx_created)
+		return ms_context_close(ctx->key, NULL) == 0;
+
+	for (i = last + 1; i-- > 0;) {
+		struct apply_op *op = &batch->opv[i];
+
+		switch (op->kind) {
+
+		case APPLY_CONFIG:
+			if (op->applied &&
+			    ms_context_configure(ctx, &op->prev_cfg, NULL))
+				complete = false;
+			break;
+
+		case APPLY_TX:
+			if (!op->applied)
+				break;
+			if (!op->had_prev)
+				ms_tx_unconfigure(ctx);
+			else if (ms_tx_configure(ctx, &op->prev_remote,
+						 op->prev_pt, op->prev_ssrc,
+						 NULL))
+				complete = false;
+			break;
+
+		case APPLY_MUTE:
+			if (op->applied &&
+			    ms_tx_set_mute(ctx, op->prev_mute, NULL))
+				complete = false;
+			break;
+
+		case APPLY_SRC:
+			if (op->created) {
+				if (ms_source_remove(ctx, op->producer_id,
+						     NULL))
+					complete = false;
+			}
+			else if (op->applied && op->activate) {
+				if (!op->had_prev)
+					ms_source_deactivate(op->src);
+				else if (ms_source_activate(op->src,
+							    &op->prev_remote,
+							    op->prev_pt,
+							    op->prev_ssrc,
+							    NULL))
+					complete = false;
+			}
+			break;
+		}
+	}
+
+	return complete;
+}
+
+
+/*
+ * ms_bridge_apply <key> <op>[;<op>...]
+ *
+ *   config party-line|isolated <bitrate> [ptime=] [interval=] [hysteresis=]
+ *   tx <remoteIp> <remotePort> <pt> <ssrc>
+ *   mute on|off
+ *   src <producerId> [<remoteIp> <remotePort> <pt> [ssrc]]
+ *
+ * Opens the context if needed and applies the operations in order in one
+ * round trip.  On the first failure the operations already applied are
+ * rolled back and the error names the failing operation's index.
+ */
+static int cmd_bridge_apply(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	struct apply_batch *batch;
+	struct ms_context *ctx = NULL;
+	const char *reason;
+	bool ctx_created = false;
+	bool changed = false;
+	bool first = true;
+	int failed_op = -1;
+	size_t i;
+	int err = 0;
+
+	if (!carg || !str_isset(carg->prm))
+		return command_error(pf, "", "invalid-parameters", EINVAL);
+
+	batch = mem_zalloc(sizeof(*batch), apply_batch_destructor);
+	if (!batch)
+		return command_error(pf, "", "apply-allocation-failed",
+				     ENOMEM);
+
+	reason = apply_parse(batch, carg->prm, &failed_op);
+	if (reason) {
+		err = apply_reject(pf, batch->key, reason, EINVAL, failed_op);
+		goto out;
+	}
+
+	err = ms_context_get_or_create(&ctx, batch->key, &ctx_created);
+	if (err) {
+		err = apply_error(pf, batch->key, "context-open-failed", err,
+				  -1, true);
+		goto out;
+	}
+
+	for (i = 0; i < batch->opc; ++i) {
+		reason = apply_op(ctx, &batch->opv[i], &changed, &err);
+		if (reason) {
+			const bool rolled_back = apply_rollback(ctx, batch, i,
+								ctx_created);
+
+			err = apply_error(pf, batch->key, reason, err, (int)i,
+					  rolled_back);
+			goto out;
+		}
+	}
+
+	err = re_hprintf(pf,
+			 "{\"key\":\"%s\",\"created\":%s,\"changed\":%s,"
+			 "\"ops\":%zu,\"tx\":{\"configured\":%s,"
+			 "\"localPort\":%u},\"sources\":[",
+			 ctx->key, ctx_created ? "true" : "false",
+			 changed || ctx_created ? "true" : "false", batch->opc,
+			 ctx->tx_ready ? "true" : "false", ctx->tx_local_port);
+
+	for (i = 0; !err && i < batch->opc; ++i) {
+		const struct apply_op *op = &batch->opv[i];
+
+		if (op->kind != APPLY_SRC)
+			continue;
+
+		err = re_hprintf(pf,
+				 "%s{\"producerId\":\"%s\","
+				 "\"localRecvPort\":%u,\"state\":\"%s\","
+				 "\"created\":%s}",
+				 first ? "" : ",", op->src->producer_id,
+				 op->src->local_port,
+				 op->activate ? "active" : "reserved",
+				 op->created ? "true" : "false");
+		first = false;
+	}
+	if (!err)
+		err = re_hprintf(pf, "]}");
+
+out:
+	mem_deref(batch);
+	mem_deref(ctx);
+	return err;
+}
+
+
 static int print_source_stat(struct re_printf *pf,
 			     const struct ms_source *src)
 {
 	struct jbuf_stat jstat;
+	struct ms_rx_stats rx;
 	char remote[64] = "";
 
+	ms_rx_stats_read(&src->rx_stats, &rx);
 	memset(&jstat, 0, sizeof(jstat));
 	if (src->jbuf)
 		(void)jbuf_stats(src->jbuf, &jstat);
@@ -437,85 +989,1065 @@ static int print_source_stat(struct re_printf *pf,
 		"\"latchedSsrc\":%u,\"rxPackets\":%llu,\"rxBytes\":%llu,"
 		"\"rxInvalid\":%llu,\"rxLost\":%llu,\"plcFrames\":%llu,"
 		"\"decodeErrors\":%llu,\"jbufDepth\":%u,"
-		"\"jbufDelayMs\":%u,\"levelDbfs\":%.1f}",
+		"\"jbufDelayMs\":%u,\"levelDbfs\":%.1f,"
+		"\"peakDbfs\":%.1f,\"driftPpm\":%.1f,"
+		"\"driftLocked\":%s,\"kernelRxTimestamps\":%s,"
+		"\"dispatchAvgUs\":%llu,\"dispatchMaxUs\":%u,"
+		"\"decodeAvgUs\":%llu,\"decodeMaxUs\":%u}",
 		src->producer_id, src->active ? "active" : "reserved",
 		src->local_port, remote,
 		src->active ? sa_port(&src->remote) : 0,
 		src->active ? src->pt : 0, src->expected_ssrc,
-		src->latched_ssrc, (unsigned long long)src->rx_packets,
-		(unsigned long long)src->rx_bytes,
-		(unsigned long long)src->rx_invalid,
-		(unsigned long long)src->rx_lost,
-		(unsigned long long)src->plc_frames,
-		(unsigned long long)src->decode_errors,
-		jstat.c_packets, jstat.c_delay, src->level_dbfs);
+		rx.latched_ssrc, (unsigned long long)rx.packets,
+		(unsigned long long)rx.bytes,
+		(unsigned long long)rx.invalid,
+		(unsigned long long)rx.lost,
+		(unsigned long long)rx.plc_frames,
+		(unsigned long long)rx.decode_errors,
+		jstat.c_packets, jstat.c_delay, ms_level_dbfs(&rx.level),
+		ms_level_peak_dbfs(&rx.level), rx.drift_ppm,
+		rx.drift_locked ? "true" : "false",
+		rx.kernel_ts ? "true" : "false",
+		(unsigned long long)(rx.dispatch_count ?
+				     rx.dispatch_us_sum / rx.dispatch_count :
+				     0),
+		rx.dispatch_us_max,
+		(unsigned long long)(rx.decodes ?
+				     rx.decode_us_sum / rx.decodes : 0),
+		rx.decode_us_max);
 }
 
 
-static int cmd_bridge_stat(struct re_printf *pf, void *arg)
+static int source_stat_handler(struct re_printf *pf, void *arg)
 {
-	struct command_params params;
-	struct ms_context *ctx = NULL;
-	struct le *le;
-	char remote[64] = "";
-	size_t source_count;
-	size_t call_count;
-	size_t ports_used;
-	bool first = true;
-	int err;
+	return print_source_stat(pf, arg);
+}
 
-	err = parse_params(&params, arg, 1, 1);
-	if (err)
-		return command_error(pf, "", "invalid-parameters", err);
 
-	err = command_context(&ctx, pf, params.argv[0]);
-	if (err)
-		return err;
+/* What ms_bridge_stat_all compares of a source: state and counters */
+static int source_state_handler(struct re_printf *pf, void *arg)
+{
+	const struct ms_source *src = arg;
+	struct ms_rx_stats rx;
+
+	ms_rx_stats_read(&src->rx_stats, &rx);
+
+	return re_hprintf(pf, "%s %u %J %u %u %u %d %d "
+			  "%llu %llu %llu %llu %llu %llu %llu",
+			  src->active ? "active" : "reserved",
+			  src->local_port, &src->remote, src->pt,
+			  src->expected_ssrc, rx.latched_ssrc,
+			  rx.drift_locked, rx.kernel_ts,
+			  (unsigned long long)rx.packets,
+			  (unsigned long long)rx.bytes,
+			  (unsigned long long)rx.invalid,
+			  (unsigned long long)rx.lost,
+			  (unsigned long long)rx.plc_frames,
+			  (unsigned long long)rx.decode_errors,
+			  (unsigned long long)rx.decodes);
+}
 
-	mtx_lock(ctx->mutex);
-	source_count = list_count(&ctx->sources);
-	call_count = list_count(&ctx->callers);
+
+/* TX configuration and counters; configuration is main-thread only. */
+static int print_tx_stat(struct re_printf *pf, void *arg)
+{
+	const struct ms_context *ctx = arg;
+	struct ms_clock_stats clock;
+	struct ms_tx_stats tx;
+	char remote[64] = "";
+
+	ms_tx_stats_read(&ctx->tx_stats, &tx);
+	ms_clock_stats_read(&ctx->clockv[MS_CLOCK_TX].stats, &clock);
 	if (ctx->tx_ready)
 		(void)sa_ntop(&ctx->tx_remote, remote, sizeof(remote));
-	ports_used = ms_port_pool_used();
 
-	err = re_hprintf(
+	return re_hprintf(
 		pf,
-		"{\"key\":\"%s\",\"state\":\"open\",\"calls\":%zu,"
-		"\"mixMode\":\"%s\",\"mixLocalCallers\":%s,"
-		"\"bitrateBps\":%d,"
-		"\"tx\":{\"configured\":%s,\"muted\":%s,"
+		"{\"configured\":%s,\"muted\":%s,"
 		"\"localPort\":%u,\"remoteIp\":\"%s\",\"remotePort\":%u,"
 		"\"payloadType\":%u,\"ssrc\":%u,\"packets\":%llu,"
-		"\"bytes\":%llu,\"errors\":%llu,\"levelDbfs\":%.1f},"
-		"\"rxSourceCount\":%zu,"
-		"\"ports\":{\"inUse\":%zu,\"capacity\":%zu,"
-		"\"purpose\":\"remote-receive\","
-		"\"txConsumesPool\":false},\"sources\":[",
-		ctx->key, call_count,
-		ctx->mix_local_callers ? "party-line" : "isolated",
-		ctx->mix_local_callers ? "true" : "false",
-		ctx->bitrate_bps, ctx->tx_ready ? "true" : "false",
+		"\"bytes\":%llu,\"errors\":%llu,\"levelDbfs\":%.1f,"
+		"\"peakDbfs\":%.1f,\"ticks\":%llu,\"lateTicks\":%llu,"
+		"\"avgLateUs\":%llu,\"maxLateUs\":%u,"
+		"\"encodeAvgUs\":%llu,\"encodeMaxUs\":%u}",
+		ctx->tx_ready ? "true" : "false",
 		ctx->tx_muted ? "true" : "false", ctx->tx_local_port, remote,
 		ctx->tx_ready ? sa_port(&ctx->tx_remote) : 0,
 		ctx->tx_ready ? ctx->tx_pt : 0, ctx->tx_ssrc,
-		(unsigned long long)ctx->tx_packets,
-		(unsigned long long)ctx->tx_bytes,
-		(unsigned long long)ctx->tx_errors, ctx->tx_level_dbfs,
-		source_count, ports_used, ms_port_pool.count);
+		(unsigned long long)tx.packets,
+		(unsigned long long)tx.bytes,
+		(unsigned long long)tx.errors, ms_level_dbfs(&tx.level),
+		ms_level_peak_dbfs(&tx.level),
+		(unsigned long long)clock.ticks,
+		(unsigned long long)clock.late_ticks,
+		(unsigned long long)(clock.ticks ?
+				     clock.late_us_sum / clock.ticks : 0),
+		clock.late_us_max,
+		(unsigned long long)(tx.encodes ?
+				     tx.encode_us_sum / tx.encodes : 0),
+		tx.encode_us_max);
+}
+
+
+/* What ms_bridge_stat_all compares of TX: state and counters */
+static int print_tx_state(struct re_printf *pf, void *arg)
+{
+	const struct ms_context *ctx = arg;
+	struct ms_clock_stats clock;
+	struct ms_tx_stats tx;
+
+	ms_tx_stats_read(&ctx->tx_stats, &tx);
+	ms_clock_stats_read(&ctx->clockv[MS_CLOCK_TX].stats, &clock);
+
+	return re_hprintf(pf, "%d %d %u %J %u %u %llu %llu %llu %llu "
+			  "%llu %llu", ctx->tx_ready,
+			  ctx->tx_muted, ctx->tx_local_port, &ctx->tx_remote,
+			  ctx->tx_pt, ctx->tx_ssrc,
+			  (unsigned long long)tx.packets,
+			  (unsigned long long)tx.bytes,
+			  (unsigned long long)tx.errors,
+			  (unsigned long long)tx.encodes,
+			  (unsigned long long)clock.ticks,
+			  (unsigned long long)clock.late_ticks);
+}
+
+
+static int print_clock(struct re_printf *pf, const struct ms_context *ctx,
+		       unsigned id)
+{
+	const struct ms_clock *clk = &ctx->clockv[id];
+	struct ms_clock_stats clock;
+	unsigned i;
+	int err;
+
+	ms_clock_stats_read(&clk->stats, &clock);
+
+	err = re_hprintf(pf, "{\"running\":%s,\"stalled\":%s,\"stalls\":%llu,"
+			 "\"ticks\":%llu,\"lateTicks\":%llu,"
+			 "\"avgLateUs\":%llu,\"maxLateUs\":%u,"
+			 "\"lateHistogram\":[",
+			 atomic_load(&clk->last_us) ? "true" : "false",
+			 clk->stalled ? "true" : "false",
+			 (unsigned long long)clk->stalls,
+			 (unsigned long long)clock.ticks,
+			 (unsigned long long)clock.late_ticks,
+			 (unsigned long long)(clock.ticks ?
+					      clock.late_us_sum / clock.ticks
+					      : 0),
+			 clock.late_us_max);
+
+	for (i = 0; !err && i < MS_LATE_BUCKETS; ++i)
+		err = re_hprintf(pf, "%s%llu", i ? "," : "",
+				 (unsigned long long)clock.late_histv[i]);
+
+	return err ? err : re_hprintf(pf, "]}");
+}
+
+
+/* Mixer clock watchdog; stall state is main-thread only. */
+static int print_clocks_stat(struct re_printf *pf, void *arg)
+{
+	const struct ms_context *ctx = arg;
+	unsigned i;
+	int err;
+
+	err = re_hprintf(pf, "{\"stallThresholdMs\":%u,\"lateBucketsUs\":[",
+			 MAX((uint32_t)MS_STALL_MS, 3 * ctx->ptime));
+
+	for (i = 0; !err && i + 1 < MS_LATE_BUCKETS; ++i)
+		err = re_hprintf(pf, "%s%u", i ? "," : "",
+				 ms_clock_bucket_us(i));
 
-	for (le = ctx->sources.head; !err && le; le = le->next) {
-		if (!first)
-			err = re_hprintf(pf, ",");
-		first = false;
-		if (!err)
-			err = print_source_stat(pf, le->data);
-	}
 	if (!err)
-		err = re_hprintf(pf, "]}");
-	mtx_unlock(ctx->mutex);
+		err = re_hprintf(pf, "],\"tx\":");
+	if (!err)
+		err = print_clock(pf, ctx, MS_CLOCK_TX);
+	if (!err)
+		err = re_hprintf(pf, ",\"rx\":");
+	if (!err)
+		err = print_clock(pf, ctx, MS_CLOCK_RX);
 
-	mem_deref(ctx);
+	return err ? err : re_hprintf(pf, "}");
+}
+
+
+static int print_clock_state(struct re_printf *pf,
+			     const struct ms_clock *clk)
+{
+	struct ms_clock_stats clock;
+
+	ms_clock_stats_read(&clk->stats, &clock);
+
+	return re_hprintf(pf, " %d %d %llu %llu %llu",
+			  atomic_load(&clk->last_us) != 0, clk->stalled,
+			  (unsigned long long)clk->stalls,
+			  (unsigned long long)clock.ticks,
+			  (unsigned long long)clock.late_ticks);
+}
+
+
+/* What ms_bridge_stat_all compares of the clocks: state and counters */
+static int print_clocks_state(struct re_printf *pf, void *arg)
+{
+	const struct ms_context *ctx = arg;
+	int err;
+
+	err = re_hprintf(pf, "%u", ctx->ptime);
+	if (!err)
+		err = print_clock_state(pf, &ctx->clockv[MS_CLOCK_TX]);
+	if (!err)
+		err = print_clock_state(pf, &ctx->clockv[MS_CLOCK_RX]);
+
+	return err;
+}
+
+
+static int print_telemetry_stat(struct re_printf *pf, void *arg)
+{
+	struct ms_telemetry_stat tstat;
+	(void)arg;
+
+	ms_telemetry_stat(&tstat);
+
+	return re_hprintf(
+		pf,
+		"{\"contexts\":%zu,\"sources\":%zu,"
+		"\"events\":%llu,\"ticks\":%llu,\"lastTickUs\":%llu,"
+		"\"avgTickUs\":%llu,\"maxTickUs\":%llu}",
+		tstat.contexts, tstat.sources,
+		(unsigned long long)tstat.events,
+		(unsigned long long)tstat.ticks,
+		(unsigned long long)tstat.last_tick_us,
+		(unsigned long long)tstat.avg_tick_us,
+		(unsigned long long)tstat.max_tick_us);
+}
+
+
+/*
+ * Pointer arrays and the section buffer of the stat commands.  They run on
+ * the main thread only and keep their storage between calls, so a stat
+ * poll allocates only when a context outgrows the previous largest one.
+ */
+struct stat_scratch {
+	void **v;
+	size_t size;
+};
+
+static struct stat_scratch stat_ctxs;
+static struct stat_scratch stat_srcs;
+static struct mbuf *stat_mb;
+
+
+static int stat_scratch_grow(struct stat_scratch *sc, size_t count)
+{
+	void **v;
+
+	if (count <= sc->size)
+		return 0;
+
+	count = MAX(count, 2 * sc->size);
+	v = mem_zalloc(count * sizeof(*v), NULL);
+	if (!v)
+		return ENOMEM;
+
+	mem_deref(sc->v);
+	sc->v    = v;
+	sc->size = count;
+
+	return 0;
+}
+
+
+/*
+ * Reference every entry of a list into a scratch array.  The array is
+ * grown with the lock released and the count taken again, so nothing is
+ * allocated under the lock.
+ */
+static int stat_scratch_take(struct stat_scratch *sc, size_t *countp,
+			     mtx_t *mutex, const struct list *list)
+{
+	struct le *le;
+	size_t n = 0;
+	int err;
+
+	for (;;) {
+		size_t count;
+
+		mtx_lock(mutex);
+		count = list_count(list);
+		if (count <= sc->size)
+			break;
+		mtx_unlock(mutex);
+
+		err = stat_scratch_grow(sc, count);
+		if (err)
+			return err;
+	}
+
+	for (le = list->head; le; le = le->next)
+		sc->v[n++] = mem_ref(le->data);
+	mtx_unlock(mutex);
+
+	*countp = n;
+	return 0;
+}
+
+
+static void stat_scratch_release(struct stat_scratch *sc, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		sc->v[i] = mem_deref(sc->v[i]);
+}
+
+
+static void stat_scratch_free(void)
+{
+	stat_ctxs.v    = mem_deref(stat_ctxs.v);
+	stat_ctxs.size = 0;
+	stat_srcs.v    = mem_deref(stat_srcs.v);
+	stat_srcs.size = 0;
+	stat_mb        = mem_deref(stat_mb);
+}
+
+
+static int cmd_bridge_stat(struct re_printf *pf, void *arg)
+{
+	struct command_params params;
+	struct ms_context *ctx = NULL;
+	struct ms_source **sourcev;
+	struct ms_sched_stat sstat;
+	struct ms_slab_stat slab;
+	struct ms_footprint fp;
+	size_t source_index = 0;
+	size_t call_count;
+	bool bypass_tx;
+	bool bypass_rx;
+	char trunk_name[MS_KEY_SIZE] = "";
+	unsigned trunk_stream = 0;
+	size_t ports_used;
+	size_t i;
+	int err;
+
+	err = parse_params(&params, arg, 1, 1);
+	if (err)
+		return command_error(pf, "", "invalid-parameters", err);
+
+	err = command_context(&ctx, pf, params.argv[0]);
+	if (err)
+		return err;
+
+	/*
+	 * Only list membership needs ctx->mutex.  Counters come from the
+	 * lock-free stats blocks, and configuration is written by commands on
+	 * this thread only, so formatting never holds the TX mixer's lock.
+	 */
+	mtx_lock(ctx->mutex);
+	call_count = list_count(&ctx->callers);
+	bypass_tx = ctx->bypass_caller != NULL;
+	bypass_rx = ctx->bypass_source != NULL;
+	if (ctx->trunk) {
+		str_ncpy(trunk_name, ctx->trunk->name, sizeof(trunk_name));
+		trunk_stream = ctx->trunk_stream;
+	}
+	mtx_unlock(ctx->mutex);
+
+	err = stat_scratch_take(&stat_srcs, &source_index, ctx->mutex,
+				&ctx->sources);
+	if (err) {
+		mem_deref(ctx);
+		return command_error(pf, params.argv[0],
+				     "stat-allocation-failed", err);
+	}
+	sourcev = (struct ms_source **)stat_srcs.v;
+
+	ms_sched_stat(&sstat);
+	ms_slab_stat(&slab);
+	ms_context_footprint(ctx, &fp);
+	ports_used = ms_port_pool_used();
+
+	err = re_hprintf(
+		pf,
+		"{\"key\":\"%s\",\"state\":\"open\",\"calls\":%zu,"
+		"\"mixMode\":\"%s\",\"mixLocalCallers\":%s,"
+		"\"bitrateBps\":%d,\"ptimeMs\":%u,\"telemetryIntervalMs\":%u,"
+		"\"levelHysteresisDb\":%.1f,"
+		"\"bypass\":{\"tx\":%s,\"rx\":%s},"
+		"\"tx\":%H,\"clocks\":%H,"
+		"\"sched\":{\"policy\":\"%s\",\"priority\":%d,"
+		"\"cpus\":\"%s\",\"threadsApplied\":%u,"
+		"\"threadsFailed\":%u},"
+		"\"memory\":{\"contextBytes\":%zu,\"sourceBytes\":%zu,"
+		"\"callerBytes\":%zu,\"perCallBytes\":%zu,"
+		"\"slab\":{\"inUseBytes\":%zu,\"chunkBytes\":%zu,"
+		"\"hugeBytes\":%zu}},"
+		"\"trunk\":{\"joined\":%s,\"name\":\"%s\",\"stream\":%u},"
+		"\"rxSourceCount\":%zu,"
+		"\"ports\":{\"inUse\":%zu,\"capacity\":%zu,"
+		"\"purpose\":\"remote-receive\","
+		"\"txConsumesPool\":false},"
+		"\"telemetry\":%H,\"sources\":[",
+		ctx->key, call_count,
+		ctx->mix_local_callers ? "party-line" : "isolated",
+		ctx->mix_local_callers ? "true" : "false",
+		ctx->bitrate_bps, ctx->ptime, ctx->telemetry_ms,
+		ctx->hysteresis_db,
+		bypass_tx ? "true" : "false", bypass_rx ? "true" : "false",
+		print_tx_stat, ctx, print_clocks_stat, ctx,
+		sstat.policy, sstat.priority, sstat.cpus, sstat.applied,
+		sstat.failed,
+		fp.context_bytes, fp.source_bytes, fp.caller_bytes,
+		(fp.context_bytes + fp.source_bytes + fp.caller_bytes) /
+		MAX(call_count, (size_t)1),
+		slab.in_use_bytes, slab.chunk_bytes, slab.huge_bytes,
+		trunk_name[0] ? "true" : "false", trunk_name, trunk_stream,
+		source_index, ports_used, ms_port_pool.count,
+		print_telemetry_stat, NULL);
+
+	for (i = 0; !err && i < source_index; ++i) {
+		if (i)
+			err = re_hprintf(pf, ",");
+		if (!err)
+			err = print_source_stat(pf, sourcev[i]);
+	}
+	if (!err)
+		err = re_hprintf(pf, "]}");
+
+	stat_scratch_release(&stat_srcs, source_index);
+	mem_deref(ctx);
+	return err;
+}
+
+
+enum stat_section {
+	STAT_STATE,
+	STAT_TX,
+	STAT_CLOCKS,
+	STAT_SOURCES,
+};
+
+struct stat_query {
+	struct mbuf *mb;          /* one formatted section */
+	uint64_t generation;
+	uint64_t since;
+	bool full;
+};
+
+struct stat_sources {
+	struct ms_source **sourcev;
+	size_t sourcec;
+};
+
+/* Bumped by every ms_bridge_stat_all; main thread only. */
+static uint64_t stat_generation;
+
+
+static uint64_t stat_digest(const struct mbuf *mb)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < mb->end; ++i) {
+		hash ^= mb->buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+
+/*
+ * Decide whether a section goes into the response and if so format it
+ * into the query's buffer.  state_h prints what is compared: a section
+ * whose state differs from the last query is stamped with this query's
+ * generation, and delta mode includes the sections stamped after the
+ * caller's generation.  The state holds configuration and counters, so a
+ * section shows up when traffic moved its counters and an idle one drops
+ * out.  Levels and timings only change with the counters and are left
+ * out; they are current whenever their section is sent.
+ */
+static bool stat_section(struct stat_query *q, uint64_t *digest,
+			 uint64_t *generation, re_printf_h *state_h,
+			 re_printf_h *h, void *arg, int *err)
+{
+	uint64_t value;
+
+	mbuf_reset(q->mb);
+	*err = mbuf_printf(q->mb, "%H", state_h, arg);
+	if (*err)
+		return false;
+
+	value = stat_digest(q->mb);
+	if (value != *digest) {
+		*digest = value;
+		*generation = q->generation;
+	}
+
+	if (!q->full && *generation <= q->since)
+		return false;
+
+	if (h == state_h)
+		return true;
+
+	mbuf_reset(q->mb);
+	*err = mbuf_printf(q->mb, "%H", h, arg);
+
+	return *err == 0;
+}
+
+
+/* Configuration and call-dependent state of a context */
+static int print_ctx_state(struct re_printf *pf, void *arg)
+{
+	struct ms_context *ctx = arg;
+	char trunk_name[MS_KEY_SIZE] = "";
+	unsigned trunk_stream = 0;
+	size_t call_count;
+	bool bypass_tx;
+	bool bypass_rx;
+
+	mtx_lock(ctx->mutex);
+	call_count = list_count(&ctx->callers);
+	bypass_tx = ctx->bypass_caller != NULL;
+	bypass_rx = ctx->bypass_source != NULL;
+	if (ctx->trunk) {
+		str_ncpy(trunk_name, ctx->trunk->name, sizeof(trunk_name));
+		trunk_stream = ctx->trunk_stream;
+	}
+	mtx_unlock(ctx->mutex);
+
+	return re_hprintf(
+		pf,
+		"{\"calls\":%zu,\"mixMode\":\"%s\",\"mixLocalCallers\":%s,"
+		"\"bitrateBps\":%d,\"ptimeMs\":%u,\"telemetryIntervalMs\":%u,"
+		"\"levelHysteresisDb\":%.1f,"
+		"\"bypass\":{\"tx\":%s,\"rx\":%s},"
+		"\"trunk\":{\"joined\":%s,\"name\":\"%s\",\"stream\":%u}}",
+		call_count, ctx->mix_local_callers ? "party-line" : "isolated",
+		ctx->mix_local_callers ? "true" : "false",
+		ctx->bitrate_bps, ctx->ptime, ctx->telemetry_ms,
+		ctx->hysteresis_db,
+		bypass_tx ? "true" : "false", bypass_rx ? "true" : "false",
+		trunk_name[0] ? "true" : "false", trunk_name, trunk_stream);
+}
+
+
+static int print_producer_ids(struct re_printf *pf, void *arg)
+{
+	const struct stat_sources *sources = arg;
+	size_t i;
+	int err;
+
+	err = re_hprintf(pf, "[");
+	for (i = 0; !err && i < sources->sourcec; ++i) {
+		err = re_hprintf(pf, "%s\"%s\"", i ? "," : "",
+				 sources->sourcev[i]->producer_id);
+	}
+	if (!err)
+		err = re_hprintf(pf, "]");
+
+	return err;
+}
+
+
+static int print_context_all(struct re_printf *pf, struct stat_query *q,
+			     struct ms_context *ctx)
+{
+	struct stat_sources sources;
+	bool first = true;
+	size_t i;
+	int err;
+
+	err = stat_scratch_take(&stat_srcs, &sources.sourcec, ctx->mutex,
+				&ctx->sources);
+	if (err)
+		return err;
+	sources.sourcev = (struct ms_source **)stat_srcs.v;
+
+	err = re_hprintf(pf, "{\"key\":\"%s\"", ctx->key);
+
+	if (!err && stat_section(q, &ctx->stat_digestv[STAT_STATE],
+				 &ctx->stat_generationv[STAT_STATE],
+				 print_ctx_state, print_ctx_state, ctx, &err))
+		err = re_hprintf(pf, ",\"state\":%b", q->mb->buf, q->mb->end);
+
+	if (!err && stat_section(q, &ctx->stat_digestv[STAT_TX],
+				 &ctx->stat_generationv[STAT_TX],
+				 print_tx_state, print_tx_stat, ctx, &err))
+		err = re_hprintf(pf, ",\"tx\":%b", q->mb->buf, q->mb->end);
+
+	if (!err && stat_section(q, &ctx->stat_digestv[STAT_CLOCKS],
+				 &ctx->stat_generationv[STAT_CLOCKS],
+				 print_clocks_state, print_clocks_stat, ctx,
+				 &err))
+		err = re_hprintf(pf, ",\"clocks\":%b", q->mb->buf,
+				 q->mb->end);
+
+	if (!err && stat_section(q, &ctx->stat_digestv[STAT_SOURCES],
+				 &ctx->stat_generationv[STAT_SOURCES],
+				 print_producer_ids, print_producer_ids,
+				 &sources, &err))
+		err = re_hprintf(pf, ",\"producerIds\":%b", q->mb->buf,
+				 q->mb->end);
+
+	if (!err)
+		err = re_hprintf(pf, ",\"sources\":[");
+
+	for (i = 0; !err && i < sources.sourcec; ++i) {
+		struct ms_source *src = sources.sourcev[i];
+
+		if (!stat_section(q, &src->stat_digest, &src->stat_generation,
+				  source_state_handler, source_stat_handler,
+				  src, &err))
+			continue;
+
+		err = re_hprintf(pf, "%s%b", first ? "" : ",", q->mb->buf,
+				 q->mb->end);
+		first = false;
+	}
+	if (!err)
+		err = re_hprintf(pf, "]}");
+
+	stat_scratch_release(&stat_srcs, sources.sourcec);
+	return err;
+}
+
+
+/*
+ * ms_bridge_stat_all [since=<generation>]
+ *
+ * Every open context in one response.  Each response carries a
+ * generation; passing it back as since= returns every context key but
+ * only the sections and sources that changed after that response.
+ */
+static int cmd_bridge_stat_all(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	struct command_params params;
+	struct ms_context **ctxv;
+	struct stat_query q;
+	const char *value;
+	size_t ctx_index = 0;
+	bool since_set = false;
+	size_t i;
+	int err;
+
+	memset(&q, 0, sizeof(q));
+
+	if (carg && str_isset(carg->prm)) {
+		err = parse_params(&params, arg, 1, 1);
+		if (err)
+			return command_error(pf, "", "invalid-parameters", err);
+
+		value = option_value(params.argv[0], "since");
+		if (!value || parse_u64(value, &q.since))
+			return command_error(pf, "", "invalid-since", EINVAL);
+		since_set = true;
+	}
+
+	q.generation = ++stat_generation;
+
+	/* A generation from before a module reload cannot be a baseline. */
+	q.full = !since_set || q.since >= q.generation;
+
+	if (!stat_mb)
+		stat_mb = mbuf_alloc(512);
+	if (!stat_mb)
+		return command_error(pf, "", "stat-allocation-failed", ENOMEM);
+	q.mb = stat_mb;
+
+	err = stat_scratch_take(&stat_ctxs, &ctx_index, ms_contexts_mutex,
+				&ms_contexts);
+	if (err)
+		return command_error(pf, "", "stat-allocation-failed", err);
+	ctxv = (struct ms_context **)stat_ctxs.v;
+
+	err = re_hprintf(pf,
+			 "{\"generation\":%llu,\"full\":%s,"
+			 "\"ports\":{\"inUse\":%zu,\"capacity\":%zu},"
+			 "\"telemetry\":%H,\"contexts\":[",
+			 (unsigned long long)q.generation,
+			 q.full ? "true" : "false", ms_port_pool_used(),
+			 ms_port_pool.count, print_telemetry_stat, NULL);
+
+	for (i = 0; !err && i < ctx_index; ++i) {
+		if (i)
+			err = re_hprintf(pf, ",");
+		if (!err)
+			err = print_context_all(pf, &q, ctxv[i]);
+	}
+	if (!err)
+		err = re_hprintf(pf, "]}");
+
+	stat_scratch_release(&stat_ctxs, ctx_index);
+	return err;
+}
+
+
+/*
+ * ms_ctx_loopback <key> [duration=<ms>] [interval=<ms>] [ptime=<ms>]
+ *                 [bitrate=<bps>]
+ * ms_ctx_loopback <key> status|stop
+ *
+ * Every form answers with the run's report; a finished run also emits it
+ * as MS_LOOPBACK.
+ */
+static int cmd_ctx_loopback(struct re_printf *pf, void *arg)
+{
+	struct command_params params;
+	struct ms_loopback_prm prm = {
+		.duration_ms = MS_LOOPBACK_MS,
+		.interval_ms = MS_LOOPBACK_MARK_MS,
+	};
+	const char *key;
+	const char *value;
+	uint32_t bitrate = 0;
+	size_t i;
+	int err;
+
+	err = parse_params(&params, arg, 1, 5);
+	if (err)
+		return command_error(pf, "", "invalid-parameters", err);
+
+	key = params.argv[0];
+	if (!ms_valid_identifier(key, MS_KEY_SIZE))
+		return command_error(pf, key, "invalid-key", EINVAL);
+
+	if (params.argc == 2 && (!str_cmp(params.argv[1], "status") ||
+				 !str_cmp(params.argv[1], "stop"))) {
+		if (!str_cmp(params.argv[1], "stop"))
+			(void)ms_loopback_stop(key);
+
+		err = ms_loopback_print(pf, key);
+		if (err == ENOENT)
+			return command_error(pf, key, "loopback-not-found",
+					     err);
+		return err;
+	}
+
+	for (i = 1; i < params.argc; ++i) {
+		if ((value = option_value(params.argv[i], "duration"))) {
+			err = parse_u32(value, &prm.duration_ms);
+			if (err || !prm.duration_ms ||
+			    prm.duration_ms > MS_LOOPBACK_MAX_MS)
+				return command_error(pf, key,
+						     "invalid-duration",
+						     EINVAL);
+		}
+		else if ((value = option_value(params.argv[i], "interval"))) {
+			err = parse_u32(value, &prm.interval_ms);
+			if (err || prm.interval_ms < MS_LOOPBACK_MARK_MIN_MS ||
+			    prm.interval_ms > MS_LOOPBACK_MARK_MAX_MS)
+				return command_error(pf, key,
+						     "invalid-interval",
+						     EINVAL);
+		}
+		else if ((value = option_value(params.argv[i], "ptime"))) {
+			err = parse_u32(value, &prm.ptime);
+			if (err || !ms_valid_ptime(prm.ptime))
+				return command_error(pf, key, "invalid-ptime",
+						     EINVAL);
+		}
+		else if ((value = option_value(params.argv[i], "bitrate"))) {
+			err = parse_u32(value, &bitrate);
+			if (err || bitrate < MS_BITRATE_MIN ||
+			    bitrate > MS_BITRATE_MAX)
+				return command_error(pf, key,
+						     "invalid-bitrate", EINVAL);
+		}
+		else {
+			return command_error(pf, key, "invalid-parameters",
+					     EINVAL);
+		}
+	}
+	prm.bitrate_bps = (int)bitrate;
+
+	err = ms_loopback_start(key, &prm);
+	if (err)
+		return command_error(pf, key,
+				     err == EEXIST ? "context-exists" :
+				     err == EALREADY ? "loopback-running" :
+				     "loopback-start-failed", err);
+
+	return ms_loopback_print(pf, key);
+}
+
+
+/*
+ * ms_trunk_open <name> <remoteIp> <remotePort> <pt> <ssrc> <streams>
+ *               [channels=1|2] [ptime=<ms>] [bitrate=<bps per stream>]
+ */
+static int cmd_trunk_open(struct re_printf *pf, void *arg)
+{
+	struct command_params params;
+	struct ms_trunk_config cfg;
+	struct ms_trunk *trunk = NULL;
+	uint32_t port = 0;
+	uint32_t pt = 0;
+	uint32_t bitrate = MS_BITRATE_DEFAULT;
+	const char *value;
+	bool created;
+	size_t i;
+	int err;
+
+	err = parse_params(&params, arg, 6, 9);
+	if (err)
+		return command_error(pf, "", "invalid-parameters", err);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.channels = MS_CHANNELS;
+	cfg.ptime = MS_PTIME_DEFAULT;
+
+	err  = parse_u32(params.argv[2], &port);
+	err |= parse_u32(params.argv[3], &pt);
+	err |= parse_u32(params.argv[4], &cfg.ssrc);
+	if (err || !port || port > UINT16_MAX || pt > 127 || !cfg.ssrc ||
+	    parse_remote(&cfg.remote, params.argv[1], params.argv[2]))
+		return command_error(pf, params.argv[0],
+				     "invalid-trunk-endpoint", EINVAL);
+	cfg.pt = (uint8_t)pt;
+
+	err = parse_u32(params.argv[5], &cfg.streams);
+	if (err || !cfg.streams || cfg.streams > MS_TRUNK_MAX_STREAMS)
+		return command_error(pf, params.argv[0],
+				     "invalid-trunk-streams", EINVAL);
+
+	for (i = 6; i < params.argc; ++i) {
+		if ((value = option_value(params.argv[i], "channels"))) {
+			err = parse_u32(value, &cfg.channels);
+			if (err || (cfg.channels != 1 && cfg.channels != 2))
+				return command_error(pf, params.argv[0],
+						     "invalid-channels",
+						     EINVAL);
+		}
+		else if ((value = option_value(params.argv[i], "ptime"))) {
+			err = parse_u32(value, &cfg.ptime);
+			if (err || !ms_valid_ptime(cfg.ptime))
+				return command_error(pf, params.argv[0],
+						     "invalid-ptime", EINVAL);
+		}
+		else if ((value = option_value(params.argv[i], "bitrate"))) {
+			err = parse_u32(value, &bitrate);
+			if (err || bitrate < MS_BITRATE_MIN ||
+			    bitrate > MS_BITRATE_MAX)
+				return command_error(pf, params.argv[0],
+						     "invalid-bitrate", EINVAL);
+		}
+		else {
+			return command_error(pf, params.argv[0],
+					     "invalid-parameters", EINVAL);
+		}
+	}
+	cfg.bitrate_bps = (int)bitrate;
+
+	err = ms_trunk_open(&trunk, params.argv[0], &cfg, &created);
+	if (err)
+		return command_error(pf, params.argv[0],
+				     err == EEXIST ? "trunk-layout-mismatch" :
+				     "trunk-open-failed", err);
+
+	err = re_hprintf(pf,
+			 "{\"trunk\":\"%s\",\"state\":\"open\","
+			 "\"changed\":%s,\"localPort\":%u,\"streams\":%u,"
+			 "\"channels\":%u,\"ptimeMs\":%u,\"bitrateBps\":%d}",
+			 trunk->name, created ? "true" : "false",
+			 trunk->local_port, trunk->cfg.streams,
+			 trunk->cfg.channels, trunk->cfg.ptime,
+			 trunk->cfg.bitrate_bps);
+	mem_deref(trunk);
+	return err;
+}
+
+
+static int cmd_trunk_close(struct re_printf *pf, void *arg)
+{
+	struct command_params params;
+	bool changed;
+	int err;
+
+	err = parse_params(&params, arg, 1, 1);
+	if (err)
+		return command_error(pf, "", "invalid-parameters", err);
+
+	err = ms_trunk_close(params.argv[0], &changed);
+	if (err)
+		return command_error(pf, params.argv[0],
+				     "trunk-close-failed", err);
+
+	return re_hprintf(pf,
+			  "{\"trunk\":\"%s\",\"state\":\"closed\","
+			  "\"changed\":%s}",
+			  params.argv[0], changed ? "true" : "false");
+}
+
+
+static const char *trunk_join_reason(int err)
+{
+	switch (err) {
+
+	case EBUSY:
+		return "trunk-member-busy";
+
+	case EADDRINUSE:
+		return "trunk-stream-in-use";
+
+	case EINVAL:
+		return "trunk-ptime-mismatch";
+
+	default:
+		return "trunk-join-failed";
+	}
+}
+
+
+/*
+ * ms_trunk_join <trunk> <key> <stream>
+ */
+static int cmd_trunk_join(struct re_printf *pf, void *arg)
+{
+	struct command_params params;
+	struct ms_context *ctx = NULL;
+	struct ms_trunk *trunk;
+	uint32_t stream = 0;
+	bool changed;
+	int err;
+
+	err = parse_params(&params, arg, 3, 3);
+	if (err)
+		return command_error(pf, "", "invalid-parameters", err);
+
+	trunk = ms_trunk_lookup(params.argv[0]);
+	if (!trunk)
+		return command_error(pf, params.argv[1], "trunk-not-found",
+				     ENOENT);
+
+	err = parse_u32(params.argv[2], &stream);
+	if (err || stream >= trunk->cfg.streams) {
+		mem_deref(trunk);
+		return command_error(pf, params.argv[1],
+				     "invalid-trunk-stream", EINVAL);
+	}
+
+	err = command_context(&ctx, pf, params.argv[1]);
+	if (err) {
+		mem_deref(trunk);
+		return err;
+	}
+
+	err = ms_trunk_join(trunk, ctx, stream, &changed);
+	if (err) {
+		err = command_error(pf, params.argv[1],
+				    trunk_join_reason(err), err);
+		goto out;
+	}
+
+	err = re_hprintf(pf,
+			 "{\"key\":\"%s\",\"trunk\":\"%s\",\"stream\":%u,"
+			 "\"changed\":%s}",
+			 ctx->key, trunk->name, stream,
+			 changed ? "true" : "false");
+
+out:
+	mem_deref(ctx);
+	mem_deref(trunk);
+	return err;
+}
+
+
+static int cmd_trunk_leave(struct re_printf *pf, void *arg)
+{
+	struct command_params params;
+	struct ms_context *ctx = NULL;
+	bool changed;
+	int err;
+
+	err = parse_params(&params, arg, 1, 1);
+	if (err)
+		return command_error(pf, "", "invalid-parameters", err);
+
+	err = command_context(&ctx, pf, params.argv[0]);
+	if (err)
+		return err;
+
+	changed = ms_trunk_leave(ctx);
+
+	err = re_hprintf(pf, "{\"key\":\"%s\",\"trunk\":null,"
+			 "\"changed\":%s}",
+			 ctx->key, changed ? "true" : "false");
+	mem_deref(ctx);
+	return err;
+}
+
+
+static int cmd_trunk_stat(struct re_printf *pf, void *arg)
+{
+	struct command_params params;
+	struct ms_trunk_stats stats;
+	struct ms_trunk *trunk;
+	char remote[64] = "";
+	bool first = true;
+	unsigned i;
+	int err;
+
+	err = parse_params(&params, arg, 1, 1);
+	if (err)
+		return command_error(pf, "", "invalid-parameters", err);
+
+	trunk = ms_trunk_lookup(params.argv[0]);
+	if (!trunk)
+		return command_error(pf, params.argv[0], "trunk-not-found",
+				     ENOENT);
+
+	ms_trunk_stats(trunk, &stats);
+	(void)sa_ntop(&trunk->cfg.remote, remote, sizeof(remote));
+
+	err = re_hprintf(
+		pf,
+		"{\"trunk\":\"%s\",\"localPort\":%u,\"remoteIp\":\"%s\","
+		"\"remotePort\":%u,\"payloadType\":%u,\"ssrc\":%u,"
+		"\"latchedSsrc\":%u,\"streams\":%u,\"channels\":%u,"
+		"\"ptimeMs\":%u,\"bitrateBps\":%d,"
+		"\"tx\":{\"packets\":%llu,\"bytes\":%llu,\"partial\":%llu,"
+		"\"errors\":%llu},"
+		"\"rx\":{\"packets\":%llu,\"bytes\":%llu,\"invalid\":%llu,"
+		"\"lost\":%llu,\"plcFrames\":%llu,\"decodeErrors\":%llu,"
+		"\"dispatchAvgUs\":%llu,\"dispatchMaxUs\":%u},"
+		"\"members\":[",
+		trunk->name, trunk->local_port, remote,
+		sa_port(&trunk->cfg.remote), trunk->cfg.pt, trunk->cfg.ssrc,
+		trunk->latched_ssrc, trunk->cfg.streams, trunk->cfg.channels,
+		trunk->cfg.ptime, trunk->cfg.bitrate_bps,
+		(unsigned long long)stats.tx_packets,
+		(unsigned long long)stats.tx_bytes,
+		(unsigned long long)stats.tx_partial,
+		(unsigned long long)stats.tx_errors,
+		(unsigned long long)stats.rx_packets,
+		(unsigned long long)stats.rx_bytes,
+		(unsigned long long)stats.rx_invalid,
+		(unsigned long long)stats.rx_lost,
+		(unsigned long long)stats.plc_frames,
+		(unsigned long long)stats.decode_errors,
+		(unsigned long long)(stats.dispatch_count ?
+				     stats.dispatch_us_sum /
+				     stats.dispatch_count : 0),
+		stats.dispatch_us_max);
+
+	/* Membership only changes on this thread. */
+	for (i = 0; !err && i < trunk->cfg.streams; ++i) {
+		const struct ms_context *ctx = trunk->memberv[i].ctx;
+
+		if (!ctx)
+			continue;
+
+		err = re_hprintf(pf, "%s{\"key\":\"%s\",\"stream\":%u}",
+				 first ? "" : ",", ctx->key, i);
+		first = false;
+	}
+	if (!err)
+		err = re_hprintf(pf, "]}");
+
+	mem_deref(trunk);
 	return err;
 }
 
@@ -537,8 +2069,25 @@ static const struct cmd commandv[] = {
 	 cmd_bridge_addsrc},
 	{"ms_bridge_delsrc", 0, CMD_PRM, "Remove a mediasoup RTP source",
 	 cmd_bridge_delsrc},
+	{"ms_bridge_apply", 0, CMD_PRM, "Apply a batch of bridge operations",
+	 cmd_bridge_apply},
 	{"ms_bridge_stat", 0, CMD_PRM, "Show mediasoup bridge statistics",
 	 cmd_bridge_stat},
+	{"ms_bridge_stat_all", 0, CMD_PRM,
+	 "Show statistics of all mediasoup bridge contexts",
+	 cmd_bridge_stat_all},
+	{"ms_ctx_loopback", 0, CMD_PRM,
+	 "Measure bridge latency over a local RTP loop", cmd_ctx_loopback},
+	{"ms_trunk_open", 0, CMD_PRM, "Open a mediasoup multistream trunk",
+	 cmd_trunk_open},
+	{"ms_trunk_close", 0, CMD_PRM, "Close a mediasoup multistream trunk",
+	 cmd_trunk_close},
+	{"ms_trunk_join", 0, CMD_PRM, "Carry a context through a trunk",
+	 cmd_trunk_join},
+	{"ms_trunk_leave", 0, CMD_PRM, "Return a context to its own RTP",
+	 cmd_trunk_leave},
+	{"ms_trunk_stat", 0, CMD_PRM, "Show mediasoup trunk statistics",
+	 cmd_trunk_stat},
 };
 
 
@@ -565,4 +2114,5 @@ void ms_commands_unregister(void)
 
 	cmd_unregister(baresip_commands(), commandv);
 	commands_registered = false;
+	stat_scratch_free();
 }
@@ -0,0 +1,182 @@
+/**
+ * @file drift.c Remote sender clock drift estimation and compensation
+ *
+ * The offset between local arrival time and the RTP timestamp (both in
+ * samples) is constant apart from network jitter if the two clocks agree.
+ * Taking the minimum offset of each two second window removes most of the
+ * jitter; the slope of those minima across up to 32 seconds is the drift.
+ * The resampler is linear interpolation, which is transparent at the
+ * sub-permille ratios involved.  This file has no libre dependency.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "drift.h"
+
+
+enum {
+	DRIFT_WINDOW_MS   = 2000,
+	DRIFT_MIN_WINDOWS = 4,
+	DRIFT_RESET_MS    = 1000,
+};
+
+
+void ms_drift_init(struct ms_drift *d, uint32_t srate)
+{
+	if (!d)
+		return;
+
+	memset(d, 0, sizeof(*d));
+	d->srate = srate;
+	d->pos = -1.0;
+}
+
+
+static void drift_restart(struct ms_drift *d, uint32_t rtp_ts,
+			  uint64_t now_us)
+{
+	const uint32_t srate = d->srate;
+	const double pos = d->pos;
+	int16_t last[MS_DRIFT_MAX_CH];
+
+	/* Only the estimator restarts; keep the resampler continuous. */
+	memcpy(last, d->last, sizeof(last));
+	ms_drift_init(d, srate);
+	memcpy(d->last, last, sizeof(last));
+	d->pos = pos;
+
+	d->started = true;
+	d->last_ts = rtp_ts;
+	d->base_us = now_us;
+}
+
+
+/**
+ * Feed one received RTP packet into the estimator
+ *
+ * @param d       Drift state
+ * @param rtp_ts  RTP timestamp of the packet
+ * @param now_us  Local arrival time in microseconds
+ */
+void ms_drift_update(struct ms_drift *d, uint32_t rtp_ts, uint64_t now_us)
+{
+	struct ms_drift_window *oldest;
+	struct ms_drift_window *newest;
+	int64_t local;
+	int64_t offset;
+	int64_t window;
+	int64_t reset;
+	int32_t step;
+
+	if (!d || !d->srate)
+		return;
+
+	window = (int64_t)d->srate * DRIFT_WINDOW_MS / 1000;
+	reset = (int64_t)d->srate * DRIFT_RESET_MS / 1000;
+
+	if (!d->started || now_us < d->base_us) {
+		drift_restart(d, rtp_ts, now_us);
+		return;
+	}
+
+	step = (int32_t)(rtp_ts - d->last_ts);
+	if (step > reset || step < -reset) {
+		/* A timestamp jump (new talk spurt source, sender restart). */
+		drift_restart(d, rtp_ts, now_us);
+		return;
+	}
+
+	d->last_ts = rtp_ts;
+	d->rtp += step;
+	local = (int64_t)((now_us - d->base_us) * d->srate / 1000000);
+	offset = local - d->rtp;
+
+	if (d->winc && offset - d->winv[d->winc - 1].min_offset > reset) {
+		/* The sender paused without advancing its timestamps. */
+		drift_restart(d, rtp_ts, now_us);
+		return;
+	}
+
+	if (d->rtp == 0 || d->rtp - d->win_start < window) {
+		if (d->rtp == 0 || offset < d->win_min)
+			d->win_min = offset;
+		return;
+	}
+
+	if (d->winc == MS_DRIFT_WINDOWS) {
+		memmove(&d->winv[0], &d->winv[1],
+			(MS_DRIFT_WINDOWS - 1) * sizeof(d->winv[0]));
+		--d->winc;
+	}
+	d->winv[d->winc].min_offset = d->win_min;
+	d->winv[d->winc].rtp = d->rtp;
+	++d->winc;
+	d->win_start = d->rtp;
+	d->win_min = offset;
+
+	if (d->winc < DRIFT_MIN_WINDOWS)
+		return;
+
+	oldest = &d->winv[0];
+	newest = &d->winv[d->winc - 1];
+
+	/* A shrinking offset means the sender's clock runs fast. */
+	d->ppm = -(double)(newest->min_offset - oldest->min_offset) * 1e6 /
+		 (double)(newest->rtp - oldest->rtp);
+	d->locked = fabs(d->ppm) <= MS_DRIFT_MAX_PPM;
+}
+
+
+/**
+ * Resample one decoded chunk by the current drift estimate
+ *
+ * @param d           Drift state
+ * @param dst         Output buffer (interleaved)
+ * @param dst_frames  Output capacity in frames; frames + 2 is always enough
+ * @param src         Input samples (interleaved)
+ * @param frames      Number of input frames
+ * @param ch          Channel count
+ *
+ * @return Number of output frames
+ */
+size_t ms_drift_resample(struct ms_drift *d, int16_t *dst, size_t dst_frames,
+			 const int16_t *src, size_t frames, unsigned ch)
+{
+	const double end = (double)frames - 1.0;
+	double step;
+	double p;
+	size_t out = 0;
+	unsigned c;
+
+	if (!d || !dst || !src || !frames || !ch || ch > MS_DRIFT_MAX_CH)
+		return 0;
+
+	step = d->locked ? 1.0 + d->ppm * 1e-6 : 1.0;
+	p = d->pos;
+
+	/* Position -1 is the last frame of the previous chunk. */
+	while (p < end && out < dst_frames) {
+		const double fl = floor(p);
+		const long i = (long)fl;
+		const double t = p - fl;
+
+		for (c = 0; c < ch; ++c) {
+			const double a = i < 0 ? d->last[c] : src[i * ch + c];
+			const double b = src[(i + 1) * ch + c];
+
+			dst[out * ch + c] = (int16_t)lrint(a + (b - a) * t);
+		}
+
+		++out;
+		p += step;
+	}
+
+	for (c = 0; c < ch; ++c)
+		d->last[c] = src[(frames - 1) * ch + c];
+	d->pos = p - (double)frames;
+	if (d->pos < -1.0)
+		d->pos = -1.0;
+
+	return out;
+}
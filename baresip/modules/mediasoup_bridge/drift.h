@@ -0,0 +1,58 @@
+/**
+ * @file drift.h Remote sender clock drift estimation and compensation
+ *
+ * Each RX source is clocked by its remote sender while the RX mixer runs on
+ * the local clock.  The estimator compares RTP timestamps with local arrival
+ * time; the resampler stretches or squeezes decoded audio by that ratio so
+ * the mixer's input buffer neither grows nor drains over long calls.
+ */
+
+#ifndef MS_DRIFT_H
+#define MS_DRIFT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	MS_DRIFT_WINDOWS   = 16,
+	MS_DRIFT_MAX_CH    = 2,
+};
+
+#define MS_DRIFT_MAX_PPM (1000.0)
+
+
+struct ms_drift_window {
+	int64_t min_offset;
+	int64_t rtp;
+};
+
+
+struct ms_drift {
+	uint32_t srate;
+
+	/* Estimator, fed from the RTP receive path */
+	bool started;
+	uint32_t last_ts;
+	int64_t rtp;
+	uint64_t base_us;
+	int64_t win_start;
+	int64_t win_min;
+	struct ms_drift_window winv[MS_DRIFT_WINDOWS];
+	unsigned winc;
+	double ppm;
+	bool locked;
+
+	/* Resampler, fed from the decode path */
+	double pos;
+	int16_t last[MS_DRIFT_MAX_CH];
+};
+
+
+void ms_drift_init(struct ms_drift *d, uint32_t srate);
+void ms_drift_update(struct ms_drift *d, uint32_t rtp_ts, uint64_t now_us);
+size_t ms_drift_resample(struct ms_drift *d, int16_t *dst, size_t dst_frames,
+			 const int16_t *src, size_t frames, unsigned ch);
+
+#endif
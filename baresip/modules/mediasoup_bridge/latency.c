@@ -0,0 +1,127 @@
+/**
+ * @file latency.c Latency samples and test markers for loopback runs
+ *
+ * Percentiles use the nearest-rank method over the retained samples.  This
+ * file has no libre dependency.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+
+
+void ms_lat_add(struct ms_lat_series *s, uint64_t us)
+{
+	if (!s)
+		return;
+
+	s->v[s->next] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+	s->next = (s->next + 1) % MS_LAT_SAMPLES;
+	if (s->count < MS_LAT_SAMPLES)
+		++s->count;
+}
+
+
+static int u32_cmp(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+static uint32_t rank(const uint32_t *sorted, size_t count, unsigned pct)
+{
+	size_t n = (count * pct + 99) / 100;
+
+	return sorted[n ? n - 1 : 0];
+}
+
+
+void ms_lat_summarise(const struct ms_lat_series *s,
+		      struct ms_lat_summary *sum)
+{
+	uint32_t sorted[MS_LAT_SAMPLES];
+
+	if (!sum)
+		return;
+
+	memset(sum, 0, sizeof(*sum));
+	if (!s || !s->count)
+		return;
+
+	/* Until the ring wraps, the samples are its first count slots. */
+	memcpy(sorted, s->v, s->count * sizeof(*sorted));
+	qsort(sorted, s->count, sizeof(*sorted), u32_cmp);
+
+	sum->count  = s->count;
+	sum->min_us = sorted[0];
+	sum->p50_us = rank(sorted, s->count, 50);
+	sum->p90_us = rank(sorted, s->count, 90);
+	sum->p99_us = rank(sorted, s->count, 99);
+	sum->max_us = sorted[s->count - 1];
+}
+
+
+/**
+ * Write a marker burst over a whole frame
+ *
+ * The tone starts at its crest, so the first sample already crosses the
+ * detection threshold.
+ *
+ * @param sampv   Interleaved samples
+ * @param frames  Samples per channel
+ * @param ch      Channel count
+ * @param srate   Sample rate
+ */
+void ms_lat_marker(int16_t *sampv, size_t frames, unsigned ch,
+		   uint32_t srate)
+{
+	const double step = 2.0 * M_PI * MS_LAT_MARK_HZ / srate;
+	size_t i;
+	unsigned c;
+
+	if (!sampv || !ch || !srate)
+		return;
+
+	for (i = 0; i < frames; ++i) {
+		const int16_t v = (int16_t)lrint(MS_LAT_MARK_AMP *
+						 cos(step * (double)i));
+
+		for (c = 0; c < ch; ++c)
+			sampv[i * ch + c] = v;
+	}
+}
+
+
+/**
+ * Find the first frame whose amplitude reaches the marker threshold
+ *
+ * @param sampv   Interleaved samples
+ * @param frames  Samples per channel
+ * @param ch      Channel count
+ * @param frame   Returned frame index of the onset
+ *
+ * @return true if the frame holds a marker onset
+ */
+bool ms_lat_onset(const int16_t *sampv, size_t frames, unsigned ch,
+		  size_t *frame)
+{
+	size_t i;
+
+	if (!sampv || !ch)
+		return false;
+
+	for (i = 0; i < frames * ch; ++i) {
+		if (abs(sampv[i]) >= MS_LAT_THRESHOLD) {
+			if (frame)
+				*frame = i / ch;
+			return true;
+		}
+	}
+
+	return false;
+}
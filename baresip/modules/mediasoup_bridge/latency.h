@@ -0,0 +1,53 @@
+/**
+ * @file latency.h Latency samples and test markers for loopback runs
+ *
+ * A marker is a burst of tone written into otherwise silent audio.  Its
+ * onset survives Opus coding well enough to be found again by a simple
+ * amplitude threshold, which lets a loopback run time the same audio at
+ * each stage of the bridge.  Stage latencies are kept in a bounded series
+ * and summarised as percentiles.
+ */
+
+#ifndef MS_LATENCY_H
+#define MS_LATENCY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	MS_LAT_SAMPLES   = 512,
+	MS_LAT_MARK_HZ   = 1000,
+	MS_LAT_MARK_AMP  = 12000,
+	MS_LAT_THRESHOLD = 4000,
+};
+
+
+/* Ring of the most recent latency samples, in microseconds. */
+struct ms_lat_series {
+	uint32_t v[MS_LAT_SAMPLES];
+	size_t count;
+	size_t next;
+};
+
+
+struct ms_lat_summary {
+	size_t count;
+	uint32_t min_us;
+	uint32_t p50_us;
+	uint32_t p90_us;
+	uint32_t p99_us;
+	uint32_t max_us;
+};
+
+
+void ms_lat_add(struct ms_lat_series *s, uint64_t us);
+void ms_lat_summarise(const struct ms_lat_series *s,
+		      struct ms_lat_summary *sum);
+void ms_lat_marker(int16_t *sampv, size_t frames, unsigned ch,
+		   uint32_t srate);
+bool ms_lat_onset(const int16_t *sampv, size_t frames, unsigned ch,
+		  size_t *frame);
+
+#endif
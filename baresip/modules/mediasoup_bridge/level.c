@@ -0,0 +1,271 @@
+/**
+ * @file level.c Integer sum-of-squares and peak kernels
+ *
+ * One pass over a frame produces the exact integer energy and the absolute
+ * peak.  SSE2 is the x86-64 baseline, AVX2 is picked at load time when the
+ * CPU has it, NEON is used on AArch64 and a scalar loop covers the rest.
+ * This file has no libre dependency so the benchmark can link it directly.
+ */
+
+#include <math.h>
+
+#include "level.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MS_LEVEL_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MS_LEVEL_NEON 1
+#endif
+
+
+typedef void (level_kernel_h)(struct ms_level *lvl, const int16_t *sampv,
+			      size_t sampc);
+
+
+static void level_tail(struct ms_level *lvl, const int16_t *sampv,
+		       size_t sampc, uint64_t sum, int peak)
+{
+	size_t i;
+
+	for (i = 0; i < sampc; ++i) {
+		const int32_t s = sampv[i];
+		const int a = s < 0 ? -s : s;
+
+		sum += (uint64_t)(s * s);
+		if (a > peak)
+			peak = a;
+	}
+
+	lvl->sum_sq = sum;
+	lvl->peak = (uint16_t)peak;
+}
+
+
+static void level_scalar(struct ms_level *lvl, const int16_t *sampv,
+			 size_t sampc)
+{
+	level_tail(lvl, sampv, sampc, 0, 0);
+}
+
+
+#ifdef MS_LEVEL_X86
+/*
+ * _mm_madd_epi16 of a vector with itself yields pairwise square sums of up
+ * to 2^31, which only fits unsigned; the lanes are zero-extended to 64 bit
+ * before accumulation.
+ */
+__attribute__((target("sse2")))
+static void level_sse2(struct ms_level *lvl, const int16_t *sampv,
+		       size_t sampc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	__m128i vmax = _mm_setzero_si128();
+	__m128i vmin = _mm_setzero_si128();
+	int16_t maxv[8];
+	int16_t minv[8];
+	uint64_t sum[2];
+	size_t i = 0;
+	int peak = 0;
+	int k;
+
+	for (; i + 8 <= sampc; i += 8) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		const __m128i sq = _mm_madd_epi16(v, v);
+
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+		vmax = _mm_max_epi16(vmax, v);
+		vmin = _mm_min_epi16(vmin, v);
+	}
+
+	_mm_storeu_si128((__m128i *)sum, acc);
+	_mm_storeu_si128((__m128i *)maxv, vmax);
+	_mm_storeu_si128((__m128i *)minv, vmin);
+	for (k = 0; k < 8; ++k) {
+		if (maxv[k] > peak)
+			peak = maxv[k];
+		if (-minv[k] > peak)
+			peak = -minv[k];
+	}
+
+	level_tail(lvl, &sampv[i], sampc - i, sum[0] + sum[1], peak);
+}
+
+
+__attribute__((target("avx2")))
+static void level_avx2(struct ms_level *lvl, const int16_t *sampv,
+		       size_t sampc)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = _mm256_setzero_si256();
+	__m256i vmax = _mm256_setzero_si256();
+	__m256i vmin = _mm256_setzero_si256();
+	int16_t maxv[16];
+	int16_t minv[16];
+	uint64_t sum[4];
+	size_t i = 0;
+	int peak = 0;
+	int k;
+
+	for (; i + 16 <= sampc; i += 16) {
+		const __m256i v =
+			_mm256_loadu_si256((const __m256i *)&sampv[i]);
+		const __m256i sq = _mm256_madd_epi16(v, v);
+
+		acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(sq, zero));
+		acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(sq, zero));
+		vmax = _mm256_max_epi16(vmax, v);
+		vmin = _mm256_min_epi16(vmin, v);
+	}
+
+	_mm256_storeu_si256((__m256i *)sum, acc);
+	_mm256_storeu_si256((__m256i *)maxv, vmax);
+	_mm256_storeu_si256((__m256i *)minv, vmin);
+	for (k = 0; k < 16; ++k) {
+		if (maxv[k] > peak)
+			peak = maxv[k];
+		if (-minv[k] > peak)
+			peak = -minv[k];
+	}
+
+	level_tail(lvl, &sampv[i], sampc - i,
+		   sum[0] + sum[1] + sum[2] + sum[3], peak);
+}
+#endif
+
+
+#ifdef MS_LEVEL_NEON
+static void level_neon(struct ms_level *lvl, const int16_t *sampv,
+		       size_t sampc)
+{
+	int64x2_t acc = vdupq_n_s64(0);
+	int16x8_t vmax = vdupq_n_s16(0);
+	int16x8_t vmin = vdupq_n_s16(0);
+	size_t i = 0;
+	int peak;
+
+	for (; i + 8 <= sampc; i += 8) {
+		const int16x8_t v = vld1q_s16(&sampv[i]);
+		const int16x4_t lo = vget_low_s16(v);
+		const int16x4_t hi = vget_high_s16(v);
+
+		/* A single square is at most 2^30 and fits int32. */
+		acc = vpadalq_s32(acc, vmull_s16(lo, lo));
+		acc = vpadalq_s32(acc, vmull_s16(hi, hi));
+		vmax = vmaxq_s16(vmax, v);
+		vmin = vminq_s16(vmin, v);
+	}
+
+	peak = vmaxvq_s16(vmax);
+	if (-(int)vminvq_s16(vmin) > peak)
+		peak = -(int)vminvq_s16(vmin);
+
+	level_tail(lvl, &sampv[i], sampc - i,
+		   (uint64_t)(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1)),
+		   peak);
+}
+#endif
+
+
+#if defined(MS_LEVEL_X86)
+static level_kernel_h *kernel = level_sse2;
+static const char *kernel_name = "sse2";
+#elif defined(MS_LEVEL_NEON)
+static level_kernel_h *kernel = level_neon;
+static const char *kernel_name = "neon";
+#else
+static level_kernel_h *kernel = level_scalar;
+static const char *kernel_name = "scalar";
+#endif
+
+
+/**
+ * Select the widest kernel the CPU supports.  Call once at load time,
+ * before any audio thread runs; until then the baseline kernel is used.
+ */
+void ms_level_init(void)
+{
+#ifdef MS_LEVEL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernel = level_avx2;
+		kernel_name = "avx2";
+	}
+#endif
+	(void)level_scalar;
+}
+
+
+const char *ms_level_kernel(void)
+{
+	return kernel_name;
+}
+
+
+/**
+ * Measure the energy and absolute peak of one frame
+ *
+ * @param lvl    Level to overwrite
+ * @param sampv  Interleaved 16-bit samples
+ * @param sampc  Number of samples
+ */
+void ms_level_measure(struct ms_level *lvl, const int16_t *sampv,
+		      size_t sampc)
+{
+	if (!lvl)
+		return;
+
+	lvl->sampc = sampv ? (uint32_t)sampc : 0;
+	if (!lvl->sampc) {
+		lvl->sum_sq = 0;
+		lvl->peak = 0;
+		return;
+	}
+
+	kernel(lvl, sampv, sampc);
+}
+
+
+/**
+ * Add one measured frame to a level accumulated over several
+ *
+ * @param acc Accumulated level
+ * @param lvl Level of the frame
+ */
+void ms_level_add(struct ms_level *acc, const struct ms_level *lvl)
+{
+	if (!acc || !lvl)
+		return;
+
+	acc->sum_sq += lvl->sum_sq;
+	acc->sampc  += lvl->sampc;
+	if (lvl->peak > acc->peak)
+		acc->peak = lvl->peak;
+}
+
+
+double ms_level_dbfs(const struct ms_level *lvl)
+{
+	double rms;
+
+	if (!lvl || !lvl->sampc)
+		return MS_DBFS_FLOOR;
+
+	rms = sqrt((double)lvl->sum_sq / (double)lvl->sampc);
+	if (rms < 1.0)
+		return MS_DBFS_FLOOR;
+
+	return 20.0 * log10(rms / 32768.0);
+}
+
+
+double ms_level_peak_dbfs(const struct ms_level *lvl)
+{
+	if (!lvl || !lvl->peak)
+		return MS_DBFS_FLOOR;
+
+	return 20.0 * log10((double)lvl->peak / 32768.0);
+}
@@ -0,0 +1,34 @@
+/**
+ * @file level.h Integer level metering for bridge TX and RX audio
+ *
+ * Audio threads only accumulate the integer energy and peak of their
+ * frames; the conversion to dBFS is done by whoever reads the level
+ * (telemetry and statistics), which runs far less often than the 20 ms
+ * frame clock.
+ */
+
+#ifndef MS_LEVEL_H
+#define MS_LEVEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MS_DBFS_FLOOR    (-96.0)
+
+
+struct ms_level {
+	uint64_t sum_sq;
+	uint32_t sampc;
+	uint16_t peak;
+};
+
+
+void ms_level_init(void);
+const char *ms_level_kernel(void);
+void ms_level_measure(struct ms_level *lvl, const int16_t *sampv,
+		      size_t sampc);
+void ms_level_add(struct ms_level *acc, const struct ms_level *lvl);
+double ms_level_dbfs(const struct ms_level *lvl);
+double ms_level_peak_dbfs(const struct ms_level *lvl);
+
+#endif
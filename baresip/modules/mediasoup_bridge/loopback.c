@@ -0,0 +1,612 @@
+/**
+ * @file loopback.c Loopback latency measurement for bridge contexts
+ *
+ * A loopback run opens a private context and closes its RTP path on
+ * itself: TX is sent over localhost to one of the context's own RX
+ * sources.  A pair of device halves opened through baresip's audio driver
+ * lists stands in for the SIP call.  Their playback half writes a marker
+ * burst into otherwise silent audio (SIP in), and their capture half
+ * receives the decoded result (SIP out).  The same marker is timed at the
+ * encoder, on the receive socket and after decoding, so each stage of the
+ * bridge gets its own latency percentiles.  Nothing leaves the host.
+ *
+ * Runs, their results and the ctx->loopback pointer belong to the main
+ * thread.  Mark state is also touched by the mixer threads that drive
+ * the device halves and the encoder, and is guarded by lb->mutex.
+ */
+
+#include <string.h>
+
+#include "mediasoup_bridge.h"
+
+
+enum {
+	LB_PT        = 111,
+	LB_MAX_RUNS  = 8,
+	LB_DEVICE_SIZE = MS_KEY_SIZE + MS_CALL_TOKEN_SIZE + 1,
+};
+
+static const char lb_producer[] = "loopback";
+
+
+enum lb_state {
+	LB_RUNNING,
+	LB_DONE,
+	LB_STOPPED,
+};
+
+
+/* Points where the current mark has been seen, in path order. */
+enum lb_point {
+	LB_SIP_IN,
+	LB_RTP_OUT,
+	LB_RTP_IN,
+	LB_DECODED,
+	LB_POINTS,
+};
+
+
+enum lb_stage {
+	LB_CAPTURE,
+	LB_NETWORK,
+	LB_JITTER,
+	LB_PLAYOUT,
+	LB_TOTAL,
+	LB_STAGES,
+};
+
+
+static const char *stage_namev[LB_STAGES] = {
+	"sipInToRtpOut",
+	"rtpOutToRtpIn",
+	"rtpInToDecoded",
+	"decodedToSipOut",
+	"sipInToSipOut",
+};
+
+
+struct ms_loopback {
+	struct le le;
+	char key[MS_KEY_SIZE];
+	mtx_t *mutex;
+	struct tmr tmr;
+	struct ms_context *ctx;
+	struct auplay_st *play;
+	struct ausrc_st *rec;
+	enum lb_state state;
+	uint32_t ptime;
+	uint32_t interval_ms;
+	uint32_t duration_ms;
+	uint64_t started_ms;
+	uint64_t ended_ms;
+
+	/* Guarded by mutex */
+	uint32_t interval_frames;
+	uint32_t frame_count;
+	unsigned seen;                 /* points passed, as a prefix */
+	uint32_t rtp_ts;
+	uint64_t stampv[LB_POINTS];
+	uint64_t marks;
+	uint64_t completed;
+	uint64_t lost;
+	struct ms_lat_series stagev[LB_STAGES];
+};
+
+
+static struct list runs;
+
+
+static uint64_t elapsed(uint64_t from, uint64_t to)
+{
+	/* The receive stamp comes from the kernel and may sort first. */
+	return to > from ? to - from : 0;
+}
+
+
+static void loopback_addr(struct sa *addr, uint16_t port)
+{
+	if (sa_is_any(&ms_bind_addr)) {
+		(void)sa_set_str(addr, sa_af(&ms_bind_addr) == AF_INET6
+				 ? "::1" : "127.0.0.1", port);
+	}
+	else {
+		*addr = ms_bind_addr;
+		sa_set_port(addr, port);
+	}
+}
+
+
+/* SIP in: the call side hands its next frame to the bridge. */
+static void loopback_write_handler(struct auframe *af, void *arg)
+{
+	struct ms_loopback *lb = arg;
+	const uint64_t now = tmr_jiffies_usec();
+
+	mtx_lock(lb->mutex);
+	if (++lb->frame_count % lb->interval_frames == 0) {
+		if (lb->seen)
+			++lb->lost;
+
+		/* The device half zeroed the frame; mark all of it. */
+		ms_lat_marker(af->sampv, af->sampc / MS_CHANNELS, MS_CHANNELS,
+			      MS_SRATE);
+		lb->seen = 1u << LB_SIP_IN;
+		lb->stampv[LB_SIP_IN] = now;
+		++lb->marks;
+	}
+	mtx_unlock(lb->mutex);
+}
+
+
+/* SIP out: the bridge hands a decoded frame to the call side. */
+static void loopback_read_handler(struct auframe *af, void *arg)
+{
+	struct ms_loopback *lb = arg;
+	const uint64_t now = tmr_jiffies_usec();
+	const uint64_t *t = lb->stampv;
+	uint64_t out_us;
+	size_t onset;
+
+	mtx_lock(lb->mutex);
+	if (lb->seen != (1u << LB_POINTS) - 1 ||
+	    !ms_lat_onset(af->sampv, af->sampc / MS_CHANNELS, MS_CHANNELS,
+			  &onset)) {
+		mtx_unlock(lb->mutex);
+		return;
+	}
+
+	/* The onset is played onset samples into the frame. */
+	out_us = now + (uint64_t)onset * 1000000 / MS_SRATE;
+
+	ms_lat_add(&lb->stagev[LB_CAPTURE],
+		   elapsed(t[LB_SIP_IN], t[LB_RTP_OUT]));
+	ms_lat_add(&lb->stagev[LB_NETWORK],
+		   elapsed(t[LB_RTP_OUT], t[LB_RTP_IN]));
+	ms_lat_add(&lb->stagev[LB_JITTER],
+		   elapsed(t[LB_RTP_IN], t[LB_DECODED]));
+	ms_lat_add(&lb->stagev[LB_PLAYOUT], elapsed(t[LB_DECODED], out_us));
+	ms_lat_add(&lb->stagev[LB_TOTAL], elapsed(t[LB_SIP_IN], out_us));
+	++lb->completed;
+	lb->seen = 0;
+	mtx_unlock(lb->mutex);
+}
+
+
+/* Advance the mark past point if it is the next one to be seen. */
+static bool mark_advance(struct ms_loopback *lb, enum lb_point point,
+			 uint64_t now)
+{
+	if (lb->seen != (1u << point) - 1)
+		return false;
+
+	lb->seen |= 1u << point;
+	lb->stampv[point] = now;
+	return true;
+}
+
+
+/**
+ * Time an encoded TX frame about to be sent
+ *
+ * Called from the TX clock with ctx->mutex held.
+ *
+ * @param lb      Loopback run
+ * @param sampv   Frame that was encoded
+ * @param sampc   Number of samples
+ * @param rtp_ts  RTP timestamp the packet is sent with
+ */
+void ms_loopback_tx(struct ms_loopback *lb, const int16_t *sampv,
+		    size_t sampc, uint32_t rtp_ts)
+{
+	const uint64_t now = tmr_jiffies_usec();
+
+	mtx_lock(lb->mutex);
+	if (lb->seen == 1u << LB_SIP_IN &&
+	    ms_lat_onset(sampv, sampc / MS_CHANNELS, MS_CHANNELS, NULL)) {
+		(void)mark_advance(lb, LB_RTP_OUT, now);
+		lb->rtp_ts = rtp_ts;
+	}
+	mtx_unlock(lb->mutex);
+}
+
+
+/**
+ * Time a received RTP packet (main thread)
+ *
+ * @param lb          Loopback run
+ * @param rtp_ts      RTP timestamp of the packet
+ * @param arrival_us  Arrival time from ms_rtp_arrival()
+ */
+void ms_loopback_rx(struct ms_loopback *lb, uint32_t rtp_ts,
+		    uint64_t arrival_us)
+{
+	mtx_lock(lb->mutex);
+	if (rtp_ts == lb->rtp_ts)
+		(void)mark_advance(lb, LB_RTP_IN, arrival_us);
+	mtx_unlock(lb->mutex);
+}
+
+
+/**
+ * Time a decoded RTP packet (main thread)
+ *
+ * @param lb      Loopback run
+ * @param rtp_ts  RTP timestamp of the packet
+ */
+void ms_loopback_decoded(struct ms_loopback *lb, uint32_t rtp_ts)
+{
+	const uint64_t now = tmr_jiffies_usec();
+
+	mtx_lock(lb->mutex);
+	if (rtp_ts == lb->rtp_ts)
+		(void)mark_advance(lb, LB_DECODED, now);
+	mtx_unlock(lb->mutex);
+}
+
+
+static int print_summary(struct re_printf *pf, void *arg)
+{
+	const struct ms_lat_summary *sum = arg;
+
+	return re_hprintf(pf,
+			  "{\"count\":%zu,\"minUs\":%u,\"p50Us\":%u,"
+			  "\"p90Us\":%u,\"p99Us\":%u,\"maxUs\":%u}",
+			  sum->count, sum->min_us, sum->p50_us,
+			  sum->p90_us, sum->p99_us, sum->max_us);
+}
+
+
+static int print_run(struct re_printf *pf, void *arg)
+{
+	static const char *statev[] = {"running", "done", "stopped"};
+	const struct ms_loopback *lb = arg;
+	struct ms_lat_summary sumv[LB_STAGES];
+	uint64_t marks;
+	uint64_t completed;
+	uint64_t lost;
+	uint64_t end_ms;
+	size_t i;
+	int err;
+
+	mtx_lock(lb->mutex);
+	marks = lb->marks;
+	completed = lb->completed;
+	lost = lb->lost;
+	for (i = 0; i < LB_STAGES; ++i)
+		ms_lat_summarise(&lb->stagev[i], &sumv[i]);
+	mtx_unlock(lb->mutex);
+
+	end_ms = lb->state == LB_RUNNING ? tmr_jiffies() : lb->ended_ms;
+	err = re_hprintf(pf,
+			 "{\"key\":\"%s\",\"state\":\"%s\",\"ptimeMs\":%u,"
+			 "\"intervalMs\":%u,\"durationMs\":%u,"
+			 "\"elapsedMs\":%llu,\"marks\":%llu,"
+			 "\"completed\":%llu,\"lost\":%llu,\"stages\":{",
+			 lb->key, statev[lb->state], lb->ptime,
+			 lb->interval_ms, lb->duration_ms,
+			 (unsigned long long)(end_ms - lb->started_ms),
+			 (unsigned long long)marks,
+			 (unsigned long long)completed,
+			 (unsigned long long)lost);
+
+	for (i = 0; i < LB_STAGES; ++i) {
+		err |= re_hprintf(pf, "%s\"%s\":%H", i ? "," : "",
+				  stage_namev[i], print_summary, &sumv[i]);
+	}
+
+	err |= re_hprintf(pf, "}}");
+	return err;
+}
+
+
+/*
+ * Release the device halves and the private context.  The results stay
+ * with the run until it is replaced or the module closes.
+ */
+static void loopback_teardown(struct ms_loopback *lb)
+{
+	struct ms_context *current;
+
+	tmr_cancel(&lb->tmr);
+
+	/* The handlers stop with their device halves. */
+	lb->rec = mem_deref(lb->rec);
+	lb->play = mem_deref(lb->play);
+
+	if (!lb->ctx)
+		return;
+
+	mtx_lock(lb->ctx->mutex);
+	if (lb->ctx->loopback == lb)
+		lb->ctx->loopback = NULL;
+	mtx_unlock(lb->ctx->mutex);
+
+	/* Someone may have closed the key and opened another under it. */
+	current = ms_context_lookup(lb->key);
+	if (current == lb->ctx)
+		(void)ms_context_close(lb->key, NULL);
+	mem_deref(current);
+
+	lb->ctx = mem_deref(lb->ctx);
+}
+
+
+static void loopback_destructor(void *arg)
+{
+	struct ms_loopback *lb = arg;
+
+	list_unlink(&lb->le);
+	loopback_teardown(lb);
+	lb->mutex = mem_deref(lb->mutex);
+}
+
+
+static void loopback_finish(struct ms_loopback *lb, enum lb_state state)
+{
+	if (lb->state != LB_RUNNING)
+		return;
+
+	loopback_teardown(lb);
+	lb->state = state;
+	lb->ended_ms = tmr_jiffies();
+
+	module_event("mediasoup_bridge", "MS_LOOPBACK", NULL, NULL, "%H",
+		     print_run, lb);
+	info("mediasoup_bridge: loopback '%s' finished, %llu of %llu marks\n",
+	     lb->key, (unsigned long long)lb->completed,
+	     (unsigned long long)lb->marks);
+}
+
+
+static void loopback_timeout(void *arg)
+{
+	loopback_finish(arg, LB_DONE);
+}
+
+
+static struct ms_loopback *loopback_find(const char *key)
+{
+	struct le *le;
+
+	for (le = runs.head; le; le = le->next) {
+		struct ms_loopback *lb = le->data;
+
+		if (!str_cmp(lb->key, key))
+			return lb;
+	}
+
+	return NULL;
+}
+
+
+/* Make room for a new run: drop the key's last result and old ones. */
+static int runs_prune(const char *key)
+{
+	struct ms_loopback *lb = loopback_find(key);
+	struct le *le;
+
+	if (lb && lb->state == LB_RUNNING)
+		return EALREADY;
+	mem_deref(lb);
+
+	le = runs.head;
+	while (le && list_count(&runs) >= LB_MAX_RUNS) {
+		lb = le->data;
+		le = le->next;
+		if (lb->state != LB_RUNNING)
+			mem_deref(lb);
+	}
+
+	return list_count(&runs) < LB_MAX_RUNS ? 0 : EBUSY;
+}
+
+
+/* Source and TX socket of the context, sending to each other. */
+static int loopback_rtp(struct ms_context *ctx)
+{
+	struct ms_source *src = NULL;
+	const uint32_t ssrc = rand_u32() | 1;
+	struct sa addr;
+	uint16_t tx_port;
+	int err;
+
+	err = ms_source_reserve(ctx, lb_producer, &src, NULL);
+	if (err)
+		return err;
+
+	loopback_addr(&addr, src->local_port);
+	err = ms_tx_configure(ctx, &addr, LB_PT, ssrc, NULL);
+	if (err)
+		goto out;
+
+	mtx_lock(ctx->mutex);
+	tx_port = ctx->tx_local_port;
+	mtx_unlock(ctx->mutex);
+
+	loopback_addr(&addr, tx_port);
+	err = ms_source_activate(src, &addr, LB_PT, ssrc, NULL);
+
+out:
+	mem_deref(src);
+	return err;
+}
+
+
+static int loopback_configure(struct ms_context *ctx,
+			      const struct ms_loopback_prm *prm)
+{
+	struct ms_ctx_config cfg;
+
+	mtx_lock(ctx->mutex);
+	cfg.mix_local_callers = ctx->mix_local_callers;
+	cfg.bitrate_bps = prm->bitrate_bps ? prm->bitrate_bps
+					   : ctx->bitrate_bps;
+	cfg.ptime = prm->ptime ? prm->ptime : ctx->ptime;
+	cfg.telemetry_ms = ctx->telemetry_ms;
+	cfg.hysteresis_db = ctx->hysteresis_db;
+	mtx_unlock(ctx->mutex);
+
+	return ms_context_configure(ctx, &cfg, NULL);
+}
+
+
+static int loopback_devices(struct ms_loopback *lb)
+{
+	struct auplay_prm play_prm = {
+		.srate = MS_SRATE,
+		.ch    = MS_CHANNELS,
+		.ptime = lb->ptime,
+		.fmt   = AUFMT_S16LE,
+	};
+	struct ausrc_prm src_prm = {
+		.srate = MS_SRATE,
+		.ch    = MS_CHANNELS,
+		.ptime = lb->ptime,
+		.fmt   = AUFMT_S16LE,
+	};
+	char device[LB_DEVICE_SIZE];
+	int err;
+
+	/* A call token of its own, as a real call would have. */
+	if (re_snprintf(device, sizeof(device),
+			"%s|%016llx%016llx%016llx%016llx", lb->key,
+			(unsigned long long)rand_u64(),
+			(unsigned long long)rand_u64(),
+			(unsigned long long)rand_u64(),
+			(unsigned long long)rand_u64()) < 0)
+		return EOVERFLOW;
+
+	err = auplay_alloc(&lb->play, baresip_auplayl(), "mediasoup",
+			   &play_prm, device, loopback_write_handler, lb);
+	if (err)
+		return err;
+
+	return ausrc_alloc(&lb->rec, baresip_ausrcl(), "mediasoup", &src_prm,
+			   device, loopback_read_handler, NULL, lb);
+}
+
+
+/**
+ * Start a loopback run on a new private context
+ *
+ * @param key  Context key; must not name an open context
+ * @param prm  Run parameters
+ *
+ * @return 0 if running, EEXIST if the context is open, EALREADY if a run
+ *         with this key is still going, otherwise an errno
+ */
+int ms_loopback_start(const char *key, const struct ms_loopback_prm *prm)
+{
+	struct ms_loopback *lb;
+	struct ms_context *ctx;
+	bool created;
+	int err;
+
+	if (!prm || !ms_valid_identifier(key, MS_KEY_SIZE))
+		return EINVAL;
+
+	ctx = ms_context_lookup(key);
+	if (ctx) {
+		mem_deref(ctx);
+		return EEXIST;
+	}
+
+	err = runs_prune(key);
+	if (err)
+		return err;
+
+	lb = mem_zalloc(sizeof(*lb), loopback_destructor);
+	if (!lb)
+		return ENOMEM;
+
+	str_ncpy(lb->key, key, sizeof(lb->key));
+	tmr_init(&lb->tmr);
+	lb->interval_ms = prm->interval_ms;
+	lb->duration_ms = prm->duration_ms;
+	lb->started_ms = tmr_jiffies();
+	list_append(&runs, &lb->le, lb);
+
+	err = mutex_alloc(&lb->mutex);
+	if (err)
+		goto out;
+
+	err = ms_context_get_or_create(&lb->ctx, key, &created);
+	if (err)
+		goto out;
+	if (!created) {
+		err = EEXIST;
+		lb->ctx = mem_deref(lb->ctx);
+		goto out;
+	}
+
+	err = loopback_configure(lb->ctx, prm);
+	if (err)
+		goto out;
+
+	mtx_lock(lb->ctx->mutex);
+	lb->ptime = lb->ctx->ptime;
+	lb->interval_frames = MAX(1u, lb->interval_ms / lb->ptime);
+	lb->ctx->loopback = lb;
+	mtx_unlock(lb->ctx->mutex);
+
+	err = loopback_rtp(lb->ctx);
+	if (err)
+		goto out;
+
+	err = loopback_devices(lb);
+	if (err)
+		goto out;
+
+	tmr_start(&lb->tmr, lb->duration_ms, loopback_timeout, lb);
+	info("mediasoup_bridge: loopback '%s' started, ptime %u ms\n",
+	     key, lb->ptime);
+
+out:
+	if (err)
+		mem_deref(lb);
+	return err;
+}
+
+
+/**
+ * End a loopback run early, keeping its results
+ *
+ * @param key  Context key of the run
+ *
+ * @return 0 or ENOENT
+ */
+int ms_loopback_stop(const char *key)
+{
+	struct ms_loopback *lb = loopback_find(key);
+
+	if (!lb)
+		return ENOENT;
+
+	loopback_finish(lb, LB_STOPPED);
+	return 0;
+}
+
+
+/**
+ * Print the state and stage latencies of a loopback run as JSON
+ *
+ * @param pf   Print handler
+ * @param key  Context key of the run
+ *
+ * @return 0, ENOENT if there is no run with that key, or a print error
+ */
+int ms_loopback_print(struct re_printf *pf, const char *key)
+{
+	struct ms_loopback *lb = loopback_find(key);
+
+	if (!lb)
+		return ENOENT;
+
+	return re_hprintf(pf, "%H", print_run, lb);
+}
+
+
+void ms_loopback_close(void)
+{
+	list_flush(&runs);
+}
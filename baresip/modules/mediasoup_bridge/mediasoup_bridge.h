@@ -10,13 +10,19 @@
 #include <baresip.h>
 #include <opus/opus.h>
 
+#include "stats.h"
+#include "drift.h"
+#include "trunk_codec.h"
+#include "latency.h"
+#include "../meter_shm.h"
+
 
 enum {
 	MS_SRATE             = 48000,
 	MS_CHANNELS          = 2,
-	MS_PTIME             = 20,
-	MS_FRAME_SAMP_PER_CH = MS_SRATE * MS_PTIME / 1000,
-	MS_FRAME_SAMPC       = MS_FRAME_SAMP_PER_CH * MS_CHANNELS,
+	MS_PTIME_DEFAULT     = 20,
+	MS_PTIME_MAX         = 60,
+	MS_FRAME_SAMPC_MAX   = MS_SRATE * MS_PTIME_MAX / 1000 * MS_CHANNELS,
 	MS_OPUS_MAX_PACKET   = 4000,
 	MS_OPUS_MAX_FRAME    = 5760,
 	MS_KEY_SIZE          = 128,
@@ -25,22 +31,41 @@ enum {
 	MS_PRODUCER_SIZE     = 128,
 	MS_ERROR_SIZE        = 96,
 	MS_TELEMETRY_MS      = 200,
+	MS_TELEMETRY_MIN_MS  = 50,
+	MS_TELEMETRY_MAX_MS  = 5000,
 	MS_KEEPALIVE_MS      = 1000,
+	MS_KEEPALIVE_BATCH   = 8,
 	MS_ACTIVITY_HOLD_MS  = 400,
 	MS_PROBE_INTERVAL_MS = 15,
 	MS_BITRATE_DEFAULT   = 64000,
 	MS_BITRATE_MIN       = 6000,
 	MS_BITRATE_MAX       = 510000,
+	MS_TRUNK_MAX_PAYLOAD = 1200,
+	MS_TICK_LATE_US      = 2000,
+	MS_STALL_MS          = 100,
+	MS_RX_DIRECT_PTIMES  = 2,
+	MS_WATCHDOG_MS       = MS_STALL_MS / 2,
+	MS_DISPATCH_MAX_US   = 1000000,
+	MS_SLAB_CLASSES      = 5,
+	MS_STAT_SECTIONS     = 4,
+	MS_LOOPBACK_MS       = 10000,
+	MS_LOOPBACK_MAX_MS   = 600000,
+	MS_LOOPBACK_MARK_MS  = 500,
+	MS_LOOPBACK_MARK_MIN_MS = 200,
+	MS_LOOPBACK_MARK_MAX_MS = 10000,
 };
 
 #define MS_ACTIVITY_DBFS (-60.0)
-#define MS_DBFS_FLOOR    (-96.0)
+#define MS_HYSTERESIS_DEFAULT_DB (1.0)
+#define MS_HYSTERESIS_MAX_DB     (20.0)
 #define MS_PORT_NONE     ((size_t)-1)
 
 
 struct ms_context;
 struct ms_caller;
 struct ms_source;
+struct ms_trunk;
+struct ms_loopback;
 
 
 struct ms_port_pool {
@@ -81,8 +106,38 @@ struct auplay_st {
 };
 
 
+enum ms_clock_id {
+	MS_CLOCK_TX,
+	MS_CLOCK_RX,
+	MS_CLOCKS,
+};
+
+
+/*
+ * One mixer clock of a context: the TX encode tick, and the RX mixer's
+ * caller callbacks.  last_us is 0 while the clock is not measured.
+ */
+struct ms_clock {
+	atomic_uint_fast64_t last_us;  /* previous tick */
+	struct ms_clock_stats_block stats;
+	uint64_t silent_since_ms;      /* main thread: watchdog state */
+	uint64_t stalls;
+	bool stalled;
+};
+
+
+struct ms_ctx_config {
+	bool mix_local_callers;
+	int bitrate_bps;
+	uint32_t ptime;           /* 0 keeps the current ptime */
+	uint32_t telemetry_ms;
+	double hysteresis_db;
+};
+
+
 struct ms_caller {
 	struct le le;
+	struct ms_context *ctx;  /* valid while its mixer sources run */
 	mtx_t *mutex;
 	struct ausrc_st *src;
 	struct auplay_st *play;
@@ -93,6 +148,10 @@ struct ms_caller {
 	bool mix_local_callers;
 	bool attached;
 	bool stopped;
+	bool tx_direct;
+	bool rx_bypass;          /* the lone RX source may deliver directly */
+	bool rx_direct;          /* it does; the RX mixer only fills gaps */
+	uint64_t rx_direct_us;   /* time of the last direct frame */
 };
 
 
@@ -105,27 +164,25 @@ struct ms_source {
 	struct jbuf *jbuf;
 	struct aumix_source *mix_source;
 	OpusDecoder *decoder;
-	int16_t *decode_buf;
+	int16_t *decode_buf;           /* slab, decode_frames per channel */
+	int16_t *resample_buf;         /* decode_buf after drift correction */
+	uint32_t decode_frames;
+	struct ms_drift drift;
 	struct tmr decode_tmr;
 	size_t pool_index;
 	uint16_t local_port;
 	uint8_t pt;
 	uint32_t expected_ssrc;
-	uint32_t latched_ssrc;
 	uint16_t last_seq;
+	uint32_t plc_samp_per_ch;
 	bool seq_set;
 	bool active;
 	bool decode_started;
-	uint64_t last_rx_ms;
 	uint64_t last_probe_ms;
-	uint64_t rx_packets;
-	uint64_t rx_bytes;
-	uint64_t rx_invalid;
-	uint64_t rx_lost;
-	uint64_t plc_frames;
-	uint64_t decode_errors;
-	double level_dbfs;
-	uint64_t telemetry_ms;
+	size_t tm_slot;                /* telemetry registry index */
+	struct ms_rx_stats_block rx_stats;
+	uint64_t stat_digest;          /* ms_bridge_stat_all, main thread */
+	uint64_t stat_generation;
 };
 
 
@@ -138,6 +195,12 @@ struct ms_context {
 	struct aumix *rx_mix;
 	struct aumix_source *tx_sink;
 	struct list callers;
+	atomic_uint caller_count;
+	struct ms_caller *bypass_caller;
+	struct ms_source *bypass_source;
+	struct ms_trunk *trunk;        /* replaces the context's own TX */
+	struct ms_loopback *loopback;  /* main thread writes under mutex */
+	unsigned trunk_stream;
 	struct list sources;
 	OpusEncoder *encoder;
 	struct rtp_sock *tx_rtp;
@@ -148,26 +211,148 @@ struct ms_context {
 	uint32_t tx_ssrc;
 	uint16_t tx_seq;
 	uint32_t tx_timestamp;
+	struct ms_clock clockv[MS_CLOCKS];
 	uint64_t tx_socket_generation;
 	bool tx_ready;
 	bool tx_muted;
 	bool mix_local_callers;
 	bool closing;
 	int bitrate_bps;
+	uint32_t ptime;                /* fixed while callers are attached */
+	uint32_t frame_samp_per_ch;
+	size_t frame_sampc;
+	uint32_t telemetry_ms;
+	double hysteresis_db;
+	struct ms_tx_stats_block tx_stats;
+	char last_error[MS_ERROR_SIZE];
+	int last_errno;
+	atomic_uint_fast64_t error_generation;
+	uint64_t error_emitted_generation;  /* telemetry pass */
+	size_t tm_slot;                /* telemetry registry index */
+	uint64_t stat_digestv[MS_STAT_SECTIONS];  /* ms_bridge_stat_all, */
+	uint64_t stat_generationv[MS_STAT_SECTIONS];  /* main thread */
+};
+
+
+struct ms_trunk_config {
+	struct sa remote;
+	uint8_t pt;
+	uint32_t ssrc;
+	unsigned streams;
+	unsigned channels;
+	uint32_t ptime;
+	int bitrate_bps;          /* per stream */
+};
+
+
+struct ms_trunk_member {
+	struct ms_context *ctx;       /* the context leaves before it is freed */
+	struct aumix_source *mix_source;
+	bool pending;                 /* has a frame in the next TX packet */
+};
+
+
+struct ms_trunk_stats {
 	uint64_t tx_packets;
 	uint64_t tx_bytes;
+	uint64_t tx_partial;
 	uint64_t tx_errors;
-	uint64_t tx_last_frame_ms;
-	double tx_level_dbfs;
-	bool tx_active_sent;
-	bool rx_active_sent;
-	bool telemetry_initialized;
-	uint64_t tx_telemetry_ms;
-	uint64_t rx_telemetry_ms;
-	char last_error[MS_ERROR_SIZE];
-	int last_errno;
-	uint64_t error_generation;
-	uint64_t error_emitted_generation;
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t rx_invalid;
+	uint64_t rx_lost;
+	uint64_t plc_frames;
+	uint64_t decode_errors;
+	uint64_t dispatch_count;       /* packets with a kernel stamp */
+	uint64_t dispatch_us_sum;
+	uint32_t dispatch_us_max;
+};
+
+
+/*
+ * The trunk list, RX state and membership changes belong to the main
+ * thread.  mutex guards the members and the TX gather, which member
+ * contexts' TX clocks drive while holding their ctx->mutex (lock order
+ * ctx->mutex, then trunk->mutex).
+ */
+struct ms_trunk {
+	struct le le;
+	char name[MS_KEY_SIZE];
+	mtx_t *mutex;
+	struct ms_trunk_config cfg;
+	struct ms_trunk_codec codec;
+	struct ms_trunk_member memberv[MS_TRUNK_MAX_STREAMS];
+	unsigned members;
+	unsigned pendingc;
+	uint32_t frame_samp_per_ch;
+	struct rtp_sock *rtp;
+	size_t pool_index;
+	uint16_t local_port;
+	struct mbuf *tx_mbuf;
+	uint16_t tx_seq;
+	uint32_t tx_timestamp;
+	struct jbuf *jbuf;
+	struct tmr decode_tmr;
+	int16_t *member_buf;
+	uint32_t latched_ssrc;
+	uint16_t last_seq;
+	bool seq_set;
+	bool decode_started;
+	struct ms_trunk_stats stats;
+};
+
+
+struct ms_loopback_prm {
+	uint32_t duration_ms;
+	uint32_t interval_ms;
+	uint32_t ptime;                /* 0 keeps the context default */
+	int bitrate_bps;               /* 0 keeps the context default */
+};
+
+
+struct ms_slab_class_stat {
+	size_t size;
+	size_t in_use;
+	size_t cached;
+	size_t peak;
+};
+
+
+struct ms_slab_stat {
+	struct ms_slab_class_stat classv[MS_SLAB_CLASSES];
+	size_t in_use_bytes;
+	size_t chunk_bytes;
+	size_t huge_bytes;
+};
+
+
+struct ms_footprint {
+	size_t context_bytes;
+	size_t source_bytes;
+	size_t caller_bytes;
+};
+
+
+struct ms_sched_stat {
+	const char *policy;
+	int priority;
+	const char *cpus;
+	unsigned applied;
+	unsigned failed;
+};
+
+
+struct ms_telemetry_stat {
+	size_t contexts;
+	size_t sources;
+	size_t context_capacity;
+	size_t source_capacity;
+	uint64_t generation;
+	uint64_t events;
+	uint64_t ticks;
+	uint64_t last_tick_us;
+	uint64_t max_tick_us;
+	uint64_t avg_tick_us;
 };
 
 
@@ -178,7 +363,7 @@ extern struct sa ms_bind_addr;
 
 
 bool ms_valid_identifier(const char *value, size_t max_len);
-double ms_level_dbfs(const int16_t *sampv, size_t sampc);
+bool ms_valid_ptime(uint32_t ptime);
 void ms_context_error(struct ms_context *ctx, const char *reason, int err);
 void ms_emit_error(const char *key, const char *reason, int err);
 
@@ -186,11 +371,14 @@ int ms_context_get_or_create(struct ms_context **ctxp, const char *key,
 			     bool *created);
 struct ms_context *ms_context_lookup(const char *key);
 int ms_context_close(const char *key, bool *changed);
-int ms_context_configure(struct ms_context *ctx, bool mix_local_callers,
-			 int bitrate_bps, bool *changed);
+int ms_context_configure(struct ms_context *ctx,
+			 const struct ms_ctx_config *cfg, bool *changed);
 int ms_context_audio_alloc(struct ms_context *ctx);
 void ms_context_audio_close(struct ms_context *ctx);
 void ms_context_detach_callers(struct ms_context *ctx);
+void ms_context_bypass_update(struct ms_context *ctx);
+bool ms_context_rx_direct(struct ms_source *src, const int16_t *sampv,
+			  size_t sampc);
 
 int ms_audio_register(void);
 void ms_audio_unregister(void);
@@ -198,6 +386,7 @@ size_t ms_audio_active_devices(void);
 
 int ms_tx_configure(struct ms_context *ctx, const struct sa *remote,
 		    uint8_t pt, uint32_t ssrc, bool *changed);
+void ms_tx_unconfigure(struct ms_context *ctx);
 int ms_tx_set_mute(struct ms_context *ctx, bool mute, bool *changed);
 
 int ms_port_pool_init(uint16_t first, uint16_t last);
@@ -208,6 +397,8 @@ int ms_rtp_socket_alloc(struct rtp_sock **rtpp, size_t *pool_index,
 int ms_rtp_socket_alloc_ephemeral(struct rtp_sock **rtpp, uint16_t *port,
 				  rtp_recv_h *recvh, void *arg);
 void ms_rtp_socket_release(struct rtp_sock **rtpp, size_t *pool_index);
+bool ms_rtp_arrival(struct rtp_sock *rtp, uint64_t *arrival_us,
+		    uint32_t *dispatch_us);
 int ms_send_probe(struct rtp_sock *rtp, const struct sa *remote,
 		  unsigned count);
 
@@ -217,9 +408,74 @@ struct ms_source *ms_source_find(struct ms_context *ctx,
 				 const char *producer_id);
 int ms_source_activate(struct ms_source *src, const struct sa *remote,
 		       uint8_t pt, uint32_t ssrc, bool *changed);
+void ms_source_deactivate(struct ms_source *src);
 int ms_source_remove(struct ms_context *ctx, const char *producer_id,
 		     bool *changed);
-void ms_source_keepalive(struct ms_source *src, uint64_t now);
+void ms_context_keepalive(struct ms_context *ctx, uint64_t now);
+void ms_source_inject(struct ms_source *src, const struct rtp_header *hdr,
+		      struct mbuf *mb);
+
+void ms_clock_tick(struct ms_clock *clk, uint32_t ptime, uint64_t now_us);
+void ms_clock_reset(struct ms_clock *clk);
+uint32_t ms_clock_bucket_us(unsigned bucket);
+void ms_context_watchdog(struct ms_context *ctx, uint64_t now);
+
+typedef void (ms_context_pass_h)(struct ms_context *ctx, uint64_t now);
+void ms_contexts_pass(ms_context_pass_h *passh, uint64_t now);
+
+int ms_trunk_open(struct ms_trunk **trunkp, const char *name,
+		  const struct ms_trunk_config *cfg, bool *created);
+struct ms_trunk *ms_trunk_lookup(const char *name);
+int ms_trunk_close(const char *name, bool *changed);
+void ms_trunk_close_all(void);
+int ms_trunk_join(struct ms_trunk *trunk, struct ms_context *ctx,
+		  unsigned stream, bool *changed);
+bool ms_trunk_leave(struct ms_context *ctx);
+void ms_trunk_send(struct ms_context *ctx, const int16_t *sampv,
+		   size_t frames);
+void ms_trunk_stats(struct ms_trunk *trunk, struct ms_trunk_stats *stats);
+
+int ms_telemetry_init(void);
+void ms_telemetry_close(void);
+int ms_telemetry_context_add(struct ms_context *ctx);
+void ms_telemetry_context_remove(struct ms_context *ctx);
+int ms_telemetry_source_add(struct ms_source *src);
+void ms_telemetry_source_remove(struct ms_source *src);
+uint64_t ms_telemetry_tick(uint64_t now);
+void ms_telemetry_stat(struct ms_telemetry_stat *stat);
+
+int ms_meter_shm_open(const char *path);
+void ms_meter_shm_close(void);
+bool ms_meter_shm_isopen(void);
+int ms_meter_shm_slot_alloc(void);
+void ms_meter_shm_slot_free(int slot);
+void ms_meter_shm_write(int slot, const char *key, const char *id,
+			uint32_t flags, double dbfs, uint64_t packets);
+void ms_meter_shm_commit(void);
+
+int ms_slab_init(void);
+void ms_slab_close(void);
+void *ms_slab_alloc(size_t size);
+void ms_slab_free(void *p);
+size_t ms_slab_size(const void *p);
+void ms_slab_stat(struct ms_slab_stat *stat);
+
+void ms_context_footprint(struct ms_context *ctx, struct ms_footprint *fp);
+size_t ms_source_footprint(const struct ms_source *src);
+
+void ms_sched_init(void);
+void ms_sched_thread_enter(void);
+void ms_sched_stat(struct ms_sched_stat *stat);
+
+int ms_loopback_start(const char *key, const struct ms_loopback_prm *prm);
+int ms_loopback_stop(const char *key);
+int ms_loopback_print(struct re_printf *pf, const char *key);
+void ms_loopback_close(void);
+void ms_loopback_tx(struct ms_loopback *lb, const int16_t *sampv,
+		    size_t sampc, uint32_t rtp_ts);
+void ms_loopback_rx(struct ms_loopback *lb, uint32_t rtp_ts,
+		    uint64_t arrival_us);
+void ms_loopback_decoded(struct ms_loopback *lb, uint32_t rtp_ts);
 
 int ms_commands_register(void);
 void ms_commands_unregister(void);
@@ -0,0 +1,225 @@
+/**
+ * @file meter_shm.c Shared-memory meter export, bridge section
+ *
+ * The meter file is shared with the vumeter_stereo module, which writes
+ * the call section; this writer owns the bridge section only.  The layout
+ * is in ../meter_shm.h.
+ *
+ * Every context has one slot for its TX level and every RX source one for
+ * its own.  Slots are written by the telemetry tick under the engine
+ * mutex, which also serializes allocating and freeing them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mediasoup_bridge.h"
+
+
+static struct {
+	int fd;
+	struct meter_shm_hdr *hdr;
+	struct meter_shm_slot *slotv;  /* the bridge section */
+	bool usedv[METER_SHM_BRIDGE];
+} shm = {.fd = -1};
+
+
+/**
+ * Map the meter file, creating or resizing it as needed
+ *
+ * @param path Path of the meter file, preferably on a tmpfs
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ms_meter_shm_open(const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+	int err;
+
+	if (!str_isset(path))
+		return EINVAL;
+
+	if (shm.hdr)
+		return EALREADY;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &st) ||
+	    (st.st_size != METER_SHM_SIZE && ftruncate(fd, METER_SHM_SIZE))) {
+		err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	map = mmap(NULL, METER_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (map == MAP_FAILED) {
+		err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	memset(shm.usedv, 0, sizeof(shm.usedv));
+	shm.fd    = fd;
+	shm.hdr   = map;
+	shm.slotv = (struct meter_shm_slot *)
+		((uint8_t *)map + METER_SHM_HDR_SIZE +
+		 METER_SHM_CALLS * METER_SHM_SLOT_SIZE);
+
+	/* Whatever the section holds is left over from an earlier run. */
+	meter_shm_hdr_init(shm.hdr);
+	memset(shm.slotv, 0, METER_SHM_BRIDGE * sizeof(*shm.slotv));
+
+	return 0;
+}
+
+
+/**
+ * Clear the bridge section and unmap the meter file
+ */
+void ms_meter_shm_close(void)
+{
+	if (!shm.hdr)
+		return;
+
+	memset(shm.slotv, 0, METER_SHM_BRIDGE * sizeof(*shm.slotv));
+	memset(shm.usedv, 0, sizeof(shm.usedv));
+	ms_meter_shm_commit();
+
+	(void)munmap(shm.hdr, METER_SHM_SIZE);
+	(void)close(shm.fd);
+
+	shm.hdr   = NULL;
+	shm.slotv = NULL;
+	shm.fd    = -1;
+}
+
+
+bool ms_meter_shm_isopen(void)
+{
+	return shm.hdr != NULL;
+}
+
+
+/**
+ * Take a free bridge slot
+ *
+ * @return Slot index, -1 if the file is not open or all slots are taken
+ */
+int ms_meter_shm_slot_alloc(void)
+{
+	int i;
+
+	if (!shm.hdr)
+		return -1;
+
+	for (i = 0; i < METER_SHM_BRIDGE; ++i) {
+		if (!shm.usedv[i]) {
+			shm.usedv[i] = true;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+ * Mark a bridge slot unused and give it back
+ *
+ * @param slot Slot index from ms_meter_shm_slot_alloc()
+ */
+void ms_meter_shm_slot_free(int slot)
+{
+	struct meter_shm_slot *s;
+
+	if (!shm.hdr || slot < 0 || slot >= METER_SHM_BRIDGE)
+		return;
+
+	s = &shm.slotv[slot];
+	meter_shm_slot_begin(s);
+	s->flags = 0;
+	meter_shm_slot_end(s);
+
+	shm.usedv[slot] = false;
+}
+
+
+static void copy_str(char *dst, const char *src, size_t size)
+{
+	const size_t len = MIN(str_len(src), size - 1);
+
+	memcpy(dst, src ? src : "", len);
+	memset(dst + len, 0, size - len);
+}
+
+
+/**
+ * Write the level of a context's TX or of one of its RX sources
+ *
+ * @param slot    Slot index from ms_meter_shm_slot_alloc()
+ * @param key     Context key
+ * @param id      Producer id of an RX source, NULL for the context TX
+ * @param flags   METER_SHM_* flags besides used and direction
+ * @param dbfs    Level in dBFS
+ * @param packets Packets sent or received
+ */
+void ms_meter_shm_write(int slot, const char *key, const char *id,
+			uint32_t flags, double dbfs, uint64_t packets)
+{
+	struct meter_shm_slot *s;
+
+	if (!shm.hdr || slot < 0 || slot >= METER_SHM_BRIDGE)
+		return;
+
+	s = &shm.slotv[slot];
+	meter_shm_slot_begin(s);
+
+	copy_str(s->key, key, sizeof(s->key));
+	copy_str(s->id, id, sizeof(s->id));
+	s->levelv[0] = (float)dbfs;
+	s->count     = (uint32_t)packets;
+	s->flags     = flags | METER_SHM_USED |
+		       (id ? METER_SHM_RX : METER_SHM_TX);
+
+	meter_shm_slot_end(s);
+}
+
+
+/**
+ * Publish one pass over the bridge
+ *
+ * Bumps the bridge section sequence and stamps it with the wall clock, so
+ * readers can tell fresh levels from the leftovers of a stopped writer.
+ * Readers only need to copy the slots below bridge_used.
+ */
+void ms_meter_shm_commit(void)
+{
+	struct timespec ts;
+	uint16_t used = METER_SHM_BRIDGE;
+
+	if (!shm.hdr)
+		return;
+
+	while (used && !shm.usedv[used - 1])
+		--used;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+
+	atomic_thread_fence(memory_order_release);
+	shm.hdr->bridge_used = used;
+	shm.hdr->bridge_ms = (uint64_t)ts.tv_sec * 1000 +
+			     (uint64_t)ts.tv_nsec / 1000000;
+	atomic_thread_fence(memory_order_release);
+	++shm.hdr->bridge_seq;
+}
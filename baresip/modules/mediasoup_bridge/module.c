@@ -4,7 +4,6 @@
 
 #include <ctype.h>
 #include <errno.h>
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -17,12 +16,14 @@ struct ms_port_pool ms_port_pool;
 struct sa ms_bind_addr;
 
 static struct tmr telemetry_tmr;
+static struct tmr watchdog_tmr;
 
 
 static void context_destructor(void *arg)
 {
 	struct ms_context *ctx = arg;
 
+	ms_telemetry_context_remove(ctx);
 	list_unlink(&ctx->le);
 
 	if (ctx->mutex) {
@@ -32,6 +33,7 @@ static void context_destructor(void *arg)
 	}
 
 	list_flush(&ctx->sources);
+	(void)ms_trunk_leave(ctx);
 	ms_context_detach_callers(ctx);
 	ctx->tx_rtp = mem_deref(ctx->tx_rtp);
 	ms_context_audio_close(ctx);
@@ -40,6 +42,13 @@ static void context_destructor(void *arg)
 }
 
 
+bool ms_valid_ptime(uint32_t ptime)
+{
+	/* Opus frame sizes that suit a realtime mix clock. */
+	return ptime == 10 || ptime == 20 || ptime == 40 || ptime == 60;
+}
+
+
 bool ms_valid_identifier(const char *value, size_t max_len)
 {
 	const unsigned char *p = (const unsigned char *)value;
@@ -62,28 +71,6 @@ bool ms_valid_identifier(const char *value, size_t max_len)
 }
 
 
-double ms_level_dbfs(const int16_t *sampv, size_t sampc)
-{
-	double sum = 0.0;
-	double rms;
-	size_t i;
-
-	if (!sampv || !sampc)
-		return MS_DBFS_FLOOR;
-
-	for (i = 0; i < sampc; ++i) {
-		const double sample = (double)sampv[i];
-		sum += sample * sample;
-	}
-
-	rms = sqrt(sum / (double)sampc);
-	if (rms < 1.0)
-		return MS_DBFS_FLOOR;
-
-	return 20.0 * log10(rms / 32768.0);
-}
-
-
 void ms_emit_error(const char *key, const char *reason, int err)
 {
 	module_event("mediasoup_bridge", "MS_CTX_ERROR", NULL, NULL,
@@ -131,7 +118,11 @@ static int context_alloc(struct ms_context **ctxp, const char *key)
 
 	ctx->mix_local_callers = true;
 	ctx->bitrate_bps = MS_BITRATE_DEFAULT;
-	ctx->tx_level_dbfs = MS_DBFS_FLOOR;
+	ctx->ptime = MS_PTIME_DEFAULT;
+	ctx->frame_samp_per_ch = MS_SRATE * MS_PTIME_DEFAULT / 1000;
+	ctx->frame_sampc = ctx->frame_samp_per_ch * MS_CHANNELS;
+	ctx->telemetry_ms = MS_TELEMETRY_MS;
+	ctx->hysteresis_db = MS_HYSTERESIS_DEFAULT_DB;
 	str_ncpy(ctx->key, key, sizeof(ctx->key));
 	list_init(&ctx->callers);
 	list_init(&ctx->sources);
@@ -194,6 +185,13 @@ int ms_context_get_or_create(struct ms_context **ctxp, const char *key,
 		return 0;
 	}
 
+	err = ms_telemetry_context_add(candidate);
+	if (err) {
+		mtx_unlock(ms_contexts_mutex);
+		mem_deref(candidate);
+		return err;
+	}
+
 	list_append(&ms_contexts, &candidate->le, candidate);
 	*ctxp = mem_ref(candidate);
 	mtx_unlock(ms_contexts_mutex);
@@ -245,6 +243,7 @@ int ms_context_close(const char *key, bool *changed)
 	ctx->closing = true;
 	mtx_unlock(ctx->mutex);
 	mtx_unlock(ms_contexts_mutex);
+	ms_telemetry_context_remove(ctx);
 
 	/* Release the list's ownership, then our temporary reference. */
 	mem_deref(ctx);
@@ -258,154 +257,22 @@ int ms_context_close(const char *key, bool *changed)
 }
 
 
-static bool source_is_active(const struct ms_source *src, uint64_t now)
-{
-	return src->active && src->last_rx_ms &&
-	       now - src->last_rx_ms <= MS_ACTIVITY_HOLD_MS &&
-	       src->level_dbfs > MS_ACTIVITY_DBFS;
-}
-
-
-static void telemetry_context(struct ms_context *ctx, uint64_t now)
+static void telemetry_handler(void *arg)
 {
-	struct le *le;
-	struct ms_source **sourcev = NULL;
-	char error[MS_ERROR_SIZE];
-	size_t source_count;
-	size_t source_index = 0;
-	size_t i;
-	int error_number;
-	uint64_t error_generation;
-	uint64_t error_emitted;
-	uint64_t tx_packets;
-	double tx_level;
-	bool tx_muted;
-	bool tx_ready;
-	bool tx_active;
-	bool emit_tx;
-	bool rx_active = false;
-	bool emit_rx_active;
-
-	mtx_lock(ctx->mutex);
-	tx_packets = ctx->tx_packets;
-	tx_level = ctx->tx_level_dbfs;
-	tx_muted = ctx->tx_muted;
-	tx_ready = ctx->tx_ready;
-	tx_active = ctx->tx_last_frame_ms &&
-		    now - ctx->tx_last_frame_ms <= MS_ACTIVITY_HOLD_MS &&
-		    tx_level > MS_ACTIVITY_DBFS;
-	emit_tx = (tx_ready || list_count(&ctx->callers)) &&
-		  now - ctx->tx_telemetry_ms >= MS_TELEMETRY_MS;
-	if (emit_tx) {
-		ctx->tx_telemetry_ms = now;
-		ctx->tx_active_sent = tx_active;
-		ctx->telemetry_initialized = true;
-	}
-	error_generation = ctx->error_generation;
-	error_emitted = ctx->error_emitted_generation;
-	error_number = ctx->last_errno;
-	str_ncpy(error, ctx->last_error, sizeof(error));
-	source_count = list_count(&ctx->sources);
-	if (source_count) {
-		sourcev = mem_zalloc(source_count * sizeof(*sourcev), NULL);
-		if (sourcev) {
-			for (le = ctx->sources.head; le; le = le->next)
-				sourcev[source_index++] = mem_ref(le->data);
-		}
-	}
-	mtx_unlock(ctx->mutex);
-
-	if (source_count && !sourcev) {
-		ms_context_error(ctx, "telemetry-allocation-failed", ENOMEM);
-		return;
-	}
-
-	if (emit_tx) {
-		module_event("mediasoup_bridge", "MS_TX_ACTIVE", NULL, NULL,
-			     "{\"key\":\"%s\",\"active\":%s,\"muted\":%s,"
-			     "\"dbfs\":%.1f,\"packets\":%llu}",
-			     ctx->key, tx_active ? "true" : "false",
-			     tx_muted ? "true" : "false", tx_level,
-			     (unsigned long long)tx_packets);
-	}
-
-	for (i = 0; i < source_index; ++i) {
-		struct ms_source *src = sourcev[i];
-		const bool active = source_is_active(src, now);
-
-		ms_source_keepalive(src, now);
-		rx_active |= active;
-
-		if (src->active && src->last_rx_ms &&
-		    now - src->last_rx_ms <= MS_KEEPALIVE_MS &&
-		    now - src->telemetry_ms >= MS_TELEMETRY_MS) {
-			src->telemetry_ms = now;
-			module_event(
-				"mediasoup_bridge", "MS_RX_LEVEL", NULL, NULL,
-				"{\"key\":\"%s\",\"producerId\":\"%s\","
-				"\"active\":%s,\"dbfs\":%.1f,\"packets\":%llu}",
-				ctx->key, src->producer_id,
-				active ? "true" : "false", src->level_dbfs,
-				(unsigned long long)src->rx_packets);
-		}
-	}
-
-	mtx_lock(ctx->mutex);
-	emit_rx_active = !ctx->telemetry_initialized ||
-			 rx_active != ctx->rx_active_sent ||
-			 now - ctx->rx_telemetry_ms >= MS_KEEPALIVE_MS;
-	if (emit_rx_active) {
-		ctx->rx_active_sent = rx_active;
-		ctx->rx_telemetry_ms = now;
-		ctx->telemetry_initialized = true;
-	}
-	if (error_generation != error_emitted)
-		ctx->error_emitted_generation = error_generation;
-	mtx_unlock(ctx->mutex);
-
-	if (emit_rx_active) {
-		module_event("mediasoup_bridge", "MS_RX_ACTIVE", NULL, NULL,
-			     "{\"key\":\"%s\",\"active\":%s}",
-			     ctx->key, rx_active ? "true" : "false");
-	}
-
-	if (error_generation != error_emitted)
-		ms_emit_error(ctx->key, error, error_number);
+	uint64_t delay;
+	(void)arg;
 
-	for (i = 0; i < source_index; ++i)
-		mem_deref(sourcev[i]);
-	mem_deref(sourcev);
+	delay = ms_telemetry_tick(tmr_jiffies());
+	tmr_start(&telemetry_tmr, delay, telemetry_handler, NULL);
 }
 
 
-static void telemetry_handler(void *arg)
+static void watchdog_handler(void *arg)
 {
-	struct ms_context **contextv = NULL;
-	struct le *le;
-	size_t context_count;
-	size_t context_index = 0;
-	size_t i;
-	uint64_t now = tmr_jiffies();
 	(void)arg;
 
-	tmr_start(&telemetry_tmr, MS_TELEMETRY_MS, telemetry_handler, NULL);
-
-	mtx_lock(ms_contexts_mutex);
-	context_count = list_count(&ms_contexts);
-	if (context_count) {
-		contextv = mem_zalloc(context_count * sizeof(*contextv), NULL);
-		if (contextv) {
-			for (le = ms_contexts.head; le; le = le->next)
-				contextv[context_index++] = mem_ref(le->data);
-		}
-	}
-	mtx_unlock(ms_contexts_mutex);
-
-	for (i = 0; i < context_index; ++i) {
-		telemetry_context(contextv[i], now);
-		mem_deref(contextv[i]);
-	}
-	mem_deref(contextv);
+	ms_contexts_pass(ms_context_watchdog, tmr_jiffies());
+	tmr_start(&watchdog_tmr, MS_WATCHDOG_MS, watchdog_handler, NULL);
 }
 
 
@@ -472,6 +339,24 @@ static int load_config(uint16_t *first, uint16_t *last)
 }
 
 
+static void open_meter_shm(void)
+{
+	char path[256];
+	int err;
+
+	if (conf_get_str(conf_cur(), "meter_shm", path, sizeof(path)))
+		return;
+
+	err = ms_meter_shm_open(path);
+	if (err) {
+		warning("mediasoup_bridge: meter file '%s' (%m)\n", path, err);
+		return;
+	}
+
+	info("mediasoup_bridge: writing levels to %s\n", path);
+}
+
+
 static int module_init(void)
 {
 	uint16_t first;
@@ -482,14 +367,28 @@ static int module_init(void)
 	if (err)
 		return err;
 
-	err = mutex_alloc(&ms_contexts_mutex);
+	ms_level_init();
+	ms_sched_init();
+
+	err = ms_slab_init();
 	if (err)
 		return err;
 
+	err = mutex_alloc(&ms_contexts_mutex);
+	if (err)
+		goto out;
+
 	err = ms_port_pool_init(first, last);
 	if (err)
 		goto out;
 
+	err = ms_telemetry_init();
+	if (err)
+		goto out;
+
+	/* Optional; without it levels only go out as MS_TELEMETRY. */
+	open_meter_shm();
+
 	err = ms_audio_register();
 	if (err)
 		goto out;
@@ -499,17 +398,22 @@ static int module_init(void)
 		goto out;
 
 	tmr_start(&telemetry_tmr, MS_TELEMETRY_MS, telemetry_handler, NULL);
+	tmr_start(&watchdog_tmr, MS_WATCHDOG_MS, watchdog_handler, NULL);
 
 	info("mediasoup_bridge: loaded, bind=%J, even RTP ports %u-%u "
-	     "(%zu slots)\n", &ms_bind_addr, ms_port_pool.first,
-	     ms_port_pool.last, ms_port_pool.count);
+	     "(%zu slots), %s level kernel\n", &ms_bind_addr,
+	     ms_port_pool.first, ms_port_pool.last, ms_port_pool.count,
+	     ms_level_kernel());
 	return 0;
 
 out:
 	ms_commands_unregister();
 	ms_audio_unregister();
+	ms_telemetry_close();
+	ms_meter_shm_close();
 	ms_port_pool_close();
 	ms_contexts_mutex = mem_deref(ms_contexts_mutex);
+	ms_slab_close();
 	return err;
 }
 
@@ -519,9 +423,12 @@ static int module_close(void)
 	size_t active;
 
 	tmr_cancel(&telemetry_tmr);
+	tmr_cancel(&watchdog_tmr);
 	ms_commands_unregister();
+	ms_loopback_close();
 	active = ms_audio_active_devices();
 	ms_audio_unregister();
+	ms_trunk_close_all();
 
 	for (;;) {
 		struct ms_context *ctx;
@@ -537,6 +444,7 @@ static int module_close(void)
 		ctx->closing = true;
 		mtx_unlock(ctx->mutex);
 		mtx_unlock(ms_contexts_mutex);
+		ms_telemetry_context_remove(ctx);
 
 		/* Drop list ownership and this loop's retained reference. */
 		mem_deref(ctx);
@@ -547,8 +455,11 @@ static int module_close(void)
 		warning("mediasoup_bridge: unloading with %zu active device "
 			"halves during shutdown is unsupported\n", active);
 	}
+	ms_telemetry_close();
+	ms_meter_shm_close();
 	ms_port_pool_close();
 	ms_contexts_mutex = mem_deref(ms_contexts_mutex);
+	ms_slab_close();
 
 	info("mediasoup_bridge: unloaded\n");
 	return 0;
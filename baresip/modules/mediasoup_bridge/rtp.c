@@ -2,7 +2,13 @@
  * @file rtp.c Fixed-port RTP transport, jitter buffering and Opus RX
  */
 
+#include <errno.h>
 #include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
 
 #include "mediasoup_bridge.h"
 
@@ -71,6 +77,80 @@ size_t ms_port_pool_used(void)
 }
 
 
+/*
+ * Have the kernel stamp every datagram on arrival.  libre reads with
+ * recvfrom(), so the stamp is fetched with SIOCGSTAMPNS after the read
+ * instead of from a control message.  The first SIOCGSTAMPNS enables
+ * stamping and fails with ENOENT.  SO_TIMESTAMPNS must not be set: it
+ * moves the stamp into control messages and the ioctl never sees one.
+ */
+static void socket_enable_timestamps(struct rtp_sock *rtp)
+{
+#if defined(__linux__) && defined(SIOCGSTAMPNS)
+	struct timespec stamp;
+	re_sock_t fd;
+
+	fd = udp_sock_fd(rtp_sock(rtp), sa_af(&ms_bind_addr));
+	if (fd == RE_BAD_SOCK)
+		return;
+
+	if (ioctl(fd, SIOCGSTAMPNS, &stamp) && errno != ENOENT)
+		debug("mediasoup_bridge: no kernel RX timestamps (%m)\n",
+		      errno);
+#else
+	(void)rtp;
+#endif
+}
+
+
+/**
+ * Arrival time of the datagram just read on a receive socket
+ *
+ * Must be called from the socket's receive handler.  The kernel stamp is
+ * on the realtime clock; the time spent waiting for the main loop is
+ * measured against it and subtracted from the monotonic handler time.
+ *
+ * @param rtp          Pool receive socket
+ * @param arrival_us   Returned arrival time on the tmr_jiffies_usec() clock
+ * @param dispatch_us  Returned delay from kernel arrival to the handler
+ *
+ * @return true if the kernel stamp was used, false for handler time
+ */
+bool ms_rtp_arrival(struct rtp_sock *rtp, uint64_t *arrival_us,
+		    uint32_t *dispatch_us)
+{
+	const uint64_t now_us = tmr_jiffies_usec();
+#if defined(__linux__) && defined(SIOCGSTAMPNS)
+	struct timespec stamp;
+	struct timespec real;
+	re_sock_t fd;
+
+	fd = rtp ? udp_sock_fd(rtp_sock(rtp), sa_af(&ms_bind_addr)) :
+		RE_BAD_SOCK;
+	if (fd != RE_BAD_SOCK && !ioctl(fd, SIOCGSTAMPNS, &stamp) &&
+	    !clock_gettime(CLOCK_REALTIME, &real)) {
+		const int64_t delay_us =
+			(int64_t)(real.tv_sec - stamp.tv_sec) * 1000000 +
+			(real.tv_nsec - stamp.tv_nsec) / 1000;
+
+		/* A wall-clock step makes the stamp useless; fall back. */
+		if (delay_us >= 0 && delay_us < MS_DISPATCH_MAX_US &&
+		    (uint64_t)delay_us <= now_us) {
+			*arrival_us = now_us - (uint64_t)delay_us;
+			*dispatch_us = (uint32_t)delay_us;
+			return true;
+		}
+	}
+#else
+	(void)rtp;
+#endif
+
+	*arrival_us = now_us;
+	*dispatch_us = 0;
+	return false;
+}
+
+
 int ms_rtp_socket_alloc(struct rtp_sock **rtpp, size_t *pool_index,
 			uint16_t *port, rtp_recv_h *recvh, void *arg)
 {
@@ -98,6 +178,7 @@ int ms_rtp_socket_alloc(struct rtp_sock **rtpp, size_t *pool_index,
 			continue;
 
 		rtcp_enable_mux(rtp, true);
+		socket_enable_timestamps(rtp);
 		ms_port_pool.used[i] = true;
 		*rtpp = rtp;
 		*pool_index = i;
@@ -221,12 +302,18 @@ static void source_media_reset(struct ms_source *src)
 	src->active = false;
 	src->decode_started = false;
 	src->seq_set = false;
-	src->latched_ssrc = 0;
+	ms_seq_write_begin(&src->rx_stats.lock);
+	src->rx_stats.v.latched_ssrc = 0;
+	ms_seq_write_end(&src->rx_stats.lock);
 	if (src->mix_source)
 		aumix_source_enable(src->mix_source, false);
 	src->mix_source = mem_deref(src->mix_source);
 	src->jbuf = mem_deref(src->jbuf);
-	src->decode_buf = mem_deref(src->decode_buf);
+	ms_slab_free(src->decode_buf);
+	ms_slab_free(src->resample_buf);
+	src->decode_buf = NULL;
+	src->resample_buf = NULL;
+	src->decode_frames = 0;
 	if (src->decoder) {
 		opus_decoder_destroy(src->decoder);
 		src->decoder = NULL;
@@ -234,23 +321,130 @@ static void source_media_reset(struct ms_source *src)
 }
 
 
+/**
+ * Bytes held by a source: structure, decoder state and frame buffers
+ *
+ * Called on the main thread, which is the only writer of the buffers.
+ */
+size_t ms_source_footprint(const struct ms_source *src)
+{
+	size_t bytes;
+
+	if (!src)
+		return 0;
+
+	bytes = sizeof(*src) + ms_slab_size(src->decode_buf) +
+		ms_slab_size(src->resample_buf);
+	if (src->decoder)
+		bytes += (size_t)opus_decoder_get_size(MS_CHANNELS);
+
+	return bytes;
+}
+
+
 static void source_destructor(void *arg)
 {
 	struct ms_source *src = arg;
 
+	ms_telemetry_source_remove(src);
 	list_unlink(&src->le);
 	source_media_reset(src);
 	ms_rtp_socket_release(&src->rtp, &src->pool_index);
 }
 
 
+static void source_count_invalid(struct ms_source *src)
+{
+	ms_seq_write_begin(&src->rx_stats.lock);
+	++src->rx_stats.v.invalid;
+	ms_seq_write_end(&src->rx_stats.lock);
+}
+
+
+static void source_count_decode_error(struct ms_source *src)
+{
+	ms_seq_write_begin(&src->rx_stats.lock);
+	++src->rx_stats.v.decode_errors;
+	ms_seq_write_end(&src->rx_stats.lock);
+}
+
+
+/*
+ * Decode and drift buffers for frames per channel.  The resampler may
+ * produce one frame more than it consumes, plus one of headroom.
+ */
+static int source_bufs_alloc(int16_t **decode_buf, int16_t **resample_buf,
+			     uint32_t frames)
+{
+	*decode_buf = ms_slab_alloc((size_t)frames * MS_CHANNELS *
+				    sizeof(**decode_buf));
+	*resample_buf = ms_slab_alloc((size_t)(frames + 2) * MS_CHANNELS *
+				      sizeof(**resample_buf));
+	if (!*decode_buf || !*resample_buf) {
+		ms_slab_free(*decode_buf);
+		ms_slab_free(*resample_buf);
+		*decode_buf = NULL;
+		*resample_buf = NULL;
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+
+/*
+ * The sender used a longer frame than the context ptime.  Decoding runs
+ * on the main thread only, so the buffers can be swapped without locking.
+ */
+static int source_bufs_grow(struct ms_source *src)
+{
+	int16_t *decode_buf;
+	int16_t *resample_buf;
+	int err;
+
+	if (src->decode_frames >= MS_OPUS_MAX_FRAME)
+		return ENOSPC;
+
+	err = source_bufs_alloc(&decode_buf, &resample_buf,
+				MS_OPUS_MAX_FRAME);
+	if (err)
+		return err;
+
+	ms_slab_free(src->decode_buf);
+	ms_slab_free(src->resample_buf);
+	src->decode_buf = decode_buf;
+	src->resample_buf = resample_buf;
+	src->decode_frames = MS_OPUS_MAX_FRAME;
+
+	return 0;
+}
+
+
 static void source_put_pcm(struct ms_source *src, size_t sampc)
 {
+	struct ms_level level;
+	size_t frames;
+
 	if (!src || !src->mix_source || !sampc)
 		return;
 
-	src->level_dbfs = ms_level_dbfs(src->decode_buf, sampc);
-	(void)aumix_source_put(src->mix_source, src->decode_buf, sampc);
+	ms_level_measure(&level, src->decode_buf, sampc);
+
+	ms_seq_write_begin(&src->rx_stats.lock);
+	ms_level_window_add(&src->rx_stats.v.level,
+			    &src->rx_stats.level_restart, &level);
+	ms_seq_write_end(&src->rx_stats.lock);
+
+	if (ms_context_rx_direct(src, src->decode_buf, sampc))
+		return;
+
+	/* The mixer pulls on the local clock; absorb the sender's drift. */
+	frames = ms_drift_resample(&src->drift, src->resample_buf,
+				   src->decode_frames + 2, src->decode_buf,
+				   sampc / MS_CHANNELS, MS_CHANNELS);
+
+	(void)aumix_source_put(src->mix_source, src->resample_buf,
+			       frames * MS_CHANNELS);
 }
 
 
@@ -262,16 +456,19 @@ static int source_decode_plc(struct ms_source *src, unsigned count,
 	count = MIN(count, 3U);
 	for (i = 0; i < count; ++i) {
 		int n = opus_decode(src->decoder, NULL, 0, src->decode_buf,
-				    MS_FRAME_SAMP_PER_CH, 0);
+				    (int)MIN(src->plc_samp_per_ch,
+					     src->decode_frames), 0);
 		if (n < 0) {
-			++src->decode_errors;
+			source_count_decode_error(src);
 			ms_context_error(src->ctx, "opus-plc-failed", EPROTO);
 			return EPROTO;
 		}
 
-		++src->plc_frames;
+		ms_seq_write_begin(&src->rx_stats.lock);
+		++src->rx_stats.v.plc_frames;
+		ms_seq_write_end(&src->rx_stats.lock);
 		/*
-		 * Emit at most one 20 ms frame at this playout instant.  Sending
+		 * Emit at most one frame at this playout instant.  Sending
 		 * every PLC frame followed by the real frame makes aumix queue
 		 * stale audio and causes latency to grow after each gap.
 		 */
@@ -288,6 +485,7 @@ static void source_decode_packet(struct ms_source *src,
 				 struct mbuf *mb, bool playout)
 {
 	bool concealed = false;
+	uint64_t decode_us;
 	uint16_t delta;
 	int n;
 
@@ -295,7 +493,9 @@ static void source_decode_packet(struct ms_source *src,
 		delta = (uint16_t)(hdr->seq - src->last_seq);
 		if (delta > 1 && delta < 0x8000) {
 			const unsigned lost = (unsigned)delta - 1;
-			src->rx_lost += lost;
+			ms_seq_write_begin(&src->rx_stats.lock);
+			src->rx_stats.v.lost += lost;
+			ms_seq_write_end(&src->rx_stats.lock);
 			if (lost <= 3) {
 				if (source_decode_plc(src, lost, playout))
 					return;
@@ -317,15 +517,36 @@ static void source_decode_packet(struct ms_source *src,
 	src->last_seq = hdr->seq;
 	src->seq_set = true;
 
+	decode_us = tmr_jiffies_usec();
 	n = opus_decode(src->decoder, mbuf_buf(mb),
 			(opus_int32)mbuf_get_left(mb), src->decode_buf,
-			MS_OPUS_MAX_FRAME, 0);
+			(int)src->decode_frames, 0);
+	if (n == OPUS_BUFFER_TOO_SMALL && !source_bufs_grow(src)) {
+		n = opus_decode(src->decoder, mbuf_buf(mb),
+				(opus_int32)mbuf_get_left(mb), src->decode_buf,
+				(int)src->decode_frames, 0);
+	}
+	decode_us = tmr_jiffies_usec() - decode_us;
 	if (n < 0) {
-		++src->decode_errors;
+		source_count_decode_error(src);
 		ms_context_error(src->ctx, "opus-decode-failed", EPROTO);
 		return;
 	}
 
+	ms_seq_write_begin(&src->rx_stats.lock);
+	++src->rx_stats.v.decodes;
+	src->rx_stats.v.decode_us_sum += decode_us;
+	if (decode_us > src->rx_stats.v.decode_us_max)
+		src->rx_stats.v.decode_us_max = (uint32_t)decode_us;
+	ms_seq_write_end(&src->rx_stats.lock);
+
+	if (src->ctx->loopback)
+		ms_loopback_decoded(src->ctx->loopback, hdr->ts);
+
+	/* Conceal with the sender's frame duration. */
+	if (n > 0)
+		src->plc_samp_per_ch = (uint32_t)n;
+
 	/* The real frame advances decoder state; PLC replaced its playout slot. */
 	if (playout && !concealed)
 		source_put_pcm(src, (size_t)n * MS_CHANNELS);
@@ -374,25 +595,34 @@ static void source_rtp_handler(const struct sa *peer,
 	struct ms_source *src = arg;
 	struct rtp_header hdr;
 	size_t payload_len;
+	uint64_t arrival_us;
+	uint32_t dispatch_us;
+	bool kernel_ts;
 	int err;
 
 	if (!src || !src->active || !src->jbuf || !src->decoder)
 		return;
 
+	/* Before anything else, while the stamp is this packet's. */
+	kernel_ts = ms_rtp_arrival(src->rtp, &arrival_us, &dispatch_us);
+
 	if (!sa_cmp(peer, &src->remote, SA_ALL) || header->pt != src->pt) {
-		++src->rx_invalid;
+		source_count_invalid(src);
 		return;
 	}
 
 	if (src->expected_ssrc && header->ssrc != src->expected_ssrc) {
-		++src->rx_invalid;
+		source_count_invalid(src);
 		return;
 	}
 
-	if (!src->latched_ssrc)
-		src->latched_ssrc = header->ssrc;
-	else if (header->ssrc != src->latched_ssrc) {
-		++src->rx_invalid;
+	if (!src->rx_stats.v.latched_ssrc) {
+		ms_seq_write_begin(&src->rx_stats.lock);
+		src->rx_stats.v.latched_ssrc = header->ssrc;
+		ms_seq_write_end(&src->rx_stats.lock);
+	}
+	else if (header->ssrc != src->rx_stats.v.latched_ssrc) {
+		source_count_invalid(src);
 		return;
 	}
 
@@ -401,34 +631,50 @@ static void source_rtp_handler(const struct sa *peer,
 		uint8_t padding;
 
 		if (!payload_len) {
-			++src->rx_invalid;
+			source_count_invalid(src);
 			return;
 		}
 		padding = mbuf_buf(mb)[payload_len - 1];
 		if (!padding || padding >= payload_len) {
-			++src->rx_invalid;
+			source_count_invalid(src);
 			return;
 		}
 		mbuf_set_end(mb, mbuf_end(mb) - padding);
 		payload_len -= padding;
 	}
 	if (!payload_len) {
-		++src->rx_invalid;
+		source_count_invalid(src);
 		return;
 	}
 
+	/* Network jitter only: main-loop queueing is taken out. */
 	hdr = *header;
-	hdr.ts_arrive = tmr_jiffies() * (MS_SRATE / 1000);
+	hdr.ts_arrive = arrival_us * (MS_SRATE / 1000) / 1000;
 
 	err = jbuf_put(src->jbuf, &hdr, mb);
 	if (err) {
-		++src->rx_invalid;
+		source_count_invalid(src);
 		return;
 	}
 
-	++src->rx_packets;
-	src->rx_bytes += payload_len;
-	src->last_rx_ms = tmr_jiffies();
+	ms_drift_update(&src->drift, hdr.ts, arrival_us);
+	if (src->ctx->loopback)
+		ms_loopback_rx(src->ctx->loopback, hdr.ts, arrival_us);
+
+	ms_seq_write_begin(&src->rx_stats.lock);
+	++src->rx_stats.v.packets;
+	src->rx_stats.v.bytes += payload_len;
+	src->rx_stats.v.last_rx_ms = tmr_jiffies();
+	src->rx_stats.v.drift_ppm = src->drift.ppm;
+	src->rx_stats.v.drift_locked = src->drift.locked;
+	src->rx_stats.v.kernel_ts = kernel_ts;
+	if (kernel_ts) {
+		++src->rx_stats.v.dispatch_count;
+		src->rx_stats.v.dispatch_us_sum += dispatch_us;
+		src->rx_stats.v.dispatch_us_max =
+			MAX(src->rx_stats.v.dispatch_us_max, dispatch_us);
+	}
+	ms_seq_write_end(&src->rx_stats.lock);
 
 	if (!src->decode_started) {
 		src->decode_started = true;
@@ -437,6 +683,27 @@ static void source_rtp_handler(const struct sa *peer,
 }
 
 
+/**
+ * Feed one RTP packet to a source as if its socket had received it
+ *
+ * For the replay harness, which drives the main-loop timers itself on a
+ * virtual clock.  The packet takes the normal path: peer and SSRC checks,
+ * jitter buffer and the decode timer.  Main thread only.
+ *
+ * @param src Active source
+ * @param hdr Decoded RTP header
+ * @param mb  Payload, positioned after the header
+ */
+void ms_source_inject(struct ms_source *src, const struct rtp_header *hdr,
+		      struct mbuf *mb)
+{
+	if (!src || !hdr || !mb)
+		return;
+
+	source_rtp_handler(&src->remote, hdr, mb, src);
+}
+
+
 struct ms_source *ms_source_find(struct ms_context *ctx,
 				 const char *producer_id)
 {
@@ -459,6 +726,7 @@ struct ms_source *ms_source_find(struct ms_context *ctx,
 int ms_source_reserve(struct ms_context *ctx, const char *producer_id,
 		      struct ms_source **srcp, bool *created)
 {
+	struct ms_source *existing;
 	struct ms_source *src;
 	int err;
 
@@ -489,7 +757,6 @@ int ms_source_reserve(struct ms_context *ctx, const char *producer_id,
 
 	src->ctx = ctx;
 	src->pool_index = MS_PORT_NONE;
-	src->level_dbfs = MS_DBFS_FLOOR;
 	str_ncpy(src->producer_id, producer_id, sizeof(src->producer_id));
 
 	err = ms_rtp_socket_alloc(&src->rtp, &src->pool_index,
@@ -503,11 +770,39 @@ int ms_source_reserve(struct ms_context *ctx, const char *producer_id,
 		return err;
 	}
 
+	mtx_unlock(ctx->mutex);
+
+	/*
+	 * Register before publishing, so telemetry knows every listed
+	 * source.  Lock order forbids doing it under ctx->mutex, so the
+	 * context is checked again before the append.
+	 */
+	err = ms_telemetry_source_add(src);
+	if (err) {
+		mem_deref(src);
+		return err;
+	}
+
+	mtx_lock(ctx->mutex);
+	existing = ctx->closing ? NULL : ms_source_find(ctx, producer_id);
+	if (ctx->closing || existing) {
+		if (existing)
+			*srcp = mem_ref(existing);
+		mtx_unlock(ctx->mutex);
+		mem_deref(src);
+		if (!existing)
+			return ESHUTDOWN;
+		if (created)
+			*created = false;
+		return 0;
+	}
+
 	list_append(&ctx->sources, &src->le, src);
 	*srcp = mem_ref(src);
+	mtx_unlock(ctx->mutex);
+
 	if (created)
 		*created = true;
-	mtx_unlock(ctx->mutex);
 
 	return 0;
 }
@@ -525,7 +820,10 @@ int ms_source_activate(struct ms_source *src, const struct sa *remote,
 	OpusDecoder *old_decoder = NULL;
 	int16_t *decode_buf = NULL;
 	int16_t *old_decode_buf = NULL;
+	int16_t *resample_buf = NULL;
+	int16_t *old_resample_buf = NULL;
 	bool mix_enabled = false;
+	uint32_t ptime;
 	bool same;
 	int opus_err;
 	int err;
@@ -544,6 +842,7 @@ int ms_source_activate(struct ms_source *src, const struct sa *remote,
 	same = src->active && src->pt == pt &&
 	       src->expected_ssrc == ssrc &&
 	       sa_cmp(&src->remote, remote, SA_ALL);
+	ptime = ctx->ptime;
 	mtx_unlock(ctx->mutex);
 
 	if (same) {
@@ -583,14 +882,14 @@ int ms_source_activate(struct ms_source *src, const struct sa *remote,
 	if (!decoder)
 		return opus_err == OPUS_ALLOC_FAIL ? ENOMEM : EPROTO;
 
-	decode_buf = mem_zalloc(MS_OPUS_MAX_FRAME * MS_CHANNELS *
-			       sizeof(*decode_buf), NULL);
-	if (!decode_buf) {
-		err = ENOMEM;
+	/* Sized to the context frame; grown once if the sender uses more. */
+	err = source_bufs_alloc(&decode_buf, &resample_buf,
+				MS_SRATE * ptime / 1000);
+	if (err)
 		goto out;
-	}
 
-	err = jbuf_alloc(&jbuf, 40, 200, 50);
+	/* Keep two context frames of minimum delay. */
+	err = jbuf_alloc(&jbuf, 2 * ptime, MAX(200U, 4 * ptime), 50);
 	if (err)
 		goto out;
 	jbuf_set_srate(jbuf, MS_SRATE);
@@ -612,15 +911,19 @@ int ms_source_activate(struct ms_source *src, const struct sa *remote,
 	src->active = false;
 	src->decode_started = false;
 	src->seq_set = false;
-	src->latched_ssrc = 0;
 	old_decoder = src->decoder;
 	old_decode_buf = src->decode_buf;
+	old_resample_buf = src->resample_buf;
 	old_jbuf = src->jbuf;
 	old_mix_source = src->mix_source;
 	src->decoder = decoder;
 	decoder = NULL;
 	src->decode_buf = decode_buf;
 	decode_buf = NULL;
+	src->resample_buf = resample_buf;
+	resample_buf = NULL;
+	src->decode_frames = MS_SRATE * ptime / 1000;
+	ms_drift_init(&src->drift, MS_SRATE);
 	src->jbuf = jbuf;
 	jbuf = NULL;
 	src->mix_source = mix_source;
@@ -629,7 +932,12 @@ int ms_source_activate(struct ms_source *src, const struct sa *remote,
 	src->remote = *remote;
 	src->pt = pt;
 	src->expected_ssrc = ssrc;
-	src->level_dbfs = MS_DBFS_FLOOR;
+	src->plc_samp_per_ch = MS_SRATE * ptime / 1000;
+	ms_seq_write_begin(&src->rx_stats.lock);
+	src->rx_stats.v.latched_ssrc = 0;
+	src->rx_stats.v.drift_ppm = 0.0;
+	src->rx_stats.v.drift_locked = false;
+	ms_seq_write_end(&src->rx_stats.lock);
 	src->active = true;
 	src->last_probe_ms = tmr_jiffies();
 	mtx_unlock(ctx->mutex);
@@ -638,10 +946,13 @@ int ms_source_activate(struct ms_source *src, const struct sa *remote,
 		aumix_source_enable(old_mix_source, false);
 	mem_deref(old_mix_source);
 	mem_deref(old_jbuf);
-	mem_deref(old_decode_buf);
+	ms_slab_free(old_decode_buf);
+	ms_slab_free(old_resample_buf);
 	if (old_decoder)
 		opus_decoder_destroy(old_decoder);
 
+	ms_context_bypass_update(ctx);
+
 	if (changed)
 		*changed = true;
 
@@ -650,13 +961,72 @@ out:
 		aumix_source_enable(mix_source, false);
 	mem_deref(mix_source);
 	mem_deref(jbuf);
-	mem_deref(decode_buf);
+	ms_slab_free(decode_buf);
+	ms_slab_free(resample_buf);
 	if (decoder)
 		opus_decoder_destroy(decoder);
 	return err;
 }
 
 
+/**
+ * Return an active source to reserved, keeping its socket and port
+ *
+ * Undoes ms_source_activate() of a source that was only reserved before,
+ * which a failed ms_bridge_apply batch relies on.  Main thread only.
+ *
+ * @param src Source
+ */
+void ms_source_deactivate(struct ms_source *src)
+{
+	struct ms_context *ctx;
+	struct aumix_source *mix_source;
+	struct jbuf *jbuf;
+	OpusDecoder *decoder;
+	int16_t *decode_buf;
+	int16_t *resample_buf;
+
+	if (!src || !src->ctx)
+		return;
+
+	ctx = src->ctx;
+	mtx_lock(ctx->mutex);
+	tmr_cancel(&src->decode_tmr);
+	src->active = false;
+	src->decode_started = false;
+	src->seq_set = false;
+	mix_source = src->mix_source;
+	src->mix_source = NULL;
+	jbuf = src->jbuf;
+	src->jbuf = NULL;
+	decoder = src->decoder;
+	src->decoder = NULL;
+	decode_buf = src->decode_buf;
+	src->decode_buf = NULL;
+	resample_buf = src->resample_buf;
+	src->resample_buf = NULL;
+	src->decode_frames = 0;
+	sa_init(&src->remote, AF_UNSPEC);
+	src->pt = 0;
+	src->expected_ssrc = 0;
+	ms_seq_write_begin(&src->rx_stats.lock);
+	src->rx_stats.v.latched_ssrc = 0;
+	ms_seq_write_end(&src->rx_stats.lock);
+	mtx_unlock(ctx->mutex);
+
+	if (mix_source)
+		aumix_source_enable(mix_source, false);
+	mem_deref(mix_source);
+	mem_deref(jbuf);
+	ms_slab_free(decode_buf);
+	ms_slab_free(resample_buf);
+	if (decoder)
+		opus_decoder_destroy(decoder);
+
+	ms_context_bypass_update(ctx);
+}
+
+
 int ms_source_remove(struct ms_context *ctx, const char *producer_id,
 		     bool *changed)
 {
@@ -676,6 +1046,8 @@ int ms_source_remove(struct ms_context *ctx, const char *producer_id,
 
 	list_unlink(&src->le);
 	mtx_unlock(ctx->mutex);
+	ms_telemetry_source_remove(src);
+	ms_context_bypass_update(ctx);
 	mem_deref(src);
 
 	if (changed)
@@ -684,31 +1056,59 @@ int ms_source_remove(struct ms_context *ctx, const char *producer_id,
 }
 
 
-void ms_source_keepalive(struct ms_source *src, uint64_t now)
+/**
+ * Send due keepalive probes for the active sources of a context; main
+ * thread only
+ *
+ * Probes are taken in small batches under ctx->mutex and sent without it.
+ *
+ * @param ctx Bridge context
+ * @param now Current time in milliseconds
+ */
+void ms_context_keepalive(struct ms_context *ctx, uint64_t now)
 {
-	struct ms_context *ctx;
-	struct rtp_sock *rtp;
-	struct sa remote;
-	int err;
+	struct {
+		struct rtp_sock *rtp;
+		struct sa remote;
+	} probev[MS_KEEPALIVE_BATCH];
+	size_t n;
+	size_t i;
+	int err = 0;
 
-	if (!src)
+	if (!ctx)
 		return;
 
-	ctx = src->ctx;
-	mtx_lock(ctx->mutex);
-	if (ctx->closing || src->le.list != &ctx->sources || !src->active ||
-	    now - src->last_probe_ms < MS_KEEPALIVE_MS) {
+	do {
+		struct le *le;
+
+		n = 0;
+		mtx_lock(ctx->mutex);
+		le = ctx->closing ? NULL : ctx->sources.head;
+		for (; le && n < MS_KEEPALIVE_BATCH; le = le->next) {
+			struct ms_source *src = le->data;
+
+			/* Also keeps a source from being sent twice. */
+			if (!src->active ||
+			    now - src->last_probe_ms < MS_KEEPALIVE_MS)
+				continue;
+
+			src->last_probe_ms = now;
+			probev[n].rtp = mem_ref(src->rtp);
+			probev[n].remote = src->remote;
+			++n;
+		}
 		mtx_unlock(ctx->mutex);
-		return;
-	}
 
-	src->last_probe_ms = now;
-	rtp = mem_ref(src->rtp);
-	remote = src->remote;
-	mtx_unlock(ctx->mutex);
+		for (i = 0; i < n; ++i) {
+			const int e = ms_send_probe(probev[i].rtp,
+						    &probev[i].remote, 1);
+
+			if (e)
+				err = e;
+			mem_deref(probev[i].rtp);
+		}
+	} while (n == MS_KEEPALIVE_BATCH);
 
-	err = ms_send_probe(rtp, &remote, 1);
-	mem_deref(rtp);
 	if (err)
 		ms_context_error(ctx, "rx-keepalive-failed", err);
 }
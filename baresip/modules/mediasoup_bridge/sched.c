@@ -0,0 +1,188 @@
+/**
+ * @file sched.c Real-time scheduling and CPU pinning of bridge audio threads
+ *
+ * The mixer clock threads are created inside aumix, so the policy is
+ * applied lazily by each thread the first time it enters a bridge mixer
+ * callback.  Without CAP_SYS_NICE (or an RLIMIT_RTPRIO allowance) the
+ * request fails with EPERM; the thread then keeps its default policy and
+ * the failure is logged once and counted.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mediasoup_bridge.h"
+
+
+static struct {
+	int policy;              /* SCHED_OTHER: not configured */
+	int priority;
+	bool pin;
+#ifdef __linux__
+	cpu_set_t cpus;
+#endif
+	char cpus_str[64];
+	atomic_uint applied;
+	atomic_uint failed;
+	atomic_bool warned;
+} sched_cfg;
+
+static _Thread_local bool thread_entered;
+
+
+#ifdef __linux__
+static int parse_cpus(const char *str, cpu_set_t *set)
+{
+	char buf[64];
+	char *tok;
+	char *save = NULL;
+
+	CPU_ZERO(set);
+	str_ncpy(buf, str, sizeof(buf));
+
+	for (tok = strtok_r(buf, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *end;
+		unsigned long lo;
+		unsigned long hi;
+
+		errno = 0;
+		lo = strtoul(tok, &end, 10);
+		hi = lo;
+		if (!errno && *end == '-')
+			hi = strtoul(end + 1, &end, 10);
+		if (errno || *end || end == tok || lo > hi ||
+		    hi >= CPU_SETSIZE)
+			return EINVAL;
+
+		for (; lo <= hi; ++lo)
+			CPU_SET(lo, set);
+	}
+
+	return CPU_COUNT(set) ? 0 : EINVAL;
+}
+#endif
+
+
+/**
+ * Read mediasoup_bridge_rt_policy, mediasoup_bridge_rt_priority and
+ * mediasoup_bridge_cpus.  Invalid values disable the respective setting
+ * with a warning; they never fail module load.
+ */
+void ms_sched_init(void)
+{
+	char policy[16] = "fifo";
+	uint32_t priority = 0;
+
+	memset(&sched_cfg, 0, sizeof(sched_cfg));
+	sched_cfg.policy = SCHED_OTHER;
+
+	(void)conf_get_u32(conf_cur(), "mediasoup_bridge_rt_priority",
+			   &priority);
+	(void)conf_get_str(conf_cur(), "mediasoup_bridge_rt_policy",
+			   policy, sizeof(policy));
+
+	if (priority) {
+		const int policy_id = !str_casecmp(policy, "rr") ?
+			SCHED_RR : !str_casecmp(policy, "fifo") ?
+			SCHED_FIFO : -1;
+
+		if (policy_id < 0 ||
+		    (int)priority < sched_get_priority_min(policy_id) ||
+		    (int)priority > sched_get_priority_max(policy_id)) {
+			warning("mediasoup_bridge: ignoring real-time policy "
+				"'%s' priority %u\n", policy, priority);
+		}
+		else {
+			sched_cfg.policy = policy_id;
+			sched_cfg.priority = (int)priority;
+		}
+	}
+
+	if (!conf_get_str(conf_cur(), "mediasoup_bridge_cpus",
+			  sched_cfg.cpus_str, sizeof(sched_cfg.cpus_str))) {
+#ifdef __linux__
+		sched_cfg.pin = !parse_cpus(sched_cfg.cpus_str,
+					    &sched_cfg.cpus);
+#endif
+		if (!sched_cfg.pin) {
+			warning("mediasoup_bridge: ignoring CPU set '%s'\n",
+				sched_cfg.cpus_str);
+			sched_cfg.cpus_str[0] = '\0';
+		}
+	}
+
+	if (sched_cfg.policy != SCHED_OTHER || sched_cfg.pin) {
+		info("mediasoup_bridge: audio threads: policy %s priority %d, "
+		     "cpus %s\n", sched_cfg.policy == SCHED_RR ? "rr" :
+		     sched_cfg.policy == SCHED_FIFO ? "fifo" : "other",
+		     sched_cfg.priority,
+		     sched_cfg.pin ? sched_cfg.cpus_str : "any");
+	}
+}
+
+
+/**
+ * Apply the configured policy to the calling audio thread, once
+ */
+void ms_sched_thread_enter(void)
+{
+	struct sched_param param;
+	int err = 0;
+
+	if (thread_entered)
+		return;
+	thread_entered = true;
+
+	if (sched_cfg.policy == SCHED_OTHER && !sched_cfg.pin)
+		return;
+
+#ifdef __linux__
+	if (sched_cfg.pin)
+		err = pthread_setaffinity_np(pthread_self(),
+					     sizeof(sched_cfg.cpus),
+					     &sched_cfg.cpus);
+#endif
+
+	/* Pinning and priority are independent; keep whichever works. */
+	if (sched_cfg.policy != SCHED_OTHER) {
+		int perr;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = sched_cfg.priority;
+		perr = pthread_setschedparam(pthread_self(), sched_cfg.policy,
+					     &param);
+		if (!err)
+			err = perr;
+	}
+
+	if (!err) {
+		atomic_fetch_add(&sched_cfg.applied, 1);
+		return;
+	}
+
+	atomic_fetch_add(&sched_cfg.failed, 1);
+	if (!atomic_exchange(&sched_cfg.warned, true)) {
+		warning("mediasoup_bridge: audio thread scheduling not "
+			"applied, continuing at default priority (%m)\n", err);
+	}
+}
+
+
+void ms_sched_stat(struct ms_sched_stat *stat)
+{
+	if (!stat)
+		return;
+
+	stat->policy = sched_cfg.policy == SCHED_FIFO ? "fifo" :
+		       sched_cfg.policy == SCHED_RR ? "rr" : "other";
+	stat->priority = sched_cfg.priority;
+	stat->cpus = sched_cfg.cpus_str;
+	stat->applied = atomic_load(&sched_cfg.applied);
+	stat->failed = atomic_load(&sched_cfg.failed);
+}
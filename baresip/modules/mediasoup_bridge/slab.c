@@ -0,0 +1,325 @@
+/**
+ * @file slab.c Size-class slab for bridge audio buffers
+ *
+ * Frame buffers of sources, callers and trunks come from a few fixed size
+ * classes matching 10 to 120 ms of 48 kHz stereo.  Blocks are carved from
+ * 64 KiB chunks, start on a cache line and return to a per-class free
+ * list on release, so setting up and tearing down calls reuses warm memory
+ * instead of going to the heap.  Chunks are only returned at module close,
+ * or, if blocks are still out then, when the last of them is freed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mediasoup_bridge.h"
+
+
+enum {
+	SLAB_LINE  = 64,
+	SLAB_CHUNK = 64 * 1024,
+	SLAB_MAGIC = 0x5b1ab,
+	SLAB_HUGE  = MS_SLAB_CLASSES,
+};
+
+
+/* One cache line in front of every block keeps the block aligned. */
+struct slab_hdr {
+	struct slab_hdr *next;
+	uint32_t magic;
+	uint32_t cls;
+	size_t size;
+	uint8_t pad[SLAB_LINE - sizeof(void *) - 2 * sizeof(uint32_t) -
+		    sizeof(size_t)];
+};
+
+
+_Static_assert(sizeof(struct slab_hdr) == SLAB_LINE, "slab header size");
+
+
+struct slab_chunk {
+	struct slab_chunk *next;
+};
+
+
+struct slab_class {
+	size_t size;
+	struct slab_hdr *free;
+	size_t in_use;
+	size_t cached;
+	size_t peak;
+};
+
+
+static const size_t class_sizev[MS_SLAB_CLASSES] = {
+	2048, 4096, 8192, 12288, 24576
+};
+
+static struct {
+	mtx_t *mutex;
+	struct slab_class classv[MS_SLAB_CLASSES];
+	struct slab_chunk *chunks;
+	size_t chunk_bytes;
+	size_t huge_bytes;
+	size_t huge_blocks;
+	bool closing;          /* closed with blocks out */
+} slab;
+
+
+int ms_slab_init(void)
+{
+	size_t i;
+
+	/* Closed with blocks still out: carry on with the same state. */
+	if (slab.mutex) {
+		mtx_lock(slab.mutex);
+		slab.closing = false;
+		mtx_unlock(slab.mutex);
+		return 0;
+	}
+
+	memset(&slab, 0, sizeof(slab));
+	for (i = 0; i < MS_SLAB_CLASSES; ++i)
+		slab.classv[i].size = class_sizev[i];
+
+	return mutex_alloc(&slab.mutex);
+}
+
+
+/* Called with slab.mutex held. */
+static size_t blocks_in_use(void)
+{
+	size_t in_use = slab.huge_blocks;
+	size_t i;
+
+	for (i = 0; i < MS_SLAB_CLASSES; ++i)
+		in_use += slab.classv[i].in_use;
+
+	return in_use;
+}
+
+
+/* Only once nothing can reach the slab any more. */
+static void slab_teardown(void)
+{
+	while (slab.chunks) {
+		struct slab_chunk *chunk = slab.chunks;
+
+		slab.chunks = chunk->next;
+		free(chunk);
+	}
+
+	slab.mutex = mem_deref(slab.mutex);
+	memset(&slab, 0, sizeof(slab));
+}
+
+
+/**
+ * Release the slab
+ *
+ * Device halves still open at unload keep their blocks.  The slab then
+ * stays until the last of them is freed, which finishes the close.
+ */
+void ms_slab_close(void)
+{
+	size_t in_use;
+
+	if (!slab.mutex)
+		return;
+
+	mtx_lock(slab.mutex);
+	in_use = blocks_in_use();
+	slab.closing = in_use > 0;
+	mtx_unlock(slab.mutex);
+
+	if (in_use) {
+		warning("mediasoup_bridge: %zu slab blocks still in use, "
+			"keeping %zu bytes of chunks until they are freed\n",
+			in_use, slab.chunk_bytes);
+		return;
+	}
+
+	slab_teardown();
+}
+
+
+/* Called with slab.mutex held. */
+static bool class_refill(struct slab_class *cls, uint32_t index)
+{
+	const size_t block = sizeof(struct slab_hdr) + cls->size;
+	const size_t count = MAX((size_t)1, (SLAB_CHUNK - SLAB_LINE) / block);
+	struct slab_chunk *chunk;
+	uint8_t *p;
+	size_t i;
+
+	chunk = aligned_alloc(SLAB_LINE, SLAB_LINE + count * block);
+	if (!chunk)
+		return false;
+
+	chunk->next = slab.chunks;
+	slab.chunks = chunk;
+	slab.chunk_bytes += SLAB_LINE + count * block;
+
+	p = (uint8_t *)chunk + SLAB_LINE;
+	for (i = 0; i < count; ++i, p += block) {
+		struct slab_hdr *hdr = (struct slab_hdr *)(void *)p;
+
+		hdr->magic = SLAB_MAGIC;
+		hdr->cls = index;
+		hdr->size = cls->size;
+		hdr->next = cls->free;
+		cls->free = hdr;
+	}
+	cls->cached += count;
+
+	return true;
+}
+
+
+/**
+ * Allocate a zeroed, cache-line aligned buffer
+ *
+ * Sizes above the largest class are served from the heap with the same
+ * alignment, so callers never need to know which path was taken.
+ *
+ * @param size  Size in bytes
+ *
+ * @return Buffer to release with ms_slab_free(), or NULL
+ */
+void *ms_slab_alloc(size_t size)
+{
+	struct slab_class *cls = NULL;
+	struct slab_hdr *hdr = NULL;
+	uint32_t i;
+
+	if (!size || !slab.mutex || slab.closing)
+		return NULL;
+
+	for (i = 0; i < MS_SLAB_CLASSES; ++i) {
+		if (size <= class_sizev[i]) {
+			cls = &slab.classv[i];
+			break;
+		}
+	}
+
+	if (!cls) {
+		const size_t total = sizeof(*hdr) +
+				     (size + SLAB_LINE - 1) / SLAB_LINE *
+				     SLAB_LINE;
+
+		hdr = aligned_alloc(SLAB_LINE, total);
+		if (!hdr)
+			return NULL;
+
+		hdr->magic = SLAB_MAGIC;
+		hdr->cls = SLAB_HUGE;
+		hdr->size = size;
+		mtx_lock(slab.mutex);
+		slab.huge_bytes += size;
+		++slab.huge_blocks;
+		mtx_unlock(slab.mutex);
+		memset(hdr + 1, 0, size);
+		return hdr + 1;
+	}
+
+	mtx_lock(slab.mutex);
+	if (cls->free || class_refill(cls, i)) {
+		hdr = cls->free;
+		cls->free = hdr->next;
+		--cls->cached;
+		++cls->in_use;
+		cls->peak = MAX(cls->peak, cls->in_use);
+	}
+	mtx_unlock(slab.mutex);
+
+	if (!hdr)
+		return NULL;
+
+	hdr->next = NULL;
+	memset(hdr + 1, 0, cls->size);
+	return hdr + 1;
+}
+
+
+void ms_slab_free(void *p)
+{
+	struct slab_hdr *hdr;
+	struct slab_class *cls;
+	bool huge;
+	bool last;
+
+	if (!p)
+		return;
+
+	hdr = (struct slab_hdr *)p - 1;
+	if (hdr->magic != SLAB_MAGIC || !slab.mutex) {
+		warning("mediasoup_bridge: ms_slab_free of foreign block\n");
+		return;
+	}
+
+	huge = hdr->cls == SLAB_HUGE;
+
+	mtx_lock(slab.mutex);
+	if (huge) {
+		slab.huge_bytes -= hdr->size;
+		--slab.huge_blocks;
+	}
+	else {
+		cls = &slab.classv[hdr->cls];
+		hdr->next = cls->free;
+		cls->free = hdr;
+		++cls->cached;
+		--cls->in_use;
+	}
+	last = slab.closing && !blocks_in_use();
+	mtx_unlock(slab.mutex);
+
+	if (huge)
+		free(hdr);
+
+	/* The last block out of a closed slab finishes the close. */
+	if (last)
+		slab_teardown();
+}
+
+
+/**
+ * Usable size of a block from ms_slab_alloc(), 0 for NULL
+ */
+size_t ms_slab_size(const void *p)
+{
+	const struct slab_hdr *hdr;
+
+	if (!p)
+		return 0;
+
+	hdr = (const struct slab_hdr *)p - 1;
+	return hdr->size;
+}
+
+
+void ms_slab_stat(struct ms_slab_stat *stat)
+{
+	size_t i;
+
+	if (!stat)
+		return;
+
+	memset(stat, 0, sizeof(*stat));
+	if (!slab.mutex)
+		return;
+
+	mtx_lock(slab.mutex);
+	for (i = 0; i < MS_SLAB_CLASSES; ++i) {
+		const struct slab_class *cls = &slab.classv[i];
+
+		stat->classv[i].size = cls->size;
+		stat->classv[i].in_use = cls->in_use;
+		stat->classv[i].cached = cls->cached;
+		stat->classv[i].peak = cls->peak;
+		stat->in_use_bytes += cls->in_use * cls->size;
+	}
+	stat->chunk_bytes = slab.chunk_bytes;
+	stat->huge_bytes = slab.huge_bytes;
+	mtx_unlock(slab.mutex);
+}
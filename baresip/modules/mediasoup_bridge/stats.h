@@ -0,0 +1,210 @@
+/**
+ * @file stats.h Lock-free statistics publication for bridge objects
+ *
+ * Counters and levels are written by exactly one thread per block: the TX
+ * mixer thread (serialized by ctx->mutex) for a context, the RX mixer
+ * thread for a context's RX clock, and the re main thread for an RX
+ * source.  Readers take a consistent snapshot through a
+ * sequence lock and never block the writer.
+ */
+
+#ifndef MS_STATS_H
+#define MS_STATS_H
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "level.h"
+
+
+enum {
+	MS_LATE_BUCKETS = 8,
+	MS_SEQ_SPINS    = 64,  /* busy-wait rounds before yielding */
+};
+
+
+struct ms_seqlock {
+	atomic_uint seq;
+};
+
+
+/* Mixer callback lateness against the ptime, one block per mixer clock. */
+struct ms_clock_stats {
+	uint64_t ticks;
+	uint64_t late_ticks;           /* later than MS_TICK_LATE_US */
+	uint64_t late_us_sum;
+	uint32_t late_us_max;
+	uint64_t late_histv[MS_LATE_BUCKETS];  /* ms_clock_bucket_us() */
+};
+
+
+struct ms_tx_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t last_frame_ms;
+	struct ms_level level;
+	uint64_t encodes;
+	uint64_t encode_us_sum;        /* opus_encode() and send */
+	uint32_t encode_us_max;
+};
+
+
+struct ms_rx_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t invalid;
+	uint64_t lost;
+	uint64_t plc_frames;
+	uint64_t decode_errors;
+	uint64_t last_rx_ms;
+	uint32_t latched_ssrc;
+	struct ms_level level;
+	double drift_ppm;
+	bool drift_locked;
+	bool kernel_ts;                /* last packet had a kernel stamp */
+	uint64_t dispatch_count;
+	uint64_t dispatch_us_sum;      /* kernel arrival to handler */
+	uint32_t dispatch_us_max;
+	uint64_t decodes;
+	uint64_t decode_us_sum;        /* opus_decode() */
+	uint32_t decode_us_max;
+};
+
+
+/*
+ * level accumulates every frame since the telemetry pass that last read
+ * it.  That pass sets level_restart and the writer starts the next window
+ * with its following frame; other readers see the running window.
+ */
+struct ms_tx_stats_block {
+	struct ms_seqlock lock;
+	atomic_bool level_restart;
+	struct ms_tx_stats v;
+};
+
+
+struct ms_rx_stats_block {
+	struct ms_seqlock lock;
+	atomic_bool level_restart;
+	struct ms_rx_stats v;
+};
+
+
+struct ms_clock_stats_block {
+	struct ms_seqlock lock;
+	struct ms_clock_stats v;
+};
+
+
+static inline void ms_seq_write_begin(struct ms_seqlock *sl)
+{
+	const unsigned seq = atomic_load_explicit(&sl->seq,
+						  memory_order_relaxed);
+
+	atomic_store_explicit(&sl->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+
+static inline void ms_seq_write_end(struct ms_seqlock *sl)
+{
+	const unsigned seq = atomic_load_explicit(&sl->seq,
+						  memory_order_relaxed);
+
+	atomic_store_explicit(&sl->seq, seq + 1, memory_order_release);
+}
+
+
+static inline void ms_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+
+static inline unsigned ms_seq_read_begin(const struct ms_seqlock *sl)
+{
+	unsigned spins = 0;
+	unsigned seq;
+
+	/*
+	 * Writer sections are a handful of stores, so an odd value is brief
+	 * unless the writer was preempted inside one; then stop spinning and
+	 * give it the CPU.
+	 */
+	while ((seq = atomic_load_explicit(&sl->seq,
+					   memory_order_acquire)) & 1) {
+		if (++spins < MS_SEQ_SPINS)
+			ms_cpu_relax();
+		else
+			sched_yield();
+	}
+
+	return seq;
+}
+
+
+static inline bool ms_seq_read_retry(const struct ms_seqlock *sl,
+				     unsigned seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&sl->seq, memory_order_relaxed) != seq;
+}
+
+
+/* Writer side, between ms_seq_write_begin() and ms_seq_write_end() */
+static inline void ms_level_window_add(struct ms_level *win,
+				       atomic_bool *restart,
+				       const struct ms_level *frame)
+{
+	if (atomic_exchange_explicit(restart, false, memory_order_relaxed) ||
+	    win->sampc > UINT32_MAX - frame->sampc)
+		*win = *frame;
+	else
+		ms_level_add(win, frame);
+}
+
+
+static inline void ms_tx_stats_read(const struct ms_tx_stats_block *b,
+				    struct ms_tx_stats *out)
+{
+	unsigned seq;
+
+	do {
+		seq = ms_seq_read_begin(&b->lock);
+		memcpy(out, &b->v, sizeof(*out));
+	} while (ms_seq_read_retry(&b->lock, seq));
+}
+
+
+static inline void ms_rx_stats_read(const struct ms_rx_stats_block *b,
+				    struct ms_rx_stats *out)
+{
+	unsigned seq;
+
+	do {
+		seq = ms_seq_read_begin(&b->lock);
+		memcpy(out, &b->v, sizeof(*out));
+	} while (ms_seq_read_retry(&b->lock, seq));
+}
+
+
+static inline void ms_clock_stats_read(const struct ms_clock_stats_block *b,
+				       struct ms_clock_stats *out)
+{
+	unsigned seq;
+
+	do {
+		seq = ms_seq_read_begin(&b->lock);
+		memcpy(out, &b->v, sizeof(*out));
+	} while (ms_seq_read_retry(&b->lock, seq));
+}
+
+#endif
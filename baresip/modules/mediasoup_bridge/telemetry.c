@@ -0,0 +1,711 @@
+/**
+ * @file telemetry.c Allocation-free periodic bridge telemetry
+ *
+ * The engine keeps a registry of every open context and its RX sources.
+ * Slots are added and removed as contexts and sources come and go, so the
+ * periodic tick only walks preallocated arrays: it performs no heap
+ * allocation and does not lock contexts in the common case.
+ *
+ * Slot pointers are borrowed.  Context and source destructors unregister
+ * before releasing memory, and the engine mutex serializes that against a
+ * running tick.  Lock order is engine -> ctx->mutex.  Under the mutex the
+ * tick only reads counters and formats the batch; the event, keepalive
+ * probes and error events run after it is released, on references taken
+ * from ms_contexts, so event handlers may call back into the bridge.  The
+ * stall watchdog walks the contexts the same way on its own timer.
+ *
+ * With the meter file open, every tick also writes the TX level of every
+ * context and the level of every source to it, and MS_TELEMETRY no longer
+ * reports level moves: only activity, mute and keepalive changes.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "mediasoup_bridge.h"
+
+
+enum {
+	TM_CONTEXT_MIN_CAPACITY = 8,
+	TM_SOURCE_MIN_CAPACITY  = 4,
+	TM_BATCH_HEADER_SIZE    = 64,
+	TM_BATCH_CONTEXT_SIZE   = 320,
+	TM_BATCH_SOURCE_SIZE    = 256,
+	TM_PASS_CHUNK           = 16,
+};
+
+
+struct tm_source {
+	struct ms_source *src;
+	uint64_t generation;
+	int shm_slot;
+	uint64_t sent_ms;
+	double dbfs_sent;
+	double dbfs_pending;         /* written to the batch, not yet sent */
+	bool active_sent;
+	bool active_pending;
+	bool pending;
+	bool sent;
+};
+
+
+struct tm_context {
+	struct ms_context *ctx;
+	uint64_t generation;
+	int shm_slot;
+	struct tm_source *srcv;
+	size_t srcc;
+	size_t src_capacity;
+	uint64_t due_ms;
+	uint32_t interval_ms;
+	uint64_t tx_sent_ms;
+	uint64_t rx_sent_ms;
+	double tx_dbfs_sent;
+	bool tx_active_sent;
+	bool tx_muted_sent;
+	bool tx_sent;
+	bool rx_active_sent;
+	bool rx_sent;
+};
+
+
+static struct {
+	mtx_t *mutex;
+	struct tm_context *ctxv;
+	size_t ctxc;
+	size_t ctx_capacity;
+	size_t sources;
+	struct mbuf *batch;
+	uint64_t generation;
+	uint64_t events;
+	uint64_t ticks;
+	uint64_t last_tick_us;
+	uint64_t max_tick_us;
+	uint64_t total_tick_us;
+} engine;
+
+
+int ms_telemetry_init(void)
+{
+	int err;
+
+	memset(&engine, 0, sizeof(engine));
+
+	engine.batch = mbuf_alloc(TM_BATCH_HEADER_SIZE);
+	if (!engine.batch)
+		return ENOMEM;
+
+	err = mutex_alloc(&engine.mutex);
+	if (err)
+		engine.batch = mem_deref(engine.batch);
+
+	return err;
+}
+
+
+void ms_telemetry_close(void)
+{
+	size_t i;
+
+	if (!engine.mutex)
+		return;
+
+	mtx_lock(engine.mutex);
+	for (i = 0; i < engine.ctxc; ++i)
+		mem_deref(engine.ctxv[i].srcv);
+	engine.ctxv = mem_deref(engine.ctxv);
+	engine.ctxc = 0;
+	engine.ctx_capacity = 0;
+	engine.sources = 0;
+	engine.batch = mem_deref(engine.batch);
+	mtx_unlock(engine.mutex);
+
+	engine.mutex = mem_deref(engine.mutex);
+}
+
+
+static int grow(void **arrayp, size_t *capacity, size_t count,
+		size_t min_capacity, size_t elem_size)
+{
+	size_t next;
+	void *array;
+
+	if (count < *capacity)
+		return 0;
+
+	next = *capacity ? *capacity * 2 : min_capacity;
+	array = mem_realloc(*arrayp, next * elem_size);
+	if (!array)
+		return ENOMEM;
+
+	memset((uint8_t *)array + *capacity * elem_size, 0,
+	       (next - *capacity) * elem_size);
+	*arrayp = array;
+	*capacity = next;
+	return 0;
+}
+
+
+/*
+ * Size the batch buffer for the worst case (every context and source
+ * changed) while registering.  The tick only appends an entry while its
+ * worst case fits the remaining space, so mbuf_printf() never has to grow
+ * the buffer.  A larger buffer replaces the old one instead of resizing
+ * it, as the last tick may still be emitting from it after releasing the
+ * mutex.
+ */
+static int reserve_batch(void)
+{
+	const size_t size = TM_BATCH_HEADER_SIZE +
+			    engine.ctx_capacity * TM_BATCH_CONTEXT_SIZE +
+			    (engine.sources + 1) * TM_BATCH_SOURCE_SIZE;
+	struct mbuf *mb;
+
+	if (engine.batch->size >= size)
+		return 0;
+
+	mb = mbuf_alloc(size);
+	if (!mb)
+		return ENOMEM;
+
+	mem_deref(engine.batch);
+	engine.batch = mb;
+	return 0;
+}
+
+
+static struct tm_context *context_slot(const struct ms_context *ctx)
+{
+	const size_t i = ctx->tm_slot;
+
+	return i < engine.ctxc && engine.ctxv[i].ctx == ctx
+		? &engine.ctxv[i] : NULL;
+}
+
+
+static struct tm_source *source_slot(struct tm_context *slot,
+				     const struct ms_source *src)
+{
+	const size_t i = src->tm_slot;
+
+	return slot && i < slot->srcc && slot->srcv[i].src == src
+		? &slot->srcv[i] : NULL;
+}
+
+
+int ms_telemetry_context_add(struct ms_context *ctx)
+{
+	struct tm_context *slot;
+	int err;
+
+	if (!ctx || !engine.mutex)
+		return EINVAL;
+
+	mtx_lock(engine.mutex);
+	if (context_slot(ctx)) {
+		mtx_unlock(engine.mutex);
+		return 0;
+	}
+
+	err = grow((void **)&engine.ctxv, &engine.ctx_capacity, engine.ctxc,
+		   TM_CONTEXT_MIN_CAPACITY, sizeof(*engine.ctxv));
+	if (!err)
+		err = reserve_batch();
+	if (err) {
+		mtx_unlock(engine.mutex);
+		return err;
+	}
+
+	ctx->tm_slot = engine.ctxc;
+	slot = &engine.ctxv[engine.ctxc++];
+	memset(slot, 0, sizeof(*slot));
+	slot->ctx = ctx;
+	slot->generation = ++engine.generation;
+	slot->shm_slot = -1;
+	mtx_unlock(engine.mutex);
+
+	return 0;
+}
+
+
+void ms_telemetry_context_remove(struct ms_context *ctx)
+{
+	struct tm_context *slot;
+	size_t i;
+
+	if (!ctx || !engine.mutex)
+		return;
+
+	mtx_lock(engine.mutex);
+	slot = context_slot(ctx);
+	if (slot) {
+		engine.sources -= slot->srcc;
+		ms_meter_shm_slot_free(slot->shm_slot);
+		for (i = 0; i < slot->srcc; ++i)
+			ms_meter_shm_slot_free(slot->srcv[i].shm_slot);
+		mem_deref(slot->srcv);
+		*slot = engine.ctxv[--engine.ctxc];
+		memset(&engine.ctxv[engine.ctxc], 0, sizeof(*slot));
+		if (slot->ctx)
+			slot->ctx->tm_slot = ctx->tm_slot;
+		++engine.generation;
+	}
+	mtx_unlock(engine.mutex);
+}
+
+
+int ms_telemetry_source_add(struct ms_source *src)
+{
+	struct tm_context *slot;
+	struct tm_source *sslot;
+	int err;
+
+	if (!src || !src->ctx || !engine.mutex)
+		return EINVAL;
+
+	mtx_lock(engine.mutex);
+	slot = context_slot(src->ctx);
+	if (!slot) {
+		mtx_unlock(engine.mutex);
+		return ENOENT;
+	}
+
+	if (source_slot(slot, src)) {
+		mtx_unlock(engine.mutex);
+		return 0;
+	}
+
+	err = grow((void **)&slot->srcv, &slot->src_capacity, slot->srcc,
+		   TM_SOURCE_MIN_CAPACITY, sizeof(*slot->srcv));
+	if (!err)
+		err = reserve_batch();
+	if (err) {
+		mtx_unlock(engine.mutex);
+		return err;
+	}
+
+	src->tm_slot = slot->srcc;
+	sslot = &slot->srcv[slot->srcc++];
+	memset(sslot, 0, sizeof(*sslot));
+	sslot->src = src;
+	sslot->generation = ++engine.generation;
+	sslot->shm_slot = -1;
+	++engine.sources;
+	mtx_unlock(engine.mutex);
+
+	return 0;
+}
+
+
+void ms_telemetry_source_remove(struct ms_source *src)
+{
+	struct tm_context *slot;
+	struct tm_source *sslot;
+
+	if (!src || !src->ctx || !engine.mutex)
+		return;
+
+	mtx_lock(engine.mutex);
+	slot = context_slot(src->ctx);
+	sslot = source_slot(slot, src);
+	if (sslot) {
+		ms_meter_shm_slot_free(sslot->shm_slot);
+		*sslot = slot->srcv[--slot->srcc];
+		memset(&slot->srcv[slot->srcc], 0, sizeof(*sslot));
+		if (sslot->src)
+			sslot->src->tm_slot = src->tm_slot;
+		--engine.sources;
+		++engine.generation;
+	}
+	mtx_unlock(engine.mutex);
+}
+
+
+static bool source_is_active(const struct ms_source *src,
+			     const struct ms_rx_stats *rx, double dbfs,
+			     uint64_t now)
+{
+	return src->active && rx->last_rx_ms &&
+	       now - rx->last_rx_ms <= MS_ACTIVITY_HOLD_MS &&
+	       dbfs > MS_ACTIVITY_DBFS;
+}
+
+
+static bool tx_is_active(const struct ms_tx_stats *tx, double dbfs,
+			 uint64_t now)
+{
+	return tx->last_frame_ms &&
+	       now - tx->last_frame_ms <= MS_ACTIVITY_HOLD_MS &&
+	       dbfs > MS_ACTIVITY_DBFS;
+}
+
+
+static bool level_moved(double level, double sent, double hysteresis_db)
+{
+	return fabs(level - sent) >= hysteresis_db;
+}
+
+
+/*
+ * Write a context's TX level and the levels of its sources to the meter
+ * file, whether due for MS_TELEMETRY or not.
+ */
+static void export_context(struct tm_context *slot, uint64_t now)
+{
+	struct ms_context *ctx = slot->ctx;
+	struct ms_tx_stats tx;
+	uint32_t flags;
+	double dbfs;
+	size_t i;
+
+	ms_tx_stats_read(&ctx->tx_stats, &tx);
+	dbfs = ms_level_dbfs(&tx.level);
+	flags = (tx_is_active(&tx, dbfs, now) ? METER_SHM_ACTIVE : 0) |
+		(ctx->tx_muted ? METER_SHM_MUTED : 0);
+
+	if (slot->shm_slot < 0)
+		slot->shm_slot = ms_meter_shm_slot_alloc();
+	ms_meter_shm_write(slot->shm_slot, ctx->key, NULL, flags, dbfs,
+			   tx.packets);
+
+	for (i = 0; i < slot->srcc; ++i) {
+		struct tm_source *sslot = &slot->srcv[i];
+		struct ms_source *src = sslot->src;
+		struct ms_rx_stats rx;
+
+		ms_rx_stats_read(&src->rx_stats, &rx);
+		dbfs = ms_level_dbfs(&rx.level);
+		flags = source_is_active(src, &rx, dbfs, now)
+			? METER_SHM_ACTIVE : 0;
+
+		if (sslot->shm_slot < 0)
+			sslot->shm_slot = ms_meter_shm_slot_alloc();
+		ms_meter_shm_write(sslot->shm_slot, ctx->key, src->producer_id,
+				   flags, dbfs, rx.packets);
+	}
+}
+
+
+static int batch_source(struct ms_source *src, bool active,
+			const struct ms_rx_stats *rx, double dbfs, bool first)
+{
+	return mbuf_printf(engine.batch,
+			   "%s{\"producerId\":\"%s\",\"active\":%s,"
+			   "\"dbfs\":%.1f,\"packets\":%llu}",
+			   first ? "" : ",", src->producer_id,
+			   active ? "true" : "false", dbfs,
+			   (unsigned long long)rx->packets);
+}
+
+
+/*
+ * Append one context entry to the batch if anything about it changed.
+ * Returns true when an entry was written.  The slot's sent state is only
+ * updated once the whole entry is in the batch.
+ *
+ * Configuration read here (tx_ready, tx_muted, source active state and the
+ * telemetry settings) is written by ctrl_tcp commands on the main thread,
+ * which is also the thread running the tick.
+ */
+static bool batch_context(struct tm_context *slot, uint64_t now, bool first)
+{
+	struct ms_context *ctx = slot->ctx;
+	struct ms_tx_stats tx;
+	const double hysteresis = ms_meter_shm_isopen()
+		? INFINITY : ctx->hysteresis_db;
+	const bool tx_muted = ctx->tx_muted;
+	double tx_dbfs;
+	const size_t start = engine.batch->end;
+	size_t sources = 0;
+	bool rx_active = false;
+	bool tx_active;
+	bool emit_tx;
+	bool emit_rx;
+	size_t i;
+	int err;
+
+	if (mbuf_get_space(engine.batch) < TM_BATCH_CONTEXT_SIZE +
+	    slot->srcc * TM_BATCH_SOURCE_SIZE)
+		return false;
+
+	/* Levels are accumulated as integers; dBFS is derived only here. */
+	ms_tx_stats_read(&ctx->tx_stats, &tx);
+	tx_dbfs = ms_level_dbfs(&tx.level);
+	tx_active = tx_is_active(&tx, tx_dbfs, now);
+
+	emit_tx = (ctx->tx_ready || atomic_load(&ctx->caller_count)) &&
+		  (!slot->tx_sent || tx_active != slot->tx_active_sent ||
+		   tx_muted != slot->tx_muted_sent ||
+		   level_moved(tx_dbfs, slot->tx_dbfs_sent, hysteresis) ||
+		   now - slot->tx_sent_ms >= MS_KEEPALIVE_MS);
+
+	err = mbuf_printf(engine.batch, "%s{\"key\":\"%s\"",
+			  first ? "" : ",", ctx->key);
+
+	if (emit_tx) {
+		err |= mbuf_printf(engine.batch,
+				   ",\"tx\":{\"active\":%s,\"muted\":%s,"
+				   "\"dbfs\":%.1f,\"packets\":%llu}",
+				   tx_active ? "true" : "false",
+				   tx_muted ? "true" : "false",
+				   tx_dbfs,
+				   (unsigned long long)tx.packets);
+	}
+
+	for (i = 0; i < slot->srcc; ++i) {
+		struct tm_source *sslot = &slot->srcv[i];
+		struct ms_source *src = sslot->src;
+		struct ms_rx_stats rx;
+		double dbfs;
+		bool active;
+
+		sslot->pending = false;
+
+		ms_rx_stats_read(&src->rx_stats, &rx);
+		dbfs = ms_level_dbfs(&rx.level);
+		active = source_is_active(src, &rx, dbfs, now);
+		rx_active |= active;
+
+		if (!src->active || !rx.last_rx_ms ||
+		    now - rx.last_rx_ms > MS_KEEPALIVE_MS)
+			continue;
+
+		if (sslot->sent && active == sslot->active_sent &&
+		    !level_moved(dbfs, sslot->dbfs_sent, hysteresis) &&
+		    now - sslot->sent_ms < MS_KEEPALIVE_MS)
+			continue;
+
+		sslot->pending = true;
+		sslot->active_pending = active;
+		sslot->dbfs_pending = dbfs;
+		if (!sources)
+			err |= mbuf_printf(engine.batch, ",\"sources\":[");
+		err |= batch_source(src, active, &rx, dbfs, !sources);
+		++sources;
+	}
+	if (sources)
+		err |= mbuf_printf(engine.batch, "]");
+
+	emit_rx = !slot->rx_sent || rx_active != slot->rx_active_sent ||
+		  now - slot->rx_sent_ms >= MS_KEEPALIVE_MS;
+	if (emit_rx) {
+		err |= mbuf_printf(engine.batch, ",\"rx\":{\"active\":%s}",
+				   rx_active ? "true" : "false");
+	}
+
+	err |= mbuf_printf(engine.batch, "}");
+
+	if (err || (!emit_tx && !emit_rx && !sources)) {
+		engine.batch->pos = start;
+		engine.batch->end = start;
+		return false;
+	}
+
+	if (emit_tx) {
+		slot->tx_sent = true;
+		slot->tx_sent_ms = now;
+		slot->tx_active_sent = tx_active;
+		slot->tx_muted_sent = tx_muted;
+		slot->tx_dbfs_sent = tx_dbfs;
+	}
+
+	for (i = 0; sources && i < slot->srcc; ++i) {
+		struct tm_source *sslot = &slot->srcv[i];
+
+		if (!sslot->pending)
+			continue;
+
+		sslot->sent = true;
+		sslot->sent_ms = now;
+		sslot->active_sent = sslot->active_pending;
+		sslot->dbfs_sent = sslot->dbfs_pending;
+	}
+
+	if (emit_rx) {
+		slot->rx_sent = true;
+		slot->rx_active_sent = rx_active;
+		slot->rx_sent_ms = now;
+	}
+
+	return true;
+}
+
+
+/* Start new level windows after a pass has read the current ones */
+static void restart_levels(struct tm_context *slot)
+{
+	size_t i;
+
+	atomic_store(&slot->ctx->tx_stats.level_restart, true);
+	for (i = 0; i < slot->srcc; ++i)
+		atomic_store(&slot->srcv[i].src->rx_stats.level_restart, true);
+}
+
+
+/* The parts of a pass that send or emit, without the engine mutex */
+static void context_pass(struct ms_context *ctx, uint64_t now)
+{
+	uint64_t error_generation;
+	char error[MS_ERROR_SIZE];
+	int error_number;
+
+	ms_context_keepalive(ctx, now);
+
+	error_generation = atomic_load(&ctx->error_generation);
+	if (error_generation == ctx->error_emitted_generation)
+		return;
+
+	mtx_lock(ctx->mutex);
+	str_ncpy(error, ctx->last_error, sizeof(error));
+	error_number = ctx->last_errno;
+	mtx_unlock(ctx->mutex);
+
+	ctx->error_emitted_generation = error_generation;
+	ms_emit_error(ctx->key, error, error_number);
+}
+
+
+/**
+ * Run a handler on every open context, without any lock held
+ *
+ * The list owns a reference to each member, so one can be taken under
+ * ms_contexts_mutex.  Contexts are taken in chunks by position; one opened
+ * or closed meanwhile may be visited twice or wait for the next pass, which
+ * the handler must allow.
+ *
+ * @param passh Handler, called with a reference held
+ * @param now   Current time in milliseconds
+ */
+void ms_contexts_pass(ms_context_pass_h *passh, uint64_t now)
+{
+	struct ms_context *ctxv[TM_PASS_CHUNK];
+	size_t pos = 0;
+	size_t n;
+	size_t i;
+
+	do {
+		struct le *le;
+
+		mtx_lock(ms_contexts_mutex);
+		le = ms_contexts.head;
+		for (i = 0; le && i < pos; ++i)
+			le = le->next;
+		for (n = 0; le && n < TM_PASS_CHUNK; le = le->next)
+			ctxv[n++] = mem_ref(le->data);
+		mtx_unlock(ms_contexts_mutex);
+
+		for (i = 0; i < n; ++i) {
+			passh(ctxv[i], now);
+			mem_deref(ctxv[i]);
+		}
+
+		pos += n;
+	} while (n == TM_PASS_CHUNK);
+}
+
+
+/**
+ * Run one telemetry pass and emit a single MS_TELEMETRY event carrying
+ * every due context that changed.
+ *
+ * @param now  Current time in milliseconds
+ *
+ * @return Delay in milliseconds until the next context is due
+ */
+uint64_t ms_telemetry_tick(uint64_t now)
+{
+	uint64_t next = MS_TELEMETRY_MS;
+	struct mbuf *mb = NULL;
+	uint64_t start;
+	uint64_t cost;
+	size_t entries = 0;
+	size_t i;
+
+	if (!engine.mutex)
+		return next;
+
+	start = tmr_jiffies_usec();
+
+	mtx_lock(engine.mutex);
+	mbuf_rewind(engine.batch);
+	(void)mbuf_printf(engine.batch, "{\"contexts\":[");
+
+	for (i = 0; i < engine.ctxc; ++i) {
+		struct tm_context *slot = &engine.ctxv[i];
+
+		if (ms_meter_shm_isopen())
+			export_context(slot, now);
+
+		/* A reconfigured interval takes effect immediately. */
+		if (slot->interval_ms != slot->ctx->telemetry_ms) {
+			slot->interval_ms = slot->ctx->telemetry_ms;
+			slot->due_ms = now;
+		}
+
+		if (now >= slot->due_ms) {
+			slot->due_ms = now + slot->interval_ms;
+			if (batch_context(slot, now, !entries))
+				++entries;
+			restart_levels(slot);
+		}
+		else if (ms_meter_shm_isopen()) {
+			restart_levels(slot);
+		}
+
+		next = MIN(next, slot->due_ms - now);
+	}
+
+	ms_meter_shm_commit();
+
+	if (entries) {
+		(void)mbuf_printf(engine.batch, "]}");
+		mb = mem_ref(engine.batch);
+		++engine.events;
+	}
+
+	cost = tmr_jiffies_usec() - start;
+	++engine.ticks;
+	engine.last_tick_us = cost;
+	engine.total_tick_us += cost;
+	if (cost > engine.max_tick_us)
+		engine.max_tick_us = cost;
+	mtx_unlock(engine.mutex);
+
+	if (mb) {
+		module_event("mediasoup_bridge", "MS_TELEMETRY", NULL, NULL,
+			     "%b", mb->buf, mb->end);
+		mem_deref(mb);
+	}
+
+	ms_contexts_pass(context_pass, now);
+
+	return MAX(next, (uint64_t)MS_TELEMETRY_MIN_MS);
+}
+
+
+void ms_telemetry_stat(struct ms_telemetry_stat *stat)
+{
+	size_t i;
+
+	if (!stat)
+		return;
+
+	memset(stat, 0, sizeof(*stat));
+	if (!engine.mutex)
+		return;
+
+	mtx_lock(engine.mutex);
+	stat->contexts = engine.ctxc;
+	stat->sources = engine.sources;
+	stat->context_capacity = engine.ctx_capacity;
+	for (i = 0; i < engine.ctxc; ++i)
+		stat->source_capacity += engine.ctxv[i].src_capacity;
+	stat->generation = engine.generation;
+	stat->events = engine.events;
+	stat->ticks = engine.ticks;
+	stat->last_tick_us = engine.last_tick_us;
+	stat->max_tick_us = engine.max_tick_us;
+	stat->avg_tick_us = engine.ticks
+		? engine.total_tick_us / engine.ticks : 0;
+	mtx_unlock(engine.mutex);
+}
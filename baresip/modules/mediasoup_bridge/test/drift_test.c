@@ -0,0 +1,166 @@
+/**
+ * @file drift_test.c Clock drift estimator and resampler test
+ *
+ * Feeds ten minutes of 20 ms packets from senders running 80 ppm fast and
+ * slow, with up to 15 ms of random network jitter, and checks that the
+ * estimate locks onto the true ratio, that the resampler's output rate
+ * follows it, that an unlocked resampler is bit exact and that timestamp
+ * jumps restart the estimator instead of corrupting it.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "drift.h"
+
+
+enum {
+	TEST_SRATE   = 48000,
+	TEST_CH      = 2,
+	TEST_FRAMES  = 960,
+	TEST_PACKETS = 30000,
+};
+
+
+static int16_t srcv[TEST_FRAMES * TEST_CH];
+static int16_t dstv[(TEST_FRAMES + 2) * TEST_CH];
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+static uint32_t rnd(uint32_t *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+
+/* Sender clock off by ppm; arrival = send time + 2 ms + 0..15 ms jitter. */
+static void feed(struct ms_drift *d, double ppm, uint32_t ts0,
+		 uint64_t *now_us, unsigned packets)
+{
+	const double period_us = 20000.0 / (1.0 + ppm * 1e-6);
+	uint32_t seed = 0xc0ffee;
+	double send_us = (double)*now_us;
+	unsigned i;
+
+	for (i = 0; i < packets; ++i) {
+		const uint64_t arrive = (uint64_t)send_us + 2000 +
+					rnd(&seed) % 15000;
+
+		ms_drift_update(d, ts0 + i * TEST_FRAMES, arrive);
+		send_us += period_us;
+	}
+
+	*now_us = (uint64_t)send_us;
+}
+
+
+static void test_estimate(double ppm)
+{
+	struct ms_drift d;
+	uint64_t now = 1000000;
+	size_t out = 0;
+	size_t in = 0;
+	double ratio;
+	unsigned i;
+
+	ms_drift_init(&d, TEST_SRATE);
+	feed(&d, ppm, 0xfffff000u, &now, TEST_PACKETS);
+
+	CHECK(d.locked);
+	CHECK(fabs(d.ppm - ppm) < 5.0);
+
+	for (i = 0; i < TEST_FRAMES * TEST_CH; ++i)
+		srcv[i] = (int16_t)(i * 7);
+
+	for (i = 0; i < TEST_PACKETS; ++i) {
+		const size_t n = ms_drift_resample(&d, dstv, TEST_FRAMES + 2,
+						   srcv, TEST_FRAMES, TEST_CH);
+
+		CHECK(n + 1 >= TEST_FRAMES && n <= TEST_FRAMES + 1);
+		out += n;
+		in += TEST_FRAMES;
+	}
+
+	/* A fast sender (positive ppm) must be squeezed. */
+	ratio = (double)out / (double)in;
+	CHECK(fabs((1.0 - ratio) * 1e6 - d.ppm) < 1.0);
+
+	printf("drift_test ppm=%+.0f estimate=%+.2f output_ratio_ppm=%+.2f\n",
+	       ppm, d.ppm, (1.0 - ratio) * 1e6);
+}
+
+
+static void test_unlocked_identity(void)
+{
+	struct ms_drift d;
+	size_t n;
+	unsigned i;
+
+	ms_drift_init(&d, TEST_SRATE);
+
+	for (i = 0; i < TEST_FRAMES * TEST_CH; ++i)
+		srcv[i] = (int16_t)(i * 31 - 20000);
+
+	/* The first call emits the zero history frame, then the chunk. */
+	n = ms_drift_resample(&d, dstv, TEST_FRAMES + 2, srcv, TEST_FRAMES,
+			      TEST_CH);
+	CHECK(n == TEST_FRAMES);
+	CHECK(dstv[0] == 0 && dstv[1] == 0);
+	CHECK(!memcmp(&dstv[TEST_CH], srcv,
+		      (TEST_FRAMES - 1) * TEST_CH * sizeof(srcv[0])));
+
+	n = ms_drift_resample(&d, dstv, TEST_FRAMES + 2, srcv, TEST_FRAMES,
+			      TEST_CH);
+	CHECK(n == TEST_FRAMES);
+	CHECK(!memcmp(dstv, &srcv[(TEST_FRAMES - 1) * TEST_CH],
+		      TEST_CH * sizeof(srcv[0])));
+}
+
+
+static void test_restart(void)
+{
+	struct ms_drift d;
+	uint64_t now = 1000000;
+
+	ms_drift_init(&d, TEST_SRATE);
+	feed(&d, 80.0, 1000, &now, 3000);
+	CHECK(d.locked);
+
+	/* A new timestamp base forgets the history but keeps running. */
+	feed(&d, -80.0, 0x80000000u, &now, 10);
+	CHECK(!d.locked);
+	CHECK(d.winc == 0);
+
+	feed(&d, -80.0, 0x80000000u + 10 * TEST_FRAMES, &now, 3000);
+	CHECK(d.locked);
+	CHECK(fabs(d.ppm + 80.0) < 5.0);
+}
+
+
+int main(void)
+{
+	test_estimate(80.0);
+	test_estimate(-80.0);
+	test_estimate(0.0);
+	test_unlocked_identity();
+	test_restart();
+
+	if (failures) {
+		fprintf(stderr, "drift_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("drift_test ok\n");
+	return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * @file latency_test.c Loopback latency marker and percentile test
+ *
+ * Checks the nearest-rank percentiles of the latency series, including
+ * after the ring wraps, and that a marker written into silence is found
+ * again after an Opus round trip with the bridge's encoder settings at
+ * every supported ptime: never in the silence before it, and inside the
+ * frame decoded from the marker packet.  The onset offset within that
+ * frame is the codec delay that loopback runs count as playout.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <opus/opus.h>
+
+#include "latency.h"
+
+
+enum {
+	TEST_SRATE      = 48000,
+	TEST_CH         = 2,
+	TEST_BITRATE    = 64000,
+	TEST_LEAD       = 25,
+	TEST_MAX_FRAMES = 2880,
+	TEST_MAX_PACKET = 4000,
+};
+
+
+static int16_t inv[TEST_MAX_FRAMES * TEST_CH];
+static int16_t outv[TEST_MAX_FRAMES * TEST_CH];
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+static void test_percentiles(void)
+{
+	struct ms_lat_series s;
+	struct ms_lat_summary sum;
+	unsigned i;
+
+	memset(&s, 0, sizeof(s));
+	ms_lat_summarise(&s, &sum);
+	CHECK(sum.count == 0 && sum.max_us == 0);
+
+	/* Added out of order on purpose. */
+	for (i = 100; i >= 1; --i)
+		ms_lat_add(&s, i);
+
+	ms_lat_summarise(&s, &sum);
+	CHECK(sum.count == 100);
+	CHECK(sum.min_us == 1);
+	CHECK(sum.p50_us == 50);
+	CHECK(sum.p90_us == 90);
+	CHECK(sum.p99_us == 99);
+	CHECK(sum.max_us == 100);
+
+	/* Only the newest MS_LAT_SAMPLES values count once the ring wraps. */
+	memset(&s, 0, sizeof(s));
+	for (i = 0; i < MS_LAT_SAMPLES; ++i)
+		ms_lat_add(&s, 1000000);
+	for (i = 1; i <= MS_LAT_SAMPLES; ++i)
+		ms_lat_add(&s, i);
+
+	ms_lat_summarise(&s, &sum);
+	CHECK(sum.count == MS_LAT_SAMPLES);
+	CHECK(sum.min_us == 1);
+	CHECK(sum.max_us == MS_LAT_SAMPLES);
+	CHECK(sum.p50_us == MS_LAT_SAMPLES / 2);
+
+	ms_lat_add(&s, UINT64_MAX);
+	ms_lat_summarise(&s, &sum);
+	CHECK(sum.max_us == UINT32_MAX);
+}
+
+
+static void test_marker(void)
+{
+	size_t onset = 1;
+
+	memset(inv, 0, sizeof(inv));
+	CHECK(!ms_lat_onset(inv, 960, TEST_CH, &onset));
+
+	ms_lat_marker(inv, 960, TEST_CH, TEST_SRATE);
+	CHECK(ms_lat_onset(inv, 960, TEST_CH, &onset));
+	CHECK(onset == 0);
+
+	/* A marker in the second half is found where it starts. */
+	memset(inv, 0, sizeof(inv));
+	ms_lat_marker(inv + 480 * TEST_CH, 480, TEST_CH, TEST_SRATE);
+	CHECK(ms_lat_onset(inv, 960, TEST_CH, &onset));
+	CHECK(onset == 480);
+}
+
+
+static void test_codec(uint32_t ptime)
+{
+	const size_t frames = TEST_SRATE * ptime / 1000;
+	uint8_t packet[TEST_MAX_PACKET];
+	OpusEncoder *enc;
+	OpusDecoder *dec;
+	size_t onset = 0;
+	bool early = false;
+	bool found = false;
+	int err;
+	int len;
+	int n;
+	unsigned i;
+
+	enc = opus_encoder_create(TEST_SRATE, TEST_CH, OPUS_APPLICATION_VOIP,
+				  &err);
+	dec = opus_decoder_create(TEST_SRATE, TEST_CH, &err);
+	CHECK(enc && dec);
+	if (!enc || !dec)
+		goto out;
+
+	opus_encoder_ctl(enc, OPUS_SET_BITRATE(TEST_BITRATE));
+	opus_encoder_ctl(enc, OPUS_SET_VBR(1));
+	opus_encoder_ctl(enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+
+	for (i = 0; i <= TEST_LEAD; ++i) {
+		memset(inv, 0, sizeof(inv));
+		if (i == TEST_LEAD)
+			ms_lat_marker(inv, frames, TEST_CH, TEST_SRATE);
+
+		len = opus_encode(enc, inv, (int)frames, packet,
+				  sizeof(packet));
+		CHECK(len > 0);
+		if (len <= 0)
+			goto out;
+
+		n = opus_decode(dec, packet, len, outv, (int)frames, 0);
+		CHECK(n == (int)frames);
+		if (n != (int)frames)
+			goto out;
+
+		if (i < TEST_LEAD)
+			early |= ms_lat_onset(outv, frames, TEST_CH, NULL);
+		else
+			found = ms_lat_onset(outv, frames, TEST_CH, &onset);
+	}
+
+	CHECK(!early);
+	CHECK(found);
+	printf("latency_test ptime=%u codec_delay_us=%zu\n", ptime,
+	       onset * 1000000 / TEST_SRATE);
+
+out:
+	if (enc)
+		opus_encoder_destroy(enc);
+	if (dec)
+		opus_decoder_destroy(dec);
+}
+
+
+int main(void)
+{
+	test_percentiles();
+	test_marker();
+	test_codec(10);
+	test_codec(20);
+	test_codec(40);
+	test_codec(60);
+
+	if (failures) {
+		fprintf(stderr, "latency_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("latency_test ok\n");
+	return 0;
+}
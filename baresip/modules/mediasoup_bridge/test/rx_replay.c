@@ -0,0 +1,767 @@
+/**
+ * @file rx_replay.c Replay a captured producer stream through the RX path
+ *
+ * Reads one RTP stream from a pcap or rtpdump file and feeds it to a
+ * mediasoup_bridge source with ms_source_inject().  The jitter buffer and
+ * decode timers run on a virtual clock that follows the capture
+ * timestamps, so a replay is repeatable and by default runs as fast as the
+ * CPU allows; -r paces it in real time instead.
+ *
+ * The harness links the module into a bare libre/libbaresip process and
+ * defines tmr_jiffies() and tmr_jiffies_usec() itself.  With libre as a
+ * shared library these also replace the clock inside jbuf and the timer
+ * list.  It defines aumix_source_put() too, so the PCM that would reach
+ * the mixer is hashed instead of mixed.
+ *
+ * Prints the jitter-buffer state every -i ms of stream time as JSON lines,
+ * then one summary line: decode throughput, lost and PLC counts, jitter
+ * buffer counters and an FNV-1a hash of the PCM handed to the mixer.
+ *
+ *   mediasoup_bridge_rx_replay [-s ssrc] [-u udp port] [-i interval ms]
+ *                              [-r] [-P first RTP port] file
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "mediasoup_bridge.h"
+
+
+enum {
+	REPLAY_STEP_US     = 1000,
+	REPLAY_DRAIN_MS    = 1000,
+	REPLAY_INTERVAL_MS = 1000,
+	REPLAY_PORT_FIRST  = 41000,
+
+	PCAP_HDR_SIZE      = 24,
+	PCAP_REC_SIZE      = 16,
+	RTPDUMP_HDR_SIZE   = 16,
+	RTPDUMP_REC_SIZE   = 8,
+
+	LINKTYPE_NULL      = 0,
+	LINKTYPE_ETHERNET  = 1,
+	LINKTYPE_RAW       = 101,
+	LINKTYPE_LINUX_SLL = 113,
+	LINKTYPE_IPV4      = 228,
+	LINKTYPE_IPV6      = 229,
+	LINKTYPE_SLL2      = 276,
+};
+
+/* Virtual time starts well above zero; jbuf treats 0 as unset. */
+#define REPLAY_CLOCK_BASE_US 1000000000ULL
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+
+enum replay_format {
+	FMT_PCAP,
+	FMT_RTPDUMP,
+};
+
+
+struct reader {
+	const uint8_t *buf;
+	size_t size;
+	size_t pos;
+	enum replay_format fmt;
+	bool be;
+	bool nsec;
+	uint32_t linktype;
+};
+
+
+struct packet {
+	uint64_t t_us;
+	struct rtp_header hdr;
+	struct mbuf *mb;
+};
+
+
+static struct {
+	const char *path;
+	uint32_t ssrc;
+	uint16_t udp_port;
+	uint32_t interval_ms;
+	bool realtime;
+	uint16_t port_first;
+
+	uint8_t *file;
+	struct reader rd;
+	struct ms_context *ctx;
+	struct ms_source *src;
+	uint8_t pt;
+	uint64_t t_first;
+	uint64_t selected;
+	uint64_t skipped;
+	uint64_t pcm_samples;
+	uint64_t pcm_hash;
+	uint64_t delay_ms_sum;
+	uint64_t delay_samples;
+	uint32_t delay_ms_max;
+} replay;
+
+
+static atomic_uint_fast64_t vclock_us = REPLAY_CLOCK_BASE_US;
+
+
+/* Replaces libre's clock for the whole process. */
+uint64_t tmr_jiffies_usec(void)
+{
+	return atomic_load(&vclock_us);
+}
+
+
+uint64_t tmr_jiffies(void)
+{
+	return atomic_load(&vclock_us) / 1000;
+}
+
+
+/* Replaces the libre mixer input: hash what the mixer would be given. */
+int aumix_source_put(struct aumix_source *src, const int16_t *sampv,
+		     size_t sampc)
+{
+	uint64_t h = replay.pcm_hash;
+	size_t i;
+	(void)src;
+
+	/* Little-endian bytes, so hosts of either order agree. */
+	for (i = 0; i < sampc; ++i) {
+		const uint16_t v = (uint16_t)sampv[i];
+
+		h = (h ^ (v & 0xff)) * FNV_PRIME;
+		h = (h ^ (v >> 8)) * FNV_PRIME;
+	}
+
+	replay.pcm_hash = h;
+	replay.pcm_samples += sampc;
+
+	return 0;
+}
+
+
+/* Forward only: capture timestamps may step back a little. */
+static void clock_advance(uint64_t us)
+{
+	if (us > atomic_load(&vclock_us))
+		atomic_store(&vclock_us, us);
+}
+
+
+static uint16_t get16(const uint8_t *p, bool be)
+{
+	return be ? (uint16_t)(p[0] << 8 | p[1])
+		  : (uint16_t)(p[1] << 8 | p[0]);
+}
+
+
+static uint32_t get32(const uint8_t *p, bool be)
+{
+	return be ? (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		    (uint32_t)p[2] << 8 | p[3]
+		  : (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 |
+		    (uint32_t)p[1] << 8 | p[0];
+}
+
+
+static int reader_open(struct reader *rd, const uint8_t *buf, size_t size)
+{
+	static const char rtpdump_magic[] = "#!rtpplay1.0 ";
+	const uint8_t *nl;
+
+	memset(rd, 0, sizeof(*rd));
+	rd->buf = buf;
+	rd->size = size;
+
+	if (size >= sizeof(rtpdump_magic) - 1 &&
+	    !memcmp(buf, rtpdump_magic, sizeof(rtpdump_magic) - 1)) {
+
+		nl = memchr(buf, '\n', size);
+		if (!nl || (size_t)(nl + 1 - buf) + RTPDUMP_HDR_SIZE > size)
+			return EBADMSG;
+
+		rd->fmt = FMT_RTPDUMP;
+		rd->be = true;
+		rd->pos = (size_t)(nl + 1 - buf) + RTPDUMP_HDR_SIZE;
+		return 0;
+	}
+
+	if (size < PCAP_HDR_SIZE)
+		return EBADMSG;
+
+	switch (get32(buf, false)) {
+
+	case 0xa1b2c3d4: rd->be = false; rd->nsec = false; break;
+	case 0xa1b23c4d: rd->be = false; rd->nsec = true;  break;
+	case 0xd4c3b2a1: rd->be = true;  rd->nsec = false; break;
+	case 0x4d3cb2a1: rd->be = true;  rd->nsec = true;  break;
+
+	case 0x0a0d0d0a:
+		fprintf(stderr, "rx_replay: pcapng is not supported, "
+			"convert with 'editcap -F pcap'\n");
+		return ENOTSUP;
+
+	default:
+		return EBADMSG;
+	}
+
+	rd->fmt = FMT_PCAP;
+	rd->linktype = get32(buf + 20, rd->be) & 0xffff;
+	rd->pos = PCAP_HDR_SIZE;
+
+	return 0;
+}
+
+
+/* Strip link, IP and UDP headers; false if the frame is not plain UDP. */
+static bool frame_udp(uint32_t linktype, const uint8_t *p, size_t len,
+		      const uint8_t **payload, size_t *payload_len,
+		      uint16_t *dport)
+{
+	size_t off;
+	size_t ulen;
+	uint16_t ethertype = 0;
+
+	switch (linktype) {
+
+	case LINKTYPE_ETHERNET:
+		if (len < 14)
+			return false;
+		ethertype = get16(p + 12, true);
+		off = 14;
+		while (ethertype == 0x8100 || ethertype == 0x88a8) {
+			if (len < off + 4)
+				return false;
+			ethertype = get16(p + off + 2, true);
+			off += 4;
+		}
+		break;
+
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return false;
+		ethertype = get16(p + 14, true);
+		off = 16;
+		break;
+
+	case LINKTYPE_SLL2:
+		if (len < 20)
+			return false;
+		ethertype = get16(p, true);
+		off = 20;
+		break;
+
+	case LINKTYPE_NULL:
+		off = 4;
+		break;
+
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		off = 0;
+		break;
+
+	default:
+		return false;
+	}
+
+	if (ethertype && ethertype != 0x0800 && ethertype != 0x86dd)
+		return false;
+	if (len <= off)
+		return false;
+
+	p += off;
+	len -= off;
+
+	switch (p[0] >> 4) {
+
+	case 4:
+		off = (size_t)(p[0] & 0x0f) * 4;
+		if (off < 20 || len < off || p[9] != IPPROTO_UDP)
+			return false;
+		/* Fragments are not reassembled. */
+		if (get16(p + 6, true) & 0x3fff)
+			return false;
+		break;
+
+	case 6:
+		/* No extension headers. */
+		off = 40;
+		if (len < off || p[6] != IPPROTO_UDP)
+			return false;
+		break;
+
+	default:
+		return false;
+	}
+
+	if (len < off + 8)
+		return false;
+
+	ulen = get16(p + off + 4, true);
+	if (ulen < 8 || off + ulen > len)
+		return false;
+
+	*dport = get16(p + off + 2, true);
+	*payload = p + off + 8;
+	*payload_len = ulen - 8;
+
+	return true;
+}
+
+
+/* Next UDP payload or RTP packet; ENODATA at the end of the file. */
+static int reader_next(struct reader *rd, uint64_t *t_us, const uint8_t **p,
+		       size_t *len, uint16_t *dport)
+{
+	for (;;) {
+		const uint8_t *rec = rd->buf + rd->pos;
+		const size_t left = rd->size - rd->pos;
+		size_t size;
+
+		if (!left)
+			return ENODATA;
+
+		if (rd->fmt == FMT_RTPDUMP) {
+			if (left < RTPDUMP_REC_SIZE)
+				return EBADMSG;
+
+			size = get16(rec, true);
+			if (size < RTPDUMP_REC_SIZE || size > left)
+				return EBADMSG;
+			rd->pos += size;
+
+			/* plen 0 marks RTCP. */
+			if (!get16(rec + 2, true))
+				continue;
+
+			*t_us = (uint64_t)get32(rec + 4, true) * 1000;
+			*p = rec + RTPDUMP_REC_SIZE;
+			*len = size - RTPDUMP_REC_SIZE;
+			*dport = 0;
+			return 0;
+		}
+
+		if (left < PCAP_REC_SIZE)
+			return EBADMSG;
+
+		size = get32(rec + 8, rd->be);
+		if (size > left - PCAP_REC_SIZE)
+			return EBADMSG;
+		rd->pos += PCAP_REC_SIZE + size;
+
+		*t_us = (uint64_t)get32(rec, rd->be) * 1000000 +
+			(rd->nsec ? get32(rec + 4, rd->be) / 1000
+				  : get32(rec + 4, rd->be));
+
+		if (frame_udp(rd->linktype, rec + PCAP_REC_SIZE, size, p, len,
+			      dport))
+			return 0;
+	}
+}
+
+
+/* The first RTP packet (or the -s SSRC) selects the stream. */
+static int packet_next(struct packet *pkt)
+{
+	for (;;) {
+		const uint8_t *p;
+		uint64_t t_us;
+		uint16_t dport;
+		size_t len;
+		int err;
+
+		err = reader_next(&replay.rd, &t_us, &p, &len, &dport);
+		if (err)
+			return err;
+
+		if (len < RTP_HEADER_SIZE || (p[0] >> 6) != RTP_VERSION ||
+		    (replay.udp_port && dport != replay.udp_port))
+			goto skip;
+
+		/* RTCP multiplexed on the RTP port (RFC 5761). */
+		if (p[1] >= 192 && p[1] <= 223)
+			goto skip;
+
+		pkt->mb = mem_deref(pkt->mb);
+		pkt->mb = mbuf_alloc(len);
+		if (!pkt->mb)
+			return ENOMEM;
+
+		(void)mbuf_write_mem(pkt->mb, p, len);
+		pkt->mb->pos = 0;
+
+		if (rtp_hdr_decode(&pkt->hdr, pkt->mb))
+			goto skip;
+
+		if (!replay.selected) {
+			if (replay.ssrc && pkt->hdr.ssrc != replay.ssrc)
+				goto skip;
+
+			replay.ssrc = pkt->hdr.ssrc;
+			replay.pt = pkt->hdr.pt;
+			replay.t_first = t_us;
+		}
+		else if (pkt->hdr.ssrc != replay.ssrc) {
+			goto skip;
+		}
+
+		++replay.selected;
+		pkt->t_us = REPLAY_CLOCK_BASE_US +
+			(t_us > replay.t_first ? t_us - replay.t_first : 0);
+		return 0;
+
+	skip:
+		++replay.skipped;
+	}
+}
+
+
+static int source_open(void)
+{
+	struct sa remote;
+	int err;
+
+	err = ms_context_get_or_create(&replay.ctx, "replay", NULL);
+	if (err)
+		return err;
+
+	err = ms_source_reserve(replay.ctx, "replay", &replay.src, NULL);
+	if (err)
+		return err;
+
+	/* Probes go to discard; injected packets claim this peer. */
+	(void)sa_set_str(&remote, "127.0.0.1", 9);
+
+	return ms_source_activate(replay.src, &remote, replay.pt, replay.ssrc,
+				  NULL);
+}
+
+
+static void sample_print(uint64_t t_ms)
+{
+	struct jbuf_stat jstat;
+	struct ms_rx_stats rx;
+
+	memset(&jstat, 0, sizeof(jstat));
+	if (replay.src->jbuf)
+		(void)jbuf_stats(replay.src->jbuf, &jstat);
+	ms_rx_stats_read(&replay.src->rx_stats, &rx);
+
+	replay.delay_ms_sum += jstat.c_delay;
+	++replay.delay_samples;
+	replay.delay_ms_max = MAX(replay.delay_ms_max, jstat.c_delay);
+
+	if (!replay.interval_ms)
+		return;
+
+	printf("{\"tMs\":%llu,\"jbufDelayMs\":%u,\"jbufPackets\":%u,"
+	       "\"lost\":%llu,\"plcFrames\":%llu,\"late\":%u}\n",
+	       (unsigned long long)t_ms, jstat.c_delay, jstat.c_packets,
+	       (unsigned long long)rx.lost, (unsigned long long)rx.plc_frames,
+	       jstat.c_late);
+}
+
+
+static uint64_t mono_usec(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+static uint64_t cpu_usec(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+	       (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+
+static void pace(uint64_t start_us, uint64_t stream_us)
+{
+	const uint64_t due = start_us + stream_us;
+	struct timespec ts = {
+		.tv_sec  = (time_t)(due / 1000000),
+		.tv_nsec = (long)(due % 1000000) * 1000,
+	};
+
+	(void)clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+
+static void report(uint64_t stream_us, uint64_t wall_us, uint64_t cpu_us)
+{
+	struct jbuf_stat jstat;
+	struct ms_rx_stats rx;
+
+	memset(&jstat, 0, sizeof(jstat));
+	if (replay.src->jbuf)
+		(void)jbuf_stats(replay.src->jbuf, &jstat);
+	ms_rx_stats_read(&replay.src->rx_stats, &rx);
+
+	printf("{\"replay\":\"%s\",\"format\":\"%s\",\"ssrc\":%u,\"pt\":%u,"
+	       "\"packets\":%llu,\"skipped\":%llu,\"streamMs\":%llu,"
+	       "\"wallMs\":%llu,\"cpuMs\":%llu,\"realtimeFactor\":%.1f,"
+	       "\"decodesPerSecond\":%.1f,",
+	       replay.path, replay.rd.fmt == FMT_RTPDUMP ? "rtpdump" : "pcap",
+	       replay.ssrc, replay.pt,
+	       (unsigned long long)replay.selected,
+	       (unsigned long long)replay.skipped,
+	       (unsigned long long)(stream_us / 1000),
+	       (unsigned long long)(wall_us / 1000),
+	       (unsigned long long)(cpu_us / 1000),
+	       wall_us ? (double)stream_us / (double)wall_us : 0.0,
+	       wall_us ? (double)rx.decodes * 1e6 / (double)wall_us : 0.0);
+
+	printf("\"rx\":{\"packets\":%llu,\"invalid\":%llu,\"lost\":%llu,"
+	       "\"plcFrames\":%llu,\"decodes\":%llu,\"decodeErrors\":%llu,"
+	       "\"driftPpm\":%.1f},",
+	       (unsigned long long)rx.packets, (unsigned long long)rx.invalid,
+	       (unsigned long long)rx.lost, (unsigned long long)rx.plc_frames,
+	       (unsigned long long)rx.decodes,
+	       (unsigned long long)rx.decode_errors, rx.drift_ppm);
+
+	printf("\"jbuf\":{\"late\":%u,\"lost\":%u,\"overflow\":%u,"
+	       "\"underflow\":%u,\"flush\":%u,\"avgDelayMs\":%llu,"
+	       "\"maxDelayMs\":%u},",
+	       jstat.c_late, jstat.c_lost, jstat.c_overflow,
+	       jstat.c_underflow, jstat.c_flush,
+	       (unsigned long long)(replay.delay_samples
+				    ? replay.delay_ms_sum /
+				      replay.delay_samples
+				    : 0),
+	       replay.delay_ms_max);
+
+	printf("\"pcm\":{\"samples\":%llu,\"fnv1a\":\"%016llx\"}}\n",
+	       (unsigned long long)replay.pcm_samples,
+	       (unsigned long long)replay.pcm_hash);
+}
+
+
+static int replay_run(void)
+{
+	struct tmrl *tmrl = re_tmrl_get();
+	struct packet pkt = {0};
+	uint64_t end = UINT64_MAX;
+	uint64_t next_sample;
+	uint64_t wall_us;
+	uint64_t cpu_us;
+	uint64_t now;
+	bool have;
+	int err;
+
+	err = packet_next(&pkt);
+	if (err == ENODATA) {
+		fprintf(stderr, "rx_replay: no RTP stream in %s\n",
+			replay.path);
+		return err;
+	}
+	if (err)
+		goto out;
+
+	err = source_open();
+	if (err)
+		goto out;
+
+	replay.pcm_hash = FNV_OFFSET;
+	have = true;
+	next_sample = REPLAY_CLOCK_BASE_US;
+	wall_us = mono_usec();
+	cpu_us = cpu_usec();
+
+	/* Timers fire at 1 ms resolution, as under re_main(). */
+	for (now = REPLAY_CLOCK_BASE_US; now < end; now += REPLAY_STEP_US) {
+
+		while (have && pkt.t_us <= now) {
+			clock_advance(pkt.t_us);
+			ms_source_inject(replay.src, &pkt.hdr, pkt.mb);
+
+			err = packet_next(&pkt);
+			if (err == ENODATA) {
+				have = false;
+				end = now + REPLAY_DRAIN_MS * 1000;
+			}
+			else if (err) {
+				goto out;
+			}
+		}
+
+		clock_advance(now);
+		tmr_poll(tmrl);
+
+		if (now >= next_sample) {
+			sample_print((now - REPLAY_CLOCK_BASE_US) / 1000);
+			next_sample += (replay.interval_ms ? replay.interval_ms
+					: REPLAY_INTERVAL_MS) * 1000ULL;
+		}
+
+		if (replay.realtime)
+			pace(wall_us, now - REPLAY_CLOCK_BASE_US);
+	}
+
+	wall_us = mono_usec() - wall_us;
+	cpu_us = cpu_usec() - cpu_us;
+	err = 0;
+
+	report(end - REPLAY_CLOCK_BASE_US, wall_us, cpu_us);
+
+out:
+	mem_deref(pkt.mb);
+	return err;
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mediasoup_bridge_rx_replay [-s ssrc] [-u udp port] "
+		"[-i interval ms]\n"
+		"         [-r] [-P first RTP port] file.pcap|file.rtpdump\n");
+}
+
+
+static int parse_args(int argc, char *argv[])
+{
+	int opt;
+
+	replay.interval_ms = REPLAY_INTERVAL_MS;
+	replay.port_first = REPLAY_PORT_FIRST;
+
+	while ((opt = getopt(argc, argv, "s:u:i:rP:h")) != -1) {
+		const unsigned long v = strtoul(optarg ? optarg : "0",
+						NULL, 0);
+
+		switch (opt) {
+
+		case 's': replay.ssrc = (uint32_t)v;        break;
+		case 'u': replay.udp_port = (uint16_t)v;    break;
+		case 'i': replay.interval_ms = (uint32_t)v; break;
+		case 'r': replay.realtime = true;           break;
+		case 'P': replay.port_first = (uint16_t)v;  break;
+		default:
+			return EINVAL;
+		}
+	}
+
+	if (optind + 1 != argc || replay.port_first < 1024 ||
+	    replay.port_first > 65534)
+		return EINVAL;
+
+	replay.path = argv[optind];
+
+	return 0;
+}
+
+
+static int file_load(void)
+{
+	FILE *f;
+	long size;
+	int err = 0;
+
+	f = fopen(replay.path, "rb");
+	if (!f)
+		return errno;
+
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET)) {
+		err = errno;
+		goto out;
+	}
+
+	replay.file = mem_alloc((size_t)size + 1, NULL);
+	if (!replay.file) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (fread(replay.file, 1, (size_t)size, f) != (size_t)size) {
+		err = EIO;
+		goto out;
+	}
+
+	err = reader_open(&replay.rd, replay.file, (size_t)size);
+
+out:
+	(void)fclose(f);
+	return err;
+}
+
+
+/* Linked in from module.c; the symbol name follows the STATIC build flag. */
+extern const struct mod_export DECL_EXPORTS(mediasoup_bridge);
+
+
+int main(int argc, char *argv[])
+{
+	char conf[256];
+	int n;
+	int err;
+
+	err = parse_args(argc, argv);
+	if (err) {
+		usage();
+		return 2;
+	}
+
+	n = re_snprintf(conf, sizeof(conf),
+			"mediasoup_bridge_rtp_ports\t%u-%u\n"
+			"mediasoup_bridge_bind_addr\t127.0.0.1\n",
+			replay.port_first, replay.port_first + 1);
+	if (n < 0)
+		return 1;
+
+	err = libre_init();
+	if (err)
+		return 1;
+
+	err = file_load();
+	if (err) {
+		fprintf(stderr, "rx_replay: %s: %s\n", replay.path,
+			strerror(err));
+		goto out;
+	}
+
+	err = conf_configure_buf((const uint8_t *)conf, (size_t)n);
+	if (!err)
+		err = baresip_init(conf_config());
+	if (err) {
+		fprintf(stderr, "rx_replay: baresip init: %s\n",
+			strerror(err));
+		goto out;
+	}
+
+	err = DECL_EXPORTS(mediasoup_bridge).init();
+	if (err) {
+		fprintf(stderr, "rx_replay: module init: %s\n",
+			strerror(err));
+		goto out;
+	}
+
+	err = replay_run();
+	if (err && err != ENODATA)
+		fprintf(stderr, "rx_replay: %s\n", strerror(err));
+
+	replay.src = mem_deref(replay.src);
+	replay.ctx = mem_deref(replay.ctx);
+	(void)DECL_EXPORTS(mediasoup_bridge).close();
+
+out:
+	baresip_close();
+	mem_deref(replay.file);
+	libre_close();
+	return err ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file slab_test.c Slab allocator lifetime test
+ *
+ * Allocates blocks from every size class and the huge path, checks that
+ * freed blocks are cached for reuse, and closes the slab while blocks are
+ * still out, as device halves open at unload do: no new blocks after the
+ * close, the late frees must not touch released state, and the last of
+ * them releases the chunks.  A reload before then carries on with the
+ * same slab.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mediasoup_bridge.h"
+
+
+enum {
+	TEST_HUGE = 65536,
+};
+
+
+static unsigned warnings;
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+void warning(const char *fmt, ...)
+{
+	(void)fmt;
+	++warnings;
+}
+
+
+static size_t in_use(void)
+{
+	struct ms_slab_stat stat;
+	size_t n = 0;
+	size_t i;
+
+	ms_slab_stat(&stat);
+	for (i = 0; i < MS_SLAB_CLASSES; ++i)
+		n += stat.classv[i].in_use;
+
+	return n;
+}
+
+
+static void check_reuse(void)
+{
+	struct ms_slab_stat stat;
+	void *a, *b;
+
+	CHECK(ms_slab_init() == 0);
+
+	a = ms_slab_alloc(100);
+	CHECK(a != NULL);
+	ms_slab_free(a);
+	b = ms_slab_alloc(100);
+	CHECK(b == a);
+
+	ms_slab_stat(&stat);
+	CHECK(stat.classv[0].in_use == 1);
+	CHECK(stat.chunk_bytes > 0);
+
+	ms_slab_free(b);
+	ms_slab_close();
+
+	ms_slab_stat(&stat);
+	CHECK(stat.chunk_bytes == 0);
+	CHECK(ms_slab_alloc(100) == NULL);
+}
+
+
+static void check_close_then_free(void)
+{
+	struct ms_slab_stat stat;
+	void *blockv[MS_SLAB_CLASSES];
+	void *huge;
+	size_t i;
+
+	CHECK(ms_slab_init() == 0);
+
+	ms_slab_stat(&stat);
+	for (i = 0; i < MS_SLAB_CLASSES; ++i) {
+		blockv[i] = ms_slab_alloc(stat.classv[i].size);
+		CHECK(blockv[i] != NULL);
+	}
+	huge = ms_slab_alloc(TEST_HUGE);
+	CHECK(huge != NULL);
+
+	warnings = 0;
+	ms_slab_close();
+	CHECK(warnings == 1);
+
+	/* Still there for the blocks that are out, closed to new ones */
+	ms_slab_stat(&stat);
+	CHECK(stat.chunk_bytes > 0);
+	CHECK(stat.huge_bytes == TEST_HUGE);
+	CHECK(in_use() == MS_SLAB_CLASSES);
+	CHECK(ms_slab_alloc(100) == NULL);
+
+	ms_slab_free(huge);
+	for (i = 0; i + 1 < MS_SLAB_CLASSES; ++i)
+		ms_slab_free(blockv[i]);
+
+	ms_slab_stat(&stat);
+	CHECK(stat.chunk_bytes > 0);
+	CHECK(in_use() == 1);
+
+	/* The last one finishes the close */
+	ms_slab_free(blockv[MS_SLAB_CLASSES - 1]);
+	ms_slab_stat(&stat);
+	CHECK(stat.chunk_bytes == 0);
+	CHECK(stat.huge_bytes == 0);
+	CHECK(warnings == 1);
+}
+
+
+static void check_reopen(void)
+{
+	void *a, *b;
+
+	CHECK(ms_slab_init() == 0);
+	a = ms_slab_alloc(100);
+	CHECK(a != NULL);
+	ms_slab_close();
+
+	/* Reloaded before the block came back */
+	CHECK(ms_slab_init() == 0);
+	b = ms_slab_alloc(100);
+	CHECK(b != NULL);
+	ms_slab_free(a);
+	CHECK(in_use() == 1);
+
+	ms_slab_free(b);
+	ms_slab_close();
+	CHECK(ms_slab_alloc(100) == NULL);
+}
+
+
+int main(void)
+{
+	int err;
+
+	err = libre_init();
+	if (err)
+		return 1;
+
+	check_reuse();
+	check_close_then_free();
+	check_reopen();
+
+	libre_close();
+
+	if (failures) {
+		fprintf(stderr, "slab_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("slab_test ok\n");
+	return 0;
+}
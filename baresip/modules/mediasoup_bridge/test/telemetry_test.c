@@ -0,0 +1,571 @@
+/**
+ * @file telemetry_test.c Telemetry engine scale and allocation test
+ *
+ * Registers 50 contexts with 30 RX sources each, drives the tick directly
+ * and checks that slot capacity (the engine's only heap storage) stays
+ * fixed while ticking, that membership changes are generation tagged and
+ * that the batched MS_TELEMETRY event carries only what changed.  Also
+ * checks the mixer clock histogram, the stall watchdog and its walk of
+ * the open contexts, and the meter file export.  Prints the measured tick
+ * cost.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mediasoup_bridge.h"
+
+
+enum {
+	TEST_CONTEXTS = 50,
+	TEST_SOURCES  = 30,
+	TEST_TICKS    = 1000,
+	TEST_SAMPC    = MS_SRATE * MS_PTIME_DEFAULT / 1000 * MS_CHANNELS,
+	TEST_SHM_BRIDGE = METER_SHM_HDR_SIZE +        /* after the calls */
+			  METER_SHM_CALLS * METER_SHM_SLOT_SIZE,
+};
+
+
+struct list ms_contexts = LIST_INIT;
+mtx_t *ms_contexts_mutex;
+
+static struct ms_context *contextv[TEST_CONTEXTS];
+static struct ms_source *sourcev[TEST_CONTEXTS][TEST_SOURCES];
+static unsigned events_batch;
+static unsigned entries_tx;
+static unsigned entries_source;
+static unsigned entries_rx;
+static unsigned events_error;
+static unsigned events_stall;
+static unsigned keepalives;
+static unsigned passes;
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+static unsigned count_tokens(const char *buf, size_t len, const char *tok)
+{
+	const size_t toklen = strlen(tok);
+	unsigned n = 0;
+	size_t i;
+
+	for (i = 0; i + toklen <= len; ++i) {
+		if (!memcmp(buf + i, tok, toklen))
+			++n;
+	}
+
+	return n;
+}
+
+
+int module_event(const char *module, const char *event, struct ua *ua,
+		 struct call *call, const char *fmt, ...)
+{
+	struct ms_telemetry_stat stat;
+	const char *buf;
+	size_t len;
+	va_list ap;
+
+	(void)module;
+	(void)ua;
+	(void)call;
+	(void)fmt;
+
+	if (!strcmp(event, "MS_CTX_STALL"))
+		++events_stall;
+	if (strcmp(event, "MS_TELEMETRY"))
+		return 0;
+
+	/* Handlers run without the engine mutex and may call back in. */
+	ms_telemetry_stat(&stat);
+
+	va_start(ap, fmt);
+	buf = va_arg(ap, const char *);
+	len = va_arg(ap, size_t);
+	va_end(ap);
+
+	++events_batch;
+	entries_tx += count_tokens(buf, len, "\"tx\":");
+	entries_source += count_tokens(buf, len, "\"producerId\":");
+	entries_rx += count_tokens(buf, len, "\"rx\":");
+
+	return 0;
+}
+
+
+void ms_emit_error(const char *key, const char *reason, int err)
+{
+	(void)key;
+	(void)reason;
+	(void)err;
+	++events_error;
+}
+
+
+void warning(const char *fmt, ...)
+{
+	(void)fmt;
+}
+
+
+void ms_context_keepalive(struct ms_context *ctx, uint64_t now)
+{
+	struct le *le;
+
+	for (le = ctx->sources.head; le; le = le->next) {
+		struct ms_source *src = le->data;
+
+		if (!src->active || now - src->last_probe_ms < MS_KEEPALIVE_MS)
+			continue;
+
+		src->last_probe_ms = now;
+		++keepalives;
+	}
+}
+
+
+/* Energy of a 20 ms stereo frame at the given RMS level. */
+static struct ms_level level_at(double dbfs)
+{
+	const double rms = 32768.0 * pow(10.0, dbfs / 20.0);
+	struct ms_level lvl;
+
+	lvl.sampc = TEST_SAMPC;
+	lvl.sum_sq = (uint64_t)llround(rms * rms * TEST_SAMPC);
+	lvl.peak = (uint16_t)MIN(rms * 1.414, 32767.0);
+
+	return lvl;
+}
+
+
+static void reset_counts(void)
+{
+	events_batch = 0;
+	entries_tx = 0;
+	entries_source = 0;
+	entries_rx = 0;
+	events_error = 0;
+	events_stall = 0;
+	keepalives = 0;
+}
+
+
+static void check_watchdog(struct ms_context *ctx, uint64_t now)
+{
+	const uint32_t ptime = MS_PTIME_DEFAULT;
+	struct ms_clock *tx = &ctx->clockv[MS_CLOCK_TX];
+	struct ms_clock *rx = &ctx->clockv[MS_CLOCK_RX];
+	struct ms_clock_stats stats;
+	uint64_t t_us = now * 1000;
+
+	ctx->ptime = ptime;
+
+	/* The first tick only starts the clock; a second one in the same
+	 * mixer cycle is not counted. */
+	ms_clock_tick(tx, ptime, t_us);
+	ms_clock_tick(tx, ptime, t_us += ptime * 1000);
+	ms_clock_tick(tx, ptime, t_us += ptime * 1000 + 3000);
+	ms_clock_tick(tx, ptime, t_us + 500);
+	ms_clock_tick(tx, ptime, t_us += ptime * 1000 + 150000);
+
+	ms_clock_stats_read(&tx->stats, &stats);
+	CHECK(stats.ticks == 3);
+	CHECK(stats.late_ticks == 2);
+	CHECK(stats.late_us_max == 150000);
+	CHECK(stats.late_histv[0] == 1);
+	CHECK(stats.late_histv[2] == 1);
+	CHECK(stats.late_histv[MS_LATE_BUCKETS - 1] == 1);
+	CHECK(ms_clock_bucket_us(2) == 5000);
+	CHECK(ms_clock_bucket_us(MS_LATE_BUCKETS - 1) == 0);
+
+	/* A silent clock raises one event, and one more when it ticks. */
+	reset_counts();
+	ms_context_watchdog(ctx, t_us / 1000 + MS_STALL_MS - 1);
+	CHECK(events_stall == 0);
+	ms_context_watchdog(ctx, t_us / 1000 + MS_STALL_MS);
+	ms_context_watchdog(ctx, t_us / 1000 + 2 * MS_STALL_MS);
+	CHECK(events_stall == 1);
+	CHECK(tx->stalled && tx->stalls == 1);
+
+	ms_clock_tick(tx, ptime, t_us += 2 * MS_STALL_MS * 1000);
+	ms_context_watchdog(ctx, t_us / 1000);
+	CHECK(events_stall == 2);
+	CHECK(!tx->stalled);
+
+	/* The RX mixer is not watched without a caller on it. */
+	ms_clock_tick(rx, ptime, t_us);
+	ms_context_watchdog(ctx, t_us / 1000 + 10 * MS_STALL_MS);
+	CHECK(events_stall == 2);
+
+	ms_clock_reset(tx);
+	ms_clock_reset(rx);
+	ms_context_watchdog(ctx, t_us / 1000 + 10 * MS_STALL_MS);
+	CHECK(events_stall == 2);
+}
+
+
+static void count_pass(struct ms_context *ctx, uint64_t now)
+{
+	(void)ctx;
+	(void)now;
+	++passes;
+}
+
+
+static void context_destructor(void *arg)
+{
+	struct ms_context *ctx = arg;
+
+	ms_telemetry_context_remove(ctx);
+	list_unlink(&ctx->le);
+	ctx->mutex = mem_deref(ctx->mutex);
+}
+
+
+static void source_destructor(void *arg)
+{
+	struct ms_source *src = arg;
+
+	ms_telemetry_source_remove(src);
+	list_unlink(&src->le);
+}
+
+
+static int setup(uint64_t now)
+{
+	size_t i;
+	size_t j;
+	int err;
+
+	for (i = 0; i < TEST_CONTEXTS; ++i) {
+		struct ms_context *ctx;
+
+		ctx = mem_zalloc(sizeof(*ctx), context_destructor);
+		if (!ctx)
+			return ENOMEM;
+
+		contextv[i] = ctx;
+		(void)re_snprintf(ctx->key, sizeof(ctx->key), "ctx%zu", i);
+		ctx->tx_ready = true;
+		ctx->telemetry_ms = MS_TELEMETRY_MS;
+		ctx->hysteresis_db = MS_HYSTERESIS_DEFAULT_DB;
+		ctx->tx_stats.v.level = level_at(-20.0);
+		ctx->tx_stats.v.last_frame_ms = now;
+		err = mutex_alloc(&ctx->mutex);
+		if (err)
+			return err;
+
+		err = ms_telemetry_context_add(ctx);
+		if (err)
+			return err;
+
+		list_append(&ms_contexts, &ctx->le, ctx);
+
+		for (j = 0; j < TEST_SOURCES; ++j) {
+			struct ms_source *src;
+
+			src = mem_zalloc(sizeof(*src), source_destructor);
+			if (!src)
+				return ENOMEM;
+
+			sourcev[i][j] = src;
+			src->ctx = ctx;
+			src->active = true;
+			src->last_probe_ms = now;
+			(void)re_snprintf(src->producer_id,
+					  sizeof(src->producer_id),
+					  "p%zu-%zu", i, j);
+			/* Every other source is talking. */
+			src->rx_stats.v.last_rx_ms = now;
+			src->rx_stats.v.level = level_at((j & 1) ? -90.0 : -12.0);
+
+			err = ms_telemetry_source_add(src);
+			if (err)
+				return err;
+
+			list_append(&ctx->sources, &src->le, src);
+		}
+	}
+
+	return 0;
+}
+
+
+static void refresh(uint64_t now)
+{
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < TEST_CONTEXTS; ++i) {
+		if (!contextv[i])
+			continue;
+
+		contextv[i]->tx_stats.v.last_frame_ms = now;
+		for (j = 0; j < TEST_SOURCES; ++j) {
+			if (sourcev[i][j])
+				sourcev[i][j]->rx_stats.v.last_rx_ms = now;
+		}
+	}
+}
+
+
+static bool read_at(FILE *f, long off, void *buf, size_t size)
+{
+	return !fseek(f, off, SEEK_SET) && fread(buf, 1, size, f) == size;
+}
+
+
+/* Find a bridge slot of the meter file by context key and producer id */
+static bool find_shm_slot(FILE *f, unsigned used, const char *key,
+			  const char *id, uint32_t *flags, float *dbfs)
+{
+	struct meter_shm_slot slot;
+	unsigned i;
+
+	for (i = 0; i < used; ++i) {
+		if (!read_at(f, TEST_SHM_BRIDGE + (long)(i * sizeof(slot)),
+			     &slot, sizeof(slot)))
+			return false;
+
+		if (strcmp(slot.key, key) || strcmp(slot.id, id))
+			continue;
+
+		*flags = slot.flags;
+		*dbfs = slot.levelv[0];
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * With the meter file open every level is written on each pass and
+ * MS_TELEMETRY stops reporting level moves.
+ */
+static void check_meter_shm(uint64_t now, unsigned contexts,
+			    unsigned sources)
+{
+	char path[] = "/tmp/telemetry_test.XXXXXX";
+	struct meter_shm_hdr hdr;
+	uint32_t flags;
+	float dbfs;
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(path);
+	CHECK(fd >= 0);
+	if (fd < 0)
+		return;
+	close(fd);
+
+	CHECK(ms_meter_shm_open(path) == 0);
+
+	/* Below the activity threshold before and after, 10 dB apart */
+	sourcev[20][3]->rx_stats.v.level = level_at(-80.0);
+	reset_counts();
+	now += MS_TELEMETRY_MS;
+	refresh(now);
+	ms_telemetry_tick(now);
+	CHECK(entries_source == 0);
+
+	f = fopen(path, "rb");
+	CHECK(f != NULL);
+	if (f) {
+		CHECK(read_at(f, 0, &hdr, sizeof(hdr)));
+		CHECK(hdr.magic == METER_SHM_MAGIC);
+		CHECK(hdr.bridge_seq == 1);
+		CHECK(hdr.bridge_used == contexts + sources);
+
+		CHECK(find_shm_slot(f, hdr.bridge_used, "ctx20", "", &flags,
+				    &dbfs));
+		CHECK(flags == (METER_SHM_USED | METER_SHM_TX |
+				METER_SHM_ACTIVE));
+		CHECK(fabs(dbfs + 20.0) < 0.5);
+
+		CHECK(find_shm_slot(f, hdr.bridge_used, "ctx20", "p20-3",
+				    &flags, &dbfs));
+		CHECK(flags == (METER_SHM_USED | METER_SHM_RX));
+		CHECK(fabs(dbfs + 80.0) < 0.5);
+
+		CHECK(!find_shm_slot(f, hdr.bridge_used, "ctx0", "", &flags,
+				     &dbfs));
+		fclose(f);
+	}
+
+	ms_meter_shm_close();
+	unlink(path);
+}
+
+
+int main(void)
+{
+	struct ms_telemetry_stat before;
+	struct ms_telemetry_stat after;
+	uint64_t now = 100000;
+	uint64_t generation;
+	size_t i;
+	size_t j;
+	int err;
+
+	err = libre_init();
+	if (err)
+		return 1;
+
+	err = mutex_alloc(&ms_contexts_mutex);
+	if (err)
+		goto out;
+
+	err = ms_telemetry_init();
+	if (err)
+		goto out;
+
+	err = setup(now);
+	if (err)
+		goto out;
+
+	ms_telemetry_stat(&before);
+	CHECK(before.contexts == TEST_CONTEXTS);
+	CHECK(before.sources == TEST_CONTEXTS * TEST_SOURCES);
+	CHECK(before.generation ==
+	      TEST_CONTEXTS + TEST_CONTEXTS * TEST_SOURCES);
+
+	/* The first pass reports everything in a single event. */
+	reset_counts();
+	CHECK(ms_telemetry_tick(now) == MS_TELEMETRY_MS);
+	CHECK(events_batch == 1);
+	CHECK(entries_tx == TEST_CONTEXTS);
+	CHECK(entries_source == TEST_CONTEXTS * TEST_SOURCES);
+	CHECK(entries_rx == TEST_CONTEXTS);
+	CHECK(events_error == 0);
+
+	/* Nothing moved: the next pass stays silent. */
+	reset_counts();
+	now += MS_TELEMETRY_MS;
+	refresh(now);
+	ms_telemetry_tick(now);
+	CHECK(events_batch == 0);
+
+	/* Only a level change beyond the hysteresis is reported. */
+	sourcev[3][4]->rx_stats.v.level = level_at(-11.5);
+	sourcev[5][6]->rx_stats.v.level = level_at(-9.0);
+	reset_counts();
+	now += MS_TELEMETRY_MS;
+	refresh(now);
+	ms_telemetry_tick(now);
+	CHECK(events_batch == 1);
+	CHECK(entries_source == 1);
+	CHECK(entries_tx == 0);
+	CHECK(entries_rx == 0);
+
+	/* A longer per-context interval holds that context back. */
+	contextv[0]->telemetry_ms = 4 * MS_TELEMETRY_MS;
+	sourcev[0][0]->rx_stats.v.level = level_at(-18.0);
+	reset_counts();
+	now += MS_TELEMETRY_MS;
+	refresh(now);
+	ms_telemetry_tick(now);
+	CHECK(entries_source == 1);
+	sourcev[0][0]->rx_stats.v.level = level_at(-12.0);
+	reset_counts();
+	now += MS_TELEMETRY_MS;
+	refresh(now);
+	ms_telemetry_tick(now);
+	CHECK(entries_source == 0);
+	contextv[0]->telemetry_ms = MS_TELEMETRY_MS;
+
+	/* An error bumps the generation and is emitted exactly once. */
+	atomic_fetch_add(&contextv[7]->error_generation, 1);
+	reset_counts();
+	now += MS_TELEMETRY_MS;
+	refresh(now);
+	ms_telemetry_tick(now);
+	ms_telemetry_tick(now);
+	CHECK(events_error == 1);
+
+	check_watchdog(contextv[20], now);
+
+	/* The watchdog timer visits every open context, in chunks */
+	ms_contexts_pass(count_pass, now);
+	CHECK(passes == list_count(&ms_contexts));
+
+	for (i = 0; i < TEST_TICKS; ++i) {
+		now += MS_TELEMETRY_MS;
+		refresh(now);
+		ms_telemetry_tick(now);
+	}
+
+	ms_telemetry_stat(&after);
+	CHECK(after.context_capacity == before.context_capacity);
+	CHECK(after.source_capacity == before.source_capacity);
+	CHECK(after.generation == before.generation);
+	CHECK(after.ticks == TEST_TICKS + 7);
+
+	printf("telemetry: %u contexts x %u sources, %llu ticks, "
+	       "avg %llu us, max %llu us per tick\n",
+	       TEST_CONTEXTS, TEST_SOURCES,
+	       (unsigned long long)after.ticks,
+	       (unsigned long long)after.avg_tick_us,
+	       (unsigned long long)after.max_tick_us);
+
+	/* Incremental removal: every other source, then ten contexts. */
+	generation = after.generation;
+	for (i = 0; i < TEST_CONTEXTS; ++i) {
+		for (j = 0; j < TEST_SOURCES; j += 2)
+			sourcev[i][j] = mem_deref(sourcev[i][j]);
+	}
+	for (i = 0; i < 10; ++i) {
+		for (j = 0; j < TEST_SOURCES; ++j)
+			sourcev[i][j] = mem_deref(sourcev[i][j]);
+		contextv[i] = mem_deref(contextv[i]);
+	}
+
+	ms_telemetry_stat(&after);
+	CHECK(after.contexts == TEST_CONTEXTS - 10);
+	CHECK(after.sources == (TEST_CONTEXTS - 10) * TEST_SOURCES / 2);
+	CHECK(after.generation > generation);
+
+	/* Quiet contexts and receiving sources still refresh their state
+	 * once per keepalive. */
+	reset_counts();
+	now += MS_KEEPALIVE_MS;
+	refresh(now);
+	ms_telemetry_tick(now);
+	CHECK(events_batch == 1);
+	CHECK(entries_tx == TEST_CONTEXTS - 10);
+	CHECK(entries_rx == TEST_CONTEXTS - 10);
+	CHECK(entries_source == (TEST_CONTEXTS - 10) * TEST_SOURCES / 2);
+	CHECK(keepalives == (TEST_CONTEXTS - 10) * TEST_SOURCES / 2);
+
+	check_meter_shm(now, TEST_CONTEXTS - 10,
+			(TEST_CONTEXTS - 10) * TEST_SOURCES / 2);
+
+out:
+	for (i = 0; i < TEST_CONTEXTS; ++i) {
+		for (j = 0; j < TEST_SOURCES; ++j)
+			mem_deref(sourcev[i][j]);
+		mem_deref(contextv[i]);
+	}
+	ms_telemetry_close();
+	ms_contexts_mutex = mem_deref(ms_contexts_mutex);
+	libre_close();
+
+	if (err) {
+		fprintf(stderr, "telemetry: setup failed (%d)\n", err);
+		return 1;
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/**
+ * @file trunk_test.c Multistream trunk loopback harness
+ *
+ * Encodes the stereo mixes of several simulated contexts into trunk
+ * packets, decodes them again as the peer would and checks that every
+ * stream comes back on its own member with no audible crosstalk, that a
+ * member without a frame is carried as silence and that packet loss
+ * concealment keeps the frame size.  The same signals are also encoded
+ * as one Opus stream per context to print the packet rate and wire bytes
+ * (with 40 bytes of IPv4/UDP/RTP headers per packet) saved by trunking.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trunk_codec.h"
+
+
+enum {
+	TEST_SRATE   = 48000,
+	TEST_FRAMES  = 960,
+	TEST_PACKETS = 200,
+	TEST_WARMUP  = 10,
+	TEST_STREAMS = 4,
+	TEST_BITRATE = 64000,
+	TEST_OVERHEAD = 40,
+	TEST_MAX_PACKET = 4000,
+};
+
+
+static const double freqv[TEST_STREAMS] = {300.0, 700.0, 1300.0, 2900.0};
+static int16_t framev[TEST_STREAMS][TEST_FRAMES * 2];
+static int16_t outv[TEST_FRAMES * 2];
+static double energy[TEST_STREAMS][TEST_STREAMS];
+static double total[TEST_STREAMS];
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+static void make_frames(unsigned packet)
+{
+	unsigned s;
+	size_t i;
+
+	for (s = 0; s < TEST_STREAMS; ++s) {
+		for (i = 0; i < TEST_FRAMES; ++i) {
+			const double t = (double)(packet * TEST_FRAMES + i) /
+					 TEST_SRATE;
+			const int16_t v = (int16_t)(8000.0 *
+					  sin(2.0 * M_PI * freqv[s] * t));
+
+			framev[s][2 * i] = v;
+			framev[s][2 * i + 1] = v;
+		}
+	}
+}
+
+
+/* Goertzel power of the left channel at one frequency. */
+static double tone_power(const int16_t *sampv, size_t frames, double freq)
+{
+	const double coeff = 2.0 * cos(2.0 * M_PI * freq / TEST_SRATE);
+	double s1 = 0.0;
+	double s2 = 0.0;
+	size_t i;
+
+	for (i = 0; i < frames; ++i) {
+		const double s0 = sampv[2 * i] + coeff * s1 - s2;
+
+		s2 = s1;
+		s1 = s0;
+	}
+
+	return s1 * s1 + s2 * s2 - coeff * s1 * s2;
+}
+
+
+static double frame_energy(const int16_t *sampv, size_t frames)
+{
+	double sum = 0.0;
+	size_t i;
+
+	for (i = 0; i < frames * 2; ++i)
+		sum += (double)sampv[i] * sampv[i];
+
+	return sum;
+}
+
+
+static void test_loopback(unsigned channels)
+{
+	struct ms_trunk_codec tc;
+	uint8_t packet[TEST_MAX_PACKET];
+	const unsigned silent = TEST_STREAMS - 1;
+	unsigned p;
+	unsigned s;
+	unsigned k;
+	int err;
+
+	memset(energy, 0, sizeof(energy));
+	memset(total, 0, sizeof(total));
+
+	err = ms_trunk_codec_init(&tc, TEST_STREAMS, channels, TEST_SRATE,
+				  TEST_BITRATE, TEST_FRAMES, 5760);
+	CHECK(err == 0);
+	if (err)
+		return;
+
+	for (p = 0; p < TEST_PACKETS; ++p) {
+		int len;
+		int n;
+
+		make_frames(p);
+
+		/* The last member never delivers: it must decode silent. */
+		for (s = 0; s < silent; ++s)
+			ms_trunk_codec_put(&tc, s, framev[s], TEST_FRAMES);
+
+		len = ms_trunk_codec_encode(&tc, TEST_FRAMES, packet,
+					    sizeof(packet));
+		CHECK(len > 0);
+		if (len <= 0)
+			break;
+
+		n = ms_trunk_codec_decode(&tc, packet, (size_t)len, 0);
+		CHECK(n == TEST_FRAMES);
+		if (n != TEST_FRAMES || p < TEST_WARMUP)
+			continue;
+
+		for (s = 0; s < TEST_STREAMS; ++s) {
+			ms_trunk_codec_get(&tc, s, outv, TEST_FRAMES);
+			total[s] += frame_energy(outv, TEST_FRAMES);
+			for (k = 0; k < TEST_STREAMS; ++k)
+				energy[s][k] += tone_power(outv, TEST_FRAMES,
+							   freqv[k]);
+		}
+	}
+
+	for (s = 0; s < silent; ++s) {
+		for (k = 0; k < TEST_STREAMS; ++k) {
+			if (k == s)
+				continue;
+
+			/* Own tone at least 30 dB above every other one. */
+			CHECK(10.0 * log10(energy[s][s] /
+					   (energy[s][k] + 1.0)) > 30.0);
+		}
+	}
+
+	/* Below -60 dBFS RMS over the whole run. */
+	CHECK(total[silent] / ((double)(TEST_PACKETS - TEST_WARMUP) *
+			       TEST_FRAMES * 2) < 32768.0 * 32768.0 * 1e-6);
+
+	/* A lost packet is concealed with the trunk's frame size. */
+	CHECK(ms_trunk_codec_decode(&tc, NULL, 0, TEST_FRAMES) ==
+	      TEST_FRAMES);
+
+	ms_trunk_codec_close(&tc);
+}
+
+
+static void report_savings(void)
+{
+	OpusEncoder *encv[TEST_STREAMS];
+	struct ms_trunk_codec tc;
+	uint8_t packet[TEST_MAX_PACKET];
+	unsigned long long single_bytes = 0;
+	unsigned long long trunk_bytes = 0;
+	unsigned p;
+	unsigned s;
+	int err;
+
+	err = ms_trunk_codec_init(&tc, TEST_STREAMS, 2, TEST_SRATE,
+				  TEST_BITRATE, TEST_FRAMES, 5760);
+	CHECK(err == 0);
+	if (err)
+		return;
+
+	for (s = 0; s < TEST_STREAMS; ++s) {
+		encv[s] = opus_encoder_create(TEST_SRATE, 2,
+					      OPUS_APPLICATION_VOIP, &err);
+		CHECK(encv[s] != NULL);
+		if (!encv[s])
+			return;
+		(void)opus_encoder_ctl(encv[s], OPUS_SET_BITRATE(TEST_BITRATE));
+		(void)opus_encoder_ctl(encv[s],
+				       OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+	}
+
+	for (p = 0; p < TEST_PACKETS; ++p) {
+		int len;
+
+		make_frames(p);
+		for (s = 0; s < TEST_STREAMS; ++s) {
+			ms_trunk_codec_put(&tc, s, framev[s], TEST_FRAMES);
+
+			len = opus_encode(encv[s], framev[s], TEST_FRAMES,
+					  packet, sizeof(packet));
+			if (len > 0)
+				single_bytes += (unsigned)len + TEST_OVERHEAD;
+		}
+
+		len = ms_trunk_codec_encode(&tc, TEST_FRAMES, packet,
+					    sizeof(packet));
+		if (len > 0)
+			trunk_bytes += (unsigned)len + TEST_OVERHEAD;
+	}
+
+	printf("trunk_test streams=%u packets_per_s single=%u trunk=%u "
+	       "wire_kbps single=%.1f trunk=%.1f\n", TEST_STREAMS,
+	       TEST_STREAMS * TEST_SRATE / TEST_FRAMES,
+	       TEST_SRATE / TEST_FRAMES,
+	       (double)single_bytes * 8.0 / (TEST_PACKETS * 20.0),
+	       (double)trunk_bytes * 8.0 / (TEST_PACKETS * 20.0));
+
+	CHECK(trunk_bytes < single_bytes);
+
+	for (s = 0; s < TEST_STREAMS; ++s)
+		opus_encoder_destroy(encv[s]);
+	ms_trunk_codec_close(&tc);
+}
+
+
+int main(void)
+{
+	test_loopback(2);
+	test_loopback(1);
+	report_savings();
+
+	if (failures) {
+		fprintf(stderr, "trunk_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("trunk_test ok\n");
+	return 0;
+}
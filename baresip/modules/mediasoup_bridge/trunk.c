@@ -0,0 +1,714 @@
+/**
+ * @file trunk.c Opus multistream trunks between bridge hosts
+ *
+ * A trunk carries the TX mix of several contexts as the streams of one
+ * multistream RTP flow to a matching peer, and feeds the peer's streams
+ * into the same contexts' RX mixers.  Member contexts stop using their own
+ * TX socket while they are joined; their RX sources are unaffected.
+ *
+ * Each member's TX mixer clocks its own frame into the gather buffer; the
+ * packet is sent when every member has delivered, or early when a member
+ * delivers twice, in which case the missing streams carry silence.
+ */
+
+#include <string.h>
+
+#include "mediasoup_bridge.h"
+
+
+static struct list trunks = LIST_INIT;
+
+
+static void trunk_destructor(void *arg)
+{
+	struct ms_trunk *trunk = arg;
+
+	tmr_cancel(&trunk->decode_tmr);
+	list_unlink(&trunk->le);
+	ms_rtp_socket_release(&trunk->rtp, &trunk->pool_index);
+	trunk->jbuf = mem_deref(trunk->jbuf);
+	trunk->tx_mbuf = mem_deref(trunk->tx_mbuf);
+	ms_slab_free(trunk->member_buf);
+	trunk->member_buf = NULL;
+	ms_trunk_codec_close(&trunk->codec);
+	trunk->mutex = mem_deref(trunk->mutex);
+}
+
+
+static struct ms_trunk *trunk_find(const char *name)
+{
+	struct le *le;
+
+	for (le = trunks.head; le; le = le->next) {
+		struct ms_trunk *trunk = le->data;
+
+		if (!str_cmp(trunk->name, name))
+			return trunk;
+	}
+
+	return NULL;
+}
+
+
+/* Called with trunk->mutex held. */
+static void trunk_flush_locked(struct ms_trunk *trunk)
+{
+	uint8_t packet[MS_OPUS_MAX_PACKET];
+	struct rtp_header hdr;
+	unsigned i;
+	int encoded;
+	int err;
+
+	if (trunk->pendingc < trunk->members)
+		++trunk->stats.tx_partial;
+
+	for (i = 0; i < trunk->cfg.streams; ++i)
+		trunk->memberv[i].pending = false;
+	trunk->pendingc = 0;
+
+	encoded = ms_trunk_codec_encode(&trunk->codec,
+					trunk->frame_samp_per_ch,
+					packet, sizeof(packet));
+	if (encoded < 0) {
+		++trunk->stats.tx_errors;
+		trunk->tx_timestamp += trunk->frame_samp_per_ch;
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.pt   = trunk->cfg.pt;
+	hdr.seq  = ++trunk->tx_seq;
+	hdr.ts   = trunk->tx_timestamp;
+	hdr.ssrc = trunk->cfg.ssrc;
+	trunk->tx_timestamp += trunk->frame_samp_per_ch;
+
+	mbuf_rewind(trunk->tx_mbuf);
+	err  = rtp_hdr_encode(trunk->tx_mbuf, &hdr);
+	err |= mbuf_write_mem(trunk->tx_mbuf, packet, (size_t)encoded);
+	if (!err) {
+		trunk->tx_mbuf->pos = 0;
+		err = udp_send(rtp_sock(trunk->rtp), &trunk->cfg.remote,
+			       trunk->tx_mbuf);
+	}
+	if (err) {
+		++trunk->stats.tx_errors;
+		return;
+	}
+
+	++trunk->stats.tx_packets;
+	trunk->stats.tx_bytes += trunk->tx_mbuf->end;
+}
+
+
+/**
+ * Gather one TX frame of a member context
+ *
+ * Called from the context's TX clock with ctx->mutex held.
+ *
+ * @param ctx     Member context
+ * @param sampv   Interleaved stereo samples of the context's ptime
+ * @param frames  Samples per channel
+ */
+void ms_trunk_send(struct ms_context *ctx, const int16_t *sampv,
+		   size_t frames)
+{
+	struct ms_trunk *trunk = ctx ? ctx->trunk : NULL;
+	struct ms_trunk_member *member;
+
+	if (!trunk || !sampv)
+		return;
+
+	mtx_lock(trunk->mutex);
+	member = &trunk->memberv[ctx->trunk_stream];
+	if (member->ctx != ctx || frames != trunk->frame_samp_per_ch)
+		goto out;
+
+	/* This member came round again before a slower one delivered. */
+	if (member->pending)
+		trunk_flush_locked(trunk);
+
+	ms_trunk_codec_put(&trunk->codec, ctx->trunk_stream, sampv, frames);
+	member->pending = true;
+	++trunk->pendingc;
+
+	if (trunk->pendingc >= trunk->members)
+		trunk_flush_locked(trunk);
+
+out:
+	mtx_unlock(trunk->mutex);
+}
+
+
+static void trunk_deliver(struct ms_trunk *trunk, size_t frames)
+{
+	struct aumix_source *mix_sourcev[MS_TRUNK_MAX_STREAMS];
+	unsigned i;
+
+	mtx_lock(trunk->mutex);
+	for (i = 0; i < trunk->cfg.streams; ++i)
+		mix_sourcev[i] = mem_ref(trunk->memberv[i].mix_source);
+	mtx_unlock(trunk->mutex);
+
+	for (i = 0; i < trunk->cfg.streams; ++i) {
+		if (!mix_sourcev[i])
+			continue;
+
+		ms_trunk_codec_get(&trunk->codec, i, trunk->member_buf, frames);
+		(void)aumix_source_put(mix_sourcev[i], trunk->member_buf,
+				       frames * MS_CHANNELS);
+		mem_deref(mix_sourcev[i]);
+	}
+}
+
+
+static void trunk_flush_members(struct ms_trunk *trunk)
+{
+	struct aumix_source *mix_sourcev[MS_TRUNK_MAX_STREAMS];
+	unsigned i;
+
+	mtx_lock(trunk->mutex);
+	for (i = 0; i < trunk->cfg.streams; ++i)
+		mix_sourcev[i] = mem_ref(trunk->memberv[i].mix_source);
+	mtx_unlock(trunk->mutex);
+
+	for (i = 0; i < trunk->cfg.streams; ++i) {
+		if (mix_sourcev[i])
+			aumix_source_flush(mix_sourcev[i]);
+		mem_deref(mix_sourcev[i]);
+	}
+}
+
+
+static void trunk_decode_plc(struct ms_trunk *trunk, unsigned count,
+			     bool playout)
+{
+	unsigned i;
+
+	/* As for sources: conceal, but play at most one frame now. */
+	count = MIN(count, 3U);
+	for (i = 0; i < count; ++i) {
+		const int n = ms_trunk_codec_decode(&trunk->codec, NULL, 0,
+						    trunk->frame_samp_per_ch);
+		if (n < 0) {
+			++trunk->stats.decode_errors;
+			return;
+		}
+
+		++trunk->stats.plc_frames;
+		if (playout && i + 1 == count)
+			trunk_deliver(trunk, (size_t)n);
+	}
+}
+
+
+static void trunk_decode_packet(struct ms_trunk *trunk,
+				const struct rtp_header *hdr,
+				struct mbuf *mb, bool playout)
+{
+	bool concealed = false;
+	uint16_t delta;
+	int n;
+
+	if (trunk->seq_set) {
+		delta = (uint16_t)(hdr->seq - trunk->last_seq);
+		if (delta > 1 && delta < 0x8000) {
+			const unsigned lost = (unsigned)delta - 1;
+
+			trunk->stats.rx_lost += lost;
+			if (lost <= 3) {
+				trunk_decode_plc(trunk, lost, playout);
+				concealed = true;
+			}
+			else {
+				ms_trunk_codec_reset(&trunk->codec);
+				trunk_flush_members(trunk);
+			}
+		}
+	}
+
+	trunk->last_seq = hdr->seq;
+	trunk->seq_set = true;
+
+	n = ms_trunk_codec_decode(&trunk->codec, mbuf_buf(mb),
+				  mbuf_get_left(mb), 0);
+	if (n < 0) {
+		++trunk->stats.decode_errors;
+		return;
+	}
+
+	if (playout && !concealed)
+		trunk_deliver(trunk, (size_t)n);
+}
+
+
+static void trunk_decode_handler(void *arg)
+{
+	struct ms_trunk *trunk = arg;
+	uint32_t pending = 1;
+	int32_t delay;
+
+	do {
+		struct rtp_header hdr;
+		void *packet = NULL;
+		int err;
+
+		err = jbuf_get(trunk->jbuf, &hdr, &packet);
+		if (err == EAGAIN)
+			++pending;
+		else if (err)
+			break;
+
+		trunk_decode_packet(trunk, &hdr, packet, err != EAGAIN);
+		mem_deref(packet);
+	} while (--pending);
+
+	delay = jbuf_next_play(trunk->jbuf);
+	if (delay < 0)
+		delay = 10;
+	tmr_start(&trunk->decode_tmr, (uint64_t)delay,
+		  trunk_decode_handler, trunk);
+}
+
+
+static void trunk_rtp_handler(const struct sa *peer,
+			      const struct rtp_header *header,
+			      struct mbuf *mb, void *arg)
+{
+	struct ms_trunk *trunk = arg;
+	struct rtp_header hdr;
+	size_t payload_len;
+	uint64_t arrival_us;
+	uint32_t dispatch_us;
+	bool kernel_ts;
+
+	kernel_ts = ms_rtp_arrival(trunk->rtp, &arrival_us, &dispatch_us);
+
+	if (!sa_cmp(peer, &trunk->cfg.remote, SA_ALL) ||
+	    header->pt != trunk->cfg.pt) {
+		++trunk->stats.rx_invalid;
+		return;
+	}
+
+	if (!trunk->latched_ssrc)
+		trunk->latched_ssrc = header->ssrc;
+	else if (header->ssrc != trunk->latched_ssrc) {
+		++trunk->stats.rx_invalid;
+		return;
+	}
+
+	payload_len = mbuf_get_left(mb);
+	if (header->pad && payload_len) {
+		const uint8_t padding = mbuf_buf(mb)[payload_len - 1];
+
+		if (padding >= payload_len) {
+			++trunk->stats.rx_invalid;
+			return;
+		}
+		mbuf_set_end(mb, mbuf_end(mb) - padding);
+		payload_len -= padding;
+	}
+	if (!payload_len) {
+		++trunk->stats.rx_invalid;
+		return;
+	}
+
+	hdr = *header;
+	hdr.ts_arrive = arrival_us * (MS_SRATE / 1000) / 1000;
+	if (jbuf_put(trunk->jbuf, &hdr, mb)) {
+		++trunk->stats.rx_invalid;
+		return;
+	}
+
+	++trunk->stats.rx_packets;
+	trunk->stats.rx_bytes += payload_len;
+	if (kernel_ts) {
+		++trunk->stats.dispatch_count;
+		trunk->stats.dispatch_us_sum += dispatch_us;
+		trunk->stats.dispatch_us_max = MAX(trunk->stats.dispatch_us_max,
+						   dispatch_us);
+	}
+
+	if (!trunk->decode_started) {
+		trunk->decode_started = true;
+		tmr_start(&trunk->decode_tmr, 0, trunk_decode_handler, trunk);
+	}
+}
+
+
+static bool valid_config(const struct ms_trunk_config *cfg)
+{
+	uint64_t payload;
+
+	if (!cfg || cfg->pt > 127 || !cfg->ssrc || !cfg->streams ||
+	    cfg->streams > MS_TRUNK_MAX_STREAMS ||
+	    (cfg->channels != 1 && cfg->channels != 2) ||
+	    !ms_valid_ptime(cfg->ptime) ||
+	    cfg->bitrate_bps < MS_BITRATE_MIN ||
+	    cfg->bitrate_bps > MS_BITRATE_MAX)
+		return false;
+
+	/* Keep the nominal packet inside one unfragmented datagram. */
+	payload = (uint64_t)cfg->streams * (uint64_t)cfg->bitrate_bps *
+		  cfg->ptime / 8000;
+
+	return payload <= MS_TRUNK_MAX_PAYLOAD;
+}
+
+
+static int trunk_alloc(struct ms_trunk **trunkp, const char *name,
+		       const struct ms_trunk_config *cfg)
+{
+	struct ms_trunk *trunk;
+	int err;
+
+	trunk = mem_zalloc(sizeof(*trunk), trunk_destructor);
+	if (!trunk)
+		return ENOMEM;
+
+	str_ncpy(trunk->name, name, sizeof(trunk->name));
+	trunk->cfg = *cfg;
+	trunk->pool_index = MS_PORT_NONE;
+	trunk->frame_samp_per_ch = MS_SRATE * cfg->ptime / 1000;
+	trunk->tx_seq = rand_u16();
+	trunk->tx_timestamp = rand_u32();
+
+	err = mutex_alloc(&trunk->mutex);
+	if (err)
+		goto out;
+
+	err = ms_trunk_codec_init(&trunk->codec, cfg->streams, cfg->channels,
+				  MS_SRATE, cfg->bitrate_bps,
+				  trunk->frame_samp_per_ch, MS_OPUS_MAX_FRAME);
+	if (err)
+		goto out;
+
+	trunk->member_buf = ms_slab_alloc(MS_OPUS_MAX_FRAME * MS_CHANNELS *
+					  sizeof(*trunk->member_buf));
+	trunk->tx_mbuf = mbuf_alloc(RTP_HEADER_SIZE + MS_OPUS_MAX_PACKET);
+	if (!trunk->member_buf || !trunk->tx_mbuf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = jbuf_alloc(&trunk->jbuf, 2 * cfg->ptime,
+			 MAX(200U, 4 * cfg->ptime), 50);
+	if (err)
+		goto out;
+	jbuf_set_srate(trunk->jbuf, MS_SRATE);
+
+	err = ms_rtp_socket_alloc(&trunk->rtp, &trunk->pool_index,
+				  &trunk->local_port, trunk_rtp_handler,
+				  trunk);
+	if (err)
+		goto out;
+
+	err = ms_send_probe(trunk->rtp, &cfg->remote, 3);
+
+out:
+	if (err)
+		mem_deref(trunk);
+	else
+		*trunkp = trunk;
+
+	return err;
+}
+
+
+/**
+ * Open a trunk, or retarget an existing one of the same shape
+ *
+ * @param trunkp   Returned trunk reference
+ * @param name     Trunk name
+ * @param cfg      Peer and stream layout
+ * @param created  Set to true if the trunk was created or retargeted
+ *
+ * @return 0 if success, EEXIST if the name has a different stream layout
+ */
+int ms_trunk_open(struct ms_trunk **trunkp, const char *name,
+		  const struct ms_trunk_config *cfg, bool *created)
+{
+	struct ms_trunk *trunk;
+	bool same;
+	int err;
+
+	if (!trunkp || !ms_valid_identifier(name, MS_KEY_SIZE) ||
+	    !valid_config(cfg))
+		return EINVAL;
+	if (sa_af(&cfg->remote) != sa_af(&ms_bind_addr))
+		return EAFNOSUPPORT;
+
+	trunk = trunk_find(name);
+	if (!trunk) {
+		err = trunk_alloc(&trunk, name, cfg);
+		if (err)
+			return err;
+
+		list_append(&trunks, &trunk->le, trunk);
+		*trunkp = mem_ref(trunk);
+		if (created)
+			*created = true;
+
+		info("mediasoup_bridge: opened trunk '%s' (%u x %u ch, "
+		     "%u ms) on port %u\n", name, cfg->streams, cfg->channels,
+		     cfg->ptime, trunk->local_port);
+		return 0;
+	}
+
+	if (trunk->cfg.streams != cfg->streams ||
+	    trunk->cfg.channels != cfg->channels ||
+	    trunk->cfg.ptime != cfg->ptime ||
+	    trunk->cfg.bitrate_bps != cfg->bitrate_bps)
+		return EEXIST;
+
+	same = sa_cmp(&trunk->cfg.remote, &cfg->remote, SA_ALL) &&
+	       trunk->cfg.pt == cfg->pt && trunk->cfg.ssrc == cfg->ssrc;
+	if (!same) {
+		err = ms_send_probe(trunk->rtp, &cfg->remote, 3);
+		if (err)
+			return err;
+
+		mtx_lock(trunk->mutex);
+		trunk->cfg.remote = cfg->remote;
+		trunk->cfg.pt = cfg->pt;
+		trunk->cfg.ssrc = cfg->ssrc;
+		trunk->tx_seq = rand_u16();
+		trunk->tx_timestamp = rand_u32();
+		mtx_unlock(trunk->mutex);
+
+		trunk->latched_ssrc = 0;
+		trunk->seq_set = false;
+	}
+
+	*trunkp = mem_ref(trunk);
+	if (created)
+		*created = !same;
+
+	return 0;
+}
+
+
+struct ms_trunk *ms_trunk_lookup(const char *name)
+{
+	struct ms_trunk *trunk;
+
+	if (!ms_valid_identifier(name, MS_KEY_SIZE))
+		return NULL;
+
+	trunk = trunk_find(name);
+
+	return trunk ? mem_ref(trunk) : NULL;
+}
+
+
+static void trunk_close(struct ms_trunk *trunk)
+{
+	unsigned i;
+
+	for (i = 0; i < trunk->cfg.streams; ++i) {
+		struct ms_context *ctx;
+
+		mtx_lock(trunk->mutex);
+		ctx = mem_ref(trunk->memberv[i].ctx);
+		mtx_unlock(trunk->mutex);
+
+		if (!ctx)
+			continue;
+
+		(void)ms_trunk_leave(ctx);
+		mem_deref(ctx);
+	}
+
+	list_unlink(&trunk->le);
+	mem_deref(trunk);
+}
+
+
+int ms_trunk_close(const char *name, bool *changed)
+{
+	struct ms_trunk *trunk;
+
+	if (!ms_valid_identifier(name, MS_KEY_SIZE))
+		return EINVAL;
+
+	trunk = trunk_find(name);
+	if (trunk) {
+		info("mediasoup_bridge: closed trunk '%s'\n", name);
+		trunk_close(trunk);
+	}
+
+	if (changed)
+		*changed = trunk != NULL;
+
+	return 0;
+}
+
+
+void ms_trunk_close_all(void)
+{
+	while (trunks.head)
+		trunk_close(trunks.head->data);
+}
+
+
+/**
+ * Carry a context's TX and the peer's matching stream through a trunk
+ *
+ * @param trunk    Trunk to join
+ * @param ctx      Context; its ptime must match the trunk's
+ * @param stream   Stream index agreed with the peer
+ * @param changed  Set to false if the context already used this stream
+ *
+ * @return 0 if success, EBUSY if the context is in another trunk or
+ *         stream, EADDRINUSE if the stream belongs to another context
+ */
+int ms_trunk_join(struct ms_trunk *trunk, struct ms_context *ctx,
+		  unsigned stream, bool *changed)
+{
+	struct aumix_source *mix_source = NULL;
+	struct ms_trunk_member *member;
+	int err = 0;
+
+	if (!trunk || !ctx || stream >= trunk->cfg.streams)
+		return EINVAL;
+
+	member = &trunk->memberv[stream];
+
+	/* Serialises with ptime changes, which replace rx_mix. */
+	mtx_lock(ctx->pairing_mutex);
+
+	mtx_lock(ctx->mutex);
+	if (ctx->closing)
+		err = ESHUTDOWN;
+	else if (ctx->trunk == trunk && ctx->trunk_stream == stream)
+		err = EALREADY;
+	else if (ctx->trunk)
+		err = EBUSY;
+	else if (ctx->ptime != trunk->cfg.ptime)
+		err = EINVAL;
+	mtx_unlock(ctx->mutex);
+
+	if (!err && member->ctx)
+		err = EADDRINUSE;
+	if (err)
+		goto out;
+
+	err = aumix_source_alloc(&mix_source, ctx->rx_mix, NULL, NULL);
+	if (err)
+		goto out;
+	aumix_source_enable(mix_source, true);
+
+	mtx_lock(ctx->mutex);
+	if (ctx->closing) {
+		mtx_unlock(ctx->mutex);
+		err = ESHUTDOWN;
+		goto out;
+	}
+
+	ctx->trunk = mem_ref(trunk);
+	ctx->trunk_stream = stream;
+
+	mtx_lock(trunk->mutex);
+	member->ctx = ctx;
+	member->mix_source = mix_source;
+	member->pending = false;
+	++trunk->members;
+	mtx_unlock(trunk->mutex);
+	mix_source = NULL;
+	mtx_unlock(ctx->mutex);
+
+out:
+	mtx_unlock(ctx->pairing_mutex);
+
+	if (mix_source)
+		aumix_source_enable(mix_source, false);
+	mem_deref(mix_source);
+
+	if (err == EALREADY) {
+		if (changed)
+			*changed = false;
+		return 0;
+	}
+	if (err)
+		return err;
+
+	/* The trunk is an extra RX mixer input. */
+	ms_context_bypass_update(ctx);
+
+	if (changed)
+		*changed = true;
+
+	info("mediasoup_bridge: context '%s' joined trunk '%s' stream %u\n",
+	     ctx->key, trunk->name, stream);
+	return 0;
+}
+
+
+/**
+ * Return a context to its own TX socket
+ *
+ * @param ctx  Context
+ *
+ * @return true if the context was a trunk member
+ */
+bool ms_trunk_leave(struct ms_context *ctx)
+{
+	struct aumix_source *mix_source = NULL;
+	struct ms_trunk_member *member;
+	struct ms_trunk *trunk;
+	unsigned stream;
+	bool closing;
+
+	if (!ctx || !ctx->mutex)
+		return false;
+
+	mtx_lock(ctx->mutex);
+	trunk = ctx->trunk;
+	stream = ctx->trunk_stream;
+	closing = ctx->closing;
+	ctx->trunk = NULL;
+	ctx->trunk_stream = 0;
+	mtx_unlock(ctx->mutex);
+
+	if (!trunk)
+		return false;
+
+	member = &trunk->memberv[stream];
+
+	mtx_lock(trunk->mutex);
+	if (member->ctx == ctx) {
+		mix_source = member->mix_source;
+		if (member->pending)
+			--trunk->pendingc;
+		member->ctx = NULL;
+		member->mix_source = NULL;
+		member->pending = false;
+		--trunk->members;
+
+		/* The remaining members may all be waiting on this one. */
+		if (trunk->members && trunk->pendingc >= trunk->members)
+			trunk_flush_locked(trunk);
+	}
+	mtx_unlock(trunk->mutex);
+
+	if (mix_source)
+		aumix_source_enable(mix_source, false);
+	mem_deref(mix_source);
+
+	if (!closing)
+		ms_context_bypass_update(ctx);
+
+	mem_deref(trunk);
+	return true;
+}
+
+
+void ms_trunk_stats(struct ms_trunk *trunk, struct ms_trunk_stats *stats)
+{
+	if (!trunk || !stats)
+		return;
+
+	mtx_lock(trunk->mutex);
+	*stats = trunk->stats;
+	mtx_unlock(trunk->mutex);
+}
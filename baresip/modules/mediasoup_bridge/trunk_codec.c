@@ -0,0 +1,232 @@
+/**
+ * @file trunk_codec.c Opus multistream framing for bridge trunks
+ *
+ * The encoder and decoder are configured like a context's own Opus encoder
+ * (VoIP, VBR, voice signal, no DTX) with the per-stream bitrate scaled by
+ * the stream count.  This file has no libre dependency so the loopback
+ * harness can link it directly.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trunk_codec.h"
+
+
+static void mapping_init(unsigned char *mapping, unsigned count)
+{
+	unsigned i;
+
+	/* Coupled streams come first, so identity covers mono and stereo. */
+	for (i = 0; i < count; ++i)
+		mapping[i] = (unsigned char)i;
+}
+
+
+/**
+ * Create the multistream encoder and decoder of a trunk
+ *
+ * @param tc         Codec state to initialise
+ * @param streams    Number of member streams (1 - MS_TRUNK_MAX_STREAMS)
+ * @param channels   Channels per stream (1 or 2)
+ * @param srate      Sample rate
+ * @param bitrate    Bitrate per stream in bit/s
+ * @param tx_frames  Largest frame size to encode, per channel
+ * @param rx_frames  Largest frame size to decode, per channel
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ms_trunk_codec_init(struct ms_trunk_codec *tc, unsigned streams,
+			unsigned channels, uint32_t srate, int bitrate,
+			size_t tx_frames, size_t rx_frames)
+{
+	unsigned char mapping[MS_TRUNK_MAX_STREAMS * 2];
+	const unsigned coupled = channels == 2 ? streams : 0;
+	int opus_err;
+	int err = 0;
+
+	if (!tc || !streams || streams > MS_TRUNK_MAX_STREAMS ||
+	    (channels != 1 && channels != 2) || !tx_frames || !rx_frames)
+		return EINVAL;
+
+	memset(tc, 0, sizeof(*tc));
+	tc->streams = streams;
+	tc->channels = channels;
+	tc->tx_frames = tx_frames;
+	tc->rx_frames = rx_frames;
+	mapping_init(mapping, streams * channels);
+
+	tc->enc = opus_multistream_encoder_create(
+		(opus_int32)srate, (int)(streams * channels), (int)streams,
+		(int)coupled, mapping, OPUS_APPLICATION_VOIP, &opus_err);
+	if (!tc->enc) {
+		err = opus_err == OPUS_ALLOC_FAIL ? ENOMEM : EINVAL;
+		goto out;
+	}
+
+	opus_err  = opus_multistream_encoder_ctl(
+		tc->enc, OPUS_SET_BITRATE(bitrate * (int)streams));
+	opus_err |= opus_multistream_encoder_ctl(tc->enc, OPUS_SET_VBR(1));
+	opus_err |= opus_multistream_encoder_ctl(
+		tc->enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+	opus_err |= opus_multistream_encoder_ctl(tc->enc, OPUS_SET_DTX(0));
+	if (opus_err != OPUS_OK) {
+		err = EPROTO;
+		goto out;
+	}
+
+	tc->dec = opus_multistream_decoder_create(
+		(opus_int32)srate, (int)(streams * channels), (int)streams,
+		(int)coupled, mapping, &opus_err);
+	if (!tc->dec) {
+		err = opus_err == OPUS_ALLOC_FAIL ? ENOMEM : EINVAL;
+		goto out;
+	}
+
+	tc->tx_pcm = calloc(tx_frames * streams * channels,
+			    sizeof(*tc->tx_pcm));
+	tc->rx_pcm = calloc(rx_frames * streams * channels,
+			    sizeof(*tc->rx_pcm));
+	if (!tc->tx_pcm || !tc->rx_pcm)
+		err = ENOMEM;
+
+out:
+	if (err)
+		ms_trunk_codec_close(tc);
+
+	return err;
+}
+
+
+void ms_trunk_codec_close(struct ms_trunk_codec *tc)
+{
+	if (!tc)
+		return;
+
+	if (tc->enc)
+		opus_multistream_encoder_destroy(tc->enc);
+	if (tc->dec)
+		opus_multistream_decoder_destroy(tc->dec);
+	free(tc->tx_pcm);
+	free(tc->rx_pcm);
+	memset(tc, 0, sizeof(*tc));
+}
+
+
+/**
+ * Place one member's stereo frame into the next packet
+ *
+ * @param tc      Codec state
+ * @param stream  Member stream index
+ * @param sampv   Interleaved stereo samples
+ * @param frames  Samples per channel
+ */
+void ms_trunk_codec_put(struct ms_trunk_codec *tc, unsigned stream,
+			const int16_t *sampv, size_t frames)
+{
+	size_t stride;
+	int16_t *dst;
+	size_t i;
+
+	if (!tc || !sampv || stream >= tc->streams || frames > tc->tx_frames)
+		return;
+
+	stride = (size_t)tc->streams * tc->channels;
+	dst = tc->tx_pcm + (size_t)stream * tc->channels;
+
+	if (tc->channels == 2) {
+		for (i = 0; i < frames; ++i) {
+			dst[i * stride]     = sampv[2 * i];
+			dst[i * stride + 1] = sampv[2 * i + 1];
+		}
+	}
+	else {
+		for (i = 0; i < frames; ++i)
+			dst[i * stride] = (int16_t)(((int32_t)sampv[2 * i] +
+						     sampv[2 * i + 1]) / 2);
+	}
+}
+
+
+/**
+ * Encode the gathered frames into one packet and clear them, so streams
+ * without a frame for the next packet are sent as silence
+ *
+ * @return Packet length, or a negative Opus error
+ */
+int ms_trunk_codec_encode(struct ms_trunk_codec *tc, size_t frames,
+			  uint8_t *packet, size_t size)
+{
+	int n;
+
+	if (!tc || !packet || !frames || frames > tc->tx_frames)
+		return OPUS_BAD_ARG;
+
+	n = opus_multistream_encode(tc->enc, tc->tx_pcm, (int)frames, packet,
+				    (opus_int32)size);
+
+	memset(tc->tx_pcm, 0, frames * tc->streams * tc->channels *
+	       sizeof(*tc->tx_pcm));
+
+	return n;
+}
+
+
+/**
+ * Decode one packet, or conceal one lost packet if packet is NULL
+ *
+ * @param tc      Codec state
+ * @param packet  Multistream packet, or NULL for PLC
+ * @param len     Packet length
+ * @param frames  Concealment length per channel, ignored for real packets
+ *
+ * @return Decoded samples per channel, or a negative Opus error
+ */
+int ms_trunk_codec_decode(struct ms_trunk_codec *tc, const uint8_t *packet,
+			  size_t len, size_t frames)
+{
+	if (!tc)
+		return OPUS_BAD_ARG;
+
+	if (!packet)
+		return opus_multistream_decode(tc->dec, NULL, 0, tc->rx_pcm,
+					       (int)(frames < tc->rx_frames ?
+						     frames : tc->rx_frames),
+					       0);
+
+	return opus_multistream_decode(tc->dec, packet, (opus_int32)len,
+				       tc->rx_pcm, (int)tc->rx_frames, 0);
+}
+
+
+/**
+ * Extract one member's stereo frame from the last decoded packet
+ */
+void ms_trunk_codec_get(const struct ms_trunk_codec *tc, unsigned stream,
+			int16_t *sampv, size_t frames)
+{
+	const int16_t *src;
+	size_t stride;
+	size_t i;
+
+	if (!tc || !sampv || stream >= tc->streams || frames > tc->rx_frames)
+		return;
+
+	stride = (size_t)tc->streams * tc->channels;
+	src = tc->rx_pcm + (size_t)stream * tc->channels;
+
+	for (i = 0; i < frames; ++i) {
+		sampv[2 * i]     = src[i * stride];
+		sampv[2 * i + 1] = src[i * stride + tc->channels - 1];
+	}
+}
+
+
+void ms_trunk_codec_reset(struct ms_trunk_codec *tc)
+{
+	if (!tc || !tc->dec)
+		return;
+
+	(void)opus_multistream_decoder_ctl(tc->dec, OPUS_RESET_STATE);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file trunk_codec.h Opus multistream framing for bridge trunks
+ *
+ * A trunk carries one Opus stream per member context inside a single
+ * multistream packet.  Members always exchange 48 kHz stereo frames with
+ * the codec; a mono trunk downmixes on the way in and duplicates on the
+ * way out.  Stream k maps to channels k (mono) or 2k and 2k + 1 (stereo).
+ */
+
+#ifndef MS_TRUNK_CODEC_H
+#define MS_TRUNK_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <opus/opus_multistream.h>
+
+
+enum {
+	MS_TRUNK_MAX_STREAMS = 8,
+};
+
+
+struct ms_trunk_codec {
+	OpusMSEncoder *enc;
+	OpusMSDecoder *dec;
+	unsigned streams;
+	unsigned channels;      /* per stream: 1 or 2 */
+	size_t tx_frames;       /* capacity of tx_pcm per channel */
+	size_t rx_frames;       /* capacity of rx_pcm per channel */
+	int16_t *tx_pcm;        /* gathered member frames, interleaved */
+	int16_t *rx_pcm;        /* last decoded packet, interleaved */
+};
+
+
+int  ms_trunk_codec_init(struct ms_trunk_codec *tc, unsigned streams,
+			 unsigned channels, uint32_t srate, int bitrate,
+			 size_t tx_frames, size_t rx_frames);
+void ms_trunk_codec_close(struct ms_trunk_codec *tc);
+void ms_trunk_codec_put(struct ms_trunk_codec *tc, unsigned stream,
+			const int16_t *sampv, size_t frames);
+int  ms_trunk_codec_encode(struct ms_trunk_codec *tc, size_t frames,
+			   uint8_t *packet, size_t size);
+int  ms_trunk_codec_decode(struct ms_trunk_codec *tc, const uint8_t *packet,
+			   size_t len, size_t frames);
+void ms_trunk_codec_get(const struct ms_trunk_codec *tc, unsigned stream,
+			int16_t *sampv, size_t frames);
+void ms_trunk_codec_reset(struct ms_trunk_codec *tc);
+
+#endif
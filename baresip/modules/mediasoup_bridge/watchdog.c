@@ -0,0 +1,168 @@
+/**
+ * @file watchdog.c Mixer clock watchdog
+ *
+ * Each context has two clocks: the TX encode tick, clocked by the TX mixer
+ * or by the bypassed caller, and the RX mixer, observed through its caller
+ * callbacks.  Every tick records how late it came after the previous one
+ * into a histogram that the mixer thread publishes through a seqlock.
+ *
+ * A stalled thread does not call back at all, so lateness alone would be
+ * reported only after the stall.  The main thread therefore also checks
+ * the time since the last tick every MS_WATCHDOG_MS, half the shortest
+ * stall threshold, and raises MS_CTX_STALL when a running clock has been
+ * silent for longer than the threshold, and again when it ticks or stops.
+ */
+
+#include "mediasoup_bridge.h"
+
+
+/* Upper bounds of the lateness buckets; the last one is open. */
+static const uint32_t bucketv[MS_LATE_BUCKETS - 1] = {
+	1000, 2000, 5000, 10000, 20000, 50000, 100000,
+};
+
+
+static const char *clock_name(unsigned id)
+{
+	return id == MS_CLOCK_TX ? "tx" : "rx";
+}
+
+
+/* The RX mixer is only observed while a caller is attached to it. */
+static bool clock_expected(const struct ms_context *ctx, unsigned id)
+{
+	return id == MS_CLOCK_TX || atomic_load(&ctx->caller_count) > 0;
+}
+
+
+/**
+ * Get the upper bound of a lateness bucket
+ *
+ * @param bucket Bucket index
+ *
+ * @return Bound in microseconds, 0 for the last (open) bucket
+ */
+uint32_t ms_clock_bucket_us(unsigned bucket)
+{
+	return bucket < RE_ARRAY_SIZE(bucketv) ? bucketv[bucket] : 0;
+}
+
+
+/**
+ * Record one tick of a mixer clock
+ *
+ * Called on the clock's own thread; the TX clock with ctx->mutex held.
+ * Ticks within half a period of the previous one belong to the same
+ * mixer cycle (one callback per caller) and are not counted again.  A
+ * tick that races ms_clock_reset() loses and is not counted, so it can
+ * not restore the time the reset cleared.
+ *
+ * @param clk    Mixer clock
+ * @param ptime  Context packet time in milliseconds
+ * @param now_us Current time in microseconds
+ */
+void ms_clock_tick(struct ms_clock *clk, uint32_t ptime, uint64_t now_us)
+{
+	const uint64_t period_us = (uint64_t)ptime * 1000;
+	uint64_t last_us = atomic_load(&clk->last_us);
+	uint64_t late_us = 0;
+	unsigned i;
+
+	if (last_us && now_us >= last_us && now_us - last_us < period_us / 2)
+		return;
+
+	if (!atomic_compare_exchange_strong(&clk->last_us, &last_us, now_us))
+		return;
+	if (!last_us || now_us < last_us)
+		return;
+
+	if (now_us - last_us > period_us)
+		late_us = now_us - last_us - period_us;
+
+	for (i = 0; i < RE_ARRAY_SIZE(bucketv) && late_us >= bucketv[i]; ++i)
+		;
+
+	ms_seq_write_begin(&clk->stats.lock);
+	++clk->stats.v.ticks;
+	++clk->stats.v.late_histv[i];
+	clk->stats.v.late_us_sum += late_us;
+	if (late_us > MS_TICK_LATE_US)
+		++clk->stats.v.late_ticks;
+	if (late_us > clk->stats.v.late_us_max)
+		clk->stats.v.late_us_max = (uint32_t)MIN(late_us, UINT32_MAX);
+	ms_seq_write_end(&clk->stats.lock);
+}
+
+
+/**
+ * Forget the previous tick at a clock handover
+ *
+ * The next tick starts a new measurement instead of counting the gap as
+ * lateness.  The watchdog treats the clock as stopped until then.
+ *
+ * @param clk Mixer clock
+ */
+void ms_clock_reset(struct ms_clock *clk)
+{
+	if (clk)
+		atomic_store(&clk->last_us, 0);
+}
+
+
+static void stall_emit(const struct ms_context *ctx, unsigned id,
+		       const char *state, uint64_t silent_ms,
+		       uint64_t threshold_ms)
+{
+	module_event("mediasoup_bridge", "MS_CTX_STALL", NULL, NULL,
+		     "{\"key\":\"%s\",\"clock\":\"%s\",\"state\":\"%s\","
+		     "\"silentMs\":%llu,\"thresholdMs\":%llu,\"stalls\":%llu}",
+		     ctx->key, clock_name(id), state,
+		     (unsigned long long)silent_ms,
+		     (unsigned long long)threshold_ms,
+		     (unsigned long long)ctx->clockv[id].stalls);
+}
+
+
+/**
+ * Check a context's mixer clocks for stalls; main thread only
+ *
+ * @param ctx Bridge context
+ * @param now Current time in milliseconds
+ */
+void ms_context_watchdog(struct ms_context *ctx, uint64_t now)
+{
+	uint64_t threshold_ms;
+	unsigned id;
+
+	if (!ctx)
+		return;
+
+	threshold_ms = MAX((uint64_t)MS_STALL_MS, 3 * (uint64_t)ctx->ptime);
+
+	for (id = 0; id < MS_CLOCKS; ++id) {
+		struct ms_clock *clk = &ctx->clockv[id];
+		const uint64_t last_us = atomic_load(&clk->last_us);
+		const bool running = last_us && clock_expected(ctx, id);
+		uint64_t silent_ms = 0;
+
+		if (running && now * 1000 > last_us)
+			silent_ms = (now * 1000 - last_us) / 1000;
+
+		if (!clk->stalled && silent_ms >= threshold_ms) {
+			clk->stalled = true;
+			clk->silent_since_ms = now - silent_ms;
+			++clk->stalls;
+			warning("mediasoup_bridge: context '%s' %s mixer "
+				"clock silent for %llu ms\n", ctx->key,
+				clock_name(id), (unsigned long long)silent_ms);
+			stall_emit(ctx, id, "stalled", silent_ms,
+				   threshold_ms);
+		}
+		else if (clk->stalled && silent_ms < threshold_ms) {
+			/* Up to MS_WATCHDOG_MS longer than the stall. */
+			clk->stalled = false;
+			stall_emit(ctx, id, running ? "resumed" : "stopped",
+				   now - clk->silent_since_ms, threshold_ms);
+		}
+	}
+}
@@ -0,0 +1,128 @@
+/**
+ * @file meter_shm.h  Shared-memory meter file layout
+ *
+ * The meter file is a fixed-layout, memory-mapped file shared by the
+ * vumeter_stereo (call levels) and mediasoup_bridge (bridge levels)
+ * modules.  Each module writes only its own section.  This header is the
+ * one definition of the layout for both writers and their tests; readers
+ * in other languages follow docs/meter-shm.md.
+ *
+ * Every slot is bracketed by a sequence number that is odd while the slot
+ * is being written, so a reader in another process can copy the slot and
+ * tell a torn copy from a good one.
+ */
+
+#ifndef METER_SHM_H
+#define METER_SHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+
+enum {
+	METER_SHM_MAGIC     = 0x52544d42,  /* "BMTR" */
+	METER_SHM_VERSION   = 2,
+	METER_SHM_HDR_SIZE  = 64,
+	METER_SHM_SLOT_SIZE = 320,
+	METER_SHM_CALLS     = 64,
+	METER_SHM_BRIDGE    = 2048,
+	METER_SHM_SIZE      = METER_SHM_HDR_SIZE + METER_SHM_SLOT_SIZE *
+			      (METER_SHM_CALLS + METER_SHM_BRIDGE),
+};
+
+/** Slot flags */
+enum {
+	METER_SHM_USED   = 1 << 0,
+	METER_SHM_TX     = 1 << 1,  /* TX levels valid */
+	METER_SHM_RX     = 1 << 2,  /* RX levels valid */
+	METER_SHM_ACTIVE = 1 << 3,  /* bridge: above the activity threshold */
+	METER_SHM_MUTED  = 1 << 4,  /* bridge: TX muted */
+};
+
+
+/** Meter file header (64 bytes) */
+struct meter_shm_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hdr_size;
+	uint16_t slot_size;
+	uint16_t call_slots;
+	uint16_t bridge_slots;
+	uint16_t call_used;       /* one past the highest call slot in use */
+	uint64_t call_seq;        /* bumped after every call pass */
+	uint64_t call_ms;         /* wall clock of the last call pass */
+	uint64_t bridge_seq;      /* same, for the bridge section */
+	uint64_t bridge_ms;
+	uint16_t bridge_used;
+	uint8_t pad[14];
+};
+
+
+/** One level slot (320 bytes) */
+struct meter_shm_slot {
+	uint32_t seq;             /* odd while being written */
+	uint32_t flags;
+	char key[128];            /* account AOR or context key */
+	char id[112];             /* call id or producer id */
+	float levelv[16];
+	uint32_t count;           /* bridge: packets, modulo 2^32 */
+	uint32_t seq_end;         /* equals seq when the slot is consistent */
+};
+
+
+_Static_assert(sizeof(struct meter_shm_hdr) == METER_SHM_HDR_SIZE,
+	       "meter file header size");
+_Static_assert(sizeof(struct meter_shm_slot) == METER_SHM_SLOT_SIZE,
+	       "meter file slot size");
+
+
+/* Set up the header unless another writer already has */
+static inline void meter_shm_hdr_init(struct meter_shm_hdr *hdr)
+{
+	if (hdr->magic == METER_SHM_MAGIC &&
+	    hdr->version == METER_SHM_VERSION &&
+	    hdr->hdr_size == METER_SHM_HDR_SIZE &&
+	    hdr->slot_size == METER_SHM_SLOT_SIZE &&
+	    hdr->call_slots == METER_SHM_CALLS &&
+	    hdr->bridge_slots == METER_SHM_BRIDGE)
+		return;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->version      = METER_SHM_VERSION;
+	hdr->hdr_size     = METER_SHM_HDR_SIZE;
+	hdr->slot_size    = METER_SHM_SLOT_SIZE;
+	hdr->call_slots   = METER_SHM_CALLS;
+	hdr->bridge_slots = METER_SHM_BRIDGE;
+	atomic_thread_fence(memory_order_release);
+	hdr->magic        = METER_SHM_MAGIC;
+}
+
+
+/*
+ * A slot is written as seq_end, seq (both odd), the payload, then seq and
+ * seq_end (both even), so a reader copying it front to back sees a torn
+ * copy as seq != seq_end or odd.
+ */
+static inline void meter_shm_slot_begin(struct meter_shm_slot *slot)
+{
+	const uint32_t seq = (slot->seq + 1) | 1;
+
+	slot->seq_end = seq;
+	atomic_thread_fence(memory_order_release);
+	slot->seq = seq;
+	atomic_thread_fence(memory_order_release);
+}
+
+
+static inline void meter_shm_slot_end(struct meter_shm_slot *slot)
+{
+	const uint32_t seq = slot->seq + 1;
+
+	atomic_thread_fence(memory_order_release);
+	slot->seq = seq;
+	atomic_thread_fence(memory_order_release);
+	slot->seq_end = seq;
+}
+
+#endif
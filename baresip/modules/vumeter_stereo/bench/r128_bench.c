@@ -0,0 +1,235 @@
+/**
+ * @file r128_bench.c Loudness cost per frame
+ *
+ * Times what the filter path does per 20 ms frame, at 8, 16 and 48 kHz,
+ * mono and stereo, s16 and float:
+ *
+ *  - level:   vu_acc_add() alone, the meter before loudness
+ *  - loud:    vu_r128_process() plus vu_acc_add() handing on its result
+ *  - added:   the difference, the cost of loudness per frame
+ *  - scalar:  a plain K-weighting in double, two biquads per channel one
+ *             after the other, as a reference for the lane layout
+ *
+ * One result line per configuration, in ns per frame.
+ *
+ *   vumeter_stereo_r128_bench
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "vu_level.h"
+#include "vu_r128.h"
+
+
+enum {
+	BENCH_PTIME     = 20,
+	BENCH_MAX_SAMPC = 48000 * BENCH_PTIME / 1000 * 2,
+	BENCH_FRAMES    = 16,
+	BENCH_ITER      = 20000,
+};
+
+
+/* Reference biquad, direct form I in double */
+struct biquad {
+	double b0, b1, b2, a1, a2;
+	double x1, x2, y1, y2;
+};
+
+
+static int16_t s16v[BENCH_FRAMES][BENCH_MAX_SAMPC];
+static float fltv[BENCH_FRAMES][BENCH_MAX_SAMPC];
+static volatile double sink;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/* Speech-like level spread: random samples from 0 to -45 dB gain. */
+static void fill_frames(void)
+{
+	uint32_t seed = 0x1234567u;
+	size_t f;
+	size_t i;
+
+	for (f = 0; f < BENCH_FRAMES; ++f) {
+		const double gain = pow(10.0, -(double)(f * 3) / 20.0);
+
+		for (i = 0; i < BENCH_MAX_SAMPC; ++i) {
+			seed = seed * 1664525u + 1013904223u;
+			s16v[f][i] = (int16_t)((double)(int16_t)(seed >> 16) *
+					       gain);
+			fltv[f][i] = (float)s16v[f][i] / 32768.0f;
+		}
+	}
+}
+
+
+static const void *frame(enum vu_fmt fmt, size_t n)
+{
+	return fmt == VU_FMT_FLOAT ? (const void *)fltv[n % BENCH_FRAMES] :
+				     (const void *)s16v[n % BENCH_FRAMES];
+}
+
+
+static double bench_level(enum vu_fmt fmt, size_t sampc, uint8_t ch)
+{
+	static struct vu_acc acc;
+	struct vu_sums sums;
+	uint64_t t0;
+	size_t n;
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_ITER; ++n)
+		vu_acc_add(&acc, fmt, frame(fmt, n), sampc, ch, NULL);
+
+	vu_acc_take(&acc, &sums);
+	sink = (double)sums.sum_l;
+
+	return (double)(now_ns() - t0) / BENCH_ITER;
+}
+
+
+static double bench_loud(enum vu_fmt fmt, uint32_t srate, size_t sampc,
+			 uint8_t ch)
+{
+	static struct vu_acc acc;
+	static struct vu_r128 r128;
+	struct vu_sums sums;
+	uint64_t t0;
+	size_t n;
+
+	vu_r128_init(&r128, srate);
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_ITER; ++n) {
+		const void *sampv = frame(fmt, n);
+		const bool block = vu_r128_process(&r128, fmt, sampv, sampc,
+						   ch, srate);
+
+		vu_acc_add(&acc, fmt, sampv, sampc, ch, block ? &r128 : NULL);
+	}
+
+	vu_acc_take(&acc, &sums);
+	sink = sums.lufs_m;
+
+	return (double)(now_ns() - t0) / BENCH_ITER;
+}
+
+
+static double biquad_step(struct biquad *q, double x)
+{
+	const double y = q->b0 * x + q->b1 * q->x1 + q->b2 * q->x2 -
+			 q->a1 * q->y1 - q->a2 * q->y2;
+
+	q->x2 = q->x1;
+	q->x1 = x;
+	q->y2 = q->y1;
+	q->y1 = y;
+
+	return y;
+}
+
+
+/* The coefficients come from the module, the filter structure does not */
+static double bench_scalar(enum vu_fmt fmt, uint32_t srate, size_t sampc,
+			   uint8_t ch)
+{
+	struct biquad shelf[2], hpf[2];
+	struct vu_r128 r128;
+	double sum = 0.0;
+	uint64_t t0;
+	size_t n, i;
+	uint8_t c;
+
+	vu_r128_init(&r128, srate);
+	memset(shelf, 0, sizeof(shelf));
+	memset(hpf, 0, sizeof(hpf));
+	for (c = 0; c < 2; ++c) {
+		shelf[c].b0 = r128.b0v[0];
+		shelf[c].b1 = r128.b1v[0];
+		shelf[c].b2 = r128.b2v[0];
+		shelf[c].a1 = r128.a1v[0];
+		shelf[c].a2 = r128.a2v[0];
+		hpf[c].b0 = 1.0;
+		hpf[c].b1 = -2.0;
+		hpf[c].b2 = 1.0;
+		hpf[c].a1 = r128.a1v[2];
+		hpf[c].a2 = r128.a2v[2];
+	}
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_ITER; ++n) {
+		const int16_t *s16 = s16v[n % BENCH_FRAMES];
+		const float *flt = fltv[n % BENCH_FRAMES];
+
+		for (c = 0; c < ch; ++c) {
+			for (i = c; i < sampc; i += ch) {
+				const double x = fmt == VU_FMT_FLOAT ?
+					flt[i] : s16[i] / 32768.0;
+				const double y = biquad_step(&hpf[c],
+					biquad_step(&shelf[c], x));
+
+				sum += y * y;
+			}
+		}
+	}
+
+	sink = sum;
+
+	return (double)(now_ns() - t0) / BENCH_ITER;
+}
+
+
+int main(void)
+{
+	static const uint32_t sratev[] = {8000, 16000, 48000};
+	static const uint8_t chv[] = {1, 2};
+	static const struct {
+		const char *name;
+		enum vu_fmt fmt;
+	} fmtv[] = {
+		{"s16",   VU_FMT_S16},
+		{"float", VU_FMT_FLOAT},
+	};
+	size_t s, c, f;
+
+	vu_level_init();
+	fill_frames();
+
+	for (f = 0; f < sizeof(fmtv) / sizeof(fmtv[0]); ++f) {
+		for (s = 0; s < sizeof(sratev) / sizeof(sratev[0]); ++s) {
+			for (c = 0; c < sizeof(chv); ++c) {
+				const enum vu_fmt fmt = fmtv[f].fmt;
+				const uint32_t srate = sratev[s];
+				const uint8_t ch = chv[c];
+				const size_t sampc =
+					srate * BENCH_PTIME / 1000 * ch;
+				const double level =
+					bench_level(fmt, sampc, ch);
+				const double loud =
+					bench_loud(fmt, srate, sampc, ch);
+				const double scalar =
+					bench_scalar(fmt, srate, sampc, ch);
+
+				printf("r128_bench fmt=%s srate=%u ch=%u "
+				       "sampc=%zu level_ns=%.1f loud_ns=%.1f "
+				       "added_ns=%.1f scalar_ns=%.1f\n",
+				       fmtv[f].name, srate, ch, sampc, level,
+				       loud, loud - level, scalar);
+			}
+		}
+	}
+
+	return 0;
+}
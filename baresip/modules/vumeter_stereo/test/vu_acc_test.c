@@ -0,0 +1,112 @@
+/**
+ * @file vu_acc_test.c Double-buffered VU accumulator stress test
+ *
+ * One thread adds stereo frames of constant samples as fast as it can
+ * while another retires the accumulator in a tight loop.  Every reading
+ * must be consistent (both sums match its sample count, so nothing came
+ * from half a frame) and the readings together must account for every
+ * frame that was added.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "vu_level.h"
+
+
+enum {
+	TEST_FRAMES  = 500000,
+	TEST_SAMPC   = 960,
+	TEST_L       = 100,
+	TEST_R       = -300,
+};
+
+
+static struct vu_acc acc;
+static int16_t sampv[TEST_SAMPC];
+static atomic_bool done;
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+static void *writer_thread(void *arg)
+{
+	unsigned i;
+	(void)arg;
+
+	for (i = 0; i < TEST_FRAMES; ++i)
+		vu_acc_add(&acc, VU_FMT_S16, sampv, TEST_SAMPC, 2, NULL);
+
+	atomic_store(&done, true);
+
+	return NULL;
+}
+
+
+/* Returns false for a torn reading */
+static bool take(uint64_t *samples, uint64_t *takes)
+{
+	struct vu_sums sums;
+
+	vu_acc_take(&acc, &sums);
+
+	*samples += sums.samples;
+	if (sums.samples)
+		++*takes;
+
+	return sums.sum_l == (uint64_t)sums.samples * TEST_L * TEST_L &&
+	       sums.sum_r == (uint64_t)sums.samples * TEST_R * TEST_R &&
+	       sums.samples % (TEST_SAMPC / 2) == 0;
+}
+
+
+int main(void)
+{
+	uint64_t samples = 0, takes = 0, torn = 0;
+	pthread_t tid;
+	unsigned i;
+
+	for (i = 0; i < TEST_SAMPC; i += 2) {
+		sampv[i]     = TEST_L;
+		sampv[i + 1] = TEST_R;
+	}
+
+	if (pthread_create(&tid, NULL, writer_thread, NULL)) {
+		fprintf(stderr, "vu_acc_test: cannot start writer\n");
+		return 1;
+	}
+
+	while (!atomic_load(&done)) {
+		if (!take(&samples, &takes))
+			++torn;
+	}
+
+	pthread_join(tid, NULL);
+
+	/* The active slot still holds the last frames */
+	if (!take(&samples, &takes))
+		++torn;
+
+	CHECK(torn == 0);
+	CHECK(samples == (uint64_t)TEST_FRAMES * (TEST_SAMPC / 2));
+	CHECK(takes > 1);
+
+	printf("vu_acc_test: %llu readings, %llu samples\n",
+	       (unsigned long long)takes, (unsigned long long)samples);
+
+	if (failures) {
+		fprintf(stderr, "vu_acc_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("vu_acc_test ok\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file vu_level_test.c VU-meter level kernel test
+ *
+ * Checks the baseline and the load-time selected s16 kernels against a
+ * plain reference loop on random frames of every length up to a few
+ * hundred samples, mono and stereo, including full-scale negative
+ * samples.  Float frames holding the same samples must give the same sums
+ * and peaks.  Also checks the dBFS conversions and the PPM ballistics.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vu_level.h"
+
+
+enum {
+	TEST_MAX_SAMPC = 600,
+	TEST_ROUNDS    = 4,
+};
+
+
+static int16_t sampv[TEST_MAX_SAMPC];
+static float fltv[TEST_MAX_SAMPC];
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+
+static uint32_t rnd(uint32_t *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+
+static void reference(struct vu_sums *sums, size_t sampc, uint8_t ch)
+{
+	size_t i;
+
+	memset(sums, 0, sizeof(*sums));
+
+	if (ch >= 2) {
+		for (i = 0; i + 1 < sampc; i += 2) {
+			sums->sum_l += (uint64_t)(sampv[i] * sampv[i]);
+			sums->sum_r += (uint64_t)(sampv[i + 1] * sampv[i + 1]);
+			sums->peak_l = MAX(sums->peak_l,
+					   (uint32_t)abs(sampv[i]));
+			sums->peak_r = MAX(sums->peak_r,
+					   (uint32_t)abs(sampv[i + 1]));
+		}
+		sums->samples = (uint32_t)(sampc / 2);
+		return;
+	}
+
+	for (i = 0; i < sampc; ++i) {
+		sums->sum_l += (uint64_t)(sampv[i] * sampv[i]);
+		sums->peak_l = MAX(sums->peak_l, (uint32_t)abs(sampv[i]));
+	}
+	sums->sum_r = sums->sum_l;
+	sums->peak_r = sums->peak_l;
+	sums->samples = (uint32_t)sampc;
+}
+
+
+static void check_kernel(uint32_t *seed)
+{
+	struct vu_sums ref, s16, flt;
+	size_t sampc, i;
+	uint8_t ch;
+	int round;
+
+	for (round = 0; round < TEST_ROUNDS; ++round) {
+		for (i = 0; i < TEST_MAX_SAMPC; ++i) {
+			sampv[i] = round == 0 ? -32768 :
+				(int16_t)(rnd(seed) & 0xffff);
+			fltv[i] = (float)sampv[i] / 32768.0f;
+		}
+
+		for (sampc = 0; sampc <= TEST_MAX_SAMPC; ++sampc) {
+			for (ch = 1; ch <= 2; ++ch) {
+				reference(&ref, sampc, ch);
+
+				memset(&s16, 0, sizeof(s16));
+				vu_measure_s16(&s16, sampv, sampc, ch);
+				CHECK(s16.sum_l == ref.sum_l);
+				CHECK(s16.sum_r == ref.sum_r);
+				CHECK(s16.peak_l == ref.peak_l);
+				CHECK(s16.peak_r == ref.peak_r);
+				CHECK(s16.samples == ref.samples);
+
+				memset(&flt, 0, sizeof(flt));
+				vu_measure_float(&flt, fltv, sampc, ch);
+				CHECK(flt.sum_l == ref.sum_l);
+				CHECK(flt.sum_r == ref.sum_r);
+				CHECK(flt.peak_l == ref.peak_l);
+				CHECK(flt.peak_r == ref.peak_r);
+				CHECK(flt.samples == ref.samples);
+			}
+		}
+	}
+}
+
+
+int main(void)
+{
+	uint32_t seed = 1;
+
+	/* Baseline kernel first, then the one picked for this CPU */
+	check_kernel(&seed);
+	vu_level_init();
+	check_kernel(&seed);
+
+	CHECK(vu_calc_dbfs(0, 0) == VU_DB_MIN);
+	CHECK(vu_calc_dbfs(0, 480) == VU_DB_MIN);
+	CHECK(vu_calc_dbfs(480ull << 30, 480) == 0.0);
+	CHECK(vu_peak_dbfs(0) == VU_DB_MIN);
+	CHECK(vu_peak_dbfs(32768) == 0.0);
+
+	/* PPM: instant attack, 20 dB fall in 1.7 s, floor at silence */
+	CHECK(vu_ppm_update(-40.0, -6.0, 100) == -6.0);
+	CHECK(fabs(vu_ppm_update(-6.0, -60.0, 1700) + 26.0) < 1e-9);
+	CHECK(vu_ppm_update(-95.0, VU_DB_MIN, 1000) == VU_DB_MIN);
+
+	if (failures) {
+		fprintf(stderr, "vu_level_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("vu_level_test ok (%s)\n", vu_level_kernel());
+	return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file vu_r128_test.c K-weighted loudness test
+ *
+ * Checks the 48 kHz K-weighting against the coefficient table of BS.1770,
+ * the steady sine cases of EBU Tech 3341 (stereo 1 kHz at -23 and -33
+ * dBFS read -23.0 and -33.0 LUFS within 0.1 LU) at common rates, s16 and
+ * float, mono counting as one channel, and the 400 ms and 3 s windows
+ * after a tone stops.  Frames of odd lengths straddle the sub-blocks.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vu_r128.h"
+
+
+enum {
+	TEST_FRAME = 441,            /* not a divisor of any sub-block */
+	TEST_MAX_CH = 2,
+};
+
+
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+#define CHECK_NEAR(a, b, tol) do {					\
+	const double a_ = (a), b_ = (b);				\
+	if (fabs(a_ - b_) > (tol)) {					\
+		fprintf(stderr, "%s:%d: %s = %f, expected %f\n",	\
+			__FILE__, __LINE__, #a, a_, b_);		\
+		++failures;						\
+	}								\
+} while (0)
+
+
+/* Feed ms of a 1 kHz sine at dbfs (or silence) in frames of TEST_FRAME */
+static unsigned feed(struct vu_r128 *r, enum vu_fmt fmt, uint32_t srate,
+		     uint8_t ch, double dbfs, unsigned ms, double *phase)
+{
+	const double amp = dbfs <= VU_LUFS_MIN ? 0.0 : pow(10.0, dbfs / 20);
+	const double step = 2 * M_PI * 1000.0 / srate;
+	int16_t s16[TEST_FRAME * TEST_MAX_CH];
+	float flt[TEST_FRAME * TEST_MAX_CH];
+	size_t frames = (size_t)srate * ms / 1000;
+	unsigned blocks = 0;
+
+	while (frames) {
+		const size_t n = frames < TEST_FRAME ? frames : TEST_FRAME;
+		size_t i;
+		uint8_t c;
+
+		for (i = 0; i < n; ++i) {
+			const double x = amp * sin(*phase);
+
+			*phase += step;
+			for (c = 0; c < ch; ++c) {
+				flt[i * ch + c] = (float)x;
+				s16[i * ch + c] = (int16_t)lrint(x * 32767);
+			}
+		}
+
+		blocks += vu_r128_process(r, fmt,
+					  fmt == VU_FMT_FLOAT ?
+					  (const void *)flt : (const void *)s16,
+					  n * ch, ch, srate);
+		frames -= n;
+	}
+
+	return blocks;
+}
+
+
+static void check_coefficients(void)
+{
+	struct vu_r128 r;
+
+	vu_r128_init(&r, 48000);
+
+	/* ITU-R BS.1770-4, tables 1 and 2 */
+	CHECK_NEAR(r.b0v[0],  1.53512485958697, 1e-6);
+	CHECK_NEAR(r.b1v[0], -2.69169618940638, 1e-6);
+	CHECK_NEAR(r.b2v[0],  1.19839281085285, 1e-6);
+	CHECK_NEAR(r.a1v[0], -1.69065929318241, 1e-6);
+	CHECK_NEAR(r.a2v[0],  0.73248077421585, 1e-6);
+	CHECK_NEAR(r.a1v[2], -1.99004745483398, 1e-6);
+	CHECK_NEAR(r.a2v[2],  0.99007225036621, 1e-6);
+	CHECK(r.b0v[1] == r.b0v[0] && r.a2v[3] == r.a2v[2]);
+	CHECK(r.block_len == 4800);
+}
+
+
+static void check_steady(enum vu_fmt fmt, uint32_t srate)
+{
+	struct vu_r128 r;
+	double phase = 0;
+	unsigned blocks;
+
+	memset(&r, 0, sizeof(r));
+
+	blocks = feed(&r, fmt, srate, 2, -23.0, 20000, &phase);
+	CHECK(blocks == 200);
+	CHECK_NEAR(r.lufs_m, -23.0, 0.1);
+	CHECK_NEAR(r.lufs_s, -23.0, 0.1);
+
+	(void)feed(&r, fmt, srate, 2, -33.0, 10000, &phase);
+	CHECK_NEAR(r.lufs_m, -33.0, 0.1);
+	CHECK_NEAR(r.lufs_s, -33.0, 0.1);
+
+	/* One channel, as mono calls are measured */
+	(void)feed(&r, fmt, srate, 1, -23.0, 10000, &phase);
+	CHECK_NEAR(r.lufs_m, -26.0, 0.1);
+	CHECK_NEAR(r.lufs_s, -26.0, 0.1);
+}
+
+
+static void check_windows(void)
+{
+	struct vu_r128 r;
+	double phase = 0;
+
+	memset(&r, 0, sizeof(r));
+	CHECK(r.srate == 0);
+
+	/* 3 s of tone, then silence */
+	(void)feed(&r, VU_FMT_FLOAT, 48000, 2, -20.0, 3000, &phase);
+	CHECK_NEAR(r.lufs_m, -20.0, 0.1);
+	CHECK_NEAR(r.lufs_s, -20.0, 0.1);
+
+	/* The filters ring into the first silent sub-block only */
+	(void)feed(&r, VU_FMT_FLOAT, 48000, 2, VU_LUFS_MIN, 400, &phase);
+	CHECK(r.lufs_m < -60.0);
+	(void)feed(&r, VU_FMT_FLOAT, 48000, 2, VU_LUFS_MIN, 100, &phase);
+	CHECK(r.lufs_m == VU_LUFS_MIN);
+	CHECK_NEAR(r.lufs_s, -20.0 + 10 * log10(25.0 / 30), 0.1);
+
+	(void)feed(&r, VU_FMT_FLOAT, 48000, 2, VU_LUFS_MIN, 2600, &phase);
+	CHECK(r.lufs_s == VU_LUFS_MIN);
+
+	/* Decayed silence must not leave the filter state denormal */
+	CHECK(r.s1v[2] == 0.0 || fabs(r.s1v[2]) > 1e-30);
+
+	/* A new rate restarts the meter */
+	(void)feed(&r, VU_FMT_FLOAT, 48000, 2, -20.0, 3000, &phase);
+	(void)feed(&r, VU_FMT_FLOAT, 16000, 2, VU_LUFS_MIN, 50, &phase);
+	CHECK(r.srate == 16000 && r.lufs_s == VU_LUFS_MIN);
+}
+
+
+int main(void)
+{
+	static const uint32_t sratev[] = {8000, 16000, 44100, 48000};
+	size_t i;
+
+	check_coefficients();
+
+	for (i = 0; i < sizeof(sratev) / sizeof(sratev[0]); ++i) {
+		check_steady(VU_FMT_S16, sratev[i]);
+		check_steady(VU_FMT_FLOAT, sratev[i]);
+	}
+
+	check_windows();
+
+	CHECK(vu_r128_lufs(0) == VU_LUFS_MIN);
+	CHECK(vu_r128_lufs(1e-9) == VU_LUFS_MIN);
+	CHECK_NEAR(vu_r128_lufs(1.0), -0.691, 1e-9);
+
+	if (failures) {
+		fprintf(stderr, "vu_r128_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("vu_r128_test ok\n");
+	return 0;
+}
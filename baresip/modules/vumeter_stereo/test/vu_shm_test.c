@@ -0,0 +1,171 @@
+/**
+ * @file vu_shm_test.c Shared-memory meter file layout test
+ *
+ * Writes calls through the module's writer and reads the file back byte by
+ * byte at the offsets given in docs/meter-shm.md, the way the Node reader
+ * does.  Also checks slot reuse and that a second writer opening the same
+ * file keeps the header.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vu_shm.h"
+
+
+static int failures;
+
+
+#define CHECK(expr) do {						\
+	if (!(expr)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #expr);			\
+		++failures;						\
+	}								\
+} while (0)
+
+
+static uint8_t filev[METER_SHM_SIZE];
+
+
+static bool read_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	size_t n;
+
+	if (!f)
+		return false;
+
+	n = fread(filev, 1, sizeof(filev), f);
+	fclose(f);
+
+	return n == sizeof(filev);
+}
+
+
+static uint32_t u32(size_t off)
+{
+	uint32_t v;
+	memcpy(&v, &filev[off], sizeof(v));
+	return v;
+}
+
+
+static uint16_t u16(size_t off)
+{
+	uint16_t v;
+	memcpy(&v, &filev[off], sizeof(v));
+	return v;
+}
+
+
+static uint64_t u64(size_t off)
+{
+	uint64_t v;
+	memcpy(&v, &filev[off], sizeof(v));
+	return v;
+}
+
+
+static float f32(size_t off)
+{
+	float v;
+	memcpy(&v, &filev[off], sizeof(v));
+	return v;
+}
+
+
+static size_t slot_off(int slot)
+{
+	return METER_SHM_HDR_SIZE + (size_t)slot * METER_SHM_SLOT_SIZE;
+}
+
+
+int main(void)
+{
+	const float txv[VU_SHM_LEVELS] = {-18.5f, -17.5f, -6, -6.5f, -5, -5.5f,
+					  -21.5f, -23};
+	char path[] = "/tmp/vu_shm_test.XXXXXX";
+	struct vu_shm shm, other;
+	size_t off;
+	int fd, a, b;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("vu_shm_test: mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	CHECK(vu_shm_open(&shm, path) == 0);
+	CHECK(vu_shm_isopen(&shm));
+
+	a = vu_shm_slot_alloc(&shm);
+	b = vu_shm_slot_alloc(&shm);
+	CHECK(a == 0 && b == 1);
+
+	vu_shm_write(&shm, a, "sip:studio@example.com", "call-a", txv, NULL);
+	vu_shm_write(&shm, b, "sip:desk@example.com", "call-b", NULL, txv);
+	vu_shm_commit(&shm);
+
+	CHECK(read_file(path));
+
+	/* Header */
+	CHECK(u32(0) == METER_SHM_MAGIC);
+	CHECK(memcmp(filev, "BMTR", 4) == 0);
+	CHECK(u16(4) == METER_SHM_VERSION);
+	CHECK(u16(6) == METER_SHM_HDR_SIZE);
+	CHECK(u16(8) == METER_SHM_SLOT_SIZE);
+	CHECK(u16(10) == METER_SHM_CALLS);
+	CHECK(u16(12) == METER_SHM_BRIDGE);
+	CHECK(u64(16) == 1);
+	CHECK(u64(24) > 0);
+	CHECK(u16(14) == 2);
+
+	/* First call slot: TX only */
+	off = slot_off(a);
+	CHECK(u32(off) == 2 && u32(off + 316) == 2);
+	CHECK(u32(off + 4) == (METER_SHM_USED | METER_SHM_TX));
+	CHECK(strcmp((char *)&filev[off + 8], "sip:studio@example.com") == 0);
+	CHECK(strcmp((char *)&filev[off + 136], "call-a") == 0);
+	CHECK(f32(off + 248) == -18.5f);
+	CHECK(f32(off + 268) == -5.5f);
+	CHECK(f32(off + 272) == -21.5f && f32(off + 276) == -23);
+
+	/* Second call slot: RX only, levels after the eight TX ones */
+	off = slot_off(b);
+	CHECK(u32(off + 4) == (METER_SHM_USED | METER_SHM_RX));
+	CHECK(f32(off + 280) == -18.5f);
+	CHECK(f32(off + 308) == -23);
+
+	/* A freed slot reads as unused and is handed out again */
+	vu_shm_slot_free(&shm, a);
+	CHECK(read_file(path));
+	off = slot_off(a);
+	CHECK(u32(off + 4) == 0);
+	CHECK(u32(off) == 4 && u32(off + 316) == 4);
+	CHECK(vu_shm_slot_alloc(&shm) == a);
+
+	/* Another writer on the same file keeps the header */
+	CHECK(vu_shm_open(&other, path) == 0);
+	CHECK(read_file(path));
+	CHECK(u32(0) == METER_SHM_MAGIC && u64(16) == 1);
+	vu_shm_close(&other);
+
+	vu_shm_close(&shm);
+	CHECK(!vu_shm_isopen(&shm));
+	CHECK(read_file(path));
+	CHECK(u32(slot_off(b) + 4) == 0);
+
+	unlink(path);
+
+	if (failures) {
+		fprintf(stderr, "vu_shm_test: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("vu_shm_test ok\n");
+	return 0;
+}
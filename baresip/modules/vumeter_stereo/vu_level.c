@@ -0,0 +1,470 @@
+/**
+ * @file vu_level.c  Stereo VU-meter level kernels
+ *
+ * 16-bit frames are squared and summed in integers, split into even (L)
+ * and odd (R) samples, in the same pass as their absolute peaks.  SSE2 is
+ * the x86-64 baseline, AVX2 is picked at load time when the CPU has it,
+ * NEON is used on AArch64 and a scalar loop covers the rest.  Float
+ * frames are measured as they are and added in the same 16-bit units.
+ */
+
+#include <math.h>
+#include <sched.h>
+#include <string.h>
+#include "vu_level.h"
+#include "vu_r128.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VU_LEVEL_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VU_LEVEL_NEON 1
+#endif
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+
+/* Squares and absolute peaks of even and odd samples of a pair stream */
+typedef void (vu_kernel_h)(uint64_t sumv[2], uint32_t peakv[2],
+			   const int16_t *sampv, size_t sampc);
+
+
+static void sum_tail(uint64_t sumv[2], uint32_t peakv[2],
+		     const int16_t *sampv, size_t sampc)
+{
+	size_t i;
+
+	/* Callers hand over the tail at an even index */
+	for (i = 0; i < sampc; ++i) {
+		const int32_t s = sampv[i];
+		const uint32_t a = (uint32_t)(s < 0 ? -s : s);
+
+		sumv[i & 1] += (uint64_t)(s * s);
+		if (a > peakv[i & 1])
+			peakv[i & 1] = a;
+	}
+}
+
+
+static void sum_scalar(uint64_t sumv[2], uint32_t peakv[2],
+		       const int16_t *sampv, size_t sampc)
+{
+	sumv[0] = sumv[1] = 0;
+	peakv[0] = peakv[1] = 0;
+
+	sum_tail(sumv, peakv, sampv, sampc);
+}
+
+
+/* Vector lanes alternate L and R since every block starts even */
+static void peak_lanes(uint32_t peakv[2], const int16_t *maxv,
+		       const int16_t *minv, unsigned n)
+{
+	unsigned k;
+
+	peakv[0] = peakv[1] = 0;
+
+	for (k = 0; k < n; ++k) {
+		const uint32_t a = (uint32_t)MAX(maxv[k], -minv[k]);
+
+		if (a > peakv[k & 1])
+			peakv[k & 1] = a;
+	}
+}
+
+
+#ifdef VU_LEVEL_X86
+/*
+ * Masking off the odd lanes (or shifting the even ones out) leaves one
+ * sample per 32-bit lane, so _mm_madd_epi16 yields a single square of at
+ * most 2^30 per lane, widened to 64 bit before accumulation.
+ */
+__attribute__((target("sse2")))
+static void sum_sse2(uint64_t sumv[2], uint32_t peakv[2],
+		     const int16_t *sampv, size_t sampc)
+{
+	const __m128i mask = _mm_set1_epi32(0xffff);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc_l = _mm_setzero_si128();
+	__m128i acc_r = _mm_setzero_si128();
+	__m128i vmax = _mm_setzero_si128();
+	__m128i vmin = _mm_setzero_si128();
+	uint64_t even[2], odd[2];
+	int16_t maxv[8], minv[8];
+	size_t i = 0;
+
+	for (; i + 8 <= sampc; i += 8) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		const __m128i l = _mm_and_si128(v, mask);
+		const __m128i r = _mm_srli_epi32(v, 16);
+		const __m128i sq_l = _mm_madd_epi16(l, l);
+		const __m128i sq_r = _mm_madd_epi16(r, r);
+
+		acc_l = _mm_add_epi64(acc_l, _mm_unpacklo_epi32(sq_l, zero));
+		acc_l = _mm_add_epi64(acc_l, _mm_unpackhi_epi32(sq_l, zero));
+		acc_r = _mm_add_epi64(acc_r, _mm_unpacklo_epi32(sq_r, zero));
+		acc_r = _mm_add_epi64(acc_r, _mm_unpackhi_epi32(sq_r, zero));
+		vmax = _mm_max_epi16(vmax, v);
+		vmin = _mm_min_epi16(vmin, v);
+	}
+
+	_mm_storeu_si128((__m128i *)even, acc_l);
+	_mm_storeu_si128((__m128i *)odd, acc_r);
+	_mm_storeu_si128((__m128i *)maxv, vmax);
+	_mm_storeu_si128((__m128i *)minv, vmin);
+
+	sumv[0] = even[0] + even[1];
+	sumv[1] = odd[0] + odd[1];
+	peak_lanes(peakv, maxv, minv, 8);
+
+	sum_tail(sumv, peakv, &sampv[i], sampc - i);
+}
+
+
+__attribute__((target("avx2")))
+static void sum_avx2(uint64_t sumv[2], uint32_t peakv[2],
+		     const int16_t *sampv, size_t sampc)
+{
+	const __m256i mask = _mm256_set1_epi32(0xffff);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc_l = _mm256_setzero_si256();
+	__m256i acc_r = _mm256_setzero_si256();
+	__m256i vmax = _mm256_setzero_si256();
+	__m256i vmin = _mm256_setzero_si256();
+	uint64_t even[4], odd[4];
+	int16_t maxv[16], minv[16];
+	size_t i = 0;
+
+	for (; i + 16 <= sampc; i += 16) {
+		const __m256i v =
+			_mm256_loadu_si256((const __m256i *)&sampv[i]);
+		const __m256i l = _mm256_and_si256(v, mask);
+		const __m256i r = _mm256_srli_epi32(v, 16);
+		const __m256i sq_l = _mm256_madd_epi16(l, l);
+		const __m256i sq_r = _mm256_madd_epi16(r, r);
+
+		acc_l = _mm256_add_epi64(acc_l,
+					 _mm256_unpacklo_epi32(sq_l, zero));
+		acc_l = _mm256_add_epi64(acc_l,
+					 _mm256_unpackhi_epi32(sq_l, zero));
+		acc_r = _mm256_add_epi64(acc_r,
+					 _mm256_unpacklo_epi32(sq_r, zero));
+		acc_r = _mm256_add_epi64(acc_r,
+					 _mm256_unpackhi_epi32(sq_r, zero));
+		vmax = _mm256_max_epi16(vmax, v);
+		vmin = _mm256_min_epi16(vmin, v);
+	}
+
+	_mm256_storeu_si256((__m256i *)even, acc_l);
+	_mm256_storeu_si256((__m256i *)odd, acc_r);
+	_mm256_storeu_si256((__m256i *)maxv, vmax);
+	_mm256_storeu_si256((__m256i *)minv, vmin);
+
+	sumv[0] = even[0] + even[1] + even[2] + even[3];
+	sumv[1] = odd[0] + odd[1] + odd[2] + odd[3];
+	peak_lanes(peakv, maxv, minv, 16);
+
+	sum_tail(sumv, peakv, &sampv[i], sampc - i);
+}
+#endif
+
+
+#ifdef VU_LEVEL_NEON
+static uint32_t peak_neon(int16x8_t vmax, int16x8_t vmin)
+{
+	return (uint32_t)MAX((int)vmaxvq_s16(vmax), -(int)vminvq_s16(vmin));
+}
+
+
+static void sum_neon(uint64_t sumv[2], uint32_t peakv[2],
+		     const int16_t *sampv, size_t sampc)
+{
+	int64x2_t acc_l = vdupq_n_s64(0);
+	int64x2_t acc_r = vdupq_n_s64(0);
+	int16x8_t max_l = vdupq_n_s16(0), min_l = vdupq_n_s16(0);
+	int16x8_t max_r = vdupq_n_s16(0), min_r = vdupq_n_s16(0);
+	size_t i = 0;
+
+	for (; i + 16 <= sampc; i += 16) {
+		/* De-interleaves into even (L) and odd (R) samples */
+		const int16x8x2_t v = vld2q_s16(&sampv[i]);
+		const int16x8_t l = v.val[0];
+		const int16x8_t r = v.val[1];
+
+		acc_l = vpadalq_s32(acc_l, vmull_s16(vget_low_s16(l),
+						     vget_low_s16(l)));
+		acc_l = vpadalq_s32(acc_l, vmull_s16(vget_high_s16(l),
+						     vget_high_s16(l)));
+		acc_r = vpadalq_s32(acc_r, vmull_s16(vget_low_s16(r),
+						     vget_low_s16(r)));
+		acc_r = vpadalq_s32(acc_r, vmull_s16(vget_high_s16(r),
+						     vget_high_s16(r)));
+		max_l = vmaxq_s16(max_l, l);
+		min_l = vminq_s16(min_l, l);
+		max_r = vmaxq_s16(max_r, r);
+		min_r = vminq_s16(min_r, r);
+	}
+
+	sumv[0] = (uint64_t)(vgetq_lane_s64(acc_l, 0) +
+			     vgetq_lane_s64(acc_l, 1));
+	sumv[1] = (uint64_t)(vgetq_lane_s64(acc_r, 0) +
+			     vgetq_lane_s64(acc_r, 1));
+	peakv[0] = peak_neon(max_l, min_l);
+	peakv[1] = peak_neon(max_r, min_r);
+
+	sum_tail(sumv, peakv, &sampv[i], sampc - i);
+}
+#endif
+
+
+#if defined(VU_LEVEL_X86)
+static vu_kernel_h *kernel = sum_sse2;
+static const char *kernel_name = "sse2";
+#elif defined(VU_LEVEL_NEON)
+static vu_kernel_h *kernel = sum_neon;
+static const char *kernel_name = "neon";
+#else
+static vu_kernel_h *kernel = sum_scalar;
+static const char *kernel_name = "scalar";
+#endif
+
+
+/**
+ * Select the widest kernel the CPU supports.  Call once at load time,
+ * before any audio thread runs; until then the baseline kernel is used.
+ */
+void vu_level_init(void)
+{
+#ifdef VU_LEVEL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernel = sum_avx2;
+		kernel_name = "avx2";
+	}
+#endif
+	(void)sum_scalar;
+}
+
+
+const char *vu_level_kernel(void)
+{
+	return kernel_name;
+}
+
+
+/**
+ * Convert a sum of squares in 16-bit units to dBFS
+ */
+double vu_calc_dbfs(uint64_t sum, uint32_t n)
+{
+	double rms;
+
+	if (n == 0)
+		return VU_DB_MIN;
+
+	rms = sqrt((double)sum / (double)n);
+
+	if (rms < 1.0e-10)
+		return VU_DB_MIN;
+
+	/* For s16 samples, full scale = 32768 */
+	return 20.0 * log10(rms / 32768.0);
+}
+
+
+/**
+ * Get the sample peak in dBFS
+ */
+double vu_peak_dbfs(uint32_t peak)
+{
+	if (!peak)
+		return VU_DB_MIN;
+
+	return 20.0 * log10((double)peak / 32768.0);
+}
+
+
+/**
+ * Let a PPM reading follow the peaks of one tick
+ *
+ * The attack is the sample peak of the tick; the return falls at
+ * VU_PPM_FALL_DB_PER_S, the rate the UI meter uses.
+ *
+ * @param ppm     Previous reading in dBFS
+ * @param peak_db Sample peak of the tick in dBFS
+ * @param dt_ms   Time since the previous reading
+ *
+ * @return New reading in dBFS
+ */
+double vu_ppm_update(double ppm, double peak_db, uint32_t dt_ms)
+{
+	const double fallen = ppm - VU_PPM_FALL_DB_PER_S * dt_ms / 1000.0;
+
+	return MAX(peak_db, MAX(fallen, VU_DB_MIN));
+}
+
+
+static void add_sums(struct vu_sums *sums, uint64_t sum_l, uint64_t sum_r,
+		     uint32_t peak_l, uint32_t peak_r, uint32_t samples)
+{
+	sums->sum_l += sum_l;
+	sums->sum_r += sum_r;
+	sums->peak_l = MAX(sums->peak_l, peak_l);
+	sums->peak_r = MAX(sums->peak_r, peak_r);
+	sums->samples += samples;
+}
+
+
+/**
+ * Add the per-channel squares and peaks of one 16-bit frame
+ *
+ * Stereo takes even samples as L and odd ones as R; mono counts for both.
+ *
+ * @param sums   Sums to add to
+ * @param sampv  Interleaved 16-bit samples
+ * @param sampc  Number of samples
+ * @param ch     Number of channels
+ */
+void vu_measure_s16(struct vu_sums *sums, const int16_t *sampv,
+		    size_t sampc, uint8_t ch)
+{
+	uint64_t sumv[2];
+	uint32_t peakv[2];
+
+	if (!sums || !sampv)
+		return;
+
+	if (ch >= 2) {
+		kernel(sumv, peakv, sampv, sampc & ~(size_t)1);
+		add_sums(sums, sumv[0], sumv[1], peakv[0], peakv[1],
+			 (uint32_t)(sampc / 2));
+	}
+	else {
+		kernel(sumv, peakv, sampv, sampc);
+		add_sums(sums, sumv[0] + sumv[1], sumv[0] + sumv[1],
+			 MAX(peakv[0], peakv[1]), MAX(peakv[0], peakv[1]),
+			 (uint32_t)sampc);
+	}
+}
+
+
+static uint32_t float_peak(float peak)
+{
+	return (uint32_t)MIN(llrint(peak * 32768.0), (long long)UINT32_MAX);
+}
+
+
+/**
+ * Add the per-channel squares and peaks of one float frame, in 16-bit
+ * units
+ *
+ * @param sums   Sums to add to
+ * @param sampv  Interleaved float samples, full scale 1.0
+ * @param sampc  Number of samples
+ * @param ch     Number of channels
+ */
+void vu_measure_float(struct vu_sums *sums, const float *sampv,
+		      size_t sampc, uint8_t ch)
+{
+	const double scale = 32768.0 * 32768.0;
+	double even = 0.0, odd = 0.0;
+	float peak_even = 0.0f, peak_odd = 0.0f;
+	size_t i;
+
+	if (!sums || !sampv)
+		return;
+
+	if (ch >= 2)
+		sampc &= ~(size_t)1;
+
+	for (i = 0; i + 1 < sampc; i += 2) {
+		even += (double)sampv[i] * sampv[i];
+		odd  += (double)sampv[i + 1] * sampv[i + 1];
+		peak_even = MAX(peak_even, fabsf(sampv[i]));
+		peak_odd  = MAX(peak_odd, fabsf(sampv[i + 1]));
+	}
+	if (i < sampc) {
+		even += (double)sampv[i] * sampv[i];
+		peak_even = MAX(peak_even, fabsf(sampv[i]));
+	}
+
+	if (ch >= 2) {
+		add_sums(sums, (uint64_t)llround(even * scale),
+			 (uint64_t)llround(odd * scale),
+			 float_peak(peak_even), float_peak(peak_odd),
+			 (uint32_t)(sampc / 2));
+	}
+	else {
+		const uint64_t sum = (uint64_t)llround((even + odd) * scale);
+		const uint32_t peak = float_peak(MAX(peak_even, peak_odd));
+
+		add_sums(sums, sum, sum, peak, peak, (uint32_t)sampc);
+	}
+}
+
+
+/**
+ * Add one frame to the active slot; audio thread only
+ *
+ * The busy flag is raised before the active index is checked, so the tick
+ * either sees the flag or this writer sees the new index and moves over.
+ * The retry happens at most once per tick.
+ *
+ * @param loud Loudness meter that just completed a sub-block, or NULL
+ */
+void vu_acc_add(struct vu_acc *acc, enum vu_fmt fmt, const void *sampv,
+		size_t sampc, uint8_t ch, const struct vu_r128 *loud)
+{
+	struct vu_sums *sums;
+	unsigned i;
+
+	for (;;) {
+		i = atomic_load(&acc->active) & 1;
+		atomic_store(&acc->busyv[i], true);
+		if ((atomic_load(&acc->active) & 1) == i)
+			break;
+		atomic_store(&acc->busyv[i], false);
+	}
+
+	sums = &acc->slotv[i];
+	if (fmt == VU_FMT_FLOAT)
+		vu_measure_float(sums, sampv, sampc, ch);
+	else
+		vu_measure_s16(sums, sampv, sampc, ch);
+
+	if (loud) {
+		++sums->blocks;
+		sums->lufs_m = (float)loud->lufs_m;
+		sums->lufs_s = (float)loud->lufs_s;
+	}
+
+	atomic_store_explicit(&acc->busyv[i], false, memory_order_release);
+}
+
+
+/**
+ * Retire the active slot and read it; meter tick only
+ *
+ * Waits at most for one frame being added on the audio thread.  The slot
+ * is cleared before it becomes active again at the next tick.
+ */
+void vu_acc_take(struct vu_acc *acc, struct vu_sums *sums)
+{
+	const unsigned i = atomic_load(&acc->active) & 1;
+	struct vu_sums *slot = &acc->slotv[i];
+
+	atomic_store(&acc->active, i ^ 1);
+
+	/* Yield in case the writer was preempted mid-frame */
+	while (atomic_load_explicit(&acc->busyv[i], memory_order_acquire))
+		sched_yield();
+
+	*sums = *slot;
+	memset(slot, 0, sizeof(*slot));
+}
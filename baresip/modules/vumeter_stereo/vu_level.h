@@ -0,0 +1,73 @@
+/**
+ * @file vu_level.h  Stereo VU-meter level kernels
+ *
+ * Kept apart from the filter so the kernels can be benchmarked and tested
+ * without baresip.
+ */
+
+#ifndef VU_LEVEL_H
+#define VU_LEVEL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Minimum dB value (silence floor) */
+#define VU_DB_MIN  -96.0
+
+/** PPM return rate, 20 dB in 1.7 s */
+#define VU_PPM_FALL_DB_PER_S  (20.0 / 1.7)
+
+
+/** Sample formats the kernels take as they are */
+enum vu_fmt {
+	VU_FMT_S16,
+	VU_FMT_FLOAT,
+};
+
+
+/** Sums of squares and peaks of one measurement period, 16-bit units */
+struct vu_sums {
+	uint64_t sum_l;
+	uint64_t sum_r;
+	uint32_t peak_l;
+	uint32_t peak_r;
+	uint32_t samples;            /* per channel */
+	uint32_t blocks;             /* loudness sub-blocks completed */
+	float lufs_m;                /* loudness after the last of them */
+	float lufs_s;
+};
+
+
+/**
+ * Double-buffered accumulator shared by the audio thread and the meter tick
+ *
+ * The audio thread adds to the active slot and flags it busy while doing
+ * so.  The tick switches the active slot and reads the retired one once
+ * its writer is done; neither side takes a lock.
+ */
+struct vu_acc {
+	struct vu_sums slotv[2];
+	atomic_bool busyv[2];
+	atomic_uint active;
+};
+
+
+struct vu_r128;
+
+void vu_level_init(void);
+const char *vu_level_kernel(void);
+void vu_measure_s16(struct vu_sums *sums, const int16_t *sampv,
+		    size_t sampc, uint8_t ch);
+void vu_measure_float(struct vu_sums *sums, const float *sampv,
+		      size_t sampc, uint8_t ch);
+double vu_calc_dbfs(uint64_t sum, uint32_t n);
+double vu_peak_dbfs(uint32_t peak);
+double vu_ppm_update(double ppm, double peak_db, uint32_t dt_ms);
+void vu_acc_add(struct vu_acc *acc, enum vu_fmt fmt, const void *sampv,
+		size_t sampc, uint8_t ch, const struct vu_r128 *loud);
+void vu_acc_take(struct vu_acc *acc, struct vu_sums *sums);
+
+#endif
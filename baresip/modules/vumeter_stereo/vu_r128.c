@@ -0,0 +1,420 @@
+/**
+ * @file vu_r128.c  K-weighted loudness (ITU-R BS.1770, EBU R 128)
+ *
+ * Frames run through the K-weighting filter, the BS.1770 pre-filter
+ * followed by the RLB high-pass, with coefficients derived for the frame
+ * sample rate.  The filtered squares of L and R are summed into 100 ms
+ * sub-blocks; the momentary loudness is the mean of the last 4 of them and
+ * the short-term loudness that of the last 30 (EBU Tech 3341).  Both are
+ * updated when a sub-block completes.  Mono frames count as one channel,
+ * further channels beyond L/R are not weighted.
+ *
+ * L and R of a stereo pair are the lanes of GCC vectors of two doubles,
+ * which the compiler maps to SSE2 or NEON: one vector biquad for the
+ * shelf, one for the high-pass.  The high-pass takes the shelf output of
+ * the previous sample, so the two do not wait for each other; that shifts
+ * the sub-blocks by one sample and nothing else.  Mono frames would leave
+ * half of every vector idle, so they run the two biquads as plain scalars.
+ * All state is double.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "vu_r128.h"
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+
+typedef double v2d __attribute__((vector_size(16)));
+
+
+/* One biquad on L and R */
+struct biquad2 {
+	v2d b0, b1, b2, a1, a2;
+	v2d s1, s2;
+};
+
+
+/* Stereo filter state in registers while a frame is processed */
+struct kfilt {
+	struct biquad2 shelf;
+	struct biquad2 hpf;
+	v2d y;                    /* shelf output of the last sample */
+	v2d sum;                  /* K-weighted squares of L and R */
+};
+
+
+/* One biquad of the mono path */
+struct biquad {
+	double b0, b1, b2, a1, a2;
+	double s1, s2;
+};
+
+
+/* Mono filter state: lane 0 of the vectors is the shelf, lane 2 the
+ * high-pass */
+struct kmono {
+	struct biquad shelf;
+	struct biquad hpf;
+	double sum;
+};
+
+
+static inline v2d biquad2_step(struct biquad2 *q, v2d x)
+{
+	const v2d y = q->b0 * x + q->s1;
+
+	q->s1 = q->b1 * x - q->a1 * y + q->s2;
+	q->s2 = q->b2 * x - q->a2 * y;
+
+	return y;
+}
+
+
+static inline void kfilt_step(struct kfilt *k, double l, double r)
+{
+	const v2d x = {l, r};
+	const v2d y = biquad2_step(&k->hpf, k->y);
+
+	k->y   = biquad2_step(&k->shelf, x);
+	k->sum += y * y;
+}
+
+
+static void kfilt_s16(struct kfilt *k, const int16_t *sampv, size_t frames,
+		      uint8_t ch)
+{
+	const double scale = 1.0 / 32768.0;
+	size_t i;
+
+	for (i = 0; i < frames; ++i, sampv += ch)
+		kfilt_step(k, sampv[0] * scale, sampv[1] * scale);
+}
+
+
+static void kfilt_float(struct kfilt *k, const float *sampv, size_t frames,
+			uint8_t ch)
+{
+	size_t i;
+
+	for (i = 0; i < frames; ++i, sampv += ch)
+		kfilt_step(k, sampv[0], sampv[1]);
+}
+
+
+static inline double biquad_step(struct biquad *q, double x)
+{
+	const double y = q->b0 * x + q->s1;
+
+	q->s1 = q->b1 * x - q->a1 * y + q->s2;
+	q->s2 = q->b2 * x - q->a2 * y;
+
+	return y;
+}
+
+
+static inline void kmono_step(struct kmono *k, double x)
+{
+	const double y = biquad_step(&k->hpf, biquad_step(&k->shelf, x));
+
+	k->sum += y * y;
+}
+
+
+static void kmono_s16(struct kmono *k, const int16_t *sampv, size_t frames)
+{
+	const double scale = 1.0 / 32768.0;
+	size_t i;
+
+	for (i = 0; i < frames; ++i)
+		kmono_step(k, sampv[i] * scale);
+}
+
+
+static void kmono_float(struct kmono *k, const float *sampv, size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i < frames; ++i)
+		kmono_step(k, sampv[i]);
+}
+
+
+static void set_lanes(double *v, double shelf, double hpf)
+{
+	v[0] = v[1] = shelf;
+	v[2] = v[3] = hpf;
+}
+
+
+/**
+ * Reset the meter and derive the K-weighting for a sample rate
+ *
+ * Coefficients as in libebur128, which reproduces the 48 kHz table of
+ * BS.1770 at any rate.
+ *
+ * @param r     Loudness meter
+ * @param srate Sample rate in Hz
+ */
+void vu_r128_init(struct vu_r128 *r, uint32_t srate)
+{
+	double f0, g, q, k, vh, vb, a0;
+	double sb0, sb1, sb2, sa1, sa2;
+	double ha1, ha2;
+
+	memset(r, 0, sizeof(*r));
+	r->srate     = srate;
+	r->block_len = srate * VU_R128_BLOCK_MS / 1000;
+	if (!r->block_len)
+		r->block_len = 1;
+	r->lufs_m    = VU_LUFS_MIN;
+	r->lufs_s    = VU_LUFS_MIN;
+
+	if (!srate)
+		return;
+
+	/* Pre-filter: high shelf, +4 dB above ~1.7 kHz */
+	f0 = 1681.974450955533;
+	g  = 3.999843853973347;
+	q  = 0.7071752369554196;
+	k  = tan(M_PI * f0 / srate);
+	vh = pow(10.0, g / 20.0);
+	vb = pow(vh, 0.4996667741545416);
+	a0 = 1.0 + k / q + k * k;
+
+	sb0 = (vh + vb * k / q + k * k) / a0;
+	sb1 = 2.0 * (k * k - vh) / a0;
+	sb2 = (vh - vb * k / q + k * k) / a0;
+	sa1 = 2.0 * (k * k - 1.0) / a0;
+	sa2 = (1.0 - k / q + k * k) / a0;
+
+	/* RLB weighting: high-pass at ~38 Hz, numerator 1, -2, 1 */
+	f0 = 38.13547087602444;
+	q  = 0.5003270373238773;
+	k  = tan(M_PI * f0 / srate);
+	a0 = 1.0 + k / q + k * k;
+
+	ha1 = 2.0 * (k * k - 1.0) / a0;
+	ha2 = (1.0 - k / q + k * k) / a0;
+
+	set_lanes(r->b0v, sb0, 1.0);
+	set_lanes(r->b1v, sb1, -2.0);
+	set_lanes(r->b2v, sb2, 1.0);
+	set_lanes(r->a1v, sa1, ha1);
+	set_lanes(r->a2v, sa2, ha2);
+}
+
+
+/**
+ * Convert a mean square sum of channels to loudness
+ *
+ * @param power Sum of the K-weighted mean squares of the channels
+ *
+ * @return Loudness in LUFS, VU_LUFS_MIN below the absolute gate
+ */
+double vu_r128_lufs(double power)
+{
+	double lufs;
+
+	if (power <= 0.0)
+		return VU_LUFS_MIN;
+
+	lufs = -0.691 + 10.0 * log10(power);
+
+	return lufs < VU_LUFS_MIN ? VU_LUFS_MIN : lufs;
+}
+
+
+static double window_power(const struct vu_r128 *r, unsigned blocks)
+{
+	double sum = 0.0;
+	unsigned i, j = r->block_head;
+
+	for (i = 0; i < blocks; ++i) {
+		j = j ? j - 1 : VU_R128_SHORT - 1;
+		sum += r->blockv[j];
+	}
+
+	return sum / blocks;
+}
+
+
+/* Close a sub-block; sum holds the K-weighted squares of all channels */
+static void block_end(struct vu_r128 *r, double sum)
+{
+	r->blockv[r->block_head] = sum / r->block_len;
+	r->block_head = (r->block_head + 1) % VU_R128_SHORT;
+	r->block_pos  = 0;
+
+	r->lufs_m = vu_r128_lufs(window_power(r, VU_R128_MOMENTARY));
+	r->lufs_s = vu_r128_lufs(window_power(r, VU_R128_SHORT));
+}
+
+
+/* Keep decaying silence out of denormals, which are slow on x86 */
+static double flush_tiny(double v)
+{
+	return fabs(v) < 1e-30 ? 0.0 : v;
+}
+
+
+static void biquad_load(struct biquad *q, const struct vu_r128 *r,
+			unsigned lane)
+{
+	q->b0 = r->b0v[lane];
+	q->b1 = r->b1v[lane];
+	q->b2 = r->b2v[lane];
+	q->a1 = r->a1v[lane];
+	q->a2 = r->a2v[lane];
+	q->s1 = r->s1v[lane];
+	q->s2 = r->s2v[lane];
+}
+
+
+static void biquad_store(struct vu_r128 *r, const struct biquad *q,
+			 unsigned lane)
+{
+	r->s1v[lane] = flush_tiny(q->s1);
+	r->s2v[lane] = flush_tiny(q->s2);
+}
+
+
+static bool process_mono(struct vu_r128 *r, enum vu_fmt fmt,
+			 const void *sampv, size_t frames)
+{
+	struct kmono k;
+	bool update = false;
+	size_t i = 0;
+
+	biquad_load(&k.shelf, r, 0);
+	biquad_load(&k.hpf, r, 2);
+	k.sum = r->sumv[2];
+
+	while (i < frames) {
+		const size_t n = MIN(frames - i, r->block_len - r->block_pos);
+
+		if (fmt == VU_FMT_FLOAT)
+			kmono_float(&k, (const float *)sampv + i, n);
+		else
+			kmono_s16(&k, (const int16_t *)sampv + i, n);
+
+		i += n;
+		r->block_pos += (uint32_t)n;
+
+		if (r->block_pos == r->block_len) {
+			block_end(r, k.sum);
+			k.sum = 0.0;
+			update = true;
+		}
+	}
+
+	biquad_store(r, &k.shelf, 0);
+	biquad_store(r, &k.hpf, 2);
+	r->sumv[2] = k.sum;
+
+	return update;
+}
+
+
+static v2d v2d_load(const double *p)
+{
+	v2d v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static void biquad2_load(struct biquad2 *q, const struct vu_r128 *r,
+			 unsigned lane)
+{
+	q->b0 = v2d_load(&r->b0v[lane]);
+	q->b1 = v2d_load(&r->b1v[lane]);
+	q->b2 = v2d_load(&r->b2v[lane]);
+	q->a1 = v2d_load(&r->a1v[lane]);
+	q->a2 = v2d_load(&r->a2v[lane]);
+	q->s1 = v2d_load(&r->s1v[lane]);
+	q->s2 = v2d_load(&r->s2v[lane]);
+}
+
+
+static void biquad2_store(struct vu_r128 *r, const struct biquad2 *q,
+			  unsigned lane)
+{
+	unsigned j;
+
+	for (j = 0; j < 2; ++j) {
+		r->s1v[lane + j] = flush_tiny(q->s1[j]);
+		r->s2v[lane + j] = flush_tiny(q->s2[j]);
+	}
+}
+
+
+static bool process_stereo(struct vu_r128 *r, enum vu_fmt fmt,
+			   const void *sampv, size_t frames, uint8_t ch)
+{
+	struct kfilt k;
+	bool update = false;
+	size_t i = 0;
+
+	biquad2_load(&k.shelf, r, 0);
+	biquad2_load(&k.hpf, r, 2);
+	k.y   = v2d_load(&r->yv[0]);
+	k.sum = v2d_load(&r->sumv[2]);
+
+	while (i < frames) {
+		const size_t n = MIN(frames - i, r->block_len - r->block_pos);
+
+		if (fmt == VU_FMT_FLOAT)
+			kfilt_float(&k, (const float *)sampv + i * ch, n, ch);
+		else
+			kfilt_s16(&k, (const int16_t *)sampv + i * ch, n, ch);
+
+		i += n;
+		r->block_pos += (uint32_t)n;
+
+		if (r->block_pos == r->block_len) {
+			block_end(r, k.sum[0] + k.sum[1]);
+			k.sum = (v2d){0, 0};
+			update = true;
+		}
+	}
+
+	biquad2_store(r, &k.shelf, 0);
+	biquad2_store(r, &k.hpf, 2);
+	r->yv[0]   = flush_tiny(k.y[0]);
+	r->yv[1]   = flush_tiny(k.y[1]);
+	r->sumv[2] = k.sum[0];
+	r->sumv[3] = k.sum[1];
+
+	return update;
+}
+
+
+/**
+ * Add a frame to the loudness meter; audio thread only
+ *
+ * @param r     Loudness meter
+ * @param fmt   Sample format
+ * @param sampv Interleaved samples
+ * @param sampc Total number of samples
+ * @param ch    Channel count
+ * @param srate Sample rate; a new rate restarts the meter
+ *
+ * @return true if lufs_m and lufs_s were updated
+ */
+bool vu_r128_process(struct vu_r128 *r, enum vu_fmt fmt, const void *sampv,
+		     size_t sampc, uint8_t ch, uint32_t srate)
+{
+	if (!r || !sampv || !ch || !srate)
+		return false;
+
+	if (srate != r->srate)
+		vu_r128_init(r, srate);
+
+	if (ch == 1)
+		return process_mono(r, fmt, sampv, sampc);
+
+	return process_stereo(r, fmt, sampv, sampc / ch, ch);
+}
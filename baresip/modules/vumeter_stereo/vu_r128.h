@@ -0,0 +1,65 @@
+/**
+ * @file vu_r128.h  K-weighted loudness (ITU-R BS.1770, EBU R 128)
+ *
+ * Kept apart from the filter so it can be benchmarked and tested without
+ * baresip.
+ */
+
+#ifndef VU_R128_H
+#define VU_R128_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "vu_level.h"
+
+
+/** Absolute gate of BS.1770; quieter windows read as this floor, LUFS */
+#define VU_LUFS_MIN  -70.0
+
+
+enum {
+	VU_R128_BLOCK_MS  = 100,  /* sub-block, the step of both windows */
+	VU_R128_MOMENTARY = 4,    /* 400 ms window in sub-blocks */
+	VU_R128_SHORT     = 30,   /* 3 s window in sub-blocks */
+};
+
+
+/**
+ * Loudness meter of one direction, preallocated in its filter state and
+ * only used by the audio thread
+ *
+ * The filter state holds four lanes: the pre-filter (high shelf) of L and
+ * R, and the RLB high-pass of L and R.  For stereo the shelf and the
+ * high-pass each run L and R as one vector, the high-pass taking the shelf
+ * output of the previous sample (lanes 0-1 of yv).  Mono runs lanes 0 and
+ * 2 one after the other.  The state is double: the 38 Hz
+ * high-pass has its poles right at the unit circle, where single precision
+ * loses the low end.
+ */
+struct vu_r128 {
+	double b0v[4];               /* coefficients by lane */
+	double b1v[4];
+	double b2v[4];
+	double a1v[4];
+	double a2v[4];
+	double s1v[4];               /* transposed direct form II state */
+	double s2v[4];
+	double yv[4];                /* outputs of the last sample */
+	double sumv[4];              /* K-weighted squares of the sub-block */
+	double blockv[VU_R128_SHORT];  /* mean squares of the last sub-blocks */
+	unsigned block_head;         /* next entry of blockv */
+	uint32_t block_len;          /* frames per sub-block */
+	uint32_t block_pos;
+	uint32_t srate;              /* 0 until the first frame */
+	double lufs_m;               /* momentary loudness, 400 ms */
+	double lufs_s;               /* short-term loudness, 3 s */
+};
+
+
+void vu_r128_init(struct vu_r128 *r, uint32_t srate);
+bool vu_r128_process(struct vu_r128 *r, enum vu_fmt fmt, const void *sampv,
+		     size_t sampc, uint8_t ch, uint32_t srate);
+double vu_r128_lufs(double power);
+
+#endif
@@ -0,0 +1,230 @@
+/**
+ * @file vu_shm.c  Shared-memory meter export, call section
+ *
+ * Both writers map the whole file and size it on open, so either module
+ * may come first.  The call section is cleared on open: whatever it holds
+ * is left over from an earlier run.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vu_shm.h"
+
+
+
+/**
+ * Map the meter file, creating or resizing it as needed
+ *
+ * @param shm  Meter file state
+ * @param path Path of the meter file, preferably on a tmpfs
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int vu_shm_open(struct vu_shm *shm, const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+	int err;
+
+	if (!shm || !path || !*path)
+		return EINVAL;
+
+	memset(shm, 0, sizeof(*shm));
+	shm->fd = -1;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &st) ||
+	    (st.st_size != METER_SHM_SIZE &&
+	     ftruncate(fd, METER_SHM_SIZE))) {
+		err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	map = mmap(NULL, METER_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (map == MAP_FAILED) {
+		err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	shm->fd    = fd;
+	shm->hdr   = map;
+	shm->slotv = (struct meter_shm_slot *)
+		((uint8_t *)map + METER_SHM_HDR_SIZE);
+
+	meter_shm_hdr_init(shm->hdr);
+	memset(shm->slotv, 0, METER_SHM_CALLS * sizeof(*shm->slotv));
+
+	return 0;
+}
+
+
+/**
+ * Clear the call section and unmap the meter file
+ *
+ * @param shm Meter file state
+ */
+void vu_shm_close(struct vu_shm *shm)
+{
+	if (!vu_shm_isopen(shm))
+		return;
+
+	memset(shm->slotv, 0, METER_SHM_CALLS * sizeof(*shm->slotv));
+	memset(shm->usedv, 0, sizeof(shm->usedv));
+	vu_shm_commit(shm);
+
+	(void)munmap(shm->hdr, METER_SHM_SIZE);
+	(void)close(shm->fd);
+
+	memset(shm, 0, sizeof(*shm));
+	shm->fd = -1;
+}
+
+
+bool vu_shm_isopen(const struct vu_shm *shm)
+{
+	return shm && shm->hdr;
+}
+
+
+/**
+ * Take a free call slot
+ *
+ * @param shm Meter file state
+ *
+ * @return Slot index, -1 if the file is not open or all slots are taken
+ */
+int vu_shm_slot_alloc(struct vu_shm *shm)
+{
+	int i;
+
+	if (!vu_shm_isopen(shm))
+		return -1;
+
+	for (i = 0; i < METER_SHM_CALLS; ++i) {
+		if (!shm->usedv[i]) {
+			shm->usedv[i] = true;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+ * Mark a call slot unused and give it back
+ *
+ * @param shm  Meter file state
+ * @param slot Slot index from vu_shm_slot_alloc()
+ */
+void vu_shm_slot_free(struct vu_shm *shm, int slot)
+{
+	struct meter_shm_slot *s;
+
+	if (!vu_shm_isopen(shm) || slot < 0 || slot >= METER_SHM_CALLS)
+		return;
+
+	s = &shm->slotv[slot];
+	meter_shm_slot_begin(s);
+	s->flags = 0;
+	meter_shm_slot_end(s);
+
+	shm->usedv[slot] = false;
+}
+
+
+static void str_copy(char *dst, const char *src, size_t size)
+{
+	size_t len = src ? strlen(src) : 0;
+
+	if (len >= size)
+		len = size - 1;
+
+	memcpy(dst, src ? src : "", len);
+	memset(dst + len, 0, size - len);
+}
+
+
+/**
+ * Write the levels of one call
+ *
+ * @param shm  Meter file state
+ * @param slot Slot index from vu_shm_slot_alloc()
+ * @param aor  Account AOR
+ * @param id   Call id
+ * @param txv  TX levels (VU_SHM_LEVELS), NULL if not metered yet
+ * @param rxv  RX levels (VU_SHM_LEVELS), NULL if not metered yet
+ */
+void vu_shm_write(struct vu_shm *shm, int slot, const char *aor,
+		  const char *id, const float *txv, const float *rxv)
+{
+	struct meter_shm_slot *s;
+	uint32_t flags = METER_SHM_USED;
+
+	if (!vu_shm_isopen(shm) || slot < 0 || slot >= METER_SHM_CALLS)
+		return;
+
+	s = &shm->slotv[slot];
+	meter_shm_slot_begin(s);
+
+	str_copy(s->key, aor, sizeof(s->key));
+	str_copy(s->id, id, sizeof(s->id));
+
+	if (txv) {
+		memcpy(&s->levelv[0], txv, VU_SHM_LEVELS * sizeof(float));
+		flags |= METER_SHM_TX;
+	}
+	if (rxv) {
+		memcpy(&s->levelv[VU_SHM_LEVELS], rxv,
+		       VU_SHM_LEVELS * sizeof(float));
+		flags |= METER_SHM_RX;
+	}
+	s->flags = flags;
+
+	meter_shm_slot_end(s);
+}
+
+
+/**
+ * Publish one pass over the calls
+ *
+ * Bumps the call section sequence and stamps it with the wall clock, so
+ * readers can tell fresh levels from the leftovers of a stopped writer.
+ * Readers only need to copy the slots below call_used.
+ *
+ * @param shm Meter file state
+ */
+void vu_shm_commit(struct vu_shm *shm)
+{
+	struct timespec ts;
+	uint16_t used = METER_SHM_CALLS;
+
+	if (!vu_shm_isopen(shm))
+		return;
+
+	while (used && !shm->usedv[used - 1])
+		--used;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+
+	atomic_thread_fence(memory_order_release);
+	shm->hdr->call_used = used;
+	shm->hdr->call_ms = (uint64_t)ts.tv_sec * 1000 +
+			    (uint64_t)ts.tv_nsec / 1000000;
+	atomic_thread_fence(memory_order_release);
+	++shm->hdr->call_seq;
+}
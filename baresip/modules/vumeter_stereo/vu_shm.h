@@ -0,0 +1,45 @@
+/**
+ * @file vu_shm.h  Shared-memory meter export, call section
+ *
+ * vumeter_stereo writes the call section of the meter file shared with
+ * mediasoup_bridge; the layout is in ../meter_shm.h.  Only the main thread
+ * writes.
+ */
+
+#ifndef VU_SHM_H
+#define VU_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../meter_shm.h"
+
+
+/**
+ * Levels of one direction in a call slot: RMS, sample peak and PPM, left
+ * then right, then momentary and short-term loudness.  TX comes first.
+ */
+enum {
+	VU_SHM_LEVELS = 8,
+};
+
+
+/** Open meter file, call section */
+struct vu_shm {
+	int fd;
+	struct meter_shm_hdr *hdr;
+	struct meter_shm_slot *slotv;   /* the call section */
+	bool usedv[METER_SHM_CALLS];
+};
+
+
+int  vu_shm_open(struct vu_shm *shm, const char *path);
+void vu_shm_close(struct vu_shm *shm);
+bool vu_shm_isopen(const struct vu_shm *shm);
+int  vu_shm_slot_alloc(struct vu_shm *shm);
+void vu_shm_slot_free(struct vu_shm *shm, int slot);
+void vu_shm_write(struct vu_shm *shm, int slot, const char *aor,
+		  const char *id, const float *txv, const float *rxv);
+void vu_shm_commit(struct vu_shm *shm);
+
+#endif
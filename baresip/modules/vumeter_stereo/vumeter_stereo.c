@@ -2,217 +2,432 @@
  * @file vumeter_stereo.c  Stereo VU-meter audio filter module
  *
  * Reports per-channel (L/R) audio levels in dBFS for both TX and RX
- * directions via baresip bevent system (BEVENT_VU_TX / BEVENT_VU_RX).
+ * directions of every call.
  *
  * This is a standalone module that does NOT modify baresip core.
  * It uses the public aufilt API and bevent API.
  *
- * Output: Standard VU_TX_REPORT / VU_RX_REPORT events with JSON param:
- *   {"l":-18.2,"r":-17.8}
+ * A single module timer measures every ~100ms and sends one VU_REPORT
+ * module event covering the calls whose meters moved:
+ *   {"calls":[{"id":"...","accountaor":"sip:...",
+ *              "tx":{"l":-18.2,"r":-17.8,"peak":{"l":-6.0,"r":-6.4},
+ *                    "ppm":{"l":-6.0,"r":-6.4},
+ *                    "lufs":{"m":-21.3,"s":-22.8}},
+ *              "rx":{...}}]}
  *
- * Events fire every ~100ms for smooth meter updates.
+ * l/r are the RMS of the last ~100ms, peak its sample peak and ppm a peak
+ * programme meter reading that falls back 20 dB in 1.7 s.  lufs holds the
+ * momentary (400 ms) and short-term (3 s) loudness of EBU R 128, K-weighted
+ * in the filter path and floored at the -70 LUFS absolute gate.  A
+ * direction is reported when its RMS, PPM or loudness moves by more than
+ * vumeter_stereo_delta dB (default 1.0), and otherwise every
+ * vumeter_stereo_keepalive ms (default 1000), so idle calls cost one small
+ * event per second.  The PPM and peak are meant to be shown as they are,
+ * so a falling PPM is reported until it reaches the floor.
+ *
+ * A direction is left out until its filter has seen audio.  Frames are
+ * measured in their own format, s16 or float; others are not metered.
+ *
+ * With meter_shm set to a file path, every tick writes all call levels to
+ * that memory-mapped file instead (see docs/meter-shm.md) and no VU_REPORT
+ * events are sent.
  */
 
-#include <string.h>
 #include <math.h>
+#include <string.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
+#include "vu_level.h"
+#include "vu_r128.h"
+#include "vu_shm.h"
 
 
 /** Update interval in milliseconds */
 #define VU_INTERVAL_MS  100
 
-/** Minimum dB value (silence floor) */
-#define VU_DB_MIN  -96.0
+/** Default change that triggers a report, in dB */
+#define VU_DELTA_DB  1.0
+
+/** Default report interval of unchanged meters in milliseconds */
+#define VU_KEEPALIVE_MS  1000
+
+
+/*
+ * Meters of one direction, updated on the meter tick
+ */
+struct vu_level {
+	double db_l;              /* RMS of the last tick */
+	double db_r;
+	double peak_l;            /* sample peak of the last tick */
+	double peak_r;
+	double ppm_l;             /* PPM ballistics */
+	double ppm_r;
+	double lufs_m;            /* loudness of the last sub-block */
+	double lufs_s;
+	double sent_l;            /* RMS, PPM and loudness last reported */
+	double sent_r;
+	double sent_ppm_l;
+	double sent_ppm_r;
+	double sent_lufs_m;
+	double sent_lufs_s;
+	uint64_t sent_ms;         /* 0 until first reported */
+	bool report;              /* in this tick's report */
+};
+
+
+struct vu_call;
+
+
+/*
+ * Encode (TX) filter state
+ */
+struct vumeter_enc {
+	struct aufilt_enc_st af;  /* inheritance */
+	struct vu_call *vc;
+	struct vu_acc acc;
+	struct vu_r128 r128;      /* audio thread only */
+	volatile bool started;
+	struct vu_level level;
+};
+
+
+/*
+ * Decode (RX) filter state
+ */
+struct vumeter_dec {
+	struct aufilt_dec_st af;  /* inheritance */
+	struct vu_call *vc;
+	struct vu_acc acc;
+	struct vu_r128 r128;      /* audio thread only */
+	volatile bool started;
+	struct vu_level level;
+};
 
 
 /*
- * Call tracker: maps audio objects to their call for bevent emission
+ * Call tracker: one entry per audio object, found by its pointer through
+ * vu_callh.  It ties the call to the filter states of that audio object,
+ * so the meter tick needs no lookup at all, and lives as long as either
+ * the call or one of the filters refers to it.
  */
 struct vu_call {
-	struct le le;
-	struct call *call;
+	struct le le;             /* vu_calls */
+	struct le he;             /* vu_callh */
 	const struct audio *au;
+	struct call *call;        /* NULL until established, after close */
+	struct vumeter_enc *enc;
+	struct vumeter_dec *dec;
+	int shm_slot;             /* meter file slot, -1 if none */
 };
 
 static struct list vu_calls = LIST_INIT;
+static struct hash *vu_callh;
+static struct tmr vu_tmr;
+static double vu_delta_db = VU_DELTA_DB;
+static uint32_t vu_keepalive_ms = VU_KEEPALIVE_MS;
+static struct vu_shm vu_shm;
 
 
 static void vu_call_destructor(void *arg)
 {
 	struct vu_call *vc = arg;
+	vu_shm_slot_free(&vu_shm, vc->shm_slot);
 	list_unlink(&vc->le);
+	hash_unlink(&vc->he);
 }
 
 
-static struct call *find_call_for_audio(const struct audio *au)
+static uint32_t audio_key(const struct audio *au)
 {
-	struct le *le;
+	return hash_fast((const char *)&au, sizeof(au));
+}
+
+
+static bool audio_cmp_handler(struct le *le, void *arg)
+{
+	const struct vu_call *vc = le->data;
+	return vc->au == arg;
+}
 
-	for (le = vu_calls.head; le; le = le->next) {
-		struct vu_call *vc = le->data;
-		if (vc->au == au)
-			return vc->call;
-	}
 
-	return NULL;
+static struct vu_call *vu_call_find(const struct audio *au)
+{
+	return list_ledata(hash_lookup(vu_callh, audio_key(au),
+				       audio_cmp_handler, (void *)au));
 }
 
 
-/*
- * Encode (TX) filter state
- */
-struct vumeter_enc {
-	struct aufilt_enc_st af;  /* inheritance */
-	struct tmr tmr;
-	const struct audio *au;
-	double sum_l;
-	double sum_r;
-	uint32_t samples;
-	volatile bool started;
-};
+static struct vu_call *vu_call_get(const struct audio *au)
+{
+	struct vu_call *vc = vu_call_find(au);
 
+	if (vc)
+		return vc;
 
-/*
- * Decode (RX) filter state
- */
-struct vumeter_dec {
-	struct aufilt_dec_st af;  /* inheritance */
-	struct tmr tmr;
-	const struct audio *au;
-	double sum_l;
-	double sum_r;
-	uint32_t samples;
-	volatile bool started;
-};
+	vc = mem_zalloc(sizeof(*vc), vu_call_destructor);
+	if (!vc)
+		return NULL;
+
+	vc->au = au;
+	vc->shm_slot = -1;
+	list_append(&vu_calls, &vc->le, vc);
+	hash_append(vu_callh, audio_key(au), &vc->he, vc);
+
+	return vc;
+}
+
+
+/* Drop the tracker once neither the call nor a filter refers to it */
+static void vu_call_release(struct vu_call *vc)
+{
+	if (vc && !vc->call && !vc->enc && !vc->dec)
+		mem_deref(vc);
+}
 
 
 static void enc_destructor(void *arg)
 {
 	struct vumeter_enc *st = arg;
+	struct vu_call *vc = st->vc;
+
 	list_unlink(&st->af.le);
-	tmr_cancel(&st->tmr);
+
+	if (vc && vc->enc == st) {
+		vc->enc = NULL;
+		vu_call_release(vc);
+	}
 }
 
 
 static void dec_destructor(void *arg)
 {
 	struct vumeter_dec *st = arg;
+	struct vu_call *vc = st->vc;
+
 	list_unlink(&st->af.le);
-	tmr_cancel(&st->tmr);
+
+	if (vc && vc->dec == st) {
+		vc->dec = NULL;
+		vu_call_release(vc);
+	}
 }
 
 
-/**
- * Convert linear RMS sum to dBFS
+static void level_init(struct vu_level *level)
+{
+	level->ppm_l  = VU_DB_MIN;
+	level->ppm_r  = VU_DB_MIN;
+	level->lufs_m = VU_LUFS_MIN;
+	level->lufs_s = VU_LUFS_MIN;
+}
+
+
+static bool level_moved(double now, double sent)
+{
+	return fabs(now - sent) > vu_delta_db;
+}
+
+
+/*
+ * Retire the accumulated sums and update the meters.  Decides whether the
+ * direction goes into this tick's report; only reported once it has a call.
  */
-static double calc_dbfs(double sum, uint32_t n)
+static bool level_update(struct vu_level *level, bool started,
+			 struct vu_acc *acc, bool tracked, uint64_t now)
 {
-	double rms;
+	struct vu_sums sums;
+
+	level->report = false;
+	if (!started)
+		return false;
+
+	vu_acc_take(acc, &sums);
+
+	level->db_l   = vu_calc_dbfs(sums.sum_l, sums.samples);
+	level->db_r   = vu_calc_dbfs(sums.sum_r, sums.samples);
+	level->peak_l = vu_peak_dbfs(sums.peak_l);
+	level->peak_r = vu_peak_dbfs(sums.peak_r);
+	level->ppm_l  = vu_ppm_update(level->ppm_l, level->peak_l,
+				      VU_INTERVAL_MS);
+	level->ppm_r  = vu_ppm_update(level->ppm_r, level->peak_r,
+				      VU_INTERVAL_MS);
+
+	/* Loudness moves in 100 ms sub-blocks, not with the tick */
+	if (sums.blocks) {
+		level->lufs_m = sums.lufs_m;
+		level->lufs_s = sums.lufs_s;
+	}
 
-	if (n == 0)
-		return VU_DB_MIN;
+	if (!tracked)
+		return false;
+
+	level->report = !level->sent_ms ||
+		now - level->sent_ms >= vu_keepalive_ms ||
+		level_moved(level->db_l, level->sent_l) ||
+		level_moved(level->db_r, level->sent_r) ||
+		level_moved(level->ppm_l, level->sent_ppm_l) ||
+		level_moved(level->ppm_r, level->sent_ppm_r) ||
+		level_moved(level->lufs_m, level->sent_lufs_m) ||
+		level_moved(level->lufs_s, level->sent_lufs_s);
+
+	if (level->report) {
+		level->sent_l      = level->db_l;
+		level->sent_r      = level->db_r;
+		level->sent_ppm_l  = level->ppm_l;
+		level->sent_ppm_r  = level->ppm_r;
+		level->sent_lufs_m = level->lufs_m;
+		level->sent_lufs_s = level->lufs_s;
+		level->sent_ms     = now;
+	}
 
-	rms = sqrt(sum / (double)n);
+	return level->report;
+}
 
-	if (rms < 1.0e-10)
-		return VU_DB_MIN;
 
-	/* For s16 samples, full scale = 32768 */
-	return 20.0 * log10(rms / 32768.0);
+static int print_level(struct re_printf *pf, const char *name,
+		       const struct vu_level *level)
+{
+	return re_hprintf(pf, ",\"%s\":{\"l\":%.1f,\"r\":%.1f,"
+			  "\"peak\":{\"l\":%.1f,\"r\":%.1f},"
+			  "\"ppm\":{\"l\":%.1f,\"r\":%.1f},"
+			  "\"lufs\":{\"m\":%.1f,\"s\":%.1f}}",
+			  name, level->db_l, level->db_r,
+			  level->peak_l, level->peak_r,
+			  level->ppm_l, level->ppm_r,
+			  level->lufs_m, level->lufs_s);
 }
 
 
-/**
- * Timer handler for TX (encode) direction
- */
-static void enc_tmr_handler(void *arg)
+static int print_calls(struct re_printf *pf, void *arg)
 {
-	struct vumeter_enc *st = arg;
-	struct call *call;
+	bool first = true;
+	struct le *le;
+	int err = 0;
+	(void)arg;
 
-	tmr_start(&st->tmr, VU_INTERVAL_MS, enc_tmr_handler, st);
+	for (le = vu_calls.head; le && !err; le = le->next) {
+		const struct vu_call *vc = le->data;
+		const bool tx = vc->enc && vc->enc->level.report;
+		const bool rx = vc->dec && vc->dec->level.report;
+
+		if (!vc->call || (!tx && !rx))
+			continue;
+
+		err = re_hprintf(pf, "%s{\"id\":\"%s\",\"accountaor\":\"%s\"",
+				 first ? "" : ",", call_id(vc->call),
+				 account_aor(call_account(vc->call)));
+		if (!err && tx)
+			err = print_level(pf, "tx", &vc->enc->level);
+		if (!err && rx)
+			err = print_level(pf, "rx", &vc->dec->level);
+		if (!err)
+			err = re_hprintf(pf, "}");
+
+		first = false;
+	}
 
-	if (!st->started)
-		return;
+	return err;
+}
+
+
+static void shm_levels(float *levelv, const struct vu_level *level)
+{
+	levelv[0] = (float)level->db_l;
+	levelv[1] = (float)level->db_r;
+	levelv[2] = (float)level->peak_l;
+	levelv[3] = (float)level->peak_r;
+	levelv[4] = (float)level->ppm_l;
+	levelv[5] = (float)level->ppm_r;
+	levelv[6] = (float)level->lufs_m;
+	levelv[7] = (float)level->lufs_s;
+}
 
-	call = find_call_for_audio(st->au);
-	if (!call)
-		return;
 
-	double db_l = calc_dbfs(st->sum_l, st->samples);
-	double db_r = calc_dbfs(st->sum_r, st->samples);
+/* Write every tracked call to the meter file, reported or not */
+static void shm_write_calls(void)
+{
+	float txv[VU_SHM_LEVELS];
+	float rxv[VU_SHM_LEVELS];
+	struct le *le;
+
+	for (le = vu_calls.head; le; le = le->next) {
+		struct vu_call *vc = le->data;
+		const bool tx = vc->enc && vc->enc->started;
+		const bool rx = vc->dec && vc->dec->started;
 
-	bevent_call_emit(BEVENT_VU_TX, call,
-			 "{\"l\":%.1f,\"r\":%.1f}", db_l, db_r);
+		if (!vc->call)
+			continue;
 
-	/* Reset accumulators */
-	st->sum_l = 0.0;
-	st->sum_r = 0.0;
-	st->samples = 0;
+		if (vc->shm_slot < 0)
+			vc->shm_slot = vu_shm_slot_alloc(&vu_shm);
+
+		if (tx)
+			shm_levels(txv, &vc->enc->level);
+		if (rx)
+			shm_levels(rxv, &vc->dec->level);
+
+		vu_shm_write(&vu_shm, vc->shm_slot,
+			     account_aor(call_account(vc->call)),
+			     call_id(vc->call), tx ? txv : NULL,
+			     rx ? rxv : NULL);
+	}
+
+	vu_shm_commit(&vu_shm);
 }
 
 
 /**
- * Timer handler for RX (decode) direction
+ * Meter tick: one report for all calls
  */
-static void dec_tmr_handler(void *arg)
+static void tmr_handler(void *arg)
 {
-	struct vumeter_dec *st = arg;
-	struct call *call;
+	const uint64_t now = tmr_jiffies();
+	bool filters = false;
+	bool pending = false;
+	struct le *le;
+	(void)arg;
 
-	tmr_start(&st->tmr, VU_INTERVAL_MS, dec_tmr_handler, st);
+	for (le = vu_calls.head; le; le = le->next) {
+		struct vu_call *vc = le->data;
+		struct vumeter_enc *enc = vc->enc;
+		struct vumeter_dec *dec = vc->dec;
+
+		if (enc)
+			pending |= level_update(&enc->level, enc->started,
+						&enc->acc, vc->call != NULL,
+						now);
+		if (dec)
+			pending |= level_update(&dec->level, dec->started,
+						&dec->acc, vc->call != NULL,
+						now);
+
+		filters |= enc || dec;
+	}
 
-	if (!st->started)
-		return;
+	if (vu_shm_isopen(&vu_shm)) {
+		shm_write_calls();
+		pending = false;
+	}
 
-	call = find_call_for_audio(st->au);
-	if (!call)
+	/* Restarted by the next filter */
+	if (!filters)
 		return;
 
-	double db_l = calc_dbfs(st->sum_l, st->samples);
-	double db_r = calc_dbfs(st->sum_r, st->samples);
+	tmr_start(&vu_tmr, VU_INTERVAL_MS, tmr_handler, NULL);
 
-	bevent_call_emit(BEVENT_VU_RX, call,
-			 "{\"l\":%.1f,\"r\":%.1f}", db_l, db_r);
+	if (!pending)
+		return;
 
-	/* Reset accumulators */
-	st->sum_l = 0.0;
-	st->sum_r = 0.0;
-	st->samples = 0;
+	module_event("vumeter_stereo", "VU_REPORT", NULL, NULL,
+		     "{\"calls\":[%H]}", print_calls, NULL);
 }
 
 
-/*
- * Accumulate per-channel RMS from interleaved samples
- */
-static void accumulate_samples(double *sum_l, double *sum_r,
-			       uint32_t *sample_count,
-			       const int16_t *sampv, size_t sampc,
-			       uint8_t ch)
+static void tmr_ensure(void)
 {
-	size_t i;
-
-	if (ch >= 2) {
-		/* Stereo: even indices = L, odd = R */
-		for (i = 0; i + 1 < sampc; i += 2) {
-			double sl = (double)sampv[i];
-			double sr = (double)sampv[i + 1];
-			*sum_l += sl * sl;
-			*sum_r += sr * sr;
-		}
-		*sample_count += (uint32_t)(sampc / 2);
-	}
-	else {
-		/* Mono: duplicate to both channels */
-		for (i = 0; i < sampc; i++) {
-			double s = (double)sampv[i];
-			*sum_l += s * s;
-			*sum_r += s * s;
-		}
-		*sample_count += (uint32_t)sampc;
-	}
+	if (!tmr_isrunning(&vu_tmr))
+		tmr_start(&vu_tmr, VU_INTERVAL_MS, tmr_handler, NULL);
 }
 
 
@@ -237,8 +452,15 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	st->au = au;
-	tmr_start(&st->tmr, VU_INTERVAL_MS, enc_tmr_handler, st);
+	st->vc = vu_call_get(au);
+	if (!st->vc) {
+		mem_deref(st);
+		return ENOMEM;
+	}
+
+	level_init(&st->level);
+	st->vc->enc = st;
+	tmr_ensure();
 
 	*stp = (struct aufilt_enc_st *)st;
 
@@ -267,8 +489,15 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	st->au = au;
-	tmr_start(&st->tmr, VU_INTERVAL_MS, dec_tmr_handler, st);
+	st->vc = vu_call_get(au);
+	if (!st->vc) {
+		mem_deref(st);
+		return ENOMEM;
+	}
+
+	level_init(&st->level);
+	st->vc->dec = st;
+	tmr_ensure();
 
 	*stp = (struct aufilt_dec_st *)st;
 
@@ -276,15 +505,41 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 }
 
 
+/* Formats measured as they are; other frames are not metered */
+static bool frame_fmt(const struct auframe *af, enum vu_fmt *fmt)
+{
+	switch (af->fmt) {
+
+	case AUFMT_S16LE:
+		*fmt = VU_FMT_S16;
+		return true;
+
+	case AUFMT_FLOAT:
+		*fmt = VU_FMT_FLOAT;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
 static int encode(struct aufilt_enc_st *st, struct auframe *af)
 {
 	struct vumeter_enc *vu = (void *)st;
+	enum vu_fmt fmt;
+	bool block;
 
 	if (!st || !af)
 		return EINVAL;
 
-	accumulate_samples(&vu->sum_l, &vu->sum_r, &vu->samples,
-			   af->sampv, af->sampc, af->ch);
+	if (!frame_fmt(af, &fmt))
+		return 0;
+
+	block = vu_r128_process(&vu->r128, fmt, af->sampv, af->sampc, af->ch,
+				af->srate);
+	vu_acc_add(&vu->acc, fmt, af->sampv, af->sampc, af->ch,
+		   block ? &vu->r128 : NULL);
 	vu->started = true;
 
 	return 0;
@@ -294,12 +549,19 @@ static int encode(struct aufilt_enc_st *st, struct auframe *af)
 static int decode(struct aufilt_dec_st *st, struct auframe *af)
 {
 	struct vumeter_dec *vu = (void *)st;
+	enum vu_fmt fmt;
+	bool block;
 
 	if (!st || !af)
 		return EINVAL;
 
-	accumulate_samples(&vu->sum_l, &vu->sum_r, &vu->samples,
-			   af->sampv, af->sampc, af->ch);
+	if (!frame_fmt(af, &fmt))
+		return 0;
+
+	block = vu_r128_process(&vu->r128, fmt, af->sampv, af->sampc, af->ch,
+				af->srate);
+	vu_acc_add(&vu->acc, fmt, af->sampv, af->sampc, af->ch,
+		   block ? &vu->r128 : NULL);
 	vu->started = true;
 
 	return 0;
@@ -312,45 +574,34 @@ static int decode(struct aufilt_dec_st *st, struct auframe *af)
 static void event_handler(enum bevent_ev ev, struct bevent *event, void *arg)
 {
 	struct call *call = bevent_get_call(event);
+	const struct audio *au = call ? call_audio(call) : NULL;
 	struct vu_call *vc;
-	struct le *le;
 	(void)arg;
 
+	if (!au)
+		return;
+
 	switch (ev) {
 
 	case BEVENT_CALL_ESTABLISHED:
-		if (!call)
+		vc = vu_call_get(au);
+		if (!vc || vc->call == call)
 			break;
 
-		/* Check if already tracked */
-		for (le = vu_calls.head; le; le = le->next) {
-			vc = le->data;
-			if (vc->call == call)
-				return;
-		}
-
-		vc = mem_zalloc(sizeof(*vc), vu_call_destructor);
-		if (!vc)
-			return;
-
 		vc->call = call;
-		vc->au = call_audio(call);
-		list_append(&vu_calls, &vc->le, vc);
 		info("vumeter_stereo: tracking call %s\n", call_id(call));
 		break;
 
 	case BEVENT_CALL_CLOSED:
-		if (!call)
+		vc = vu_call_find(au);
+		if (!vc || vc->call != call)
 			break;
 
-		for (le = vu_calls.head; le; le = le->next) {
-			vc = le->data;
-			if (vc->call == call) {
-				info("vumeter_stereo: untracking call\n");
-				mem_deref(vc);
-				break;
-			}
-		}
+		info("vumeter_stereo: untracking call\n");
+		vc->call = NULL;
+		vu_shm_slot_free(&vu_shm, vc->shm_slot);
+		vc->shm_slot = -1;
+		vu_call_release(vc);
 		break;
 
 	default:
@@ -370,11 +621,43 @@ static struct aufilt vumeter_stereo = {
 
 static int module_init(void)
 {
+	char path[256] = "";
+	struct pl pl;
+	int err;
+
+	err = hash_alloc(&vu_callh, 32);
+	if (err)
+		return err;
+
+	if (!conf_get(conf_cur(), "vumeter_stereo_delta", &pl)) {
+		const double delta = pl_float(&pl);
+
+		if (isfinite(delta) && delta >= 0)
+			vu_delta_db = delta;
+		else
+			warning("vumeter_stereo: invalid vumeter_stereo_delta "
+				"'%r', using %.1f dB\n", &pl, vu_delta_db);
+	}
+	(void)conf_get_u32(conf_cur(), "vumeter_stereo_keepalive",
+			   &vu_keepalive_ms);
+
+	/* The meter file is optional; without it levels go out as events */
+	if (!conf_get_str(conf_cur(), "meter_shm", path, sizeof(path))) {
+		err = vu_shm_open(&vu_shm, path);
+		if (err)
+			warning("vumeter_stereo: meter file '%s' (%m)\n",
+				path, err);
+		else
+			info("vumeter_stereo: writing levels to %s\n", path);
+	}
+
+	vu_level_init();
 	aufilt_register(baresip_aufiltl(), &vumeter_stereo);
 	bevent_register(event_handler, NULL);
 
-	info("vumeter_stereo: module loaded (interval=%dms)\n",
-	     VU_INTERVAL_MS);
+	info("vumeter_stereo: module loaded (interval=%dms, delta=%.1fdB, "
+	     "keepalive=%ums, %s kernel)\n", VU_INTERVAL_MS, vu_delta_db,
+	     vu_keepalive_ms, vu_level_kernel());
 	return 0;
 }
 
@@ -385,15 +668,24 @@ static int module_close(void)
 
 	bevent_unregister(event_handler);
 	aufilt_unregister(&vumeter_stereo);
+	tmr_cancel(&vu_tmr);
 
 	/* Clean up call trackers */
 	le = vu_calls.head;
 	while (le) {
 		struct vu_call *vc = le->data;
 		le = le->next;
+
+		if (vc->enc)
+			vc->enc->vc = NULL;
+		if (vc->dec)
+			vc->dec->vc = NULL;
 		mem_deref(vc);
 	}
 
+	vu_callh = mem_deref(vu_callh);
+	vu_shm_close(&vu_shm);
+
 	info("vumeter_stereo: module unloaded\n");
 	return 0;
 }
@@ -234,7 +234,10 @@ function mappingAffectsRuntime(
     previous.ptt.holdMs !== next.ptt.holdMs ||
     previous.ptt.gpi !== next.ptt.gpi ||
     previous.mixLocalCallers !== next.mixLocalCallers ||
-    previous.bitrateBps !== next.bitrateBps
+    previous.bitrateBps !== next.bitrateBps ||
+    previous.ptimeMs !== next.ptimeMs ||
+    previous.telemetryIntervalMs !== next.telemetryIntervalMs ||
+    previous.levelHysteresisDb !== next.levelHysteresisDb
   );
 }
 
@@ -1,5 +1,6 @@
 import { getBaresipConnection } from '../services/baresip-connection';
 import { BaresipLogger } from '../services/baresip-logger';
+import { MeterShmReader } from '../services/meter-shm';
 import { stateManager } from '../services/state-manager';
 import { setBaresipLogger } from '../utils/logger';
 
@@ -19,4 +20,10 @@ export default defineNitroPlugin((nitroApp) => {
   
   // Start streaming logs from shared volume
   baresipLogger.start();
+
+  // Meter levels from the shared-memory file, when baresip writes one
+  const meterShmPath = process.env.BARESIP_METER_SHM;
+  if (meterShmPath) {
+    new MeterShmReader(meterShmPath, stateManager).start();
+  }
 });
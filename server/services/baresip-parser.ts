@@ -1,5 +1,5 @@
 import type { StateManager } from './state-manager';
-import type { BaresipEvent, BaresipCommandResponse, CallInfo } from '~/types';
+import type { AudioMeterLevels, AudioMeterLoudness, BaresipEvent, BaresipCommandResponse, CallInfo } from '~/types';
 import { dtmfToGpio, gpioToDtmf } from '~/types';
 import { getBaresipConnection } from './baresip-connection';
 import { recordRegistrationEvent, recordCallStarted, recordCallEnded, recordAlsaError, recordJbufDrop } from './prometheus';
@@ -1060,9 +1060,122 @@ function parseCallsResponse(data: string, stateManager: StateManager, autoReset:
  * Handle VU meter events from vumeter_stereo module.
  * Accumulates TX and RX levels per account into a single AudioMeter update.
  *
- * Wire format: param = "{\"l\":-18.2,\"r\":-17.8}"
+ * Wire format: one MODULE event per meter tick for the calls whose meters
+ * moved (or are due for a keepalive), param =
+ * "vumeter_stereo,VU_REPORT,{\"calls\":[{\"accountaor\":...,
+ * \"tx\":{\"l\":-18.2,\"r\":-17.8,\"peak\":{...},\"ppm\":{...},
+ * \"lufs\":{\"m\":-21.3,\"s\":-22.8}},\"rx\":{...}}]}". lufs is the
+ * EBU R 128 momentary and short-term loudness. A direction that did not
+ * move is left out and keeps its previous value. Older module builds send
+ * per-call VU_TX_REPORT / VU_RX_REPORT events with param
+ * "{\"l\":-18.2,\"r\":-17.8}"; both are accepted.
  */
-const vuAccumulator = new Map<string, { txL: number; txR: number; rxL: number; rxR: number }>();
+type VuPair = { l: number; r: number };
+type VuLoudness = { m: number; s: number };
+export type VuLevels = VuPair & {
+  peak?: unknown;
+  ppm?: unknown;
+  lufs?: unknown;
+};
+
+const vuAccumulator = new Map<
+  string,
+  {
+    rms: AudioMeterLevels;
+    peak?: AudioMeterLevels;
+    ppm?: AudioMeterLevels;
+    lufs?: AudioMeterLoudness;
+  }
+>();
+
+function isVuLevels(value: unknown): value is VuLevels {
+  return (
+    typeof value === 'object' &&
+    value !== null &&
+    typeof (value as VuLevels).l === 'number' &&
+    typeof (value as VuLevels).r === 'number'
+  );
+}
+
+function isVuLoudness(value: unknown): value is VuLoudness {
+  return (
+    typeof value === 'object' &&
+    value !== null &&
+    typeof (value as VuLoudness).m === 'number' &&
+    typeof (value as VuLoudness).s === 'number'
+  );
+}
+
+function silentLevels(): AudioMeterLevels {
+  return { txL: -96, txR: -96, rxL: -96, rxR: -96 };
+}
+
+function applyVuPair(
+  levels: AudioMeterLevels,
+  dir: 'tx' | 'rx',
+  pair: VuPair
+): void {
+  if (dir === 'tx') {
+    levels.txL = pair.l;
+    levels.txR = pair.r;
+  } else {
+    levels.rxL = pair.l;
+    levels.rxR = pair.r;
+  }
+}
+
+/**
+ * Apply the levels of one call to its account's meter. Also used for call
+ * slots read from the shared-memory meter file (see meter-shm.ts).
+ */
+export function updateVuLevels(
+  accountUri: string,
+  tx: VuLevels | undefined,
+  rx: VuLevels | undefined,
+  stateManager: StateManager,
+  timestamp: number
+): void {
+  // Get or create accumulator for this account
+  let acc = vuAccumulator.get(accountUri);
+  if (!acc) {
+    acc = { rms: silentLevels() };
+    vuAccumulator.set(accountUri, acc);
+  }
+
+  // Update the reported directions
+  for (const [dir, levels] of [['tx', tx], ['rx', rx]] as const) {
+    if (!levels) continue;
+    applyVuPair(acc.rms, dir, levels);
+    if (isVuLevels(levels.peak)) {
+      acc.peak ??= silentLevels();
+      applyVuPair(acc.peak, dir, levels.peak);
+    }
+    if (isVuLevels(levels.ppm)) {
+      acc.ppm ??= silentLevels();
+      applyVuPair(acc.ppm, dir, levels.ppm);
+    }
+    if (isVuLoudness(levels.lufs)) {
+      acc.lufs ??= { txM: -70, txS: -70, rxM: -70, rxS: -70 };
+      if (dir === 'tx') {
+        acc.lufs.txM = levels.lufs.m;
+        acc.lufs.txS = levels.lufs.s;
+      } else {
+        acc.lufs.rxM = levels.lufs.m;
+        acc.lufs.rxS = levels.lufs.s;
+      }
+    }
+  }
+
+  // Send combined meter update
+  stateManager.updateAudioMeter({
+    accountUri,
+    ...acc.rms,
+    ...(acc.peak ? { peak: { ...acc.peak } } : {}),
+    ...(acc.ppm ? { ppm: { ...acc.ppm } } : {}),
+    ...(acc.lufs ? { lufs: { ...acc.lufs } } : {}),
+    timestamp
+  });
+}
 
 function handleVuMeterEvent(jsonEvent: BaresipEvent, stateManager: StateManager, timestamp: number): void {
   const accountUri = jsonEvent.accountaor;
@@ -1074,38 +1187,45 @@ function handleVuMeterEvent(jsonEvent: BaresipEvent, stateManager: StateManager,
   if (braceIdx < 0) return;
   const jsonStr = param.substring(braceIdx);
 
-  let levels: { l: number; r: number };
+  let levels: unknown;
   try {
     levels = JSON.parse(jsonStr);
   } catch {
     return;
   }
+  if (!isVuLevels(levels)) return;
 
-  // Get or create accumulator for this account
-  let acc = vuAccumulator.get(accountUri);
-  if (!acc) {
-    acc = { txL: -96, txR: -96, rxL: -96, rxR: -96 };
-    vuAccumulator.set(accountUri, acc);
-  }
-
-  // Update the relevant direction
   if (jsonEvent.type === 'VU_TX_REPORT') {
-    acc.txL = levels.l;
-    acc.txR = levels.r;
+    updateVuLevels(accountUri, levels, undefined, stateManager, timestamp);
   } else {
-    acc.rxL = levels.l;
-    acc.rxR = levels.r;
+    updateVuLevels(accountUri, undefined, levels, stateManager, timestamp);
   }
+}
 
-  // Send combined meter update
-  stateManager.updateAudioMeter({
-    accountUri,
-    txL: acc.txL,
-    txR: acc.txR,
-    rxL: acc.rxL,
-    rxR: acc.rxR,
-    timestamp
-  });
+function handleVuReport(param: string, stateManager: StateManager, timestamp: number): void {
+  const braceIdx = param.indexOf('{');
+  if (braceIdx < 0) return;
+
+  let report: { calls?: unknown };
+  try {
+    report = JSON.parse(param.substring(braceIdx));
+  } catch {
+    return;
+  }
+  const calls = report?.calls;
+  if (!Array.isArray(calls)) return;
+
+  for (const entry of calls) {
+    const accountUri = typeof entry?.accountaor === 'string' ? entry.accountaor : '';
+    if (!accountUri) continue;
+    updateVuLevels(
+      accountUri,
+      isVuLevels(entry.tx) ? entry.tx : undefined,
+      isVuLevels(entry.rx) ? entry.rx : undefined,
+      stateManager,
+      timestamp
+    );
+  }
 }
 
 function handleJsonEvent(jsonEvent: BaresipEvent, stateManager: StateManager): void {
@@ -1117,6 +1237,13 @@ function handleJsonEvent(jsonEvent: BaresipEvent, stateManager: StateManager): v
     handleVuMeterEvent(jsonEvent, stateManager, timestamp);
     return;
   }
+  if (
+    jsonEvent.type === 'MODULE' &&
+    jsonEvent.param?.startsWith('vumeter_stereo,VU_REPORT,')
+  ) {
+    handleVuReport(jsonEvent.param, stateManager, timestamp);
+    return;
+  }
   if (
     jsonEvent.type === 'MODULE' &&
     jsonEvent.param?.startsWith('mediasoup_bridge,')
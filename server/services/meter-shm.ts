@@ -0,0 +1,282 @@
+import { open, type FileHandle } from 'fs/promises';
+import type { StateManager } from './state-manager';
+import { updateVuLevels, type VuLevels } from './baresip-parser';
+
+/**
+ * Reader of the shared-memory meter file written by the vumeter_stereo and
+ * mediasoup_bridge modules (config `meter_shm`). The layout is described in
+ * docs/meter-shm.md: a 64-byte header, then fixed 320-byte slots, first
+ * the call section, then the bridge section.
+ *
+ * Levels are polled on our own schedule instead of arriving as VU_REPORT
+ * events. A slot whose copy overlapped a write (odd seq, or seq and seq_end
+ * differ) is skipped for this poll; the next one picks it up.
+ */
+
+export const METER_SHM_MAGIC = 0x52544d42; // "BMTR"
+export const METER_SHM_VERSION = 2;
+
+const HDR_SIZE = 64;
+const SLOT_SIZE = 320;
+
+const FLAG_USED = 1 << 0;
+const FLAG_TX = 1 << 1;
+const FLAG_RX = 1 << 2;
+const FLAG_ACTIVE = 1 << 3;
+const FLAG_MUTED = 1 << 4;
+
+/** Levels of a section whose writer stopped are ignored after this long */
+const STALE_MS = 2000;
+
+export interface MeterShmHeader {
+  callSlots: number;
+  bridgeSlots: number;
+  callUsed: number;
+  callSeq: number;
+  callUpdatedMs: number;
+  bridgeUsed: number;
+  bridgeSeq: number;
+  bridgeUpdatedMs: number;
+}
+
+export interface MeterShmCall {
+  accountUri: string;
+  callId: string;
+  tx?: VuLevels;
+  rx?: VuLevels;
+}
+
+export interface MeterShmBridgeLevel {
+  /** Bridge context key */
+  key: string;
+  /** RX source producer; absent for the context's TX level */
+  producerId?: string;
+  active: boolean;
+  muted: boolean;
+  dbfs: number;
+  /** Packets sent or received, modulo 2^32 */
+  packets: number;
+}
+
+export type MeterShmBridgeObserver = (
+  levels: MeterShmBridgeLevel[],
+) => void | Promise<void>;
+
+const bridgeObservers = new Set<MeterShmBridgeObserver>();
+
+/** Get the bridge levels of every fresh meter file pass */
+export function registerMeterShmBridgeObserver(
+  observer: MeterShmBridgeObserver,
+): () => void {
+  bridgeObservers.add(observer);
+  return () => bridgeObservers.delete(observer);
+}
+
+/** Counters and timestamps stay well below 2^53 */
+function readU64(buf: Buffer, off: number): number {
+  return buf.readUInt32LE(off) + buf.readUInt32LE(off + 4) * 2 ** 32;
+}
+
+export function parseMeterShmHeader(buf: Buffer): MeterShmHeader | undefined {
+  if (buf.length < HDR_SIZE) return undefined;
+  if (
+    buf.readUInt32LE(0) !== METER_SHM_MAGIC ||
+    buf.readUInt16LE(4) !== METER_SHM_VERSION ||
+    buf.readUInt16LE(6) !== HDR_SIZE ||
+    buf.readUInt16LE(8) !== SLOT_SIZE
+  ) {
+    return undefined;
+  }
+
+  const callSlots = buf.readUInt16LE(10);
+  const bridgeSlots = buf.readUInt16LE(12);
+  return {
+    callSlots,
+    bridgeSlots,
+    callUsed: Math.min(buf.readUInt16LE(14), callSlots),
+    callSeq: readU64(buf, 16),
+    callUpdatedMs: readU64(buf, 24),
+    bridgeSeq: readU64(buf, 32),
+    bridgeUpdatedMs: readU64(buf, 40),
+    bridgeUsed: Math.min(buf.readUInt16LE(48), bridgeSlots),
+  };
+}
+
+/** One consistent slot, or undefined for an unused or torn one */
+function readSlot(buf: Buffer, off: number) {
+  if (off + SLOT_SIZE > buf.length) return undefined;
+  const seq = buf.readUInt32LE(off);
+  const seqEnd = buf.readUInt32LE(off + 316);
+  if (seq & 1 || seq !== seqEnd) return undefined;
+
+  const flags = buf.readUInt32LE(off + 4);
+  if (!(flags & FLAG_USED)) return undefined;
+
+  return {
+    flags,
+    key: cString(buf, off + 8, 128),
+    id: cString(buf, off + 136, 112),
+    level: (i: number) => round1(buf.readFloatLE(off + 248 + 4 * i)),
+    count: buf.readUInt32LE(off + 312),
+  };
+}
+
+function cString(buf: Buffer, off: number, size: number): string {
+  const end = buf.indexOf(0, off);
+  return buf.toString('utf8', off, end < 0 || end > off + size ? off + size : end);
+}
+
+function round1(value: number): number {
+  return Math.round(value * 10) / 10;
+}
+
+function vuLevels(level: (i: number) => number, base: number): VuLevels {
+  return {
+    l: level(base),
+    r: level(base + 1),
+    peak: { l: level(base + 2), r: level(base + 3) },
+    ppm: { l: level(base + 4), r: level(base + 5) },
+    lufs: { m: level(base + 6), s: level(base + 7) },
+  };
+}
+
+/** Parse the call section of a meter file copy (header included) */
+export function parseMeterShmCalls(
+  buf: Buffer,
+  header: MeterShmHeader,
+): MeterShmCall[] {
+  const calls: MeterShmCall[] = [];
+  for (let i = 0; i < header.callUsed; i++) {
+    const slot = readSlot(buf, HDR_SIZE + i * SLOT_SIZE);
+    if (!slot || !slot.key) continue;
+    calls.push({
+      accountUri: slot.key,
+      callId: slot.id,
+      ...(slot.flags & FLAG_TX ? { tx: vuLevels(slot.level, 0) } : {}),
+      ...(slot.flags & FLAG_RX ? { rx: vuLevels(slot.level, 8) } : {}),
+    });
+  }
+  return calls;
+}
+
+/** Parse the bridge section of a meter file copy (header included) */
+export function parseMeterShmBridge(
+  buf: Buffer,
+  header: MeterShmHeader,
+): MeterShmBridgeLevel[] {
+  const base = HDR_SIZE + header.callSlots * SLOT_SIZE;
+  const levels: MeterShmBridgeLevel[] = [];
+  for (let i = 0; i < header.bridgeUsed; i++) {
+    const slot = readSlot(buf, base + i * SLOT_SIZE);
+    if (!slot || !slot.key) continue;
+    levels.push({
+      key: slot.key,
+      ...(slot.flags & FLAG_RX ? { producerId: slot.id } : {}),
+      active: (slot.flags & FLAG_ACTIVE) !== 0,
+      muted: (slot.flags & FLAG_MUTED) !== 0,
+      dbfs: slot.level(0),
+      packets: slot.count,
+    });
+  }
+  return levels;
+}
+
+export class MeterShmReader {
+  private file: FileHandle | null = null;
+  private timer: ReturnType<typeof setInterval> | null = null;
+  private polling = false;
+  private callSeq = -1;
+  private bridgeSeq = -1;
+  private header = Buffer.alloc(HDR_SIZE);
+  private body = Buffer.alloc(0);
+
+  constructor(
+    private readonly path: string,
+    private readonly stateManager: StateManager,
+    private readonly intervalMs = 100,
+  ) {}
+
+  start(): void {
+    if (this.timer) return;
+    this.timer = setInterval(() => {
+      void this.poll();
+    }, this.intervalMs);
+    this.stateManager.addLog('info', 'system', `Reading meter levels from ${this.path}`);
+  }
+
+  async stop(): Promise<void> {
+    if (this.timer) {
+      clearInterval(this.timer);
+      this.timer = null;
+    }
+    await this.close();
+  }
+
+  /** Read the file once; exposed for tests */
+  async poll(now = Date.now()): Promise<void> {
+    if (this.polling) return;
+    this.polling = true;
+    try {
+      await this.read(now);
+    } catch {
+      // Not there yet, or replaced by a restarted writer: reopen next time
+      await this.close();
+    } finally {
+      this.polling = false;
+    }
+  }
+
+  private async read(now: number): Promise<void> {
+    this.file ??= await open(this.path, 'r');
+
+    const { bytesRead } = await this.file.read(this.header, 0, HDR_SIZE, 0);
+    const header = parseMeterShmHeader(this.header.subarray(0, bytesRead));
+    if (!header) return;
+
+    const callsDue =
+      header.callSeq !== this.callSeq && now - header.callUpdatedMs < STALE_MS;
+    const bridgeDue =
+      bridgeObservers.size > 0 &&
+      header.bridgeSeq !== this.bridgeSeq &&
+      now - header.bridgeUpdatedMs < STALE_MS;
+    if (!callsDue && !bridgeDue) return;
+
+    // Copy only up to the highest slot in use of the section(s) needed
+    const size = bridgeDue
+      ? HDR_SIZE + (header.callSlots + header.bridgeUsed) * SLOT_SIZE
+      : HDR_SIZE + header.callUsed * SLOT_SIZE;
+    if (this.body.length < size) this.body = Buffer.alloc(size);
+    this.header.copy(this.body, 0);
+    await this.file.read(this.body, HDR_SIZE, size - HDR_SIZE, HDR_SIZE);
+    const buf = this.body.subarray(0, size);
+
+    if (callsDue) {
+      this.callSeq = header.callSeq;
+      for (const call of parseMeterShmCalls(buf, header)) {
+        updateVuLevels(call.accountUri, call.tx, call.rx, this.stateManager, now);
+      }
+    }
+
+    if (bridgeDue) {
+      this.bridgeSeq = header.bridgeSeq;
+      const levels = parseMeterShmBridge(buf, header);
+      for (const observer of bridgeObservers) {
+        try {
+          void Promise.resolve(observer(levels)).catch((error) => {
+            console.error('Meter file observer failed:', error);
+          });
+        } catch (error) {
+          console.error('Meter file observer failed:', error);
+        }
+      }
+    }
+  }
+
+  private async close(): Promise<void> {
+    const file = this.file;
+    this.file = null;
+    this.callSeq = -1;
+    this.bridgeSeq = -1;
+    await file?.close().catch(() => undefined);
+  }
+}
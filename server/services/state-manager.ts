@@ -475,22 +475,16 @@ export class StateManager {
   }
 
   // Audio Meter Management
-  private audioMeterLastBroadcast = new Map<string, number>();
-
   updateAudioMeter(meter: AudioMeter): void {
     this.audioMeters.set(meter.accountUri, meter);
 
-    // Throttle broadcasts to max ~7/s per account (150ms interval)
-    // Client-side PPM smoothing interpolates between updates at 60fps
-    const now = Date.now();
-    const lastBroadcast = this.audioMeterLastBroadcast.get(meter.accountUri) || 0;
-    if (now - lastBroadcast >= 150) {
-      this.audioMeterLastBroadcast.set(meter.accountUri, now);
-      this.broadcast({
-        type: 'audioMeter',
-        data: meter
-      });
-    }
+    // The module paces its reports (one tick per ~100 ms, only levels that
+    // moved) and computes the PPM and peak the client shows as they are,
+    // so every update is forwarded
+    this.broadcast({
+      type: 'audioMeter',
+      data: meter
+    });
   }
 
   getAudioMeter(accountUri: string): AudioMeter | undefined {
@@ -466,6 +466,9 @@ function normalizeMapping(
       'tally',
       'mixLocalCallers',
       'bitrateBps',
+      'ptimeMs',
+      'telemetryIntervalMs',
+      'levelHysteresisDb',
       'previousAudioSource',
       'previousAudioPlayer',
     ],
@@ -538,6 +541,37 @@ function normalizeMapping(
   if (bitrateBps === undefined || bitrateBps < 6_000 || bitrateBps > 510_000) {
     issues.push(`${location}.bitrateBps must be an integer between 6000 and 510000`);
   }
+  const ptimeMs =
+    value.ptimeMs === undefined ? undefined : finiteInteger(value.ptimeMs);
+  if (
+    value.ptimeMs !== undefined &&
+    (ptimeMs === undefined || ![10, 20, 40, 60].includes(ptimeMs))
+  ) {
+    issues.push(`${location}.ptimeMs must be 10, 20, 40 or 60`);
+  }
+  const telemetryIntervalMs =
+    value.telemetryIntervalMs === undefined
+      ? undefined
+      : finiteInteger(value.telemetryIntervalMs);
+  if (
+    value.telemetryIntervalMs !== undefined &&
+    (telemetryIntervalMs === undefined ||
+      telemetryIntervalMs < 50 ||
+      telemetryIntervalMs > 5_000)
+  ) {
+    issues.push(`${location}.telemetryIntervalMs must be an integer between 50 and 5000`);
+  }
+  const levelHysteresisDb =
+    typeof value.levelHysteresisDb === 'number' ? value.levelHysteresisDb : undefined;
+  if (
+    value.levelHysteresisDb !== undefined &&
+    (levelHysteresisDb === undefined ||
+      !Number.isFinite(levelHysteresisDb) ||
+      levelHysteresisDb < 0 ||
+      levelHysteresisDb > 20)
+  ) {
+    issues.push(`${location}.levelHysteresisDb must be between 0 and 20`);
+  }
 
   let previousAudioSource = '';
   let previousAudioPlayer = '';
@@ -588,6 +622,9 @@ function normalizeMapping(
           ? value.mixLocalCallers
           : TALKTOME_ACCOUNT_DEFAULTS.mixLocalCallers,
     bitrateBps,
+    ...(ptimeMs === undefined ? {} : { ptimeMs }),
+    ...(telemetryIntervalMs === undefined ? {} : { telemetryIntervalMs }),
+    ...(levelHysteresisDb === undefined ? {} : { levelHysteresisDb }),
     previousAudioSource,
     previousAudioPlayer,
   };
@@ -23,21 +23,59 @@ export interface ModuleSourceEndpoint {
 export interface ModuleContextConfig {
   mixLocalCallers: boolean;
   bitrateBps: number;
+  /** Packet and mixer frame duration: 10, 20, 40 or 60 ms. */
+  ptimeMs?: number;
+  /** MS_TELEMETRY reporting interval for this context (50-5000 ms). */
+  telemetryIntervalMs?: number;
+  /** Minimum level change in dB before a level is re-reported (0-20). */
+  levelHysteresisDb?: number;
+}
+
+export interface ModuleTransmitEndpoint {
+  ip: string;
+  port: number;
+  payloadType: number;
+  ssrc: number;
+}
+
+/** One step of an `ms_bridge_apply` batch, applied in order. */
+export type ModuleBridgeOperation =
+  | { op: 'config'; config: ModuleContextConfig }
+  | { op: 'tx'; endpoint: ModuleTransmitEndpoint }
+  | { op: 'mute'; muted: boolean }
+  | { op: 'reserve'; producerId: string }
+  | { op: 'source'; endpoint: ModuleSourceEndpoint };
+
+export interface ModuleBridgeApplyResult {
+  /** True when the batch opened the context. */
+  created: boolean;
+  /** Receive port of every reserved or activated source, by producer ID. */
+  sources: Record<string, ReservedModuleSource>;
 }
 
 export interface TalktomeModuleController {
   openContext(key: string): Promise<void>;
   configureContext(key: string, config: ModuleContextConfig): Promise<void>;
   closeContext(key: string): Promise<void>;
-  bindTransmit(
+  bindTransmit(key: string, endpoint: ModuleTransmitEndpoint): Promise<void>;
+  /**
+   * Opens the context and applies the operations in one round trip. The
+   * module rolls back every applied operation when one of them fails.
+   */
+  applyBridge?(
     key: string,
-    endpoint: { ip: string; port: number; payloadType: number; ssrc: number },
-  ): Promise<void>;
+    operations: ModuleBridgeOperation[],
+  ): Promise<ModuleBridgeApplyResult>;
   setTransmitMuted(key: string, muted: boolean): Promise<void>;
   reserveSource(key: string, producerId: string): Promise<ReservedModuleSource>;
   addSource(key: string, endpoint: ModuleSourceEndpoint): Promise<void>;
   removeSource(key: string, producerId: string): Promise<void>;
   getStats(key: string): Promise<JsonObject>;
+  /**
+   * Statistics of every context in one round trip. With `since` set to the
+   * `generation` of an earlier response, only changed sections are returned.
+   */
+  getAllStats?(since?: number): Promise<JsonObject>;
 }
 
 /**
@@ -51,38 +89,49 @@ export class CtrlTcpTalktomeModuleController implements TalktomeModuleController
   }
 
   async configureContext(key: string, config: ModuleContextConfig): Promise<void> {
-    if (!config || typeof config.mixLocalCallers !== 'boolean') {
-      throw new Error('mixLocalCallers must be a boolean');
-    }
-    if (
-      !Number.isSafeInteger(config.bitrateBps) ||
-      config.bitrateBps < 6_000 ||
-      config.bitrateBps > 510_000
-    ) {
-      throw new Error('bitrateBps must be an integer from 6000 to 510000');
-    }
-    await this.command('ms_ctx_config', [
-      contextKey(key),
-      config.mixLocalCallers ? 'party-line' : 'isolated',
-      String(config.bitrateBps),
-    ]);
+    await this.command('ms_ctx_config', [contextKey(key), ...contextConfigParams(config)]);
   }
 
   async closeContext(key: string): Promise<void> {
     await this.command('ms_ctx_close', [contextKey(key)]);
   }
 
-  async bindTransmit(
+  async bindTransmit(key: string, endpoint: ModuleTransmitEndpoint): Promise<void> {
+    await this.command('ms_bridge_tx', [contextKey(key), ...transmitParams(endpoint)]);
+  }
+
+  async applyBridge(
     key: string,
-    endpoint: { ip: string; port: number; payloadType: number; ssrc: number },
-  ): Promise<void> {
-    await this.command('ms_bridge_tx', [
+    operations: ModuleBridgeOperation[],
+  ): Promise<ModuleBridgeApplyResult> {
+    if (!Array.isArray(operations) || operations.length < 1 || operations.length > 16) {
+      throw new Error('ms_bridge_apply takes 1 to 16 operations');
+    }
+    const steps = operations.map((operation) => {
+      const step = operationParams(operation);
+      if (step.some((part) => part.includes(';'))) {
+        throw new Error('Bridge operation contains the batch separator');
+      }
+      return step;
+    });
+    const response = await this.command('ms_bridge_apply', [
       contextKey(key),
-      token(endpoint.ip, 'IP address'),
-      port(endpoint.port),
-      payloadType(endpoint.payloadType),
-      positiveInteger(endpoint.ssrc, 'SSRC'),
+      steps.map((step) => step.join(' ')).join(';'),
     ]);
+    const decoded = decodeCommandPayload(response);
+    if (!isRecord(decoded)) {
+      throw new Error('ms_bridge_apply returned no structured response');
+    }
+    const sources: Record<string, ReservedModuleSource> = {};
+    for (const source of Array.isArray(decoded.sources) ? decoded.sources : []) {
+      if (!isRecord(source) || typeof source.producerId !== 'string') continue;
+      const localRecvPort = Number(source.localRecvPort);
+      if (!Number.isSafeInteger(localRecvPort) || localRecvPort < 1 || localRecvPort > 65_535) {
+        throw new Error('ms_bridge_apply returned an invalid localRecvPort');
+      }
+      sources[source.producerId] = { localRecvPort };
+    }
+    return { created: decoded.created === true, sources };
   }
 
   async setTransmitMuted(key: string, muted: boolean): Promise<void> {
@@ -114,16 +163,7 @@ export class CtrlTcpTalktomeModuleController implements TalktomeModuleController
   }
 
   async addSource(key: string, endpoint: ModuleSourceEndpoint): Promise<void> {
-    await this.command('ms_bridge_addsrc', [
-      contextKey(key),
-      token(endpoint.producerId, 'producer ID'),
-      token(endpoint.ip, 'IP address'),
-      port(endpoint.port),
-      payloadType(endpoint.payloadType),
-      ...(endpoint.ssrc === undefined
-        ? []
-        : [positiveInteger(endpoint.ssrc, 'SSRC')]),
-    ]);
+    await this.command('ms_bridge_addsrc', [contextKey(key), ...sourceParams(endpoint)]);
   }
 
   async removeSource(key: string, producerId: string): Promise<void> {
@@ -142,6 +182,22 @@ export class CtrlTcpTalktomeModuleController implements TalktomeModuleController
     return toJsonObject(decoded);
   }
 
+  async getAllStats(since?: number): Promise<JsonObject> {
+    const params: string[] = [];
+    if (since !== undefined) {
+      if (!Number.isSafeInteger(since) || since < 0) {
+        throw new Error('since must be a non-negative integer');
+      }
+      params.push(`since=${since}`);
+    }
+    const response = await this.command('ms_bridge_stat_all', params);
+    const decoded = decodeCommandPayload(response);
+    if (!isRecord(decoded)) {
+      throw new Error('ms_bridge_stat_all returned no structured response');
+    }
+    return toJsonObject(decoded);
+  }
+
   private async command(command: string, parameters: string[]): Promise<unknown> {
     const response = await this.executor.execute(command, parameters.join(' '));
     // Validate every acknowledgement, including void commands such as mute.
@@ -192,6 +248,88 @@ function decodeCommandPayload(value: unknown): unknown {
   }
 }
 
+function contextConfigParams(config: ModuleContextConfig): string[] {
+  if (!config || typeof config.mixLocalCallers !== 'boolean') {
+    throw new Error('mixLocalCallers must be a boolean');
+  }
+  if (
+    !Number.isSafeInteger(config.bitrateBps) ||
+    config.bitrateBps < 6_000 ||
+    config.bitrateBps > 510_000
+  ) {
+    throw new Error('bitrateBps must be an integer from 6000 to 510000');
+  }
+  const params = [
+    config.mixLocalCallers ? 'party-line' : 'isolated',
+    String(config.bitrateBps),
+  ];
+  if (config.ptimeMs !== undefined) {
+    if (![10, 20, 40, 60].includes(config.ptimeMs)) {
+      throw new Error('ptimeMs must be 10, 20, 40 or 60');
+    }
+    params.push(`ptime=${config.ptimeMs}`);
+  }
+  if (config.telemetryIntervalMs !== undefined) {
+    if (
+      !Number.isSafeInteger(config.telemetryIntervalMs) ||
+      config.telemetryIntervalMs < 50 ||
+      config.telemetryIntervalMs > 5_000
+    ) {
+      throw new Error('telemetryIntervalMs must be an integer from 50 to 5000');
+    }
+    params.push(`interval=${config.telemetryIntervalMs}`);
+  }
+  if (config.levelHysteresisDb !== undefined) {
+    if (
+      !Number.isFinite(config.levelHysteresisDb) ||
+      config.levelHysteresisDb < 0 ||
+      config.levelHysteresisDb > 20
+    ) {
+      throw new Error('levelHysteresisDb must be from 0 to 20');
+    }
+    params.push(`hysteresis=${config.levelHysteresisDb}`);
+  }
+  return params;
+}
+
+function operationParams(operation: ModuleBridgeOperation): string[] {
+  switch (operation?.op) {
+    case 'config':
+      return ['config', ...contextConfigParams(operation.config)];
+    case 'tx':
+      return ['tx', ...transmitParams(operation.endpoint)];
+    case 'mute':
+      return ['mute', operation.muted ? 'on' : 'off'];
+    case 'reserve':
+      return ['src', token(operation.producerId, 'producer ID')];
+    case 'source':
+      return ['src', ...sourceParams(operation.endpoint)];
+    default:
+      throw new Error('Unknown bridge operation');
+  }
+}
+
+function transmitParams(endpoint: ModuleTransmitEndpoint): string[] {
+  return [
+    token(endpoint.ip, 'IP address'),
+    port(endpoint.port),
+    payloadType(endpoint.payloadType),
+    positiveInteger(endpoint.ssrc, 'SSRC'),
+  ];
+}
+
+function sourceParams(endpoint: ModuleSourceEndpoint): string[] {
+  return [
+    token(endpoint.producerId, 'producer ID'),
+    token(endpoint.ip, 'IP address'),
+    port(endpoint.port),
+    payloadType(endpoint.payloadType),
+    ...(endpoint.ssrc === undefined
+      ? []
+      : [positiveInteger(endpoint.ssrc, 'SSRC')]),
+  ];
+}
+
 function contextKey(value: string): string {
   const result = token(value, 'context key');
   if (result.length > 120 || !/^[A-Za-z0-9_.:@-]+$/.test(result)) {
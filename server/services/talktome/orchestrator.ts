@@ -32,7 +32,11 @@ import type {
   BridgeUserEndpointUpdate,
   JsonObject,
 } from './types';
-import type { TalktomeModuleController } from './module-controller';
+import type {
+  ModuleBridgeOperation,
+  ReservedModuleSource,
+  TalktomeModuleController,
+} from './module-controller';
 
 export type { TalktomeBridgePhase, TalktomeBridgeStatus } from '~/types';
 
@@ -138,6 +142,7 @@ const INITIAL_PTT_SAFETY_RETRY_MS = 500;
 const MAX_PTT_SAFETY_RETRY_MS = 10_000;
 const INITIAL_SESSION_DELETE_RETRY_MS = 1_000;
 const MAX_SESSION_DELETE_RETRY_MS = 30_000;
+const MAX_BRIDGE_OPERATIONS = 16;
 
 /**
  * Per-account control-plane orchestrator. It has no imports from the baresip
@@ -569,12 +574,25 @@ export class TalktomeBridgeOrchestrator {
     runtime.lifecycleEvents.push({ event: 'session-starting' });
     this.emitStatus(runtime);
     try {
-      await this.options.module.openContext(runtime.mapping.key);
-      runtime.contextOpen = true;
-      await this.options.module.configureContext(runtime.mapping.key, {
+      const contextConfig = {
         mixLocalCallers: runtime.mapping.mixLocalCallers,
         bitrateBps: runtime.mapping.bitrateBps,
-      });
+        ptimeMs: runtime.mapping.ptimeMs,
+        telemetryIntervalMs: runtime.mapping.telemetryIntervalMs,
+        levelHysteresisDb: runtime.mapping.levelHysteresisDb,
+      };
+      if (this.options.module.applyBridge) {
+        // One round trip. The context may predate this runtime, so the
+        // teardown closes it even when the batch fails; close is idempotent.
+        runtime.contextOpen = true;
+        await this.options.module.applyBridge(runtime.mapping.key, [
+          { op: 'config', config: contextConfig },
+        ]);
+      } else {
+        await this.options.module.openContext(runtime.mapping.key);
+        runtime.contextOpen = true;
+        await this.options.module.configureContext(runtime.mapping.key, contextConfig);
+      }
 
       const feedMapping = isFeedMapping(runtime.mapping);
       const session = await this.options.api.createSession(
@@ -614,20 +632,44 @@ export class TalktomeBridgeOrchestrator {
         transport.ssrc,
       );
       runtime.producerId = producer.id;
-      const txIp = await resolveMediaEndpointIp(transport.ip);
-      await this.options.module.bindTransmit(runtime.mapping.key, {
-        ip: txIp,
+      const transmit = {
+        ip: await resolveMediaEndpointIp(transport.ip),
         port: transport.port,
         payloadType: transport.payloadType,
         ssrc: transport.ssrc,
-      });
-      await this.options.module.setTransmitMuted(runtime.mapping.key, !feedMapping);
+      };
+      const active = feedMapping
+        ? []
+        : await this.options.api.getActiveProducers(session.sessionId);
+      let reserved: Record<string, ReservedModuleSource> = {};
+      if (this.options.module.applyBridge) {
+        // TX, its mute state and the sources already known share one round
+        // trip; sources that do not fit the batch reserve on their own.
+        const reserve = this.consumableProducers(runtime, active)
+          .slice(0, MAX_BRIDGE_OPERATIONS - 2)
+          .map(
+            (candidate): ModuleBridgeOperation => ({
+              op: 'reserve',
+              producerId: candidate.producerId,
+            }),
+          );
+        ({ sources: reserved } = await this.options.module.applyBridge(
+          runtime.mapping.key,
+          [
+            { op: 'tx', endpoint: transmit },
+            { op: 'mute', muted: !feedMapping },
+            ...reserve,
+          ],
+        ));
+      } else {
+        await this.options.module.bindTransmit(runtime.mapping.key, transmit);
+        await this.options.module.setTransmitMuted(runtime.mapping.key, !feedMapping);
+      }
 
       if (feedMapping) {
         runtime.pttLive = true;
       } else {
-        const active = await this.options.api.getActiveProducers(session.sessionId);
-        await this.reconcileProducers(runtime, active);
+        await this.reconcileProducers(runtime, active, reserved);
       }
       this.startHeartbeat(runtime, generation);
       runtime.phase = 'connected';
@@ -813,9 +855,32 @@ export class TalktomeBridgeOrchestrator {
     }
   }
 
+  /** Remote producers in `activeProducers` that get a consumer. */
+  private consumableProducers(
+    runtime: AccountRuntime,
+    activeProducers: BridgeActiveProducer[],
+  ): BridgeActiveProducer[] {
+    // talktome v1.1.1: paused talk producers stay in active-producers with
+    // retainOnly so existing consumers survive PTT gaps. Do not create new
+    // consumers for those entries (matches official bridge-client).
+    const consumable = new Map<string, BridgeActiveProducer>();
+    for (const producer of activeProducers) {
+      if (
+        producer.producerId &&
+        producer.producerId !== runtime.producerId &&
+        !producer.retainOnly &&
+        !runtime.consumers.has(producer.producerId)
+      ) {
+        consumable.set(producer.producerId, producer);
+      }
+    }
+    return [...consumable.values()];
+  }
+
   private async reconcileProducers(
     runtime: AccountRuntime,
     activeProducers: BridgeActiveProducer[],
+    reserved: Record<string, ReservedModuleSource> = {},
   ): Promise<void> {
     if (!runtime.sessionId) return;
     const activeById = new Map(
@@ -824,13 +889,9 @@ export class TalktomeBridgeOrchestrator {
         .map((producer) => [producer.producerId, producer]),
     );
 
-    for (const producer of activeById.values()) {
-      // talktome v1.1.1: paused talk producers stay in active-producers with
-      // retainOnly so existing consumers survive PTT gaps. Do not create new
-      // consumers for those entries (matches official bridge-client).
-      if (producer.retainOnly) continue;
+    for (const producer of this.consumableProducers(runtime, activeProducers)) {
       try {
-        await this.ensureConsumer(runtime, producer);
+        await this.ensureConsumer(runtime, producer, reserved[producer.producerId]);
       } catch (error) {
         runtime.phase = 'degraded';
         runtime.lastError = `consumer ${producer.producerId}: ${errorMessage(error)}`;
@@ -846,17 +907,18 @@ export class TalktomeBridgeOrchestrator {
   /**
    * Load-bearing reserve-first sequence:
    * module reserve -> HTTP consumer -> module activation/probe -> HTTP resume.
+   * `reserved` is a reservation already made by the setup batch.
    */
   private async ensureConsumer(
     runtime: AccountRuntime,
     producer: BridgeActiveProducer,
+    reserved?: ReservedModuleSource,
   ): Promise<void> {
     if (!runtime.sessionId || runtime.consumers.has(producer.producerId)) return;
     const producerId = producer.producerId;
-    const reservation = await this.options.module.reserveSource(
-      runtime.mapping.key,
-      producerId,
-    );
+    const reservation =
+      reserved ??
+      (await this.options.module.reserveSource(runtime.mapping.key, producerId));
     let consumer: BridgeConsumer | undefined;
     let moduleSourceAdded = false;
     try {
@@ -1908,6 +1970,9 @@ function mappingRequiresRestart(
     previous.target?.id !== next.target?.id ||
     previous.mixLocalCallers !== next.mixLocalCallers ||
     previous.bitrateBps !== next.bitrateBps ||
+    previous.ptimeMs !== next.ptimeMs ||
+    previous.telemetryIntervalMs !== next.telemetryIntervalMs ||
+    previous.levelHysteresisDb !== next.levelHysteresisDb ||
     previous.ptt.mode !== next.ptt.mode ||
     previous.ptt.thresholdDb !== next.ptt.thresholdDb ||
     previous.ptt.holdMs !== next.ptt.holdMs ||
@@ -14,6 +14,10 @@ import {
   type BaresipConnection,
 } from '../baresip-connection';
 import { registerBaresipEventObserver } from '../baresip-parser';
+import {
+  registerMeterShmBridgeObserver,
+  type MeterShmBridgeLevel,
+} from '../meter-shm';
 import {
   getTalktomeBridgeConfigManager,
   isFeedMapping,
@@ -76,6 +80,7 @@ export class TalktomeBridgeRuntime {
   private remoteConfig?: BridgeRuntimeConfig;
   private lifecycle: Promise<void> = Promise.resolve();
   private unregisterEventObserver?: () => void;
+  private unregisterMeterObserver?: () => void;
   private unregisterConnectionListener?: () => void;
   private retryTimer?: ReturnType<typeof setTimeout>;
   private retryDelayMs = 5_000;
@@ -122,6 +127,13 @@ export class TalktomeBridgeRuntime {
           this.reportError(error);
         });
       });
+      this.unregisterMeterObserver = registerMeterShmBridgeObserver(
+        (levels) => {
+          void this.applyMeterLevels(levels).catch((error) => {
+            this.reportError(error);
+          });
+        },
+      );
       this.unregisterConnectionListener =
         this.options.connection.onConnectionStatusChange((connected) => {
           void this.enqueueLifecycle(() =>
@@ -144,8 +156,10 @@ export class TalktomeBridgeRuntime {
     if (this.stopped) return;
     this.stopped = true;
     this.unregisterEventObserver?.();
+    this.unregisterMeterObserver?.();
     this.unregisterConnectionListener?.();
     this.unregisterEventObserver = undefined;
+    this.unregisterMeterObserver = undefined;
     this.unregisterConnectionListener = undefined;
     this.clearRetry();
     this.setGlobalStatus('stopping', false);
@@ -493,46 +507,84 @@ export class TalktomeBridgeRuntime {
 
     const telemetry = parseModuleTelemetry(event);
     if (!telemetry) return;
-    const accountUri = this.accountUriForKey(telemetry.payload.key);
-    if (!accountUri) return;
     switch (telemetry.name) {
-      case 'MS_TX_ACTIVE': {
-        const dbfs = Number(telemetry.payload.dbfs);
-        if (Number.isFinite(dbfs)) {
-          await orchestrator.updateVadLevel(accountUri, dbfs);
-        }
-        break;
-      }
-      case 'MS_RX_LEVEL': {
-        const producerId = stringValue(telemetry.payload.producerId);
-        if (producerId && typeof telemetry.payload.active === 'boolean') {
-          await orchestrator.setReceiveActivity(
-            accountUri,
-            producerId,
-            telemetry.payload.active,
-          );
+      case 'MS_TELEMETRY': {
+        const contexts = telemetry.payload.contexts;
+        if (!Array.isArray(contexts)) break;
+        for (const entry of contexts) {
+          if (isRecord(entry)) await this.applyContextTelemetry(entry);
         }
         break;
       }
-      case 'MS_RX_ACTIVE':
-        if (typeof telemetry.payload.active === 'boolean') {
-          await orchestrator.setAggregateReceiveActivity(
-            accountUri,
-            telemetry.payload.active,
-          );
-        }
-        break;
-      case 'MS_CTX_ERROR':
+      case 'MS_CTX_ERROR': {
+        const accountUri = this.accountUriForKey(telemetry.payload.key);
+        if (!accountUri) return;
         await orchestrator.reportModuleError(
           accountUri,
           stringValue(telemetry.payload.reason) || 'unknown module error',
         );
         break;
+      }
       default:
         break;
     }
   }
 
+  /**
+   * Apply one context entry of a batched MS_TELEMETRY event. The module
+   * only includes the parts (tx, rx, sources) that changed since the last
+   * report, so absent fields leave the current state untouched.
+   */
+  private async applyContextTelemetry(
+    entry: Record<string, unknown>,
+  ): Promise<void> {
+    const accountUri = this.accountUriForKey(entry.key);
+    if (!accountUri) return;
+
+    if (isRecord(entry.tx)) {
+      const dbfs = Number(entry.tx.dbfs);
+      if (Number.isFinite(dbfs)) {
+        await orchestrator.updateVadLevel(accountUri, dbfs);
+      }
+    }
+
+    if (Array.isArray(entry.sources)) {
+      for (const source of entry.sources) {
+        if (!isRecord(source)) continue;
+        const producerId = stringValue(source.producerId);
+        if (producerId && typeof source.active === 'boolean') {
+          await orchestrator.setReceiveActivity(
+            accountUri,
+            producerId,
+            source.active,
+          );
+        }
+      }
+    }
+
+    if (isRecord(entry.rx) && typeof entry.rx.active === 'boolean') {
+      await orchestrator.setAggregateReceiveActivity(
+        accountUri,
+        entry.rx.active,
+      );
+    }
+  }
+
+  /**
+   * With the meter file enabled the module leaves level moves out of
+   * MS_TELEMETRY; the audio-level PTT reads the context TX level from the
+   * file instead.
+   */
+  private async applyMeterLevels(levels: MeterShmBridgeLevel[]): Promise<void> {
+    const orchestrator = this.orchestrator;
+    if (!orchestrator) return;
+    for (const level of levels) {
+      if (level.producerId !== undefined) continue;
+      const accountUri = this.accountUriForKey(level.key);
+      if (accountUri) await orchestrator.updateVadLevel(accountUri, level.dbfs);
+    }
+  }
+
   private async handleTally(update: TalktomeTallyUpdate): Promise<void> {
     stateManager.updateGpioOut(update.accountUri, update.gpo, update.active);
     const activeCalls = stateManager.getCalls().filter(
@@ -275,6 +275,9 @@ function validateJournalMapping(
     'tally',
     'mixLocalCallers',
     'bitrateBps',
+    'ptimeMs',
+    'telemetryIntervalMs',
+    'levelHysteresisDb',
     'previousAudioSource',
     'previousAudioPlayer',
   ] as const;
@@ -396,6 +399,9 @@ function mappingEquals(
     left.tally.liveGpo === right.tally.liveGpo &&
     left.mixLocalCallers === right.mixLocalCallers &&
     left.bitrateBps === right.bitrateBps &&
+    left.ptimeMs === right.ptimeMs &&
+    left.telemetryIntervalMs === right.telemetryIntervalMs &&
+    left.levelHysteresisDb === right.levelHysteresisDb &&
     left.previousAudioSource === right.previousAudioSource &&
     left.previousAudioPlayer === right.previousAudioPlayer
   );
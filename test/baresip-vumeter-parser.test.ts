@@ -0,0 +1,107 @@
+import { describe, expect, it } from 'vitest';
+import { parseBaresipEventBuffered } from '~/server/services/baresip-parser';
+import { StateManager } from '~/server/services/state-manager';
+
+function eventNetstring(event: Record<string, unknown>): string {
+  const payload = JSON.stringify({ event: true, ...event });
+  return `${payload.length}:${payload},`;
+}
+
+describe('vumeter_stereo event parsing', () => {
+  it('applies every call of a batched VU_REPORT to its account', () => {
+    const state = new StateManager();
+    const report = {
+      calls: [
+        {
+          id: 'call-a',
+          accountaor: 'sip:studio@example.com',
+          tx: {
+            l: -18.2,
+            r: -17.8,
+            peak: { l: -6.1, r: -6.4 },
+            ppm: { l: -5.0, r: -5.5 },
+            lufs: { m: -21.3, s: -22.8 },
+          },
+          rx: { l: -20.1, r: -20.3 },
+        },
+        {
+          id: 'call-b',
+          accountaor: 'sip:desk@example.com',
+          tx: { l: -30, r: -31 },
+        },
+      ],
+    };
+
+    expect(
+      parseBaresipEventBuffered(
+        eventNetstring({
+          class: 'module',
+          type: 'MODULE',
+          param: `vumeter_stereo,VU_REPORT,${JSON.stringify(report)}`,
+        }),
+        state,
+      ),
+    ).toEqual({ remaining: '' });
+
+    expect(state.getAudioMeter('sip:studio@example.com')).toEqual(
+      expect.objectContaining({
+        txL: -18.2,
+        txR: -17.8,
+        rxL: -20.1,
+        rxR: -20.3,
+        ppm: { txL: -5.0, txR: -5.5, rxL: -96, rxR: -96 },
+        lufs: { txM: -21.3, txS: -22.8, rxM: -70, rxS: -70 },
+      }),
+    );
+    expect(state.getAudioMeter('sip:desk@example.com')).toEqual(
+      expect.objectContaining({ txL: -30, txR: -31, rxL: -96, rxR: -96 }),
+    );
+  });
+
+  it('keeps the last levels of a direction left out of a report', () => {
+    const state = new StateManager();
+    const report = (calls: unknown[]) =>
+      eventNetstring({
+        class: 'module',
+        type: 'MODULE',
+        param: `vumeter_stereo,VU_REPORT,${JSON.stringify({ calls })}`,
+      });
+
+    parseBaresipEventBuffered(
+      report([
+        {
+          accountaor: 'sip:studio@example.com',
+          tx: { l: -18, r: -18 },
+          rx: { l: -24, r: -25 },
+        },
+      ]),
+      state,
+    );
+    parseBaresipEventBuffered(
+      report([{ accountaor: 'sip:studio@example.com', tx: { l: -12, r: -13 } }]),
+      state,
+    );
+
+    expect(state.getAudioMeter('sip:studio@example.com')).toEqual(
+      expect.objectContaining({ txL: -12, txR: -13, rxL: -24, rxR: -25 }),
+    );
+  });
+
+  it('still accepts per-call VU_TX_REPORT events', () => {
+    const state = new StateManager();
+
+    parseBaresipEventBuffered(
+      eventNetstring({
+        class: 'call',
+        type: 'VU_TX_REPORT',
+        accountaor: 'sip:legacy@example.com',
+        param: '{"l":-12.5,"r":-13.5}',
+      }),
+      state,
+    );
+
+    expect(state.getAudioMeter('sip:legacy@example.com')).toEqual(
+      expect.objectContaining({ txL: -12.5, txR: -13.5, rxL: -96, rxR: -96 }),
+    );
+  });
+});
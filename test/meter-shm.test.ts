@@ -0,0 +1,186 @@
+import { mkdtemp, rm, writeFile } from 'node:fs/promises';
+import { tmpdir } from 'node:os';
+import path from 'node:path';
+import { afterEach, describe, expect, it } from 'vitest';
+import {
+  MeterShmReader,
+  registerMeterShmBridgeObserver,
+  type MeterShmBridgeLevel,
+} from '~/server/services/meter-shm';
+import { StateManager } from '~/server/services/state-manager';
+
+// Layout from docs/meter-shm.md
+const HDR = 64;
+const SLOT = 320;
+const CALLS = 64;
+const BRIDGE = 2048;
+const USED = 1;
+const TX = 2;
+const RX = 4;
+const ACTIVE = 8;
+
+const tempDirs: string[] = [];
+
+afterEach(async () => {
+  await Promise.all(
+    tempDirs.splice(0).map((dir) => rm(dir, { recursive: true, force: true })),
+  );
+});
+
+interface SlotInit {
+  flags: number;
+  key: string;
+  id?: string;
+  levels?: number[];
+  count?: number;
+  seq?: number;
+  seqEnd?: number;
+}
+
+function writeU64(buf: Buffer, off: number, value: number): void {
+  buf.writeUInt32LE(value % 2 ** 32, off);
+  buf.writeUInt32LE(Math.floor(value / 2 ** 32), off + 4);
+}
+
+function meterFile(
+  now: number,
+  calls: SlotInit[],
+  bridge: SlotInit[],
+  callMs = now,
+): Buffer {
+  const buf = Buffer.alloc(HDR + (CALLS + BRIDGE) * SLOT);
+  buf.write('BMTR', 0, 'latin1');
+  buf.writeUInt16LE(2, 4);
+  buf.writeUInt16LE(HDR, 6);
+  buf.writeUInt16LE(SLOT, 8);
+  buf.writeUInt16LE(CALLS, 10);
+  buf.writeUInt16LE(BRIDGE, 12);
+  buf.writeUInt16LE(calls.length, 14);
+  writeU64(buf, 16, 7);
+  writeU64(buf, 24, callMs);
+  writeU64(buf, 32, 3);
+  writeU64(buf, 40, now);
+  buf.writeUInt16LE(bridge.length, 48);
+
+  const slot = (off: number, init: SlotInit) => {
+    buf.writeUInt32LE(init.seq ?? 2, off);
+    buf.writeUInt32LE(init.flags, off + 4);
+    buf.write(init.key, off + 8, 'utf8');
+    buf.write(init.id ?? '', off + 136, 'utf8');
+    (init.levels ?? []).forEach((level, i) =>
+      buf.writeFloatLE(level, off + 248 + 4 * i),
+    );
+    buf.writeUInt32LE(init.count ?? 0, off + 312);
+    buf.writeUInt32LE(init.seqEnd ?? init.seq ?? 2, off + 316);
+  };
+  calls.forEach((init, i) => slot(HDR + i * SLOT, init));
+  bridge.forEach((init, i) => slot(HDR + (CALLS + i) * SLOT, init));
+  return buf;
+}
+
+async function tempMeterFile(buf: Buffer): Promise<string> {
+  const dir = await mkdtemp(path.join(tmpdir(), 'meter-shm-'));
+  tempDirs.push(dir);
+  const file = path.join(dir, 'levels');
+  await writeFile(file, buf);
+  return file;
+}
+
+describe('shared-memory meter file', () => {
+  it('applies call slots to their account meters', async () => {
+    const now = Date.now();
+    const state = new StateManager();
+    const file = await tempMeterFile(
+      meterFile(now, [
+        {
+          flags: USED | TX | RX,
+          key: 'sip:studio@example.com',
+          id: 'call-a',
+          levels: [
+            -18.2, -17.8, -6, -6.4, -5, -5.5, -21.3, -22.8,
+            -20.1, -20.3, -9, -9, -8, -8, -24, -24.5,
+          ],
+        },
+        { flags: USED | TX, key: 'sip:desk@example.com', levels: [-30, -31] },
+      ], []),
+    );
+
+    const reader = new MeterShmReader(file, state);
+    await reader.poll(now);
+    await reader.stop();
+
+    expect(state.getAudioMeter('sip:studio@example.com')).toEqual(
+      expect.objectContaining({
+        txL: -18.2,
+        txR: -17.8,
+        rxL: -20.1,
+        rxR: -20.3,
+        ppm: { txL: -5, txR: -5.5, rxL: -8, rxR: -8 },
+        lufs: { txM: -21.3, txS: -22.8, rxM: -24, rxS: -24.5 },
+      }),
+    );
+    expect(state.getAudioMeter('sip:desk@example.com')).toEqual(
+      expect.objectContaining({ txL: -30, txR: -31, rxL: -96, rxR: -96 }),
+    );
+  });
+
+  it('skips torn and unused slots and stale sections', async () => {
+    const now = Date.now();
+    const state = new StateManager();
+    const torn = await tempMeterFile(
+      meterFile(now, [
+        { flags: USED | TX, key: 'sip:odd@example.com', seq: 3 },
+        { flags: USED | TX, key: 'sip:torn@example.com', seq: 4, seqEnd: 6 },
+        { flags: 0, key: 'sip:free@example.com' },
+      ], []),
+    );
+    const stale = await tempMeterFile(
+      meterFile(now, [{ flags: USED | TX, key: 'sip:old@example.com' }], [],
+        now - 5000),
+    );
+
+    for (const file of [torn, stale]) {
+      const reader = new MeterShmReader(file, state);
+      await reader.poll(now);
+      await reader.stop();
+    }
+
+    expect(state.getAllAudioMeters()).toEqual([]);
+  });
+
+  it('hands bridge levels to observers', async () => {
+    const now = Date.now();
+    const state = new StateManager();
+    const file = await tempMeterFile(
+      meterFile(now, [], [
+        { flags: USED | TX | ACTIVE, key: 'ctx1', levels: [-21.5], count: 50 },
+        { flags: USED | RX, key: 'ctx1', id: 'producer-1', levels: [-70] },
+      ]),
+    );
+    const seen: MeterShmBridgeLevel[][] = [];
+    const unregister = registerMeterShmBridgeObserver((levels) => {
+      seen.push(levels);
+    });
+
+    const reader = new MeterShmReader(file, state);
+    await reader.poll(now);
+    // Nothing new: the section sequence did not move
+    await reader.poll(now);
+    await reader.stop();
+    unregister();
+
+    expect(seen).toEqual([
+      [
+        { key: 'ctx1', active: true, muted: false, dbfs: -21.5, packets: 50 },
+        {
+          key: 'ctx1',
+          producerId: 'producer-1',
+          active: false,
+          muted: false,
+          dbfs: -70,
+          packets: 0,
+        },
+      ],
+    ]);
+  });
+});
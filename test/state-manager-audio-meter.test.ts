@@ -0,0 +1,34 @@
+import { describe, expect, it, vi } from 'vitest';
+import { StateManager } from '~/server/services/state-manager';
+import type { AudioMeter } from '~/types';
+
+function meter(ppm: number, timestamp: number): AudioMeter {
+  return {
+    accountUri: 'sip:alice@example.com',
+    txL: ppm - 12,
+    txR: ppm - 12,
+    rxL: -96,
+    rxR: -96,
+    peak: { txL: ppm, txR: ppm, rxL: -96, rxR: -96 },
+    ppm: { txL: ppm, txR: ppm, rxL: -96, rxR: -96 },
+    timestamp,
+  };
+}
+
+describe('audio meter broadcasts', () => {
+  it('forwards every module report, so a falling PPM reaches the client', () => {
+    const state = new StateManager();
+    const broadcast = vi.spyOn(state, 'broadcast');
+
+    state.updateAudioMeter(meter(-6, 1));
+    state.updateAudioMeter(meter(-7.2, 2));
+    state.updateAudioMeter(meter(-8.4, 3));
+
+    expect(broadcast).toHaveBeenCalledTimes(3);
+    expect(broadcast).toHaveBeenLastCalledWith({
+      type: 'audioMeter',
+      data: meter(-8.4, 3),
+    });
+    expect(state.getAudioMeter('sip:alice@example.com')).toEqual(meter(-8.4, 3));
+  });
+});
@@ -303,6 +303,65 @@ describe('talktome bridge configuration', () => {
     }
   });
 
+  it('keeps an optional ptime and accepts only Opus frame durations', () => {
+    const mapping = {
+      talktomeUserId: 41,
+      target: { type: 'conference', id: 9 },
+    };
+    for (const ptimeMs of [10, 20, 40, 60]) {
+      expect(
+        validateTalktomeBridgeConfig({
+          accounts: { 'sip:studio@example.com': { ...mapping, ptimeMs } },
+        }).accounts['sip:studio@example.com'].ptimeMs,
+      ).toBe(ptimeMs);
+    }
+    expect(
+      validateTalktomeBridgeConfig({
+        accounts: { 'sip:studio@example.com': mapping },
+      }).accounts['sip:studio@example.com'],
+    ).not.toHaveProperty('ptimeMs');
+    for (const ptimeMs of [0, 30, 20.5, '20']) {
+      expect(() =>
+        validateTalktomeBridgeConfig({
+          accounts: { 'sip:studio@example.com': { ...mapping, ptimeMs } },
+        }),
+      ).toThrow(/ptimeMs must be 10, 20, 40 or 60/);
+    }
+  });
+
+  it('keeps optional telemetry settings and rejects them out of range', () => {
+    const mapping = {
+      talktomeUserId: 41,
+      target: { type: 'conference', id: 9 },
+    };
+    const account = validateTalktomeBridgeConfig({
+      accounts: {
+        'sip:studio@example.com': {
+          ...mapping,
+          telemetryIntervalMs: 500,
+          levelHysteresisDb: 2.5,
+        },
+      },
+    }).accounts['sip:studio@example.com'];
+    expect(account.telemetryIntervalMs).toBe(500);
+    expect(account.levelHysteresisDb).toBe(2.5);
+
+    for (const invalid of [
+      { telemetryIntervalMs: 20 },
+      { telemetryIntervalMs: 250.5 },
+      { telemetryIntervalMs: '500' },
+      { levelHysteresisDb: -1 },
+      { levelHysteresisDb: 21 },
+      { levelHysteresisDb: '2' },
+    ]) {
+      expect(() =>
+        validateTalktomeBridgeConfig({
+          accounts: { 'sip:studio@example.com': { ...mapping, ...invalid } },
+        }),
+      ).toThrow(TalktomeConfigValidationError);
+    }
+  });
+
   it('loads, serializes concurrent atomic set/remove operations, and persists no token data', async () => {
     const configPath = await temporaryConfigPath();
     const manager = new TalktomeBridgeConfigManager(configPath);
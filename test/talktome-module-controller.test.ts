@@ -80,6 +80,7 @@ describe('CtrlTcpTalktomeModuleController', () => {
     await controller.configureContext('isolated', {
       mixLocalCallers: false,
       bitrateBps: 96_000,
+      ptimeMs: 40,
     });
     await controller.addSource('isolated', {
       producerId: 'producer-2',
@@ -95,17 +96,132 @@ describe('CtrlTcpTalktomeModuleController', () => {
     );
 
     expect(execute.mock.calls.slice(0, 2)).toEqual([
-      ['ms_ctx_config', 'isolated isolated 96000'],
+      ['ms_ctx_config', 'isolated isolated 96000 ptime=40'],
       ['ms_bridge_addsrc', 'isolated producer-2 127.0.0.1 50006 109'],
     ]);
     await expect(controller.openContext('bad key')).rejects.toThrow(
       'command separators',
     );
+    await expect(
+      controller.configureContext('isolated', {
+        mixLocalCallers: false,
+        bitrateBps: 96_000,
+        ptimeMs: 30,
+      }),
+    ).rejects.toThrow('ptimeMs');
     await expect(
       controller.reserveSource('isolated', 'bad producer'),
     ).rejects.toThrow('command separators');
   });
 
+  it('appends telemetry options to ms_ctx_config and validates their ranges', async () => {
+    const execute = vi.fn(async () => ({ response: true }));
+    const controller = new CtrlTcpTalktomeModuleController({
+      execute,
+    } as ModuleCommandExecutor);
+
+    await controller.configureContext('studio', {
+      mixLocalCallers: true,
+      bitrateBps: 64_000,
+      telemetryIntervalMs: 500,
+      levelHysteresisDb: 2.5,
+    });
+    await expect(
+      controller.configureContext('studio', {
+        mixLocalCallers: true,
+        bitrateBps: 64_000,
+        telemetryIntervalMs: 10,
+      }),
+    ).rejects.toThrow('telemetryIntervalMs');
+    await expect(
+      controller.configureContext('studio', {
+        mixLocalCallers: true,
+        bitrateBps: 64_000,
+        levelHysteresisDb: 25,
+      }),
+    ).rejects.toThrow('levelHysteresisDb');
+
+    expect(execute.mock.calls).toEqual([
+      ['ms_ctx_config', 'studio party-line 64000 interval=500 hysteresis=2.5'],
+    ]);
+  });
+
+  it('batches call setup into one ms_bridge_apply command and decodes reserved ports', async () => {
+    const execute = vi.fn(async (_command: string, _params?: string) => ({
+      response: JSON.stringify({
+        key: 'studio',
+        created: true,
+        changed: true,
+        ops: 4,
+        tx: { configured: true, localPort: 49_152 },
+        sources: [
+          { producerId: 'producer-1', localRecvPort: 40_000, state: 'reserved', created: true },
+          { producerId: 'producer-2', localRecvPort: 40_002, state: 'active', created: true },
+        ],
+      }),
+    }));
+    const controller = new CtrlTcpTalktomeModuleController({
+      execute,
+    } as ModuleCommandExecutor);
+
+    await expect(
+      controller.applyBridge('studio', [
+        { op: 'config', config: { mixLocalCallers: true, bitrateBps: 64_000, ptimeMs: 10 } },
+        {
+          op: 'tx',
+          endpoint: { ip: '192.0.2.10', port: 40_000, payloadType: 111, ssrc: 987_654 },
+        },
+        { op: 'mute', muted: true },
+        { op: 'reserve', producerId: 'producer-1' },
+        {
+          op: 'source',
+          endpoint: { producerId: 'producer-2', ip: '127.0.0.1', port: 50_004, payloadType: 111 },
+        },
+      ]),
+    ).resolves.toEqual({
+      created: true,
+      sources: {
+        'producer-1': { localRecvPort: 40_000 },
+        'producer-2': { localRecvPort: 40_002 },
+      },
+    });
+
+    expect(execute.mock.calls).toEqual([
+      [
+        'ms_bridge_apply',
+        'studio config party-line 64000 ptime=10;tx 192.0.2.10 40000 111 987654;mute on;' +
+          'src producer-1;src producer-2 127.0.0.1 50004 111',
+      ],
+    ]);
+    await expect(
+      controller.applyBridge('studio', [{ op: 'reserve', producerId: 'a;b' }]),
+    ).rejects.toThrow('batch separator');
+    await expect(controller.applyBridge('studio', [])).rejects.toThrow('1 to 16');
+    expect(execute).toHaveBeenCalledTimes(1);
+  });
+
+  it('requests all-context statistics with an optional since generation', async () => {
+    const execute = vi.fn(async (_command: string, _params?: string) => ({
+      response: JSON.stringify({ generation: 7, full: false, contexts: [{ key: 'studio' }] }),
+    }));
+    const controller = new CtrlTcpTalktomeModuleController({
+      execute,
+    } as ModuleCommandExecutor);
+
+    await controller.getAllStats();
+    await expect(controller.getAllStats(6)).resolves.toEqual({
+      generation: 7,
+      full: false,
+      contexts: [{ key: 'studio' }],
+    });
+    await expect(controller.getAllStats(-1)).rejects.toThrow('since');
+
+    expect(execute.mock.calls).toEqual([
+      ['ms_bridge_stat_all', ''],
+      ['ms_bridge_stat_all', 'since=6'],
+    ]);
+  });
+
   it('keeps context keys and producer IDs correlated across independent module commands', async () => {
     const execute = vi.fn(async (command: string, params?: string) => {
       if (command === 'ms_src_reserve') {
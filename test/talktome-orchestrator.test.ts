@@ -334,6 +334,53 @@ describe('TalktomeBridgeOrchestrator', () => {
     });
   });
 
+  it('batches the context config, then TX, mute and known reservations through ms_bridge_apply', async () => {
+    const harness = makeBridgeHarness(
+      { [ACCOUNT_URI]: makeMapping() },
+      [makeActiveProducer('producer-1'), makeActiveProducer('producer-1')],
+    );
+    const applyBridge = vi.fn(async (_key: string, operations: Array<{ op: string }>) => ({
+      created: false,
+      sources: operations.some((operation) => operation.op === 'reserve')
+        ? { 'producer-1': { localRecvPort: 52_000 } }
+        : {},
+    }));
+    Object.assign(harness.module, { applyBridge });
+    const orchestrator = createOrchestrator(harness);
+    await orchestrator.initialize();
+
+    await orchestrator.callEstablished(ACCOUNT_URI, 'call-1');
+    await harness.waitForStream('session-41');
+
+    expect(applyBridge.mock.calls).toEqual([
+      ['studio', [{ op: 'config', config: expect.any(Object) }]],
+      [
+        'studio',
+        [
+          {
+            op: 'tx',
+            endpoint: { ip: '127.0.0.1', port: 40_000, payloadType: 111, ssrc: 987_654 },
+          },
+          { op: 'mute', muted: true },
+          { op: 'reserve', producerId: 'producer-1' },
+        ],
+      ],
+    ]);
+    expect(harness.module.openContext).not.toHaveBeenCalled();
+    expect(harness.module.bindTransmit).not.toHaveBeenCalled();
+    expect(harness.module.setTransmitMuted).not.toHaveBeenCalled();
+    expect(harness.module.reserveSource).not.toHaveBeenCalled();
+    expect(harness.order).toEqual([
+      'consumer:producer-1',
+      'add:producer-1',
+      'resume:producer-1',
+    ]);
+    expect(orchestrator.getStatus(ACCOUNT_URI)).toMatchObject({
+      phase: 'connected',
+      consumerCount: 1,
+    });
+  });
+
   it('uses reserve → consumer → add → resume, deduplicates producer events, and reconciles missed closure', async () => {
     const producerOne = makeActiveProducer('producer-1');
     const producerTwo = makeActiveProducer('producer-2');
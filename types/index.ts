@@ -42,6 +42,12 @@ interface TalktomeAccountMappingBase {
   tally: TalktomeTallyConfig;
   mixLocalCallers: boolean;
   bitrateBps: number;
+  /** Packet and mixer frame duration: 10, 20, 40 or 60 ms (default 20). */
+  ptimeMs?: number;
+  /** MS_TELEMETRY interval in ms (50-5000); the module default when unset. */
+  telemetryIntervalMs?: number;
+  /** Level change in dB before a level is re-reported (0-20). */
+  levelHysteresisDb?: number;
   previousAudioSource: string;
   previousAudioPlayer: string;
 }
@@ -79,6 +85,9 @@ export interface TalktomeAccountMappingInput {
   tally?: TalktomeTallyConfig;
   mixLocalCallers?: boolean;
   bitrateBps?: number;
+  ptimeMs?: number;
+  telemetryIntervalMs?: number;
+  levelHysteresisDb?: number;
   previousAudioSource?: string;
   previousAudioPlayer?: string;
 }
@@ -237,12 +246,31 @@ export interface CallInfo {
   };
 }
 
-export interface AudioMeter {
-  accountUri: string;
-  txL: number;   // dBFS (negative, e.g. -18.2)
+export interface AudioMeterLevels {
+  txL: number;   // dBFS
   txR: number;   // dBFS
   rxL: number;   // dBFS
   rxR: number;   // dBFS
+}
+
+/** EBU R 128 momentary (400 ms) and short-term (3 s) loudness */
+export interface AudioMeterLoudness {
+  txM: number;   // LUFS, -70 at or below the absolute gate
+  txS: number;   // LUFS
+  rxM: number;   // LUFS
+  rxS: number;   // LUFS
+}
+
+export interface AudioMeter {
+  accountUri: string;
+  txL: number;   // dBFS RMS (negative, e.g. -18.2)
+  txR: number;   // dBFS RMS
+  rxL: number;   // dBFS RMS
+  rxR: number;   // dBFS RMS
+  /** Sample peak and PPM reading, when the module reports them */
+  peak?: AudioMeterLevels;
+  ppm?: AudioMeterLevels;
+  lufs?: AudioMeterLoudness;
   timestamp: number;
 }
 